@@ -0,0 +1,305 @@
+#include "AssetLoader.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+// Anonymous namespace
+namespace
+{
+	// size bytes of the file from offset, or everything after it for AssetLoader::WholeFile.
+	bool read_file(const std::string& path, uint64_t offset, uint64_t size, std::vector<uint8_t>& bytes)
+	{
+		if (size == 0)
+		{
+			return true;
+		}
+
+		std::ifstream file(path, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		std::streamoff end = file.tellg();
+		if (end < 0 || offset > static_cast<uint64_t>(end))
+		{
+			return false;
+		}
+		const uint64_t left = static_cast<uint64_t>(end) - offset;
+		if (size == MRenderer::AssetLoader::WholeFile)
+		{
+			size = left;
+		}
+		else if (size > left)
+		{
+			return false;
+		}
+		file.seekg(static_cast<std::streamoff>(offset), std::ios_base::beg);
+
+		bytes.resize(static_cast<size_t>(size));
+		return size == 0 || static_cast<bool>(file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(size)));
+	}
+}
+
+namespace MRenderer
+{
+	bool AssetLoader::JobOrder::operator()(const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) const
+	{
+		// std::push_heap keeps the largest on top: higher priority first, then the older request.
+		if (a->request.priority != b->request.priority)
+		{
+			return a->request.priority < b->request.priority;
+		}
+		return a->sequence > b->sequence;
+	}
+
+	AssetLoader::~AssetLoader()
+	{
+		Stop();
+	}
+
+	void AssetLoader::Start(unsigned workerCount, ThreadHook onWorkerStart, ThreadHook onWorkerStop)
+	{
+		if (!m_workers.empty())
+		{
+			return;
+		}
+
+		if (workerCount == 0)
+		{
+			unsigned hardware = std::thread::hardware_concurrency();
+			workerCount = hardware > 1 ? hardware - 1 : 1;
+		}
+
+		m_stopping = false;
+		for (unsigned i = 0; i < workerCount; i++)
+		{
+			m_workers.emplace_back(&AssetLoader::WorkerMain, this, onWorkerStart, onWorkerStop);
+		}
+	}
+
+	void AssetLoader::Stop()
+	{
+		std::vector<std::shared_ptr<Job>> dropped;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+			dropped.swap(m_queue);
+			for (auto& live : m_live)
+			{
+				live.second->cancelled = true;
+			}
+		}
+		m_wake.notify_all();
+
+		for (std::thread& worker : m_workers)
+		{
+			worker.join();
+		}
+		m_workers.clear();
+
+		for (const std::shared_ptr<Job>& job : dropped)
+		{
+			LoadResult result;
+			result.status = LOAD_CANCELLED;
+			Finish(job, std::move(result));
+		}
+
+		Pump();
+	}
+
+	AssetLoader::Ticket AssetLoader::Load(Request request)
+	{
+		std::shared_ptr<Job> job = std::make_shared<Job>();
+		job->request = std::move(request);
+
+		Ticket ticket;
+		ticket.result = job->promise.get_future().share();
+
+		bool rejected = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			job->id = m_nextId++;
+			job->sequence = m_nextSequence++;
+			ticket.id = job->id;
+
+			rejected = m_stopping || m_workers.empty();
+			if (!rejected)
+			{
+				m_live[job->id] = job;
+				m_queue.push_back(job);
+				std::push_heap(m_queue.begin(), m_queue.end(), JobOrder());
+			}
+		}
+
+		if (rejected)
+		{
+			LoadResult result;
+			result.status = LOAD_CANCELLED;
+			result.error = "The loader is not running";
+			Finish(job, std::move(result));
+			return ticket;
+		}
+
+		m_wake.notify_one();
+		return ticket;
+	}
+
+	bool AssetLoader::Cancel(RequestId id)
+	{
+		std::shared_ptr<Job> dropped;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto live = m_live.find(id);
+			if (live == m_live.end())
+			{
+				return false;
+			}
+			live->second->cancelled = true;
+
+			// Still queued, take it out now rather than wait for a worker to skip it.
+			auto queued = std::find(m_queue.begin(), m_queue.end(), live->second);
+			if (queued != m_queue.end())
+			{
+				dropped = *queued;
+				m_queue.erase(queued);
+				std::make_heap(m_queue.begin(), m_queue.end(), JobOrder());
+			}
+		}
+
+		if (dropped)
+		{
+			LoadResult result;
+			result.status = LOAD_CANCELLED;
+			Finish(dropped, std::move(result));
+		}
+		return true;
+	}
+
+	size_t AssetLoader::Pump(size_t maxCallbacks)
+	{
+		size_t ran = 0;
+		while (ran < maxCallbacks)
+		{
+			std::pair<Callback, LoadResult> completed;
+			{
+				std::lock_guard<std::mutex> lock(m_completedMutex);
+				if (m_completed.empty())
+				{
+					break;
+				}
+				completed = std::move(m_completed.front());
+				m_completed.pop_front();
+			}
+
+			if (completed.first)
+			{
+				completed.first(completed.second);
+			}
+			ran++;
+		}
+		return ran;
+	}
+
+	size_t AssetLoader::InFlight() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_live.size();
+	}
+
+	void AssetLoader::WorkerMain(ThreadHook onStart, ThreadHook onStop)
+	{
+		if (onStart)
+		{
+			onStart();
+		}
+
+		for (;;)
+		{
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+				if (m_queue.empty())
+				{
+					break;
+				}
+				std::pop_heap(m_queue.begin(), m_queue.end(), JobOrder());
+				job = std::move(m_queue.back());
+				m_queue.pop_back();
+			}
+
+			Run(job);
+		}
+
+		if (onStop)
+		{
+			onStop();
+		}
+	}
+
+	void AssetLoader::Run(const std::shared_ptr<Job>& job)
+	{
+		PROFILE_ZONE("AssetLoader::Run");
+
+		const Request& request = job->request;
+
+		LoadResult result;
+		result.path = request.path;
+
+		std::vector<uint8_t> bytes;
+		if (job->cancelled)
+		{
+			result.status = LOAD_CANCELLED;
+		}
+		else if (!read_file(request.path, request.offset, request.size, bytes))
+		{
+			result.status = LOAD_FAILED;
+			result.error = "Could not read " + request.path;
+		}
+		else if (job->cancelled)
+		{
+			result.status = LOAD_CANCELLED;
+		}
+		else if (request.decode)
+		{
+			result.asset = request.decode(request.path, bytes, result.error);
+			result.status = job->cancelled ? LOAD_CANCELLED : (result.asset ? LOAD_LOADED : LOAD_FAILED);
+		}
+		else
+		{
+			result.asset = std::make_shared<std::vector<uint8_t>>(std::move(bytes));
+			result.status = LOAD_LOADED;
+		}
+
+		if (result.status == LOAD_CANCELLED)
+		{
+			result.asset.reset();
+		}
+
+		Finish(job, std::move(result));
+	}
+
+	void AssetLoader::Finish(const std::shared_ptr<Job>& job, LoadResult result)
+	{
+		result.id = job->id;
+		if (result.path.empty())
+		{
+			result.path = job->request.path;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_live.erase(job->id);
+		}
+
+		// Queue the callback before the future becomes ready, so anyone who waited on it and then pumps sees it.
+		{
+			std::lock_guard<std::mutex> lock(m_completedMutex);
+			m_completed.emplace_back(std::move(job->request.onComplete), result);
+		}
+
+		job->promise.set_value(std::move(result));
+	}
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Background file loading. Requests are served highest priority first by a pool of worker threads that
+// read the file, or the range of it asked for, and run the request's decoder; completion callbacks are
+// queued and only run when the owner calls Pump(), so they can safely touch renderer state. No D3D12 or
+// Windows dependency.
+namespace MRenderer
+{
+	enum LoadPriority : uint8_t
+	{
+		LOAD_PRIORITY_LOW = 0,
+		LOAD_PRIORITY_NORMAL,
+		LOAD_PRIORITY_HIGH,
+		LOAD_PRIORITY_COUNT
+	};
+
+	enum LoadStatus : uint8_t
+	{
+		LOAD_PENDING = 0,
+		LOAD_LOADED,
+		LOAD_FAILED,
+		LOAD_CANCELLED
+	};
+
+	struct LoadResult
+	{
+		uint64_t id = 0;
+		LoadStatus status = LOAD_PENDING;
+		std::string path;
+		std::shared_ptr<void> asset; // what the decoder returned, or the raw bytes as std::vector<uint8_t> if there was none
+		std::string error;
+	};
+
+	class AssetLoader
+	{
+	public:
+		using RequestId = uint64_t;
+		static const RequestId InvalidRequest = 0;
+		static const uint64_t WholeFile = UINT64_MAX;
+
+		// Runs on a worker. Turns the bytes read into an asset, or returns nullptr and fills error.
+		using Decoder = std::function<std::shared_ptr<void>(const std::string& path, std::vector<uint8_t>& bytes, std::string& error)>;
+
+		// Runs on the thread that calls Pump(), for every request however it ended.
+		using Callback = std::function<void(const LoadResult& result)>;
+
+		// Runs once on each worker as it starts or stops, e.g. to initialize COM for a decoder.
+		using ThreadHook = std::function<void()>;
+
+		struct Request
+		{
+			std::string path;
+			LoadPriority priority = LOAD_PRIORITY_NORMAL;
+			uint64_t offset = 0;       // where in the file reading starts
+			uint64_t size = WholeFile; // bytes read from offset, the request fails if the file is shorter. 0 reads
+			                           // nothing, for a decoder that opens the file itself
+			Decoder decode;
+			Callback onComplete;
+		};
+
+		struct Ticket
+		{
+			RequestId id = InvalidRequest;
+			std::shared_future<LoadResult> result;
+		};
+
+		AssetLoader() = default;
+		AssetLoader(const AssetLoader&) = delete;
+		AssetLoader& operator=(const AssetLoader&) = delete;
+		~AssetLoader();
+
+		// workerCount 0 uses every hardware thread but one, which is left for the render loop.
+		void Start(unsigned workerCount = 0, ThreadHook onWorkerStart = nullptr, ThreadHook onWorkerStop = nullptr);
+
+		// Cancels everything not yet finished, waits for the workers and runs the outstanding callbacks.
+		void Stop();
+
+		Ticket Load(Request request);
+
+		// A queued request is dropped without being read. One already on a worker is abandoned at its next
+		// step; its result and callback report LOAD_CANCELLED either way. False if the id already finished.
+		bool Cancel(RequestId id);
+
+		// Runs up to maxCallbacks queued completion callbacks on the calling thread. Returns how many ran.
+		size_t Pump(size_t maxCallbacks = SIZE_MAX);
+
+		// Requests queued or on a worker.
+		size_t InFlight() const;
+
+		unsigned WorkerCount() const { return static_cast<unsigned>(m_workers.size()); }
+
+	private:
+		struct Job
+		{
+			RequestId id;
+			uint64_t sequence; // FIFO order within a priority
+			Request request;
+			std::atomic<bool> cancelled{ false };
+			std::promise<LoadResult> promise;
+		};
+
+		struct JobOrder
+		{
+			bool operator()(const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) const;
+		};
+
+		void WorkerMain(ThreadHook onStart, ThreadHook onStop);
+		void Run(const std::shared_ptr<Job>& job);
+		void Finish(const std::shared_ptr<Job>& job, LoadResult result);
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::vector<std::shared_ptr<Job>> m_queue; // heap ordered by JobOrder
+		std::unordered_map<RequestId, std::shared_ptr<Job>> m_live;
+		std::vector<std::thread> m_workers;
+		bool m_stopping = false;
+		RequestId m_nextId = 1;
+		uint64_t m_nextSequence = 0;
+
+		std::mutex m_completedMutex;
+		std::deque<std::pair<Callback, LoadResult>> m_completed;
+	};
+}
@@ -0,0 +1,367 @@
+#include "ClipStream.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+// Anonymous namespace
+namespace
+{
+	using MRenderer::ClipStream;
+	using MRenderer::Matrix4;
+
+	uint64_t record_bytes(uint32_t jointCount)
+	{
+		return sizeof(double) + jointCount * ClipStream::KeyJointBytes;
+	}
+
+	// A block's key records into its joint transforms, key major. Fails if the records aren't the keys the block
+	// table says they are, which is what a file rewritten since it was loaded reads as.
+	std::shared_ptr<std::vector<Matrix4>> decode_block(const std::vector<uint8_t>& bytes, const std::vector<double>& keytimes,
+		uint32_t jointCount, std::string& error)
+	{
+		const uint64_t recordBytes = record_bytes(jointCount);
+		if (bytes.size() != keytimes.size() * recordBytes)
+		{
+			error = "Clip block is the wrong size";
+			return nullptr;
+		}
+
+		std::shared_ptr<std::vector<Matrix4>> poses = std::make_shared<std::vector<Matrix4>>(keytimes.size() * jointCount);
+		const uint8_t* record = bytes.data();
+		for (size_t k = 0; k < keytimes.size(); k++, record += recordBytes)
+		{
+			double keytime;
+			memcpy(&keytime, record, sizeof(double));
+			if (keytime != keytimes[k])
+			{
+				error = "Clip block doesn't match the keys it was loaded with";
+				return nullptr;
+			}
+
+			const uint8_t* joint = record + sizeof(double);
+			for (uint32_t j = 0; j < jointCount; j++, joint += ClipStream::KeyJointBytes)
+			{
+				memcpy(&(*poses)[k * jointCount + j], joint, sizeof(Matrix4));
+			}
+		}
+		return poses;
+	}
+}
+
+namespace MRenderer
+{
+	bool ClipStream::SourceValid(const Source& source, size_t keyCount)
+	{
+		if (keyCount == 0 || source.jointCount == 0 || !(source.blockSeconds > 0.0) || source.blocks.empty() ||
+			source.keytimes.size() != keyCount)
+		{
+			return false;
+		}
+
+		size_t key = 0;
+		for (const ClipBlock& block : source.blocks)
+		{
+			if (block.firstKey != key || block.keyCount == 0 || block.keyCount > keyCount - key)
+			{
+				return false;
+			}
+			key += block.keyCount;
+		}
+		for (size_t k = 1; k < keyCount; k++)
+		{
+			if (!(source.keytimes[k] >= source.keytimes[k - 1]))
+			{
+				return false;
+			}
+		}
+		return key == keyCount;
+	}
+
+	ClipStream::ClipStream(AssetLoader& loader, Source source, size_t cacheBlocks, double prefetchSeconds)
+		: m_loader(loader), m_source(std::move(source)), m_cacheBlocks(std::max<size_t>(cacheBlocks, 1)),
+		m_prefetchSeconds(std::max(prefetchSeconds, 0.0)), m_self(std::make_shared<ClipStream*>(this))
+	{
+		m_slotOf.assign(m_source.blocks.size(), -1);
+		m_lastWanted.assign(m_source.blocks.size(), 0);
+		m_failed.assign(m_source.blocks.size(), 0);
+	}
+
+	ClipStream::~ClipStream()
+	{
+		for (const auto& pending : m_pending)
+		{
+			m_loader.Cancel(pending.second);
+		}
+	}
+
+	bool ClipStream::Open()
+	{
+		PROFILE_ZONE("ClipStream::Open");
+
+		if (m_source.blocks.empty())
+		{
+			return false;
+		}
+
+		const AssetLoader::Request request = BlockRequest(0);
+		std::ifstream file(request.path, std::ios_base::in | std::ios_base::binary);
+		std::vector<uint8_t> bytes(static_cast<size_t>(request.size));
+		file.seekg(static_cast<std::streamoff>(request.offset), std::ios_base::beg);
+		if (!file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+		{
+			return false;
+		}
+
+		std::string error;
+		std::shared_ptr<void> poses = request.decode(request.path, bytes, error);
+		if (!poses)
+		{
+			return false;
+		}
+		Keep(0, std::move(*std::static_pointer_cast<std::vector<Matrix4>>(poses)));
+		return true;
+	}
+
+	void ClipStream::Update(const SkinnedClip& clip, const std::vector<CrowdInstance>& instances, uint32_t clipIndex)
+	{
+		PROFILE_ZONE("ClipStream::Update");
+
+		m_update++;
+		m_wanted.clear();
+		const uint32_t blockCount = static_cast<uint32_t>(m_source.blocks.size());
+		if (clip.keytimes.size() != m_source.keytimes.size() || blockCount == 0)
+		{
+			return;
+		}
+
+		// Every block an instance will sample soon, with the playback seconds until it gets there. The ones
+		// under its playhead are 0 seconds away; an instance that wasn't visible waits behind every visible one.
+		for (const CrowdInstance& instance : instances)
+		{
+			if (instance.clip != clipIndex)
+			{
+				continue;
+			}
+
+			const double hidden = instance.visible ? 0.0 : m_prefetchSeconds;
+			const ClipKeys keys = find_clip_keys(clip, instance.time);
+			m_wanted.push_back({ hidden, BlockOf(keys.previous) });
+			m_wanted.push_back({ hidden, BlockOf(keys.next) });
+
+			const double speed = std::fabs(static_cast<double>(instance.speed));
+			if (speed <= 0.0)
+			{
+				continue;
+			}
+
+			// Walk the blocks the way it plays, around the loop, until they're further off than the prefetch distance.
+			const double time = wrap_clip_time(instance.time, clip.duration);
+			const bool forward = instance.speed > 0.0f;
+			uint32_t block = BlockOf(forward ? keys.next : keys.previous);
+			for (uint32_t n = 1; n < blockCount; n++)
+			{
+				block = forward ? (block + 1) % blockCount : (block + blockCount - 1) % blockCount;
+				const ClipBlock& range = m_source.blocks[block];
+				double ahead = forward ? m_source.keytimes[range.firstKey] - time
+					: time - m_source.keytimes[range.firstKey + range.keyCount - 1];
+				if (ahead < 0.0)
+				{
+					ahead = std::max(ahead + clip.duration, 0.0);
+				}
+				if (ahead / speed > m_prefetchSeconds)
+				{
+					break;
+				}
+				m_wanted.push_back({ hidden + ahead / speed, block });
+			}
+		}
+
+		// The nearest cacheBlocks of them are kept or asked for, the rest have to wait.
+		std::sort(m_wanted.begin(), m_wanted.end());
+		size_t taken = 0;
+		for (const std::pair<double, uint32_t>& wanted : m_wanted)
+		{
+			const uint32_t block = wanted.second;
+			if (m_lastWanted[block] == m_update)
+			{
+				continue;
+			}
+			if (block == 0)
+			{
+				m_lastWanted[block] = m_update;
+				continue;
+			}
+			if (taken == m_cacheBlocks)
+			{
+				break;
+			}
+			m_lastWanted[block] = m_update;
+			taken++;
+
+			if (m_slotOf[block] >= 0 || m_pending.count(block) || m_failed[block] || !Trim(m_cacheBlocks - 1))
+			{
+				continue;
+			}
+
+			AssetLoader::Request request = BlockRequest(block);
+			request.priority = wanted.first <= 0.0 ? LOAD_PRIORITY_HIGH : LOAD_PRIORITY_NORMAL;
+			std::weak_ptr<ClipStream*> self = m_self;
+			request.onComplete = [self, block](const LoadResult& result)
+			{
+				if (std::shared_ptr<ClipStream*> stream = self.lock())
+				{
+					(*stream)->Arrive(block, result);
+				}
+			};
+			m_pending[block] = m_loader.Load(std::move(request)).id;
+			m_stats.requests++;
+		}
+
+		// SetCacheBlocks() may have shrunk the cache below what's held.
+		Trim(m_cacheBlocks);
+	}
+
+	const Matrix4* ClipStream::KeyPose(size_t key) const
+	{
+		const uint32_t block = BlockOf(key);
+		if (m_slotOf[block] >= 0)
+		{
+			return &m_slots[m_slotOf[block]].poses[(key - m_source.blocks[block].firstKey) * m_source.jointCount];
+		}
+
+		m_misses++;
+		for (uint32_t b = block; b-- > 0;)
+		{
+			if (m_slotOf[b] >= 0)
+			{
+				return &m_slots[m_slotOf[b]].poses[(m_source.blocks[b].keyCount - 1) * m_source.jointCount];
+			}
+		}
+		return nullptr;
+	}
+
+	void ClipStream::SetCacheBlocks(size_t cacheBlocks)
+	{
+		m_cacheBlocks = std::max<size_t>(cacheBlocks, 1);
+	}
+
+	void ClipStream::SetPrefetchSeconds(double prefetchSeconds)
+	{
+		m_prefetchSeconds = std::max(prefetchSeconds, 0.0);
+	}
+
+	ClipStream::Stats ClipStream::GetStats() const
+	{
+		Stats stats = m_stats;
+		stats.residentBlocks = m_slots.size();
+		stats.misses = m_misses;
+		return stats;
+	}
+
+	uint32_t ClipStream::BlockOf(size_t key) const
+	{
+		const auto after = std::upper_bound(m_source.blocks.begin(), m_source.blocks.end(), key,
+			[](size_t k, const ClipBlock& block) { return k < block.firstKey; });
+		return static_cast<uint32_t>(after - m_source.blocks.begin()) - 1;
+	}
+
+	AssetLoader::Request ClipStream::BlockRequest(uint32_t block) const
+	{
+		const ClipBlock& range = m_source.blocks[block];
+		const uint32_t jointCount = m_source.jointCount;
+		const uint64_t recordBytes = record_bytes(jointCount);
+		const std::vector<double> keytimes(m_source.keytimes.begin() + range.firstKey,
+			m_source.keytimes.begin() + range.firstKey + range.keyCount);
+
+		AssetLoader::Request request;
+		request.path = m_source.path;
+		request.offset = m_source.keyOffset + range.firstKey * recordBytes;
+		request.size = range.keyCount * recordBytes;
+		request.decode = [keytimes, jointCount](const std::string&, std::vector<uint8_t>& bytes, std::string& error) -> std::shared_ptr<void>
+		{
+			return decode_block(bytes, keytimes, jointCount, error);
+		};
+		return request;
+	}
+
+	bool ClipStream::Trim(size_t keep)
+	{
+		const bool firstResident = !m_slotOf.empty() && m_slotOf[0] >= 0;
+		size_t held = m_slots.size() - (firstResident ? 1 : 0) + m_pending.size();
+		while (held > keep)
+		{
+			// The resident block wanted longest ago goes first, then a read nobody wants any more. Never one
+			// wanted by this update, nor the first block.
+			uint32_t victim = 0;
+			for (const Slot& slot : m_slots)
+			{
+				if (slot.block != 0 && m_lastWanted[slot.block] < m_update &&
+					(victim == 0 || m_lastWanted[slot.block] < m_lastWanted[victim]))
+				{
+					victim = slot.block;
+				}
+			}
+			if (victim != 0)
+			{
+				Evict(victim);
+				held--;
+				continue;
+			}
+
+			auto stale = std::find_if(m_pending.begin(), m_pending.end(),
+				[this](const std::pair<const uint32_t, AssetLoader::RequestId>& pending) { return m_lastWanted[pending.first] < m_update; });
+			if (stale == m_pending.end())
+			{
+				return false;
+			}
+			m_loader.Cancel(stale->second);
+			m_pending.erase(stale);
+			held--;
+		}
+		return true;
+	}
+
+	void ClipStream::Arrive(uint32_t block, const LoadResult& result)
+	{
+		// A read cancelled to make room may finish after the block was asked for again.
+		auto pending = m_pending.find(block);
+		if (pending == m_pending.end() || pending->second != result.id)
+		{
+			return;
+		}
+		m_pending.erase(pending);
+
+		if (result.status == LOAD_FAILED)
+		{
+			m_failed[block] = 1;
+			m_stats.failures++;
+		}
+		else if (result.status == LOAD_LOADED)
+		{
+			Keep(block, std::move(*std::static_pointer_cast<std::vector<Matrix4>>(result.asset)));
+		}
+	}
+
+	void ClipStream::Keep(uint32_t block, std::vector<Matrix4>&& poses)
+	{
+		m_slotOf[block] = static_cast<int32_t>(m_slots.size());
+		m_slots.push_back({ block, std::move(poses) });
+		m_stats.residentBytes += m_slots.back().poses.size() * sizeof(Matrix4);
+		m_stats.peakBytes = std::max(m_stats.peakBytes, m_stats.residentBytes);
+	}
+
+	void ClipStream::Evict(uint32_t block)
+	{
+		const int32_t slot = m_slotOf[block];
+		m_stats.residentBytes -= m_slots[slot].poses.size() * sizeof(Matrix4);
+		m_stats.evictions++;
+
+		std::swap(m_slots[slot], m_slots.back());
+		m_slotOf[m_slots[slot].block] = slot;
+		m_slots.pop_back();
+		m_slotOf[block] = -1;
+	}
+}
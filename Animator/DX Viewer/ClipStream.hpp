@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AssetLoader.hpp"
+#include "InstanceBuilder.hpp"
+
+// Pages a long clip's keyframes in from its .mbm a block at a time, so a cinematic keeps the keys around its
+// playheads resident rather than the whole clip. The exporter groups the keys into blocks of a fixed duration
+// and writes every key as a record of the same size, so a block is one ranged read on the loader's threads.
+//
+// Update() wants the block under each playhead and every block within the prefetch distance ahead of it,
+// nearest first, and asks for the ones it doesn't have. The cache holds at most cacheBlocks of them, resident
+// or on their way; making room evicts the one wanted least recently. The first block is read up front and
+// never evicted, so a key whose block hasn't arrived can always fall back to an earlier one. Blocks arrive
+// through AssetLoader::Pump(). No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	// A run of consecutive keys, as the exporter wrote them.
+	struct ClipBlock
+	{
+		uint32_t firstKey;
+		uint32_t keyCount;
+	};
+
+	class ClipStream
+	{
+	public:
+		// Clips whose keyframes would take more than this resident are streamed.
+		static const uint64_t StreamedClipBytes = 64ull << 20;
+
+		static const size_t DefaultCacheBlocks = 8;
+		static constexpr double DefaultPrefetchSeconds = 2.0;
+
+		// One joint of a key record: its transform as 16 floats, then its parent index. A record is the key's
+		// time then one of these per joint.
+		static const uint64_t KeyJointBytes = 16 * sizeof(float) + sizeof(int32_t);
+
+		// Where a clip's keys are in its file.
+		struct Source
+		{
+			std::string path;
+			uint64_t keyOffset = 0;        // of the first key record
+			uint32_t jointCount = 0;
+			double blockSeconds = 0.0;
+			std::vector<ClipBlock> blocks; // every key in one, in order
+			std::vector<double> keytimes;  // ascending, one per key
+		};
+
+		struct Stats
+		{
+			size_t residentBlocks = 0;
+			uint64_t residentBytes = 0;
+			uint64_t peakBytes = 0;
+			uint64_t requests = 0;  // blocks asked of the loader
+			uint64_t evictions = 0;
+			uint64_t failures = 0;  // blocks that couldn't be read, they're not asked for again
+			uint64_t misses = 0;    // keys sampled before their block arrived
+		};
+
+		// Whether source puts each of a clip's keyCount keys in one block, in order, with ascending keytimes.
+		static bool SourceValid(const Source& source, size_t keyCount);
+
+		ClipStream(AssetLoader& loader, Source source, size_t cacheBlocks = DefaultCacheBlocks,
+			double prefetchSeconds = DefaultPrefetchSeconds);
+		ClipStream(const ClipStream&) = delete;
+		ClipStream& operator=(const ClipStream&) = delete;
+		~ClipStream();
+
+		// Reads the first block on the calling thread. False if it couldn't be read, the stream is then unusable.
+		bool Open();
+
+		// Asks for the blocks the instances playing clipIndex will sample next; clip is that clip, the one this
+		// stream feeds. Instances that weren't visible last frame come after every visible one. Only from the
+		// thread that pumps the loader.
+		void Update(const SkinnedClip& clip, const std::vector<CrowdInstance>& instances, uint32_t clipIndex);
+
+		// The key's jointCount joint transforms. If its block isn't resident, the last key of the nearest
+		// resident block before it, and the miss is counted; nullptr only before Open() succeeds. Safe from any
+		// number of threads at once, as long as Update() and the loader's Pump() don't run meanwhile.
+		const Matrix4* KeyPose(size_t key) const;
+
+		// Blocks resident or on their way, the first one not counted. At least 1.
+		void SetCacheBlocks(size_t cacheBlocks);
+
+		// Playback seconds ahead of each playhead that are paged in before it gets there.
+		void SetPrefetchSeconds(double prefetchSeconds);
+
+		size_t CacheBlocks() const { return m_cacheBlocks; }
+		double PrefetchSeconds() const { return m_prefetchSeconds; }
+		const Source& GetSource() const { return m_source; }
+		Stats GetStats() const;
+
+	private:
+		struct Slot
+		{
+			uint32_t block;
+			std::vector<Matrix4> poses; // keyCount * jointCount, key major
+		};
+
+		uint32_t BlockOf(size_t key) const;
+		AssetLoader::Request BlockRequest(uint32_t block) const;
+
+		// Evicts, then cancels, blocks this update doesn't want until at most keep are held. False if it can't.
+		bool Trim(size_t keep);
+
+		void Arrive(uint32_t block, const LoadResult& result);
+		void Keep(uint32_t block, std::vector<Matrix4>&& poses);
+		void Evict(uint32_t block);
+
+		AssetLoader& m_loader;
+		Source m_source;
+		size_t m_cacheBlocks;
+		double m_prefetchSeconds;
+
+		std::vector<Slot> m_slots;                                      // resident blocks, in no particular order
+		std::vector<int32_t> m_slotOf;                                  // per block, its m_slots index or -1
+		std::vector<uint64_t> m_lastWanted;                             // per block, the last Update() that wanted it
+		std::vector<uint8_t> m_failed;                                  // per block, its read failed
+		std::unordered_map<uint32_t, AssetLoader::RequestId> m_pending; // block to the read on its way
+		std::vector<std::pair<double, uint32_t>> m_wanted;              // Update()'s scratch, seconds away and block
+		uint64_t m_update = 0;
+
+		Stats m_stats;
+		mutable std::atomic<uint64_t> m_misses{ 0 };
+
+		// Completion callbacks hold it weakly, so one that runs after the stream is gone drops its block.
+		std::shared_ptr<ClipStream*> m_self;
+	};
+}
@@ -0,0 +1,114 @@
+#include "ClusterCulling.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace MRenderer
+{
+	Frustum frustum_from_matrix(const Matrix4& viewProjection)
+	{
+		// Clip space is p * M, so each plane is a sum or difference of the matrix's columns.
+		const float (&m)[4][4] = viewProjection.m;
+		const float sign[6] = { 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, -1.0f };
+		const int axis[6] = { 0, 0, 1, 1, 2, 2 };
+
+		Frustum frustum;
+		for (int p = 0; p < 6; p++)
+		{
+			float* plane = frustum.planes[p];
+			for (int i = 0; i < 4; i++)
+			{
+				// left, right, bottom, top, then near (z >= 0) and far (z <= w)
+				plane[i] = p == 4 ? m[i][2] : m[i][3] + sign[p] * m[i][axis[p]];
+			}
+			const float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+			if (length > 0.0f)
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					plane[i] /= length;
+				}
+			}
+		}
+		return frustum;
+	}
+
+	ClusterVisibility cull_cluster(const Meshlet& meshlet, const Matrix4& world, const Frustum& frustum, const float eye[3])
+	{
+		const float (&m)[4][4] = world.m;
+
+		// The sphere in world space, its radius grown by the largest scale along any axis.
+		float center[3];
+		for (int j = 0; j < 3; j++)
+		{
+			center[j] = meshlet.center[0] * m[0][j] + meshlet.center[1] * m[1][j] + meshlet.center[2] * m[2][j] + m[3][j];
+		}
+		float scales[3];
+		for (int i = 0; i < 3; i++)
+		{
+			scales[i] = std::sqrt(m[i][0] * m[i][0] + m[i][1] * m[i][1] + m[i][2] * m[i][2]);
+		}
+		const float maxScale = std::max(scales[0], std::max(scales[1], scales[2]));
+		const float minScale = std::min(scales[0], std::min(scales[1], scales[2]));
+		const float radius = meshlet.radius * maxScale;
+
+		for (const float (&plane)[4] : frustum.planes)
+		{
+			if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius)
+			{
+				return ClusterVisibility::OutsideFrustum;
+			}
+		}
+
+		if (meshlet.coneCutoff <= 0.0f || maxScale - minScale > maxScale * 1e-3f)
+		{
+			return ClusterVisibility::Visible;
+		}
+
+		float axis[3];
+		for (int j = 0; j < 3; j++)
+		{
+			axis[j] = meshlet.coneAxis[0] * m[0][j] + meshlet.coneAxis[1] * m[1][j] + meshlet.coneAxis[2] * m[2][j];
+		}
+		const float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		const float toCenter[3] = { center[0] - eye[0], center[1] - eye[1], center[2] - eye[2] };
+		const float distance = std::sqrt(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+		if (axisLength <= 0.0f || distance <= radius)
+		{
+			return ClusterVisibility::Visible;
+		}
+
+		// Back facing as a whole when every normal in the cone points away from the eye at every point of the
+		// sphere: the normal furthest from the view direction, at angle(view, axis) + half angle, still makes
+		// dot(point - eye, normal) >= distance * cos(that angle) - radius >= 0.
+		const float cosView = (toCenter[0] * axis[0] + toCenter[1] * axis[1] + toCenter[2] * axis[2]) / (distance * axisLength);
+		const float sinView = std::sqrt(std::max(0.0f, 1.0f - cosView * cosView));
+		const float sinCone = std::sqrt(std::max(0.0f, 1.0f - meshlet.coneCutoff * meshlet.coneCutoff));
+		if (cosView * meshlet.coneCutoff - sinView * sinCone >= radius / distance)
+		{
+			return ClusterVisibility::BackFacing;
+		}
+		return ClusterVisibility::Visible;
+	}
+
+	void cull_clusters(const Meshlet* meshlets, uint32_t first, uint32_t count, const Matrix4& world, const Frustum& frustum,
+		const float eye[3], std::vector<uint32_t>& visible, ClusterCullStats& stats)
+	{
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			stats.tested++;
+			switch (cull_cluster(meshlets[i], world, frustum, eye))
+			{
+			case ClusterVisibility::OutsideFrustum:
+				stats.outsideFrustum++;
+				break;
+			case ClusterVisibility::BackFacing:
+				stats.backFacing++;
+				break;
+			default:
+				visible.push_back(i);
+				break;
+			}
+		}
+	}
+}
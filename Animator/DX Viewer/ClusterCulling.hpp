@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "InstanceBuilder.hpp"
+
+// CPU reference for culling meshlets, the exporter's clusters of up to 64 vertices and 124 triangles, against
+// the camera: a bounding sphere against the frustum and a normal cone against the eye. The exporter builds
+// both bounds over every pose of the clip, so the tests hold whatever time an instance is sampled at. Written
+// to be ported to a task or amplification shader as it is. No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	// Mirrors MoralesMeshlet in the exporter.
+	struct Meshlet
+	{
+		uint32_t vertexStart;   // into the mesh's meshlet vertices
+		uint32_t vertexCount;
+		uint32_t triangleStart; // into the mesh's meshlet triangles, three bytes per triangle
+		uint32_t triangleCount;
+		uint32_t submesh;
+		float center[3];        // bounding sphere, model space
+		float radius;
+		float coneAxis[3];
+		float coneCutoff;       // cos of the cone's half angle, 0 or less if it faces every way
+	};
+
+	static_assert(sizeof(Meshlet) == 52, "Meshlet must match MoralesMeshlet");
+
+	// Six planes facing inwards, normalized, a point p is inside plane i when dot(planes[i].xyz, p) + planes[i].w >= 0.
+	struct Frustum
+	{
+		float planes[6][4];
+	};
+
+	// The frustum of a row vector view-projection matrix with D3D's 0 to w depth range, in the space the matrix
+	// takes points from.
+	Frustum frustum_from_matrix(const Matrix4& viewProjection);
+
+	enum class ClusterVisibility
+	{
+		Visible,
+		OutsideFrustum,
+		BackFacing,
+	};
+
+	struct ClusterCullStats
+	{
+		uint64_t tested = 0;
+		uint64_t outsideFrustum = 0;
+		uint64_t backFacing = 0;
+
+		uint64_t Visible() const { return tested - outsideFrustum - backFacing; }
+	};
+
+	// Tests one meshlet placed by world (row vectors, as CrowdInstance::world) against a world space frustum and
+	// eye. The cone test is skipped under a non-uniform scale, which doesn't keep normals inside the cone.
+	ClusterVisibility cull_cluster(const Meshlet& meshlet, const Matrix4& world, const Frustum& frustum, const float eye[3]);
+
+	// Appends the index of every meshlet of [first, first + count) that survives cull_cluster() to visible.
+	void cull_clusters(const Meshlet* meshlets, uint32_t first, uint32_t count, const Matrix4& world, const Frustum& frustum,
+		const float eye[3], std::vector<uint32_t>& visible, ClusterCullStats& stats);
+}
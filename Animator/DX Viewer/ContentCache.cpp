@@ -0,0 +1,73 @@
+#include "ContentCache.hpp"
+
+// Anonymous namespace
+namespace
+{
+	int hex_value(char c)
+	{
+		if (c >= '0' && c <= '9')
+		{
+			return c - '0';
+		}
+		if (c >= 'a' && c <= 'f')
+		{
+			return c - 'a' + 10;
+		}
+		if (c >= 'A' && c <= 'F')
+		{
+			return c - 'A' + 10;
+		}
+		return -1;
+	}
+}
+
+namespace MRenderer
+{
+	uint64_t content_hash(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::string content_hash_name(uint64_t hash)
+	{
+		const char digits[] = "0123456789abcdef";
+		std::string name(16, '0');
+		for (int i = 15; i >= 0; i--)
+		{
+			name[i] = digits[hash & 0xF];
+			hash >>= 4;
+		}
+		return name;
+	}
+
+	bool content_hash_from_path(const std::string& path, uint64_t& hash)
+	{
+		const size_t separator = path.find_last_of("/\\");
+		const size_t start = separator == std::string::npos ? 0 : separator + 1;
+		const size_t end = path.find('.', start);
+		if ((end == std::string::npos ? path.size() : end) - start != 16)
+		{
+			return false;
+		}
+
+		uint64_t value = 0;
+		for (size_t i = start; i < start + 16; i++)
+		{
+			const int digit = hex_value(path[i]);
+			if (digit < 0)
+			{
+				return false;
+			}
+			value = (value << 4) | static_cast<uint64_t>(digit);
+		}
+		hash = value;
+		return true;
+	}
+}
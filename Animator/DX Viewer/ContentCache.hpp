@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Content addressed sharing. Assets are keyed by a hash of their bytes rather than by where they were
+// loaded from, so two meshes pointing at byte-identical files end up with one decoded copy and one GPU
+// copy. The cache only holds weak references: an entry lives exactly as long as something uses it.
+// Paths that have been seen are remembered too, so asking for the same file again skips the read.
+// The exporter writes textures into a shared store named by the same hash ("Textures\<hash>.png"); for
+// those the hash comes from the name and nothing has to be read at all. No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	// 64 bit FNV-1a. Not cryptographic, collisions between a library's worth of textures are vanishingly unlikely.
+	uint64_t content_hash(const void* data, size_t size);
+
+	// 16 lower case hex digits, the file name the exporter gives a texture in the shared store.
+	std::string content_hash_name(uint64_t hash);
+
+	// Reads the hash back from a store path, "dir/0123456789abcdef.png" or its cooked ".png.dds". False
+	// for anything else, those have to be hashed after reading.
+	bool content_hash_from_path(const std::string& path, uint64_t& hash);
+
+	// Main thread only.
+	template <typename T>
+	class ContentCache
+	{
+	public:
+		std::shared_ptr<T> Find(uint64_t hash) const
+		{
+			auto entry = m_entries.find(hash);
+			return entry != m_entries.end() ? entry->second.lock() : nullptr;
+		}
+
+		// By the hash in a store path, or by a path that was earlier Alias()ed to a hash.
+		std::shared_ptr<T> FindPath(const std::string& path) const
+		{
+			uint64_t hash = 0;
+			if (content_hash_from_path(path, hash))
+			{
+				return Find(hash);
+			}
+
+			auto alias = m_paths.find(path);
+			return alias != m_paths.end() ? Find(alias->second) : nullptr;
+		}
+
+		// Returns the live entry for hash if there is one, otherwise stores value and returns it. Either way
+		// the caller should use what comes back and drop its own copy.
+		std::shared_ptr<T> Insert(uint64_t hash, std::shared_ptr<T> value)
+		{
+			std::weak_ptr<T>& entry = m_entries[hash];
+			std::shared_ptr<T> live = entry.lock();
+			if (live)
+			{
+				return live;
+			}
+			entry = value;
+			return value;
+		}
+
+		// Remembers that path held this content. Only valid while the file doesn't change, which holds for
+		// the store and for source assets the viewer doesn't watch.
+		void Alias(const std::string& path, uint64_t hash)
+		{
+			m_paths[path] = hash;
+		}
+
+		// Forgets entries nothing uses any more, and the paths that led to them.
+		void Prune()
+		{
+			for (auto entry = m_entries.begin(); entry != m_entries.end(); )
+			{
+				entry = entry->second.expired() ? m_entries.erase(entry) : std::next(entry);
+			}
+			for (auto alias = m_paths.begin(); alias != m_paths.end(); )
+			{
+				alias = m_entries.count(alias->second) == 0 ? m_paths.erase(alias) : std::next(alias);
+			}
+		}
+
+		size_t Live() const
+		{
+			size_t live = 0;
+			for (const auto& entry : m_entries)
+			{
+				live += entry.second.expired() ? 0 : 1;
+			}
+			return live;
+		}
+
+	private:
+		std::unordered_map<uint64_t, std::weak_ptr<T>> m_entries;
+		std::unordered_map<std::string, uint64_t> m_paths;
+	};
+}
@@ -0,0 +1,237 @@
+#include "CrowdBenchmark.hpp"
+#include "CrowdCulling.hpp"
+#include "CrowdGrid.hpp"
+#include "Profiler.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <ostream>
+#include <random>
+
+// Anonymous namespace
+namespace
+{
+	using namespace MRenderer;
+
+	const int BenchmarkFrames = 60;
+	const double FrameTime = 1.0 / 60.0;
+	const float CrowdExtent = 200.0f; // the crowd stands within this of the camera along x and z
+	const float WalkSpeed = 1.4f;     // metres a second
+	const float FieldOfView = 0.785398163f;
+
+	float projection_scale(float fovY)
+	{
+		return 1.0f / std::tan(fovY * 0.5f);
+	}
+
+	Matrix4 identity()
+	{
+		Matrix4 m = {};
+		for (int i = 0; i < 4; i++)
+		{
+			m.m[i][i] = 1.0f;
+		}
+		return m;
+	}
+
+	// A chain of joints swinging about x, with a box per key about the height of a character.
+	SkinnedClip synthetic_clip(uint32_t jointCount, uint32_t keyCount)
+	{
+		SkinnedClip clip;
+		clip.jointCount = jointCount;
+		clip.duration = 1.0;
+		clip.inverseBind.assign(jointCount, identity());
+		clip.parents.resize(jointCount);
+		for (uint32_t k = 0; k < keyCount; k++)
+		{
+			const double time = clip.duration * k / keyCount;
+			const float angle = 0.5f * static_cast<float>(std::sin(time * 6.283185307));
+			clip.keytimes.push_back(time);
+			for (uint32_t j = 0; j < jointCount; j++)
+			{
+				Matrix4 m = identity();
+				m.m[1][1] = m.m[2][2] = std::cos(angle);
+				m.m[1][2] = std::sin(angle);
+				m.m[2][1] = -m.m[1][2];
+				m.m[3][1] = 1.8f * j / jointCount;
+				clip.poses.push_back(m);
+			}
+			const float reach = 0.3f + 0.4f * std::fabs(angle);
+			clip.keyBounds.push_back({ { -0.4f, 0.0f, -reach }, { 0.4f, 1.8f, reach } });
+		}
+		for (uint32_t j = 0; j < jointCount; j++)
+		{
+			clip.parents[j] = static_cast<int>(j) - 1;
+		}
+		return clip;
+	}
+
+	// Row vector perspective projection looking down +z from the origin, D3D depth range, as the viewer's.
+	Frustum camera_frustum(float fovY, float aspect, float nearZ, float farZ)
+	{
+		const float yScale = projection_scale(fovY);
+		Matrix4 projection = {};
+		projection.m[0][0] = yScale / aspect;
+		projection.m[1][1] = yScale;
+		projection.m[2][2] = farZ / (farZ - nearZ);
+		projection.m[2][3] = 1.0f;
+		projection.m[3][2] = -nearZ * farZ / (farZ - nearZ);
+		return frustum_from_matrix(projection);
+	}
+
+	// Scattered over a square around the camera at ground level, random headings and phases, so roughly the
+	// fraction of them a 45 degree frustum takes in is visible.
+	std::vector<CrowdInstance> scattered_crowd(size_t instanceCount, std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> position(-CrowdExtent, CrowdExtent);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<CrowdInstance> crowd(instanceCount);
+		for (CrowdInstance& instance : crowd)
+		{
+			const float heading = unit(random) * 6.283185307f;
+			instance.world = identity();
+			instance.world.m[0][0] = instance.world.m[2][2] = std::cos(heading);
+			instance.world.m[0][2] = -std::sin(heading);
+			instance.world.m[2][0] = std::sin(heading);
+			instance.world.m[3][0] = position(random);
+			instance.world.m[3][1] = -1.0f;
+			instance.world.m[3][2] = position(random);
+			instance.time = unit(random);
+			instance.speed = 0.5f + unit(random);
+		}
+		return crowd;
+	}
+
+	// Three levels switching where the synthetic character is a fifth and a twentieth of the screen tall,
+	// stepping its keys below a fiftieth, seen from the benchmark camera.
+	LodSelection benchmark_lods(float projectionScale)
+	{
+		LodSelection selection;
+		selection.lodCount = 3;
+		selection.switchSizes[0] = FLT_MAX;
+		selection.switchSizes[1] = 0.2f;
+		selection.switchSizes[2] = 0.05f;
+		selection.center[1] = 0.9f;
+		selection.radius = 1.0f;
+		selection.projectionScale = projectionScale;
+		selection.steppedSize = 0.02f;
+		return selection;
+	}
+
+	void run(std::vector<CrowdInstance> crowd, const std::vector<SkinnedClip>& clips, const Frustum& frustum, bool cull, std::ostream& out)
+	{
+		std::vector<GpuInstance> records(crowd.size());
+		std::vector<Matrix4> palette(crowd.size() * clips[0].jointCount);
+		InstanceBuilder builder;
+		CrowdCuller culler;
+
+		// Each frame ends its own "Frame" zone, the one the previous run left open is cleared with the rest.
+		Profiler::begin_frame();
+		Profiler::clear();
+		uint64_t visible = 0;
+		for (int frame = 0; frame < BenchmarkFrames; frame++)
+		{
+			visible += cull ? culler.Cull(crowd, clips, FrameTime, frustum) : crowd.size();
+			builder.Build(crowd, clips, FrameTime, records.data(), palette.data());
+			Profiler::begin_frame();
+		}
+
+		out << (cull ? "With culling" : "Without culling") << ", " << crowd.size() << " instances, " << visible / BenchmarkFrames
+			<< " visible a frame on average\n";
+		Profiler::print_stats(out);
+	}
+
+	// Frames of walking the crowd, then culling and picking levels either for every instance or through the grid.
+	// The walk itself isn't timed.
+	void run_walking(std::vector<CrowdInstance> crowd, const std::vector<SkinnedClip>& clips, const Frustum& frustum, bool useGrid,
+		std::ostream& out)
+	{
+		CrowdCuller culler;
+		CrowdGrid grid;
+		grid.Build(crowd, clips);
+		LodSelection selection = benchmark_lods(projection_scale(FieldOfView));
+
+		Profiler::begin_frame();
+		Profiler::clear();
+		uint64_t visible = 0;
+		uint64_t moved = 0;
+		for (int frame = 0; frame < BenchmarkFrames; frame++)
+		{
+			// Everyone walks the way they face, turning back at the edge of the square.
+			for (CrowdInstance& instance : crowd)
+			{
+				float (&m)[4][4] = instance.world.m;
+				const float step = WalkSpeed * static_cast<float>(FrameTime);
+				m[3][0] += m[2][0] * step;
+				m[3][2] += m[2][2] * step;
+				if ((std::fabs(m[3][0]) > CrowdExtent && m[3][0] * m[2][0] > 0.0f) || (std::fabs(m[3][2]) > CrowdExtent && m[3][2] * m[2][2] > 0.0f))
+				{
+					for (int j = 0; j < 3; j++)
+					{
+						m[0][j] = -m[0][j];
+						m[2][j] = -m[2][j];
+					}
+				}
+			}
+
+			if (useGrid)
+			{
+				moved += grid.Update(crowd, clips);
+				visible += culler.Cull(crowd, clips, FrameTime, frustum, grid);
+				select_lods(crowd, grid, selection);
+			}
+			else
+			{
+				visible += culler.Cull(crowd, clips, FrameTime, frustum);
+				select_lods(crowd, selection);
+			}
+			Profiler::begin_frame();
+		}
+
+		out << (useGrid ? "Grid" : "Every instance") << ", " << crowd.size() << " walking instances, " << visible / BenchmarkFrames
+			<< " visible a frame on average";
+		if (useGrid)
+		{
+			out << ", " << grid.Cells().size() << " cells, " << moved / BenchmarkFrames << " changed cell a frame on average";
+		}
+		out << "\n";
+		Profiler::print_stats(out);
+	}
+}
+
+namespace MRenderer
+{
+	int run_culling_benchmark(size_t instanceCount, std::ostream& out)
+	{
+		const std::vector<SkinnedClip> clips = { synthetic_clip(64, 30) };
+
+		std::mt19937 random(1);
+		const std::vector<CrowdInstance> crowd = scattered_crowd(instanceCount, random);
+
+		const Frustum frustum = camera_frustum(FieldOfView, 16.0f / 9.0f, 0.1f, 100.0f);
+		run(crowd, clips, frustum, false, out);
+		run(crowd, clips, frustum, true, out);
+		return 0;
+	}
+
+	int run_grid_benchmark(size_t instanceCount, std::ostream& out)
+	{
+		std::vector<SkinnedClip> clips = { synthetic_clip(64, 30) };
+		bake_key_palettes(clips[0]);
+		const Frustum frustum = camera_frustum(FieldOfView, 16.0f / 9.0f, 0.1f, 100.0f);
+
+		// A hundredth, a tenth and all of the crowd, to show how each way scales.
+		for (size_t count : { instanceCount / 100, instanceCount / 10, instanceCount })
+		{
+			if (count == 0)
+			{
+				continue;
+			}
+			std::mt19937 random(1);
+			const std::vector<CrowdInstance> crowd = scattered_crowd(count, random);
+			run_walking(crowd, clips, frustum, false, out);
+			run_walking(crowd, clips, frustum, true, out);
+		}
+		return 0;
+	}
+}
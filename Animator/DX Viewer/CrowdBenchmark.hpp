@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+
+// Headless benchmarks of the crowd's CPU work, run from the command line without a window or a device
+// ("-bench-culling [instances]", "-bench-grid [instances]"). A synthetic clip and crowd stand in for an
+// exported mesh so the numbers don't depend on the asset. No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	// Frames of culling and instance building for instanceCount characters spread around a camera, once
+	// with culling and once without. Prints the profiler's per-zone stats for each. Returns 0.
+	int run_culling_benchmark(size_t instanceCount, std::ostream& out);
+
+	// Frames of a crowd walking about, culled and given levels of detail by testing every instance and then
+	// through a CrowdGrid, at a hundredth, a tenth and all of instanceCount. Prints the profiler's per-zone
+	// stats for each, the grid's updates included. Returns 0.
+	int run_grid_benchmark(size_t instanceCount, std::ostream& out);
+}
@@ -0,0 +1,349 @@
+#include "CrowdCulling.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define CROWD_CULLING_SSE 1
+#endif
+
+// Anonymous namespace
+namespace
+{
+	using namespace MRenderer;
+
+	// Half extent given to an instance with no bounds, large enough to straddle every plane without overflowing.
+	const float Unbounded = 1e30f;
+
+	// Index of the first component array of m_boxes: centre x, y, z then half extent x, y, z.
+	enum BoxComponent { CenterX, CenterY, CenterZ, ExtentX, ExtentY, ExtentZ, ComponentCount };
+}
+
+namespace MRenderer
+{
+	void compute_key_bounds(const SkinnedClip& clip, const SkinningVertex* vertices, size_t vertexCount, std::vector<Aabb>& outBounds)
+	{
+		outBounds.clear();
+		if (vertexCount == 0)
+		{
+			return;
+		}
+
+		// Furthest any vertex a joint moves sits from it: v times the joint's inverse bind, whose length the
+		// pose's rotation keeps.
+		std::vector<float> radius(clip.jointCount, 0.0f);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			const SkinningVertex& vertex = vertices[v];
+			for (int influence = 0; influence < 4; influence++)
+			{
+				const int32_t joint = vertex.joints[influence];
+				if (unpack_weight(vertex.weights, influence) == 0.0f || joint < 0 || static_cast<uint32_t>(joint) >= clip.jointCount)
+				{
+					continue;
+				}
+				const Matrix4& m = clip.inverseBind[joint];
+				float lengthSquared = 0.0f;
+				for (int j = 0; j < 3; j++)
+				{
+					const float a = vertex.position[0] * m.m[0][j] + vertex.position[1] * m.m[1][j] + vertex.position[2] * m.m[2][j] + m.m[3][j];
+					lengthSquared += a * a;
+				}
+				radius[joint] = std::max(radius[joint], std::sqrt(lengthSquared));
+			}
+		}
+
+		std::vector<Matrix4> joints(clip.jointCount);
+		std::vector<Matrix4> palette(clip.jointCount);
+		for (size_t k = 0; k < clip.keytimes.size(); k++)
+		{
+			sample_clip_pose(clip, clip.keytimes[k], joints.data());
+			build_skin_palette(clip, joints.data(), palette.data());
+
+			Aabb box = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				const SkinningVertex& vertex = vertices[v];
+				float position[3] = { 0.0f, 0.0f, 0.0f };
+				for (int influence = 0; influence < 4; influence++)
+				{
+					const int32_t joint = vertex.joints[influence];
+					const float weight = unpack_weight(vertex.weights, influence);
+					if (weight == 0.0f || joint < 0 || static_cast<uint32_t>(joint) >= clip.jointCount)
+					{
+						continue;
+					}
+					// The palette is transposed for HLSL, stored.m[j][i] is the matrix's m[i][j].
+					const Matrix4& m = palette[joint];
+					for (int j = 0; j < 3; j++)
+					{
+						position[j] += weight * (vertex.position[0] * m.m[j][0] + vertex.position[1] * m.m[j][1] +
+							vertex.position[2] * m.m[j][2] + m.m[j][3]);
+					}
+				}
+				for (int j = 0; j < 3; j++)
+				{
+					box.min[j] = std::min(box.min[j], position[j]);
+					box.max[j] = std::max(box.max[j], position[j]);
+				}
+			}
+			outBounds.push_back(box);
+		}
+
+		// Between two keys each joint turns at a steady rate through the angle between its key rotations, so
+		// the vertices it carries stay within r * (1 - cos(angle / 2)) of the line between where the keys put
+		// them, which is inside both keys' boxes. A blend of joints strays no further than its worst joint.
+		// Grow both keys' boxes by that for every pair sample_clip_pose() interpolates, the last key with the
+		// first included.
+		const size_t keyCount = clip.keytimes.size();
+		std::vector<float> margins(keyCount, 0.0f);
+		for (size_t k = 0; k < keyCount; k++)
+		{
+			const size_t next = (k + 1) % keyCount;
+			const Matrix4* poseA = clip_key_pose(clip, k);
+			const Matrix4* poseB = clip_key_pose(clip, next);
+			float margin = 0.0f;
+			for (uint32_t i = 0; i < clip.jointCount; i++)
+			{
+				margin = std::max(margin, radius[i] * key_turn(poseA[i], poseB[i]));
+			}
+			margins[k] = std::max(margins[k], margin);
+			margins[next] = std::max(margins[next], margin);
+		}
+		for (size_t k = 0; k < keyCount; k++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				outBounds[k].min[j] -= margins[k];
+				outBounds[k].max[j] += margins[k];
+			}
+		}
+	}
+
+	float key_turn(const Matrix4& a, const Matrix4& b)
+	{
+		// The trace of a * transpose(b)'s rotation is 1 + 2 cos(angle), and cos(angle / 2) = sqrt(1 + trace) / 2.
+		float trace = 0.0f;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				trace += a.m[i][j] * b.m[i][j];
+			}
+		}
+		trace = std::min(std::max(trace, -1.0f), 3.0f);
+		return 1.0f - std::sqrt(1.0f + trace) * 0.5f;
+	}
+
+	bool clip_bounds(const SkinnedClip& clip, double time, Aabb& outBounds)
+	{
+		if (clip.keyBounds.empty() || clip.keyBounds.size() != clip.keytimes.size())
+		{
+			return false;
+		}
+
+		const ClipKeys keys = find_clip_keys(clip, time);
+		const Aabb& a = clip.keyBounds[keys.previous];
+		const Aabb& b = clip.keyBounds[keys.next];
+		for (int j = 0; j < 3; j++)
+		{
+			outBounds.min[j] = std::min(a.min[j], b.min[j]);
+			outBounds.max[j] = std::max(a.max[j], b.max[j]);
+		}
+		return true;
+	}
+
+	Aabb transform_aabb(const Aabb& box, const Matrix4& world)
+	{
+		// Centre and half extents, the extents through the absolute value of the matrix.
+		const float (&m)[4][4] = world.m;
+		float center[3];
+		float extent[3];
+		for (int i = 0; i < 3; i++)
+		{
+			center[i] = (box.min[i] + box.max[i]) * 0.5f;
+			extent[i] = (box.max[i] - box.min[i]) * 0.5f;
+		}
+
+		Aabb placed;
+		for (int j = 0; j < 3; j++)
+		{
+			const float c = center[0] * m[0][j] + center[1] * m[1][j] + center[2] * m[2][j] + m[3][j];
+			const float e = extent[0] * std::fabs(m[0][j]) + extent[1] * std::fabs(m[1][j]) + extent[2] * std::fabs(m[2][j]);
+			placed.min[j] = c - e;
+			placed.max[j] = c + e;
+		}
+		return placed;
+	}
+
+	bool aabb_in_frustum(const Aabb& box, const Frustum& frustum)
+	{
+		for (const float (&plane)[4] : frustum.planes)
+		{
+			// The corner furthest along the plane's normal.
+			const float x = plane[0] >= 0.0f ? box.max[0] : box.min[0];
+			const float y = plane[1] >= 0.0f ? box.max[1] : box.min[1];
+			const float z = plane[2] >= 0.0f ? box.max[2] : box.min[2];
+			if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	FrustumOverlap classify_aabb(const Aabb& box, const Frustum& frustum)
+	{
+		FrustumOverlap overlap = FrustumOverlap::Inside;
+		for (const float (&plane)[4] : frustum.planes)
+		{
+			// The corners furthest along and furthest against the plane's normal.
+			float along = plane[3];
+			float against = plane[3];
+			for (int j = 0; j < 3; j++)
+			{
+				along += plane[j] * (plane[j] >= 0.0f ? box.max[j] : box.min[j]);
+				against += plane[j] * (plane[j] >= 0.0f ? box.min[j] : box.max[j]);
+			}
+			if (along < 0.0f)
+			{
+				return FrustumOverlap::Outside;
+			}
+			if (against < 0.0f)
+			{
+				overlap = FrustumOverlap::Intersecting;
+			}
+		}
+		return overlap;
+	}
+
+	uint32_t CrowdCuller::Cull(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime, const Frustum& frustum)
+	{
+		PROFILE_ZONE("Crowd::Cull");
+
+		m_listed.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			m_listed[i] = static_cast<uint32_t>(i);
+		}
+		return CullListed(instances, clips, deltaTime, frustum);
+	}
+
+	uint32_t CrowdCuller::Cull(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime, const Frustum& frustum,
+		const CrowdGrid& grid)
+	{
+		PROFILE_ZONE("Crowd::CullGrid");
+
+		uint32_t visible = 0;
+		m_listed.clear();
+		for (const CrowdGrid::Cell& cell : grid.Cells())
+		{
+			if (cell.members.empty())
+			{
+				continue;
+			}
+			switch (classify_aabb(grid.CellBounds(cell), frustum))
+			{
+			case FrustumOverlap::Outside:
+				for (uint32_t member : cell.members)
+				{
+					instances[member].visible = false;
+				}
+				break;
+			case FrustumOverlap::Inside:
+				for (uint32_t member : cell.members)
+				{
+					instances[member].visible = true;
+				}
+				visible += static_cast<uint32_t>(cell.members.size());
+				break;
+			default:
+				m_listed.insert(m_listed.end(), cell.members.begin(), cell.members.end());
+				break;
+			}
+		}
+		return visible + CullListed(instances, clips, deltaTime, frustum);
+	}
+
+	uint32_t CrowdCuller::CullListed(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime, const Frustum& frustum)
+	{
+		const size_t count = m_listed.size();
+		const size_t stride = (count + 3) & ~size_t(3);
+		m_boxes.assign(stride * ComponentCount, 0.0f);
+		float* boxes[ComponentCount];
+		for (int c = 0; c < ComponentCount; c++)
+		{
+			boxes[c] = m_boxes.data() + c * stride;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const CrowdInstance& instance = instances[m_listed[i]];
+			const SkinnedClip& clip = clips[instance.clip];
+			Aabb box;
+			if (!clip_bounds(clip, instance.time + deltaTime * instance.speed, box))
+			{
+				boxes[ExtentX][i] = boxes[ExtentY][i] = boxes[ExtentZ][i] = Unbounded;
+				continue;
+			}
+			box = transform_aabb(box, instance.world);
+			for (int j = 0; j < 3; j++)
+			{
+				boxes[CenterX + j][i] = (box.min[j] + box.max[j]) * 0.5f;
+				boxes[ExtentX + j][i] = (box.max[j] - box.min[j]) * 0.5f;
+			}
+		}
+
+		// A box is outside a plane when its centre is further behind it than the box reaches towards it:
+		// dot(n, c) + d < -dot(|n|, e).
+		uint32_t visible = 0;
+#if defined(CROWD_CULLING_SSE)
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		for (size_t i = 0; i < stride; i += 4)
+		{
+			const __m128 cx = _mm_loadu_ps(boxes[CenterX] + i);
+			const __m128 cy = _mm_loadu_ps(boxes[CenterY] + i);
+			const __m128 cz = _mm_loadu_ps(boxes[CenterZ] + i);
+			const __m128 ex = _mm_loadu_ps(boxes[ExtentX] + i);
+			const __m128 ey = _mm_loadu_ps(boxes[ExtentY] + i);
+			const __m128 ez = _mm_loadu_ps(boxes[ExtentZ] + i);
+			__m128 outside = _mm_setzero_ps();
+			for (const float (&plane)[4] : frustum.planes)
+			{
+				const __m128 nx = _mm_set1_ps(plane[0]);
+				const __m128 ny = _mm_set1_ps(plane[1]);
+				const __m128 nz = _mm_set1_ps(plane[2]);
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane[3])));
+				const __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex), _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+					_mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+			}
+
+			const int mask = _mm_movemask_ps(outside);
+			for (size_t lane = 0; lane < 4 && i + lane < count; lane++)
+			{
+				CrowdInstance& instance = instances[m_listed[i + lane]];
+				instance.visible = (mask & (1 << lane)) == 0;
+				visible += instance.visible ? 1 : 0;
+			}
+		}
+#else
+		for (size_t i = 0; i < count; i++)
+		{
+			bool inside = true;
+			for (const float (&plane)[4] : frustum.planes)
+			{
+				const float distance = plane[0] * boxes[CenterX][i] + plane[1] * boxes[CenterY][i] + plane[2] * boxes[CenterZ][i] + plane[3];
+				const float reach = std::fabs(plane[0]) * boxes[ExtentX][i] + std::fabs(plane[1]) * boxes[ExtentY][i] + std::fabs(plane[2]) * boxes[ExtentZ][i];
+				inside = inside && distance + reach >= 0.0f;
+			}
+			instances[m_listed[i]].visible = inside;
+			visible += inside ? 1 : 0;
+		}
+#endif
+		return visible;
+	}
+}
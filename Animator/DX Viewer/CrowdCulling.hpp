@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "InstanceBuilder.hpp"
+#include "PreSkinning.hpp"
+#include "ClusterCulling.hpp"
+#include "CrowdGrid.hpp"
+
+// Frustum culling for the crowd, done before anything is sampled so culled characters cost neither a pose
+// nor a skinning pass. Each clip carries the bounds of the skinned mesh at every keyframe, grown to take in
+// everywhere interpolating to either neighbouring key carries it (written by the exporter, or
+// compute_key_bounds() for files without them). An instance's box is the union of the boxes of the two keys
+// it is between, placed by its world transform.
+// The boxes are tested four at a time with SSE where the compiler has it. Given a CrowdGrid, whole cells are
+// tested first and only the characters in cells the frustum cuts through are tested one by one. No D3D12 or
+// Windows dependency.
+namespace MRenderer
+{
+	// Bounds of vertices skinned at every keyframe of clip, posed exactly as sample_clip_pose() poses them, one
+	// per keyframe into outBounds. Each is grown by the furthest interpolating to the key before or after it
+	// can carry a vertex outside the two keys' boxes.
+	void compute_key_bounds(const SkinnedClip& clip, const SkinningVertex* vertices, size_t vertexCount, std::vector<Aabb>& outBounds);
+
+	// 1 - cos(angle / 2) for the angle between the rotations of two joint transforms: times a vertex's
+	// distance from the joint, how far a slerp between them carries it off the straight line between the two.
+	float key_turn(const Matrix4& a, const Matrix4& b);
+
+	// Model space bounds of the clip at time. False if the clip has no key bounds.
+	bool clip_bounds(const SkinnedClip& clip, double time, Aabb& outBounds);
+
+	// The box around box placed by world (row vectors).
+	Aabb transform_aabb(const Aabb& box, const Matrix4& world);
+
+	// False when the box is entirely outside one of the frustum's planes. The scalar reference for CrowdCuller.
+	bool aabb_in_frustum(const Aabb& box, const Frustum& frustum);
+
+	enum class FrustumOverlap
+	{
+		Outside,     // entirely outside one of the planes
+		Inside,      // entirely inside all of them
+		Intersecting
+	};
+
+	FrustumOverlap classify_aabb(const Aabb& box, const Frustum& frustum);
+
+	class CrowdCuller
+	{
+	public:
+		// Sets every instance's visible flag from its bounds at the time Build() will sample it, deltaTime after
+		// its current time. Instances whose clip has no key bounds stay visible. Returns how many are visible.
+		uint32_t Cull(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime, const Frustum& frustum);
+
+		// The same, a grid cell at a time: every member of a cell outside the frustum is culled and every member
+		// of one inside it kept without testing their own bounds. The grid must be up to date with the instances.
+		uint32_t Cull(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime, const Frustum& frustum,
+			const CrowdGrid& grid);
+
+	private:
+		// Tests the listed instances' own bounds, sets their visible flags and returns how many are visible.
+		uint32_t CullListed(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime, const Frustum& frustum);
+
+		std::vector<uint32_t> m_listed; // instances for CullListed()
+		// World boxes as centres and half extents, one array per component, each padded to a multiple of 4.
+		std::vector<float> m_boxes;
+	};
+}
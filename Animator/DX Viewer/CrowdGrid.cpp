@@ -0,0 +1,266 @@
+#include "CrowdGrid.hpp"
+#include "CrowdCulling.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Anonymous namespace
+namespace
+{
+	using namespace MRenderer;
+
+	// How far an instance whose clip has no bounds reaches, far enough to straddle every plane.
+	const float Unbounded = 1e30f;
+
+	// Cell coordinates are kept well inside int32_t so the packed key and the cell's corners stay exact.
+	const float MaxCellCoordinate = 1 << 30;
+
+	int32_t cell_coordinate(float position, float cellSize)
+	{
+		const float cell = std::floor(position / cellSize);
+		return static_cast<int32_t>(std::max(-MaxCellCoordinate, std::min(cell, MaxCellCoordinate)));
+	}
+
+	uint64_t cell_key(int32_t x, int32_t z)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(z);
+	}
+
+	float row_length(const Matrix4& world, int row)
+	{
+		const float (&m)[4][4] = world.m;
+		return std::sqrt(m[row][0] * m[row][0] + m[row][1] * m[row][1] + m[row][2] * m[row][2]);
+	}
+
+	// Longest row of the world transform, the most it stretches any direction for a scale then rotation.
+	float stretch(const Matrix4& world)
+	{
+		return std::max(row_length(world, 0), std::max(row_length(world, 1), row_length(world, 2)));
+	}
+
+	// Furthest any corner of the clip's bounds gets from the model origin, at any time in the clip.
+	float clip_reach(const SkinnedClip& clip)
+	{
+		if (clip.keyBounds.empty() || clip.keyBounds.size() != clip.keytimes.size())
+		{
+			return Unbounded;
+		}
+
+		// clip_bounds() at each key covers that key and the next, which between them is every pair it can use.
+		float reach = 0.0f;
+		for (double keytime : clip.keytimes)
+		{
+			Aabb box;
+			clip_bounds(clip, keytime, box);
+			float corner = 0.0f;
+			for (int j = 0; j < 3; j++)
+			{
+				const float extent = std::max(std::fabs(box.min[j]), std::fabs(box.max[j]));
+				corner += extent * extent;
+			}
+			reach = std::max(reach, std::sqrt(corner));
+		}
+		return reach;
+	}
+
+	// Nearest and furthest any point of box is from point.
+	void distance_range(const Aabb& box, const float point[3], float& outNearest, float& outFurthest)
+	{
+		float nearest = 0.0f;
+		float furthest = 0.0f;
+		for (int j = 0; j < 3; j++)
+		{
+			const float below = box.min[j] - point[j];
+			const float above = point[j] - box.max[j];
+			const float outside = std::max(0.0f, std::max(below, above));
+			const float across = std::max(std::fabs(box.min[j] - point[j]), std::fabs(box.max[j] - point[j]));
+			nearest += outside * outside;
+			furthest += across * across;
+		}
+		outNearest = std::sqrt(nearest);
+		outFurthest = std::sqrt(furthest);
+	}
+}
+
+namespace MRenderer
+{
+	CrowdGrid::CrowdGrid(float cellSize)
+		: m_cellSize(cellSize > 0.0f ? cellSize : DefaultCellSize)
+	{
+	}
+
+	void CrowdGrid::Build(const std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips)
+	{
+		PROFILE_ZONE("CrowdGrid::Build");
+
+		m_cells.clear();
+		m_cellIndex.clear();
+		m_clipReach.resize(clips.size());
+		for (size_t c = 0; c < clips.size(); c++)
+		{
+			m_clipReach[c] = clip_reach(clips[c]);
+		}
+
+		m_cellOf.resize(instances.size());
+		m_slotOf.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			const CrowdInstance& instance = instances[i];
+			m_cellOf[i] = Enter(static_cast<uint32_t>(i), instance,
+				cell_coordinate(instance.world.m[3][0], m_cellSize), cell_coordinate(instance.world.m[3][2], m_cellSize));
+		}
+	}
+
+	uint32_t CrowdGrid::Update(const std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips)
+	{
+		if (instances.size() != m_cellOf.size() || clips.size() != m_clipReach.size())
+		{
+			Build(instances, clips);
+			return static_cast<uint32_t>(instances.size());
+		}
+
+		PROFILE_ZONE("CrowdGrid::Update");
+
+		uint32_t moved = 0;
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			const CrowdInstance& instance = instances[i];
+			const int32_t x = cell_coordinate(instance.world.m[3][0], m_cellSize);
+			const int32_t z = cell_coordinate(instance.world.m[3][2], m_cellSize);
+			Cell& cell = m_cells[m_cellOf[i]];
+			if (cell.x == x && cell.z == z)
+			{
+				Grow(cell, instance);
+				continue;
+			}
+
+			Leave(static_cast<uint32_t>(i));
+			m_cellOf[i] = Enter(static_cast<uint32_t>(i), instance, x, z);
+			moved++;
+		}
+		return moved;
+	}
+
+	Aabb CrowdGrid::CellBounds(const Cell& cell) const
+	{
+		Aabb box = CellOrigins(cell);
+		for (int j = 0; j < 3; j++)
+		{
+			box.min[j] -= cell.reach;
+			box.max[j] += cell.reach;
+		}
+		return box;
+	}
+
+	Aabb CrowdGrid::CellOrigins(const Cell& cell) const
+	{
+		Aabb box;
+		box.min[0] = cell.x * m_cellSize;
+		box.max[0] = (cell.x + 1) * m_cellSize;
+		box.min[1] = cell.minY;
+		box.max[1] = cell.maxY;
+		box.min[2] = cell.z * m_cellSize;
+		box.max[2] = (cell.z + 1) * m_cellSize;
+		return box;
+	}
+
+	uint32_t CrowdGrid::Enter(uint32_t index, const CrowdInstance& instance, int32_t x, int32_t z)
+	{
+		auto found = m_cellIndex.find(cell_key(x, z));
+		uint32_t cellIndex;
+		if (found != m_cellIndex.end())
+		{
+			cellIndex = found->second;
+		}
+		else
+		{
+			cellIndex = static_cast<uint32_t>(m_cells.size());
+			m_cellIndex.emplace(cell_key(x, z), cellIndex);
+			Cell cell;
+			cell.x = x;
+			cell.z = z;
+			cell.minY = FLT_MAX;
+			cell.maxY = -FLT_MAX;
+			cell.reach = 0.0f;
+			cell.minScale = FLT_MAX;
+			cell.maxScale = 0.0f;
+			cell.maxStretch = 0.0f;
+			m_cells.push_back(cell);
+		}
+
+		Cell& cell = m_cells[cellIndex];
+		m_slotOf[index] = static_cast<uint32_t>(cell.members.size());
+		cell.members.push_back(index);
+		Grow(cell, instance);
+		return cellIndex;
+	}
+
+	void CrowdGrid::Leave(uint32_t index)
+	{
+		std::vector<uint32_t>& members = m_cells[m_cellOf[index]].members;
+		const uint32_t slot = m_slotOf[index];
+		members[slot] = members.back();
+		m_slotOf[members[slot]] = slot;
+		members.pop_back();
+	}
+
+	void CrowdGrid::Grow(Cell& cell, const CrowdInstance& instance) const
+	{
+		const float y = instance.world.m[3][1];
+		const float scale = row_length(instance.world, 0);
+		const float stretched = stretch(instance.world);
+		cell.minY = std::min(cell.minY, y);
+		cell.maxY = std::max(cell.maxY, y);
+		cell.reach = std::max(cell.reach, m_clipReach[instance.clip] * stretched);
+		cell.minScale = std::min(cell.minScale, scale);
+		cell.maxScale = std::max(cell.maxScale, scale);
+		cell.maxStretch = std::max(cell.maxStretch, stretched);
+	}
+
+	void select_lods(std::vector<CrowdInstance>& instances, const CrowdGrid& grid, const LodSelection& selection)
+	{
+		PROFILE_ZONE("Crowd::SelectLods");
+
+		const float centerOffset = std::sqrt(selection.center[0] * selection.center[0] + selection.center[1] * selection.center[1] +
+			selection.center[2] * selection.center[2]);
+		for (const CrowdGrid::Cell& cell : grid.Cells())
+		{
+			if (cell.members.empty())
+			{
+				continue;
+			}
+
+			// The members' sphere centres lie within the mesh's centre offset, stretched, of the origins' box. The
+			// nearest, largest member covers the most screen and the furthest, smallest the least.
+			float nearest;
+			float furthest;
+			distance_range(grid.CellOrigins(cell), selection.eye, nearest, furthest);
+			const float offset = centerOffset * cell.maxStretch;
+			const float largest = projected_screen_size(selection.radius * cell.maxScale, std::max(0.0f, nearest - offset), selection.projectionScale) * selection.bias;
+			const float smallest = projected_screen_size(selection.radius * cell.minScale, furthest + offset, selection.projectionScale) * selection.bias;
+
+			const uint32_t lod = lod_for_screen_size(selection, largest);
+			const bool stepped = stepped_for_screen_size(selection, largest);
+			const bool uniform = lod == lod_for_screen_size(selection, smallest) && stepped == stepped_for_screen_size(selection, smallest);
+			for (uint32_t member : cell.members)
+			{
+				CrowdInstance& instance = instances[member];
+				if (!instance.visible)
+				{
+					continue;
+				}
+				if (uniform)
+				{
+					instance.lod = lod;
+					instance.stepped = stepped;
+				}
+				else
+				{
+					select_instance_lod(instance, selection);
+				}
+			}
+		}
+	}
+}
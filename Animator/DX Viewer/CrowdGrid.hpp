@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "InstanceBuilder.hpp"
+
+// A uniform grid over the ground plane (x, z) that the crowd is sorted into, so culling and level of detail
+// selection can settle a whole cell of characters with one test. Cells are hashed by their coordinates, so the
+// crowd can spread anywhere, and made as they're first entered. Update() moves only the instances that crossed
+// into another cell, each move a swap with the last member of the cell it left.
+//
+// Cells are loose: each one's bounds cover how far its members' clips reach past the cell and how high they
+// stand, growing as instances move in but never shrinking until the next Build(). No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	class CrowdGrid
+	{
+	public:
+		// Edge length of a cell in world units.
+		static constexpr float DefaultCellSize = 10.0f;
+
+		struct Cell
+		{
+			int32_t x;
+			int32_t z;
+			std::vector<uint32_t> members; // instance indices, in no particular order
+			float minY;                    // of the members' origins
+			float maxY;
+			float reach;                   // furthest any member's clip reaches from its origin, in world units
+			float minScale;                // of the members' world transforms, measured as select_lods() does
+			float maxScale;
+			float maxStretch;              // longest row of any member's world transform
+		};
+
+		explicit CrowdGrid(float cellSize = DefaultCellSize);
+
+		// Sorts every instance into its cell from scratch. Clip bounds come from clip_bounds(), an instance whose
+		// clip has none reaches without limit.
+		void Build(const std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips);
+
+		// Moves the instances whose origin crossed into another cell since the last call and grows the cells for
+		// the rest. Builds from scratch if the number of instances changed. Returns how many moved.
+		uint32_t Update(const std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips);
+
+		// Every cell ever entered, some may be empty.
+		const std::vector<Cell>& Cells() const { return m_cells; }
+
+		// World space box around everything the cell's members draw, at any time in their clips.
+		Aabb CellBounds(const Cell& cell) const;
+
+		// World space box around the cell's members' origins.
+		Aabb CellOrigins(const Cell& cell) const;
+
+		float CellSize() const { return m_cellSize; }
+		size_t InstanceCount() const { return m_cellOf.size(); }
+
+	private:
+		// Adds instance index to cell (x, z), made if it's new, and takes in its bounds. Returns the cell's index.
+		uint32_t Enter(uint32_t index, const CrowdInstance& instance, int32_t x, int32_t z);
+		void Leave(uint32_t index);
+		void Grow(Cell& cell, const CrowdInstance& instance) const;
+
+		float m_cellSize;
+		std::vector<Cell> m_cells;
+		std::unordered_map<uint64_t, uint32_t> m_cellIndex; // packed cell coordinates to m_cells index
+		std::vector<uint32_t> m_cellOf;                     // per instance, its m_cells index
+		std::vector<uint32_t> m_slotOf;                     // per instance, where it is in its cell's members
+		std::vector<float> m_clipReach;                     // per clip, furthest its bounds reach from the origin
+	};
+
+	// select_lods() for the visible instances, a cell at a time. A cell whose nearest and furthest member would
+	// both get the same level and animation rate settles all of them at once; the rest are picked one by one,
+	// exactly as select_lods() would.
+	void select_lods(std::vector<CrowdInstance>& instances, const CrowdGrid& grid, const LodSelection& selection);
+}
@@ -0,0 +1,86 @@
+#include "D3D12FrameQueue.hpp"
+
+#include <iostream>
+
+namespace MRenderer
+{
+	D3D12FrameQueue::~D3D12FrameQueue()
+	{
+		Shutdown();
+	}
+
+	bool D3D12FrameQueue::Initialize(ID3D12Device* device, ID3D12CommandQueue* queue)
+	{
+		m_queue = queue;
+
+		HRESULT hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the fence \n";
+			m_status = hr;
+			Shutdown();
+			return false;
+		}
+		m_nextValue = 1;
+
+		// Create an event handle to use for frame synchronization.
+		m_fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+		if (m_fenceEvent == nullptr)
+		{
+			std::cout << "Failed to create the event handle \n";
+			m_status = HRESULT_FROM_WIN32(GetLastError());
+			Shutdown();
+			return false;
+		}
+
+		m_status = S_OK;
+		return true;
+	}
+
+	void D3D12FrameQueue::Shutdown()
+	{
+		if (m_fenceEvent != nullptr)
+		{
+			CloseHandle(m_fenceEvent);
+			m_fenceEvent = nullptr;
+		}
+		m_fence.Reset();
+		m_queue.Reset();
+	}
+
+	uint64_t D3D12FrameQueue::Signal()
+	{
+		const uint64_t value = m_nextValue++;
+		HRESULT hr = m_queue->Signal(m_fence.Get(), value);
+		if (FAILED(hr))
+		{
+			// Nothing may wait on a value the fence will never reach.
+			std::cout << "Failed to signal the fence \n";
+			m_status = hr;
+			return 0;
+		}
+		return value;
+	}
+
+	uint64_t D3D12FrameQueue::CompletedValue()
+	{
+		return m_fence->GetCompletedValue();
+	}
+
+	void D3D12FrameQueue::WaitForValue(uint64_t value)
+	{
+		if (m_fence->GetCompletedValue() >= value)
+		{
+			return;
+		}
+
+		HRESULT hr = m_fence->SetEventOnCompletion(value, m_fenceEvent);
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to wait on the fence \n";
+			m_status = hr;
+			return;
+		}
+		WaitForSingleObject(m_fenceEvent, INFINITE);
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Windows.h>
+#include <wrl/client.h>
+#include <d3d12.h>
+
+#include "FrameRing.hpp"
+
+namespace MRenderer
+{
+	// IFrameQueue over a D3D12 command queue and a fence it owns. A call that fails logs it, keeps the HRESULT
+	// in Status() and returns without blocking, so the owner decides what to do about it.
+	class D3D12FrameQueue : public IFrameQueue
+	{
+	public:
+		~D3D12FrameQueue();
+
+		// False if the fence or its event couldn't be created, see Status().
+		bool Initialize(ID3D12Device* device, ID3D12CommandQueue* queue);
+		void Shutdown();
+
+		// S_OK, or the HRESULT of the last call that failed.
+		HRESULT Status() const { return m_status; }
+
+		uint64_t Signal() override;
+		uint64_t CompletedValue() override;
+		void WaitForValue(uint64_t value) override;
+
+		ID3D12Fence* GetFence() const { return m_fence.Get(); }
+
+	private:
+		Microsoft::WRL::ComPtr<ID3D12CommandQueue> m_queue;
+		Microsoft::WRL::ComPtr<ID3D12Fence> m_fence;
+		HANDLE m_fenceEvent = nullptr;
+		uint64_t m_nextValue = 1;
+		HRESULT m_status = S_OK;
+	};
+}
@@ -0,0 +1,528 @@
+#include "D3D12ResourceManager.hpp"
+#include "d3dx12.h"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+
+namespace MRenderer
+{
+	using Microsoft::WRL::ComPtr;
+
+	D3D12ResourceManager::~D3D12ResourceManager()
+	{
+		Shutdown();
+	}
+
+	bool D3D12ResourceManager::Initialize(ID3D12Device* device, uint32_t descriptorCapacity, uint64_t uploadBudget, uint64_t heapSize)
+	{
+		m_device = device;
+		m_uploadBudget = uploadBudget;
+
+		// Placement offsets are multiples of the small resource alignment, 64KB for buffers and most textures anyway.
+		m_bufferHeaps.pool.Initialize(heapSize, D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT);
+		m_bufferHeaps.flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+		m_textureHeaps.pool.Initialize(heapSize, D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT);
+		m_textureHeaps.flags = D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES;
+
+		D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+		heapDesc.NumDescriptors = descriptorCapacity;
+		heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+		heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		heapDesc.NodeMask = 0;
+		HRESULT hr = m_device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&m_descriptorHeap));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the resource manager's descriptor heap\n";
+			exit(hr);
+		}
+		m_descriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+		m_descriptors.Initialize(descriptorCapacity);
+
+		D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+		queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+		hr = m_device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&m_copyQueue));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the copy queue\n";
+			exit(hr);
+		}
+		m_copyFence.Initialize(m_device.Get(), m_copyQueue.Get());
+		m_uploads.SetQueue(&m_copyFence);
+
+		m_copyAllocators.resize(m_uploads.BatchesInFlight());
+		for (ComPtr<ID3D12CommandAllocator>& allocator : m_copyAllocators)
+		{
+			hr = m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&allocator));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create a copy command allocator\n";
+				exit(hr);
+			}
+		}
+
+		hr = m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, m_copyAllocators[0].Get(), nullptr, IID_PPV_ARGS(&m_copyList));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the copy command list\n";
+			exit(hr);
+		}
+		m_copyList->Close();
+
+		return true;
+	}
+
+	void D3D12ResourceManager::Shutdown()
+	{
+		WaitForUploads();
+
+		m_pending.clear();
+		m_released.Flush([this](ReleasedResource& released) { FreeReleased(released); });
+		m_textures.Clear();
+		m_buffers.Clear();
+
+		// Every resource placed in them is gone by now.
+		for (PlacedHeaps* heaps : { &m_bufferHeaps, &m_textureHeaps })
+		{
+			heaps->heaps.clear();
+			heaps->pool.Initialize(heaps->pool.HeapSize(), D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT);
+			heaps->committed = 0;
+		}
+		m_stagingBuffers.clear();
+		m_stagingData.clear();
+		m_stagingPool = StagingPool();
+		m_descriptors.Initialize(0);
+		m_descriptorHeap.Reset();
+		m_copyList.Reset();
+		m_copyAllocators.clear();
+		m_copyFence.Shutdown();
+		m_copyQueue.Reset();
+		m_device.Reset();
+	}
+
+	TextureHandle D3D12ResourceManager::CreateTexture(std::shared_ptr<const DirectX::ScratchImage> image)
+	{
+		const DirectX::TexMetadata& metadata = image->GetMetadata();
+
+		D3D12_RESOURCE_DESC textureDesc = {};
+		textureDesc.MipLevels = static_cast<UINT16>(metadata.mipLevels);
+		textureDesc.Format = metadata.format;
+		textureDesc.Width = metadata.width;
+		textureDesc.Height = static_cast<UINT>(metadata.height);
+		textureDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+		textureDesc.DepthOrArraySize = static_cast<UINT16>(metadata.arraySize);
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.SampleDesc.Quality = 0;
+		textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+
+		TextureRecord record;
+		record.resource = CreatePlaced(m_textureHeaps, textureDesc, record.memory);
+		record.uploadFence = NotSubmitted;
+
+		record.descriptor = m_descriptors.Allocate();
+		if (record.descriptor == DescriptorAllocator::InvalidIndex)
+		{
+			std::cout << "Out of texture descriptors\n";
+			exit(E_OUTOFMEMORY);
+		}
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = textureDesc.Format;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = textureDesc.MipLevels;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		m_device->CreateShaderResourceView(record.resource.Get(), &srvDesc, CD3DX12_CPU_DESCRIPTOR_HANDLE(m_descriptorHeap->GetCPUDescriptorHandleForHeapStart(), record.descriptor, m_descriptorSize));
+
+		PendingUpload upload;
+		upload.destination = record.resource;
+		upload.image = std::move(image);
+		upload.request.size = GetRequiredIntermediateSize(record.resource.Get(), 0, static_cast<UINT>(upload.image->GetImageCount()));
+		upload.request.alignment = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+
+		upload.texture = m_textures.Add(std::move(record));
+		const TextureHandle texture = upload.texture;
+		m_pending.push_back(std::move(upload));
+		return texture;
+	}
+
+	BufferHandle D3D12ResourceManager::CreateBuffer(const void* data, uint64_t size)
+	{
+		// D3D12 rejects empty buffers, an empty mesh still gets something to point a view at.
+		const uint64_t bufferSize = size > 0 ? size : 4;
+
+		BufferRecord record;
+		record.resource = CreatePlaced(m_bufferHeaps, CD3DX12_RESOURCE_DESC::Buffer(bufferSize), record.memory);
+		if (size == 0)
+		{
+			return m_buffers.Add(std::move(record));
+		}
+
+		record.uploadFence = NotSubmitted;
+
+		PendingUpload upload;
+		upload.destination = record.resource;
+		upload.bytes.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+		upload.request.size = size;
+		upload.request.alignment = 16;
+
+		upload.buffer = m_buffers.Add(std::move(record));
+		const BufferHandle buffer = upload.buffer;
+		m_pending.push_front(std::move(upload));
+		return buffer;
+	}
+
+	void D3D12ResourceManager::Release(TextureHandle texture)
+	{
+		TextureRecord record;
+		if (m_textures.Remove(texture, &record))
+		{
+			// Nothing will copy into it if the upload hasn't been submitted yet.
+			if (record.uploadFence == NotSubmitted)
+			{
+				m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(), [texture](const PendingUpload& upload) { return upload.texture == texture; }), m_pending.end());
+				record.uploadFence = 0;
+			}
+
+			m_descriptors.Free(record.descriptor);
+			m_released.Push({ std::move(record.resource), &m_textureHeaps, record.memory, record.uploadFence });
+		}
+	}
+
+	void D3D12ResourceManager::Release(BufferHandle buffer)
+	{
+		BufferRecord record;
+		if (m_buffers.Remove(buffer, &record))
+		{
+			if (record.uploadFence == NotSubmitted)
+			{
+				m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(), [buffer](const PendingUpload& upload) { return upload.buffer == buffer; }), m_pending.end());
+				record.uploadFence = 0;
+			}
+
+			m_released.Push({ std::move(record.resource), &m_bufferHeaps, record.memory, record.uploadFence });
+		}
+	}
+
+	ID3D12Resource* D3D12ResourceManager::Resource(TextureHandle texture) const
+	{
+		const TextureRecord* record = m_textures.Get(texture);
+		return record ? record->resource.Get() : nullptr;
+	}
+
+	ID3D12Resource* D3D12ResourceManager::Resource(BufferHandle buffer) const
+	{
+		const BufferRecord* record = m_buffers.Get(buffer);
+		return record ? record->resource.Get() : nullptr;
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE D3D12ResourceManager::Srv(TextureHandle texture) const
+	{
+		const TextureRecord* record = m_textures.Get(texture);
+		assert(record);
+		return CD3DX12_CPU_DESCRIPTOR_HANDLE(m_descriptorHeap->GetCPUDescriptorHandleForHeapStart(), record->descriptor, m_descriptorSize);
+	}
+
+	bool D3D12ResourceManager::Ready(TextureHandle texture)
+	{
+		const TextureRecord* record = m_textures.Get(texture);
+		return record && record->uploadFence != NotSubmitted && m_uploads.Complete(record->uploadFence);
+	}
+
+	bool D3D12ResourceManager::Ready(BufferHandle buffer)
+	{
+		const BufferRecord* record = m_buffers.Get(buffer);
+		return record && record->uploadFence != NotSubmitted && m_uploads.Complete(record->uploadFence);
+	}
+
+	void D3D12ResourceManager::Require(BufferHandle buffer, ID3D12CommandQueue* queue)
+	{
+		const BufferRecord* record = m_buffers.Get(buffer);
+		if (!record || Ready(buffer))
+		{
+			return;
+		}
+
+		// Everything queued ahead of it goes first; buffers jump the textures, so that's rarely more than one batch.
+		while (record->uploadFence == NotSubmitted)
+		{
+			SubmitBatch(true);
+		}
+
+		HRESULT hr = queue->Wait(m_copyFence.GetFence(), record->uploadFence);
+		if (FAILED(hr))
+		{
+			exit(hr);
+		}
+	}
+
+	size_t D3D12ResourceManager::FlushUploads()
+	{
+		return SubmitBatch(false);
+	}
+
+	void D3D12ResourceManager::WaitForUploads()
+	{
+		m_uploads.WaitForIdle();
+	}
+
+	size_t D3D12ResourceManager::SubmitBatch(bool wait)
+	{
+		if (m_pending.empty())
+		{
+			return 0;
+		}
+
+		PROFILE_ZONE("ResourceManager::SubmitBatch");
+
+		// With every batch still copying, the uploads wait for a later frame rather than the frame for them.
+		const uint32_t slot = m_uploads.BeginBatch(wait);
+		if (slot == UploadScheduler::InvalidSlot)
+		{
+			return 0;
+		}
+
+		std::vector<UploadRequest> requests;
+		requests.reserve(m_pending.size());
+		for (const PendingUpload& upload : m_pending)
+		{
+			requests.push_back(upload.request);
+		}
+
+		std::vector<uint64_t> offsets;
+		const uint64_t batchSize = plan_upload_batch(requests, m_uploadBudget, offsets);
+
+		const StagingPool::Block block = m_stagingPool.Acquire(batchSize);
+		if (block.created)
+		{
+			if (m_stagingBuffers.size() <= block.id)
+			{
+				m_stagingBuffers.resize(block.id + 1);
+				m_stagingData.resize(block.id + 1, nullptr);
+			}
+
+			HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE, &CD3DX12_RESOURCE_DESC::Buffer(block.size),
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&m_stagingBuffers[block.id]));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create a staging buffer\n";
+				exit(hr);
+			}
+
+			D3D12_RANGE readRange = { 0, 0 }; // We do not intend to read from this resource on the CPU.
+			hr = m_stagingBuffers[block.id]->Map(0, &readRange, reinterpret_cast<void**>(&m_stagingData[block.id]));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to map a staging buffer\n";
+				exit(hr);
+			}
+		}
+		ID3D12Resource* staging = m_stagingBuffers[block.id].Get();
+
+		// The slot's last batch has finished, so its allocator can be reused.
+		HRESULT hr = m_copyAllocators[slot]->Reset();
+		if (FAILED(hr))
+		{
+			exit(hr);
+		}
+		hr = m_copyList->Reset(m_copyAllocators[slot].Get(), nullptr);
+		if (FAILED(hr))
+		{
+			exit(hr);
+		}
+
+		// Destinations are created in COMMON and promoted to COPY_DEST by the copies themselves. The copy queue
+		// can't transition to shader read states, and doesn't need to: they decay back to COMMON when the batch
+		// finishes and the graphics queue promotes them from there.
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			const PendingUpload& upload = m_pending[i];
+			if (upload.image)
+			{
+				const DirectX::ScratchImage& image = *upload.image;
+				std::vector<D3D12_SUBRESOURCE_DATA> subresources(image.GetImageCount());
+				const DirectX::Image* images = image.GetImages();
+				for (size_t j = 0; j < image.GetImageCount(); ++j)
+				{
+					subresources[j].RowPitch = images[j].rowPitch;
+					subresources[j].SlicePitch = images[j].slicePitch;
+					subresources[j].pData = images[j].pixels;
+				}
+				UpdateSubresources(m_copyList.Get(), upload.destination.Get(), staging, offsets[i], 0, static_cast<UINT>(subresources.size()), subresources.data());
+			}
+			else
+			{
+				memcpy(m_stagingData[block.id] + offsets[i], upload.bytes.data(), upload.bytes.size());
+				m_copyList->CopyBufferRegion(upload.destination.Get(), 0, staging, offsets[i], upload.bytes.size());
+			}
+		}
+
+		hr = m_copyList->Close();
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to close the copy command list\n";
+			exit(hr);
+		}
+		ID3D12CommandList* ppCommandLists[] = { m_copyList.Get() };
+		m_copyQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+
+		const uint64_t fenceValue = m_uploads.EndBatch(slot);
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			const PendingUpload& upload = m_pending[i];
+			if (TextureRecord* record = m_textures.Get(upload.texture))
+			{
+				record->uploadFence = fenceValue;
+			}
+			if (BufferRecord* record = m_buffers.Get(upload.buffer))
+			{
+				record->uploadFence = fenceValue;
+			}
+		}
+
+		// Back in the pool once the copy queue is past this batch.
+		m_stagingPool.Release(block.id);
+		m_stagingPool.EndFrame(fenceValue);
+
+		m_pending.erase(m_pending.begin(), m_pending.begin() + offsets.size());
+		return offsets.size();
+	}
+
+	void D3D12ResourceManager::EndFrame(uint64_t fenceValue)
+	{
+		m_released.EndFrame(fenceValue);
+		m_descriptors.EndFrame(fenceValue);
+	}
+
+	void D3D12ResourceManager::Retire(uint64_t completedValue)
+	{
+		m_released.Retire(completedValue, [this](ReleasedResource& released)
+		{
+			// The graphics queue is done with it; if the copy queue isn't yet, it waits another frame.
+			if (!m_uploads.Complete(released.uploadFence))
+			{
+				m_released.Push(std::move(released));
+				return;
+			}
+			FreeReleased(released);
+		});
+		m_descriptors.Retire(completedValue);
+
+		// Staging blocks are tagged with copy queue fence values.
+		m_stagingPool.Retire(m_copyFence.CompletedValue());
+
+		// Keep enough staging around for a couple of full batches, give the rest of a loading burst back.
+		std::vector<uint32_t> destroyed;
+		m_stagingPool.Trim(2 * m_uploadBudget, destroyed);
+		for (uint32_t id : destroyed)
+		{
+			m_stagingBuffers[id].Reset();
+			m_stagingData[id] = nullptr;
+		}
+
+		// One empty heap of each kind stays for the next mesh or texture, the rest go back to the driver.
+		for (PlacedHeaps* heaps : { &m_bufferHeaps, &m_textureHeaps })
+		{
+			destroyed.clear();
+			heaps->pool.TrimEmpty(destroyed);
+			for (uint32_t id : destroyed)
+			{
+				heaps->heaps[id].Reset();
+			}
+		}
+	}
+
+	void D3D12ResourceManager::PrintMemoryStats(std::ostream& out)
+	{
+		const auto print = [&out](const char* name, const PlacedHeaps& heaps)
+		{
+			const HeapStats stats = heaps.pool.Stats();
+			out << name << ": " << heaps.pool.HeapCount() << " heaps, " << stats.allocations << " placed, " << heaps.committed << " committed, "
+				<< std::fixed << std::setprecision(1) << stats.used / 1048576.0 << "/" << stats.capacity / 1048576.0 << " MB used, "
+				<< stats.freeBlocks << " free blocks, largest " << stats.largestFree / 1048576.0 << " MB, fragmentation "
+				<< std::setprecision(2) << stats.Fragmentation() << "\n";
+		};
+		print("Buffer memory", m_bufferHeaps);
+		print("Texture memory", m_textureHeaps);
+		out << "Staging memory: " << std::fixed << std::setprecision(1) << m_stagingPool.TotalSize() / 1048576.0 << " MB\n";
+		out << "Uploads: " << m_pending.size() << " queued, " << m_uploads.Busy() << "/" << m_uploads.BatchesInFlight() << " batches copying, "
+			<< m_uploads.DeferredCount() << " deferred, " << m_uploads.StallCount() << " stalls\n";
+	}
+
+	ComPtr<ID3D12Resource> D3D12ResourceManager::CreatePlaced(PlacedHeaps& heaps, D3D12_RESOURCE_DESC desc, HeapPool::Allocation& memory)
+	{
+		memory = HeapPool::Allocation();
+
+		// Small textures can take 4KB alignment instead of 64KB; the device says whether this one can.
+		D3D12_RESOURCE_ALLOCATION_INFO info;
+		if (desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+		{
+			desc.Alignment = D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT;
+			info = m_device->GetResourceAllocationInfo(0, 1, &desc);
+			if (info.Alignment != D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT)
+			{
+				desc.Alignment = 0;
+				info = m_device->GetResourceAllocationInfo(0, 1, &desc);
+			}
+		}
+		else
+		{
+			info = m_device->GetResourceAllocationInfo(0, 1, &desc);
+		}
+
+		ComPtr<ID3D12Resource> resource;
+		bool createdHeap = false;
+		const bool placed = heaps.pool.Allocate(info.SizeInBytes, info.Alignment, memory, createdHeap);
+		if (createdHeap)
+		{
+			if (heaps.heaps.size() <= memory.heap)
+			{
+				heaps.heaps.resize(memory.heap + 1);
+			}
+
+			CD3DX12_HEAP_DESC heapDesc(heaps.pool.HeapSize(), D3D12_HEAP_TYPE_DEFAULT, 0, heaps.flags);
+			HRESULT hr = m_device->CreateHeap(&heapDesc, IID_PPV_ARGS(&heaps.heaps[memory.heap]));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create a resource heap\n";
+				exit(hr);
+			}
+		}
+
+		if (!placed)
+		{
+			HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&resource));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create a committed resource\n";
+				exit(hr);
+			}
+			heaps.committed++;
+			return resource;
+		}
+
+		HRESULT hr = m_device->CreatePlacedResource(heaps.heaps[memory.heap].Get(), memory.placement.offset, &desc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&resource));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create a placed resource\n";
+			exit(hr);
+		}
+		return resource;
+	}
+
+	void D3D12ResourceManager::FreeReleased(ReleasedResource& released)
+	{
+		released.resource.Reset();
+		if (released.memory.Valid())
+		{
+			released.heaps->pool.Free(released.memory);
+		}
+		else
+		{
+			released.heaps->committed--;
+		}
+	}
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <Windows.h>
+#include <wrl/client.h>
+#include <d3d12.h>
+
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+#include "D3D12FrameQueue.hpp"
+#include "DirectXTex.h"
+#include "HeapAllocator.hpp"
+#include "ResourceManager.hpp"
+#include "UploadScheduler.hpp"
+
+namespace MRenderer
+{
+	// Owns the viewer's static GPU resources behind handles. Creating one makes the default heap resource
+	// (and a texture's SRV, from a CPU only heap shared by every texture) straight away and queues its
+	// contents; FlushUploads() then copies everything queued out of one staging block on a copy queue of
+	// the manager's own, so uploads overlap with rendering instead of going ahead of it on the graphics
+	// queue. A resource is Ready() once its batch's fence has passed; resources come back from the copy
+	// queue in the common state and the graphics queue promotes them to whatever read state it uses them
+	// in, so handing over needs no barriers. Release() is deferred until the frames that could still use
+	// the resource have retired, tracked with the same EndFrame()/Retire() fence values as the upload ring,
+	// and until the copy queue is done with it.
+	// Resources are placed in a few large default heaps, buffers and textures apart so tier 1 hardware
+	// works too, rather than each getting a committed allocation of its own; anything larger than a heap
+	// still does.
+	class D3D12ResourceManager
+	{
+	public:
+		D3D12ResourceManager() = default;
+		D3D12ResourceManager(const D3D12ResourceManager&) = delete;
+		D3D12ResourceManager& operator=(const D3D12ResourceManager&) = delete;
+		~D3D12ResourceManager();
+
+		// uploadBudget caps the staging memory one FlushUploads() uses, anything past it waits for the next one.
+		// heapSize is the size of each default heap resources are placed in.
+		bool Initialize(ID3D12Device* device, uint32_t descriptorCapacity, uint64_t uploadBudget = 64ull << 20, uint64_t heapSize = 64ull << 20);
+
+		// Only once the GPU is idle.
+		void Shutdown();
+
+		// All of image's mips; the image is kept until the upload has been recorded.
+		TextureHandle CreateTexture(std::shared_ptr<const DirectX::ScratchImage> image);
+
+		// A copy of data is kept until the upload has been recorded. Buffers go ahead of queued textures,
+		// which have placeholders to show in the meantime.
+		BufferHandle CreateBuffer(const void* data, uint64_t size);
+
+		void Release(TextureHandle texture);
+		void Release(BufferHandle buffer);
+
+		// Null for a released or null handle.
+		ID3D12Resource* Resource(TextureHandle texture) const;
+		ID3D12Resource* Resource(BufferHandle buffer) const;
+
+		// The texture's SRV in the CPU only heap, for copying into a shader visible table.
+		D3D12_CPU_DESCRIPTOR_HANDLE Srv(TextureHandle texture) const;
+
+		// Whether the copy queue has finished filling the resource. False for a released or null handle.
+		bool Ready(TextureHandle texture);
+		bool Ready(BufferHandle buffer);
+
+		// For a buffer the next frame can't do without: makes queue wait, on the GPU, for its upload.
+		// Submits the upload first if it's still queued, which can block if every copy batch is in flight.
+		void Require(BufferHandle buffer, ID3D12CommandQueue* queue);
+
+		// Submits the queued uploads that fit the budget to the copy queue, oldest first, unless every
+		// batch is still in flight. Never waits. Returns how many went in.
+		size_t FlushUploads();
+
+		// Blocks until everything submitted to the copy queue has finished.
+		void WaitForUploads();
+
+		void EndFrame(uint64_t fenceValue);
+		void Retire(uint64_t completedValue);
+
+		size_t PendingUploads() const { return m_pending.size(); }
+		uint64_t DeferredUploadBatches() const { return m_uploads.DeferredCount(); }
+		uint64_t StagingSize() const { return m_stagingPool.TotalSize(); }
+
+		HeapStats BufferMemory() const { return m_bufferHeaps.pool.Stats(); }
+		HeapStats TextureMemory() const { return m_textureHeaps.pool.Stats(); }
+		void PrintMemoryStats(std::ostream& out);
+
+	private:
+		// Default heaps of one kind, by HeapPool id.
+		struct PlacedHeaps
+		{
+			HeapPool pool;
+			std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> heaps;
+			D3D12_HEAP_FLAGS flags = D3D12_HEAP_FLAG_NONE;
+			uint32_t committed = 0; // resources too big to place
+		};
+
+		// Copy queue fence value of the batch filling a resource, until it's been submitted.
+		static const uint64_t NotSubmitted = UINT64_MAX;
+
+		struct TextureRecord
+		{
+			Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+			HeapPool::Allocation memory;
+			uint32_t descriptor = DescriptorAllocator::InvalidIndex;
+			uint64_t uploadFence = 0;
+		};
+
+		struct BufferRecord
+		{
+			Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+			HeapPool::Allocation memory;
+			uint64_t uploadFence = 0;
+		};
+
+		// The memory goes back to its heap together with the resource, once no frame can use either.
+		struct ReleasedResource
+		{
+			Microsoft::WRL::ComPtr<ID3D12Resource> resource;
+			PlacedHeaps* heaps;
+			HeapPool::Allocation memory;
+			uint64_t uploadFence; // copy queue fence, 0 if nothing was copied
+		};
+
+		struct PendingUpload
+		{
+			Microsoft::WRL::ComPtr<ID3D12Resource> destination;
+			TextureHandle texture;                              // whichever the upload fills
+			BufferHandle buffer;
+			std::shared_ptr<const DirectX::ScratchImage> image; // for a texture
+			std::vector<uint8_t> bytes;                         // for a buffer
+			UploadRequest request;
+		};
+
+		Microsoft::WRL::ComPtr<ID3D12Resource> CreatePlaced(PlacedHeaps& heaps, D3D12_RESOURCE_DESC desc, HeapPool::Allocation& memory);
+		void FreeReleased(ReleasedResource& released);
+		size_t SubmitBatch(bool wait);
+
+		Microsoft::WRL::ComPtr<ID3D12Device> m_device;
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> m_descriptorHeap;
+		UINT m_descriptorSize = 0;
+		uint64_t m_uploadBudget = 0;
+
+		HandleTable<TextureRecord, TextureTag> m_textures;
+		HandleTable<BufferRecord, BufferTag> m_buffers;
+		DescriptorAllocator m_descriptors;
+
+		Microsoft::WRL::ComPtr<ID3D12CommandQueue> m_copyQueue;
+		D3D12FrameQueue m_copyFence;
+		UploadScheduler m_uploads;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> m_copyAllocators; // by UploadScheduler slot
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> m_copyList;
+		DeferredQueue<ReleasedResource> m_released;
+
+		PlacedHeaps m_bufferHeaps;
+		PlacedHeaps m_textureHeaps;
+
+		StagingPool m_stagingPool;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> m_stagingBuffers; // by StagingPool block id
+		std::vector<uint8_t*> m_stagingData;                                 // mapped for as long as the buffer lives
+
+		std::deque<PendingUpload> m_pending;
+	};
+}
@@ -0,0 +1,343 @@
+#include "FileWatcher.hpp"
+#include "Profiler.hpp"
+
+#include <chrono>
+
+#if defined _WIN32
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#if defined __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Anonymous namespace
+namespace
+{
+	using MRenderer::FileWatchBackend;
+
+	class PollingBackend : public FileWatchBackend
+	{
+	public:
+		bool Add(const std::string& path) override
+		{
+			// Remember what's there now, so only later writes count.
+			m_files[path] = stamp(path);
+			return true;
+		}
+
+		void Wait(int timeoutMs, std::vector<std::string>& changed) override
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+
+			for (auto& file : m_files)
+			{
+				Stamp current = stamp(file.first);
+				if (current.exists != file.second.exists || current.modified != file.second.modified || current.size != file.second.size)
+				{
+					file.second = current;
+					if (current.exists)
+					{
+						changed.push_back(file.first);
+					}
+				}
+			}
+		}
+
+	private:
+		struct Stamp
+		{
+			bool exists;
+			int64_t modified; // 100ns FILETIME ticks on Windows, nanoseconds elsewhere
+			int64_t size;
+		};
+
+		// Modification time to the filesystem's full resolution: whole seconds would miss a save in the same
+		// second as the last one that left the size alone.
+		static Stamp stamp(const std::string& path)
+		{
+#if defined _WIN32
+			WIN32_FILE_ATTRIBUTE_DATA info;
+			if (!GetFileAttributesExW(std::wstring(path.begin(), path.end()).c_str(), GetFileExInfoStandard, &info))
+			{
+				return { false, 0, 0 };
+			}
+			const int64_t modified = (static_cast<int64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+			const int64_t size = (static_cast<int64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+			return { true, modified, size };
+#else
+			struct stat info;
+			if (stat(path.c_str(), &info) != 0)
+			{
+				return { false, 0, 0 };
+			}
+#if defined __APPLE__
+			const timespec& time = info.st_mtimespec;
+#else
+			const timespec& time = info.st_mtim;
+#endif
+			const int64_t modified = static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+			return { true, modified, static_cast<int64_t>(info.st_size) };
+#endif
+		}
+
+		std::unordered_map<std::string, Stamp> m_files;
+	};
+
+#if defined __linux__
+	class InotifyBackend : public FileWatchBackend
+	{
+	public:
+		InotifyBackend()
+		{
+			m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		}
+
+		~InotifyBackend()
+		{
+			if (m_fd >= 0)
+			{
+				close(m_fd);
+			}
+		}
+
+		bool Valid() const { return m_fd >= 0; }
+
+		bool Add(const std::string& path) override
+		{
+			// Watch the directory rather than the file: tools that save by writing a new file and renaming it
+			// over the old one would otherwise leave the watch on a deleted inode.
+			const std::string directory = path.substr(0, path.find_last_of('/'));
+			for (const auto& watch : m_directories)
+			{
+				if (watch.second == directory)
+				{
+					return true;
+				}
+			}
+
+			int wd = inotify_add_watch(m_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+			if (wd < 0)
+			{
+				return false;
+			}
+			m_directories[wd] = directory;
+			return true;
+		}
+
+		void Wait(int timeoutMs, std::vector<std::string>& changed) override
+		{
+			pollfd descriptor = { m_fd, POLLIN, 0 };
+			if (poll(&descriptor, 1, timeoutMs) <= 0)
+			{
+				return;
+			}
+
+			alignas(inotify_event) char buffer[4096];
+			for (;;)
+			{
+				ssize_t length = read(m_fd, buffer, sizeof(buffer));
+				if (length <= 0)
+				{
+					break;
+				}
+
+				for (char* cursor = buffer; cursor < buffer + length; )
+				{
+					const inotify_event* event = reinterpret_cast<const inotify_event*>(cursor);
+					cursor += sizeof(inotify_event) + event->len;
+
+					auto directory = m_directories.find(event->wd);
+					if (directory == m_directories.end())
+					{
+						continue;
+					}
+					if (event->mask & IN_IGNORED)
+					{
+						m_directories.erase(directory); // the directory itself went away
+						continue;
+					}
+					if (event->len > 0)
+					{
+						changed.push_back(directory->second + "/" + event->name);
+					}
+				}
+			}
+		}
+
+	private:
+		int m_fd = -1;
+		std::unordered_map<int, std::string> m_directories;
+	};
+#endif
+}
+
+namespace MRenderer
+{
+	std::unique_ptr<FileWatchBackend> create_polling_backend()
+	{
+		return std::unique_ptr<FileWatchBackend>(new PollingBackend());
+	}
+
+	std::unique_ptr<FileWatchBackend> create_inotify_backend()
+	{
+#if defined __linux__
+		std::unique_ptr<InotifyBackend> backend(new InotifyBackend());
+		if (backend->Valid())
+		{
+			return std::unique_ptr<FileWatchBackend>(backend.release());
+		}
+#endif
+		return nullptr;
+	}
+
+	std::string file_watch_key(const std::string& path)
+	{
+		std::string key = path;
+		for (char& c : key)
+		{
+			if (c == '\\')
+			{
+				c = '/';
+			}
+		}
+
+		if (key.find('/') == std::string::npos)
+		{
+			key = "./" + key;
+		}
+		return key;
+	}
+
+	FileWatcher::~FileWatcher()
+	{
+		Stop();
+	}
+
+	bool FileWatcher::Start(std::unique_ptr<FileWatchBackend> backend, int settleMs)
+	{
+		if (m_thread.joinable())
+		{
+			return true;
+		}
+
+		if (!backend)
+		{
+			backend = create_inotify_backend();
+		}
+		if (!backend)
+		{
+			backend = create_polling_backend();
+		}
+
+		m_backend = std::move(backend);
+		m_settleMs = settleMs > 0 ? settleMs : 1;
+		m_stopping = false;
+		m_thread = std::thread(&FileWatcher::WatcherMain, this);
+		return true;
+	}
+
+	void FileWatcher::Stop()
+	{
+		if (!m_thread.joinable())
+		{
+			return;
+		}
+
+		m_stopping = true;
+		m_thread.join();
+		m_backend.reset();
+
+		// Watch() may be called again before a restart, which adds everything back.
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (const auto& watched : m_watched)
+		{
+			m_added.push_back(watched.second);
+		}
+		m_watched.clear();
+		m_bursts.clear();
+	}
+
+	void FileWatcher::Watch(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_added.push_back(path);
+	}
+
+	size_t FileWatcher::Drain(std::vector<FileChange>& changes)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const size_t count = m_settled.size();
+		changes.insert(changes.end(), m_settled.begin(), m_settled.end());
+		m_settled.clear();
+		return count;
+	}
+
+	void FileWatcher::WatcherMain()
+	{
+		// Wake often enough to notice a burst settling, and to see Stop() promptly.
+		const int pollMs = m_settleMs < 50 ? m_settleMs : 50;
+		const int64_t settleTicks = Profiler::frequency() * m_settleMs / 1000;
+
+		std::vector<std::string> added;
+		std::vector<std::string> changed;
+		while (!m_stopping)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				added.swap(m_added);
+			}
+			for (const std::string& path : added)
+			{
+				const std::string key = file_watch_key(path);
+				if (m_watched.emplace(key, path).second)
+				{
+					m_backend->Add(key);
+				}
+			}
+			added.clear();
+
+			changed.clear();
+			m_backend->Wait(pollMs, changed);
+
+			const int64_t now = Profiler::now();
+			for (const std::string& key : changed)
+			{
+				if (m_watched.find(key) == m_watched.end())
+				{
+					continue;
+				}
+
+				auto burst = m_bursts.find(key);
+				if (burst == m_bursts.end())
+				{
+					m_bursts[key] = { now, now };
+				}
+				else
+				{
+					burst->second.last = now;
+				}
+			}
+
+			for (auto burst = m_bursts.begin(); burst != m_bursts.end(); )
+			{
+				if (now - burst->second.last < settleTicks)
+				{
+					++burst;
+					continue;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_settled.push_back({ m_watched[burst->first], burst->second.first });
+				}
+				burst = m_bursts.erase(burst);
+			}
+		}
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Watches individual files for changes on a background thread. How changes are noticed is up to a
+// FileWatchBackend: inotify on Linux, or polling modification times, which works anywhere. Editors and
+// compilers tend to write a file in several steps, so a change is only reported once the file has been
+// quiet for a while. The owner collects settled changes with Drain(). No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	struct FileChange
+	{
+		std::string path; // as it was passed to FileWatcher::Watch()
+		int64_t detected; // Profiler::now() when the first write of the burst was seen
+	};
+
+	// Only ever used from the watcher thread.
+	class FileWatchBackend
+	{
+	public:
+		virtual ~FileWatchBackend() = default;
+
+		// Starts watching a file. The backend may watch more than that (e.g. its whole directory), the
+		// watcher ignores anything it wasn't asked for. path is in the form file_watch_key() returns.
+		virtual bool Add(const std::string& path) = 0;
+
+		// Waits at most timeoutMs, then appends every path written since the last call, in file_watch_key() form.
+		virtual void Wait(int timeoutMs, std::vector<std::string>& changed) = 0;
+	};
+
+	// Compares modification times and sizes every time Wait() is called.
+	std::unique_ptr<FileWatchBackend> create_polling_backend();
+
+	// Kernel change notification. Returns nullptr where it isn't available.
+	std::unique_ptr<FileWatchBackend> create_inotify_backend();
+
+	// "dir/name" with either separator turned into '/', and "./" for a bare file name, so a path and what
+	// a backend reports for it compare equal.
+	std::string file_watch_key(const std::string& path);
+
+	class FileWatcher
+	{
+	public:
+		FileWatcher() = default;
+		FileWatcher(const FileWatcher&) = delete;
+		FileWatcher& operator=(const FileWatcher&) = delete;
+		~FileWatcher();
+
+		// A null backend uses inotify where there is one and polling otherwise.
+		// A change is reported once nothing has been written to the file for settleMs.
+		bool Start(std::unique_ptr<FileWatchBackend> backend = nullptr, int settleMs = 100);
+
+		void Stop();
+
+		// Safe to call at any time, before or after Start().
+		void Watch(const std::string& path);
+
+		// Appends every change that has settled since the last call. Returns how many were added.
+		size_t Drain(std::vector<FileChange>& changes);
+
+	private:
+		struct Burst
+		{
+			int64_t first;
+			int64_t last;
+		};
+
+		void WatcherMain();
+
+		std::unique_ptr<FileWatchBackend> m_backend;
+		std::thread m_thread;
+		std::atomic<bool> m_stopping{ false };
+		int m_settleMs = 100;
+
+		std::mutex m_mutex;
+		std::vector<std::string> m_added;    // Watch() calls the watcher thread hasn't picked up yet
+		std::vector<FileChange> m_settled;
+
+		// Watcher thread only.
+		std::unordered_map<std::string, std::string> m_watched; // key -> path as given to Watch()
+		std::unordered_map<std::string, Burst> m_bursts;
+	};
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+
+namespace MRenderer
+{
+	// The parts of a GPU queue that frame pacing needs.
+	// D3D12FrameQueue implements it over an ID3D12CommandQueue and ID3D12Fence; a CPU fake can stand
+	// in for it so FrameRing can be driven without a device.
+	class IFrameQueue
+	{
+	public:
+		virtual ~IFrameQueue() = default;
+
+		// Queues a fence signal behind all work submitted so far and returns the value it will write, or 0 if
+		// it couldn't be queued; waiting for 0 never blocks.
+		virtual uint64_t Signal() = 0;
+
+		// Highest fence value the queue has reached.
+		virtual uint64_t CompletedValue() = 0;
+
+		// Blocks the calling thread until CompletedValue() >= value.
+		virtual void WaitForValue(uint64_t value) = 0;
+
+		// Blocks until everything submitted so far has finished executing.
+		void WaitForIdle() { WaitForValue(Signal()); }
+	};
+
+	// Ring of per-frame resources (allocators, upload memory, ...).
+	// The CPU may run up to Latency() frames ahead of the queue. BeginFrame() only blocks when the slot
+	// it is about to reuse still belongs to a frame the queue hasn't finished.
+	template <typename FrameResources>
+	class FrameRing
+	{
+	public:
+		static const uint32_t MaxLatency = 4;
+
+		explicit FrameRing(uint32_t latency = 2)
+		{
+			SetLatency(latency);
+		}
+
+		// Only valid while the queue is idle (at startup, or after WaitForIdle()).
+		void SetLatency(uint32_t latency)
+		{
+			latency = latency < 1 ? 1 : latency > MaxLatency ? MaxLatency : latency;
+			m_slots.clear();
+			m_slots.resize(latency);
+			m_current = 0;
+		}
+
+		void SetQueue(IFrameQueue* queue) { m_queue = queue; }
+
+		uint32_t Latency() const { return static_cast<uint32_t>(m_slots.size()); }
+
+		uint32_t CurrentIndex() const { return m_current; }
+
+		// Access to every slot, for creating and destroying the per-frame resources.
+		FrameResources& operator[](uint32_t i) { return m_slots[i].resources; }
+
+		FrameResources& Current() { return m_slots[m_current].resources; }
+
+		// Fence value the queue will reach once the frame last recorded in slot i has executed (0 if never used).
+		uint64_t FenceValue(uint32_t i) const { return m_slots[i].fenceValue; }
+
+		// How many times BeginFrame() had to wait on the queue.
+		uint64_t StallCount() const { return m_stalls; }
+
+		// Waits until the current slot is free again and hands it out for recording.
+		FrameResources& BeginFrame()
+		{
+			assert(m_queue != nullptr);
+
+			Slot& slot = m_slots[m_current];
+			if (slot.fenceValue != 0 && m_queue->CompletedValue() < slot.fenceValue)
+			{
+				m_stalls++;
+				m_queue->WaitForValue(slot.fenceValue);
+			}
+
+			return slot.resources;
+		}
+
+		// Call after the frame's work has been submitted. Tags the slot with a fence and moves to the next one.
+		// Returns the fence value, for anything else that retires per frame.
+		uint64_t EndFrame()
+		{
+			assert(m_queue != nullptr);
+
+			uint64_t fenceValue = m_queue->Signal();
+			m_slots[m_current].fenceValue = fenceValue;
+			m_current = (m_current + 1) % Latency();
+			return fenceValue;
+		}
+
+		void WaitForIdle()
+		{
+			assert(m_queue != nullptr);
+
+			m_queue->WaitForIdle();
+		}
+
+	private:
+		struct Slot
+		{
+			FrameResources resources = {};
+			uint64_t fenceValue = 0;
+		};
+
+		IFrameQueue* m_queue = nullptr;
+		std::vector<Slot> m_slots;
+		uint32_t m_current = 0;
+		uint64_t m_stalls = 0;
+	};
+}
@@ -5,13 +5,12 @@ namespace MRenderer
 
 #pragma warning(disable: 26812) // Disable prefer enum class over enum/\.
 
-	GraphicsApplication::GraphicsApplication(int width, int height)
+	GraphicsApplication::GraphicsApplication(int width, int height, UINT frameLatency)
 	{
 		m_windowWidth = width;
 		m_windowHeight = height;
 
-		m_fenceEvent = nullptr;
-		m_fenceValue = 0;
+		m_frames.SetLatency(frameLatency);
 		m_frameIndex = 0;
 		m_rtvDescriptorSize = 0;
 
@@ -27,8 +26,16 @@ namespace MRenderer
 		m_scissorRect.right = static_cast<LONG>(width);
 		m_scissorRect.bottom = static_cast<LONG>(height);
 
-		m_pCbvDataBegin = nullptr;
-		m_constantBufferData = {};
+		m_perFrameData = {};
+		m_lastPerFrameData = {};
+		m_perFrameVersion = 0;
+		m_perObjectData = {};
+		m_crowdSide = 0;
+		m_preSkinning = true;
+		m_forcedLod = -1;
+		m_crowdCulling = true;
+		m_crowdGridQueries = true;
+		m_skinnedVertexCapacity = 0;
 
 		m_camera.horizontalAngle = 0.0f;
 		m_camera.verticalAngle = 0.0f;
@@ -92,7 +99,10 @@ namespace MRenderer
 
 		CreateDevice();
 		
-		CreateCommandQueue();
+		if (!CreateCommandQueue())
+		{
+			return E_FAIL;
+		}
 		
 		CreateSwapchain();
 		
@@ -109,16 +119,20 @@ namespace MRenderer
 
 	HRESULT GraphicsApplication::LoadAssets()
 	{
+		PROFILE_ZONE("LoadAssets");
+
 		// Load Assets
+
+		// Textures stream in on the loader's threads. WIC decodes through COM, so each worker joins the MTA.
+		m_assetLoader.Start(0, [] { CoInitializeEx(nullptr, COINIT_MULTITHREADED); }, [] { CoUninitialize(); });
 		
 		LoadMesh(DefaultCube.mesh, DefaultCube.animation);
 
 		DefaultLineRenderer.animation = DefaultCube.animation;
 
-		for (int i = 0; i < DefaultLineRenderer.animation.bindPose.size(); i++)
-		{
-			DefaultCube.InverseBind[i] = XMMatrixInverse(nullptr, XMLoadFloat4x4(&DefaultLineRenderer.animation.bindPose[i].transform));
-		}
+		m_clips.resize(1);
+		BakeClip(DefaultCube.mesh, DefaultCube.animation, m_clips[0]);
+		ResizeCrowd(1);
 
 		CreateRootSignature();
 
@@ -136,68 +150,74 @@ namespace MRenderer
 
 		CreateTextures();
 
+		m_resources.FlushUploads();
+
 		ExecuteCommandList();
 
 		CreateConstantBuffers();
 
-		SetupDepthStencil();
-
-		
-
-		// Create synchronization objects and wait until assets have been uploaded to the GPU.
-		{
-			HRESULT hr = m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to create the fence \n";
-				return E_FAIL;
-			}
-			m_fenceValue = 1;
+		CreateUploadRing();
 
-			// Create an event handle to use for frame synchronization.
-			m_fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-			if (m_fenceEvent == nullptr)
-			{
-				hr = HRESULT_FROM_WIN32(GetLastError());
-				if (FAILED(hr))
-				{
-					std::cout << "Failed to create the event handle \n";
-					return E_FAIL;
-				}
-			}
+		SetupDepthStencil();
 
-			// Wait for the command list to execute; we are reusing the same command 
-			// list in our main loop but for now, we just want to wait for setup to 
-			// complete before continuing.
-			WaitForPreviousFrame();
+		// Wait until assets have been uploaded to the GPU; the placeholder textures are
+		// bound from the first frame and its allocator is reused once this returns.
+		WaitForGpu();
 
-		}
+		WatchFiles();
 
 		return S_OK;
 	}
 
 	void GraphicsApplication::CleanupDevice()
 	{
+		// Nothing may complete into the textures once they're gone. Streamed clips cancel their reads as they go.
+		m_fileWatcher.Stop();
+		m_clips.clear();
+		m_assetLoader.Stop();
+		m_hotReloads.clear();
+
 		// Wait for the GPU to be done with all resources.
-		WaitForPreviousFrame();
+		WaitForGpu();
 
-		CloseHandle(m_fenceEvent);
+		m_frameQueue.Shutdown();
+		for (UINT i = 0; i < m_frames.Latency(); ++i)
+		{
+			m_frames[i].commandAllocator.Reset();
+			m_frames[i].perFrameBuffer.Reset();
+			m_frames[i].retiredResources.clear();
+		}
+		for (UINT i = 0; i < TEXTURE_SLOT_COUNT; ++i)
+		{
+			m_textures[i].shared.reset();
+			m_textures[i].bound.reset();
+		}
+		m_resources.Shutdown();
+		m_materialBuffer.Reset();
+		m_uploadRing.Reset();
+		m_uploadBuffer.Reset();
 		m_swapChain.Reset();
 		m_device.Reset();
 		for (int i = 0; i < FrameCount; ++i)
 		{
 			m_renderTargets[i].Reset();
 		}
-		m_commandAllocator.Reset();
 		m_commandQueue.Reset();
 		m_rootSignature.Reset();
+		m_computeRootSignature.Reset();
+		for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+		{
+			m_computeStates[bucket].Reset();
+			m_skinnedStates[bucket].Reset();
+		}
+		m_preSkinnedState.Reset();
+		m_skinnedVertexBuffer.Reset();
+		m_skinnedVertexCapacity = 0;
 		m_rtvHeap.Reset();
 		m_commandList.Reset();
-		m_constantBuffer.Reset();
 		m_cbvHeap.Reset();
 		m_depthStencil.Reset();
 		m_dsvHeap.Reset();
-		m_fence.Reset();
 
 #if defined _DEBUG
 		m_debugController.Reset();
@@ -206,6 +226,35 @@ namespace MRenderer
 
 	void GraphicsApplication::Update()
 	{
+		Profiler::begin_frame();
+		PROFILE_ZONE("Update");
+
+		FrameResources* frameResources;
+		{
+			PROFILE_ZONE("Update::WaitForFrame");
+
+			// Blocks only if the GPU is still using this slot from Latency() frames ago.
+			frameResources = &m_frames.BeginFrame();
+			m_uploadRing.Retire(m_frameQueue.CompletedValue());
+			m_resources.Retire(m_frameQueue.CompletedValue());
+			frameResources->retiredResources.clear();
+		}
+
+		{
+			PROFILE_ZONE("Update::Assets");
+
+			// Completion callbacks only stage decoded images; they're uploaded when the command list is recorded.
+			m_assetLoader.Pump();
+		}
+
+		{
+			PROFILE_ZONE("Update::HotReload");
+
+			// Changed files are read on the loader threads and swapped in here, before this frame records anything.
+			RequestHotReloads();
+			ApplyHotReloads(*frameResources);
+		}
+
 		timer.Signal();
 		static float speed = 1.5f;
 
@@ -225,7 +274,7 @@ namespace MRenderer
 
 
 
-		XMFLOAT4 lightPos = m_constantBufferData.Lights[0].Position;
+		XMFLOAT4 lightPos = m_perFrameData.Lights[0].Position;
 
 		// Check for input
 		if ((GetAsyncKeyState((SHORT)'W') & 0xF000))
@@ -277,19 +326,19 @@ namespace MRenderer
 		if ((GetAsyncKeyState(SHORT('O')) & 0xF000))
 		{
 			// Move up
-			m_constantBufferData.Lights[0].LightPower += -timer.Delta() * speed;
+			m_perFrameData.Lights[0].LightPower += -timer.Delta() * speed;
 		}
 		if ((GetAsyncKeyState(SHORT('P')) & 0xF000))
 		{
 			// Move down
-			m_constantBufferData.Lights[0].LightPower += timer.Delta() * speed;
+			m_perFrameData.Lights[0].LightPower += timer.Delta() * speed;
 		}
 		if (GetAsyncKeyState('Q') & 0x1)
 		{
 			// Toggle lights
-			m_constantBufferData.Lights[0].Enabled = !m_constantBufferData.Lights[0].Enabled;
-			m_constantBufferData.Lights[1].Enabled = !m_constantBufferData.Lights[1].Enabled;
-			m_constantBufferData.Lights[2].Enabled = !m_constantBufferData.Lights[2].Enabled;
+			m_perFrameData.Lights[0].Enabled = !m_perFrameData.Lights[0].Enabled;
+			m_perFrameData.Lights[1].Enabled = !m_perFrameData.Lights[1].Enabled;
+			m_perFrameData.Lights[2].Enabled = !m_perFrameData.Lights[2].Enabled;
 		}
 		static bool escDownLastFrame = false;
 		if ((GetAsyncKeyState('M') & 0xF000) && !escDownLastFrame)
@@ -325,7 +374,7 @@ namespace MRenderer
 			m_camera.verticalAngle = m_camera.verticalAngle > XM_PIDIV2 ? m_camera.verticalAngle = XM_PIDIV2 : m_camera.verticalAngle < -XM_PIDIV2 ? -XM_PIDIV2 : m_camera.verticalAngle;
 		}
 
-		m_constantBufferData.World = XMMatrixTranspose(m_world);
+		m_perObjectData.World = XMMatrixTranspose(m_world);
 		m_MVP.World = m_world;
 
 		XMFLOAT4 temp = {};
@@ -341,14 +390,16 @@ namespace MRenderer
 
 		m_MVP.Projection = m_projection;
 
-		XMStoreFloat4(&m_constantBufferData.EyePosition, XMMatrixInverse(nullptr, m_MVP.View).r[3]);
+		m_perFrameData.ViewProjectionMatrix = XMMatrixTranspose(XMMatrixMultiply(m_MVP.View, m_MVP.Projection));
+
+		XMStoreFloat4(&m_perFrameData.EyePosition, XMMatrixInverse(nullptr, m_MVP.View).r[3]);
 
 		//std::cout << "X: " << m_constantBufferData.EyePosition.x << " Y: " << m_constantBufferData.EyePosition.y << " Z: " << m_constantBufferData.EyePosition.z << '\n';
 
-		m_constantBufferData.Lights[0].Position = lightPos;
+		m_perFrameData.Lights[0].Position = lightPos;
 
-		m_constantBufferData.InverseTransposeWorldMatrix = XMMatrixTranspose(XMMatrixInverse(nullptr, m_constantBufferData.World));
-		m_constantBufferData.MVP = XMMatrixTranspose(XMMatrixMultiply(XMMatrixMultiply(m_MVP.World, m_MVP.View), m_MVP.Projection));
+		m_perObjectData.InverseTransposeWorldMatrix = XMMatrixTranspose(XMMatrixInverse(nullptr, m_perObjectData.World));
+		m_perObjectData.MVP = XMMatrixTranspose(XMMatrixMultiply(XMMatrixMultiply(m_MVP.World, m_MVP.View), m_MVP.Projection));
 		
 
 
@@ -392,8 +443,62 @@ namespace MRenderer
 		{
 			DefaultLineRenderer.animation.enabled = !DefaultLineRenderer.animation.enabled;
 		}
+		if ((GetAsyncKeyState(SHORT('T')) & 0x1))
+		{
+			// Dump the profiler: per-zone stats to the console and the timeline as a Chrome trace.
+			Profiler::print_stats(std::cout);
+			m_resources.PrintMemoryStats(std::cout);
+			PrintClusterStats(std::cout);
+			PrintClipStats(std::cout);
+			if (Profiler::write_chrome_trace("profile_trace.json"))
+				std::cout << "Profile written to profile_trace.json\n";
+		}
+		if ((GetAsyncKeyState(VK_OEM_PLUS) & 0x1) && m_crowdSide < MaxCrowdSide)
+		{
+			ResizeCrowd(m_crowdSide + 1);
+		}
+		if ((GetAsyncKeyState(VK_OEM_MINUS) & 0x1) && m_crowdSide > 1)
+		{
+			ResizeCrowd(m_crowdSide - 1);
+		}
+		if ((GetAsyncKeyState(SHORT('K')) & 0x1))
+		{
+			m_preSkinning = !m_preSkinning;
+			std::cout << (m_preSkinning ? "Skinning in a compute pass\n" : "Skinning in the vertex shader\n");
+		}
+		if ((GetAsyncKeyState(SHORT('C')) & 0x1))
+		{
+			m_crowdCulling = !m_crowdCulling;
+			std::cout << (m_crowdCulling ? "Frustum culling the crowd\n" : "Drawing the whole crowd\n");
+		}
+		if ((GetAsyncKeyState(SHORT('G')) & 0x1))
+		{
+			m_crowdGridQueries = !m_crowdGridQueries;
+			std::cout << (m_crowdGridQueries ? "Culling and picking levels by grid cell\n" : "Culling and picking levels per character\n");
+		}
+		if ((GetAsyncKeyState(SHORT('L')) & 0x1))
+		{
+			// Cycles through forcing each level of detail, then back to selecting by screen size.
+			m_forcedLod = m_forcedLod + 1 < static_cast<int>(DefaultCube.mesh.lods.size()) ? m_forcedLod + 1 : -1;
+			if (m_forcedLod < 0)
+				std::cout << "Level of detail by screen size\n";
+			else
+				std::cout << "Level of detail " << m_forcedLod << ": " << DefaultCube.mesh.lods[m_forcedLod].vertexCount << " vertices\n";
+		}
+		if (m_preSkinning)
+		{
+			CreateSkinnedVertexBuffer(static_cast<UINT>(m_crowd.size()));
+		}
+
+		{
+			PROFILE_ZONE("Animation::Crowd");
+
+			// A paused crowd is still rebuilt every frame, it just doesn't advance.
+			BuildCrowd(*frameResources, DefaultLineRenderer.animation.enabled ? timer.Delta() : 0.0);
+		}
 
-		if (!DefaultLineRenderer.animation.enabled) // not animating
+		// Stepping through the keyframes needs them held, a streamed clip's paused skeleton is drawn like a moving one's.
+		if (!DefaultLineRenderer.animation.enabled && static_cast<size_t>(frame) < DefaultLineRenderer.animation.keyframes.size()) // not animating
 		{
 			XMVECTOR Location;
 			XMFLOAT4 position;
@@ -440,97 +545,31 @@ namespace MRenderer
 		}
 		else // animating
 		{
-			// find a key start
-			DefaultLineRenderer.animation.currentTime += timer.Delta();
-			//std::cout << "Time : " << DefaultLineRenderer.animation.currentTime << "\nOutO : " << DefaultLineRenderer.animation.duration << '\n';
-			if (DefaultLineRenderer.animation.currentTime > DefaultLineRenderer.animation.duration)
-			{
-				DefaultLineRenderer.animation.currentTime -= DefaultLineRenderer.animation.duration;
-			}
-
-			for (int i = 0; i < DefaultLineRenderer.animation.keyframes.size(); i++)
-			{
-				if (DefaultLineRenderer.animation.keyframes[i].keytime > DefaultLineRenderer.animation.currentTime)
-				{
-					frame = i;
-					break;
-				}
-			}
-
-			// get the 0 to 1 ratio for the two frames.
-			int useThisFrame = frame;
-			int previousFrame = frame - 1;
-			double delta;
-			double t = DefaultLineRenderer.animation.currentTime;
-			double t2 = DefaultLineRenderer.animation.keyframes[frame].keytime;
-			if (previousFrame < 0)
-			{
-				useThisFrame = frame + 1;
-				previousFrame += DefaultLineRenderer.animation.keyframes.size();
-				double t1 = DefaultLineRenderer.animation.keyframes[previousFrame].keytime;
-				t2 = DefaultLineRenderer.animation.duration + DefaultLineRenderer.animation.keyframes[useThisFrame].keytime;
-				delta = ((t + DefaultLineRenderer.animation.duration) - t1) / (t2 - t1);//r = (t-t1) / (t2-t1)
-			}
-			else if (previousFrame > 0)
-			{
-				double t1 = DefaultLineRenderer.animation.keyframes[previousFrame].keytime;
-				delta = (t - t1) / (t2 - t1);//r = (t-t1) / (t2-t1)
-				useThisFrame = frame;
-			}
-			else
-			{
-				previousFrame = DefaultLineRenderer.animation.keyframes.size() - 1;
-				double t1 = 0.0;
-				t2 = DefaultLineRenderer.animation.duration + DefaultLineRenderer.animation.keyframes[useThisFrame].keytime;
-				delta = (t - t1) / (t2 - t1);//r = (t-t1) / (t2-t1)
-			}
-
-			// now interpolate the frames.
-			//std::cout << delta << '\n';
+			PROFILE_ZONE("Animation::DebugLines");
 
+			// The skeleton overlay follows the first character of the crowd.
+			const CrowdInstance& overlay = m_crowd[0];
+			const SkinnedClip& clip = m_clips[overlay.clip];
+			m_overlayJoints.resize(clip.jointCount);
+			sample_clip_pose(clip, overlay.time, m_overlayJoints.data());
 
-			XMFLOAT4 positionA;
-			XMFLOAT4 positionB;
 			XMFLOAT4 position;
+			XMFLOAT4 parentPosition;
 			XMFLOAT4 xOffset;
 			XMFLOAT4 yOffset;
 			XMFLOAT4 zOffset;
 			XMFLOAT4 scaledDown;
-			XMMATRIX transformA;
-			XMMATRIX transformB;
 			XMMATRIX transform;
-			XMVECTOR quatA;
-			XMVECTOR quatB;
 			float lineLength = 0.25f;
 
-			for (int i = 0; i < DefaultLineRenderer.animation.keyframes[useThisFrame].poseData.size(); i++)
+			for (uint32_t i = 0; i < clip.jointCount; i++)
 			{
-				transformA = XMLoadFloat4x4(&DefaultLineRenderer.animation.keyframes[previousFrame].poseData[i].transform);
-				transformB = XMLoadFloat4x4(&DefaultLineRenderer.animation.keyframes[useThisFrame].poseData[i].transform);
-				//transform = XMMatrixTranspose(transform);
-
-				XMStoreFloat4(&positionA, transformA.r[3]);
-				XMStoreFloat4(&positionB, transformB.r[3]);
-
-				position = Float4Lerp(positionA, positionB, delta);
-
-				quatA = XMQuaternionRotationMatrix(transformA);
-				quatB = XMQuaternionRotationMatrix(transformB);
-
-				quatA = XMQuaternionSlerp(quatA, quatB, delta);
-
-				transform = XMMatrixRotationQuaternion(quatA);
-
-				XMMATRIX tweenJoint = XMMatrixMultiply(transform, XMMatrixTranslation(position.x, position.y, position.z));
-
-				m_constantBufferData.JointTransforms[i] = XMMatrixMultiplyTranspose(DefaultCube.InverseBind[i], tweenJoint);
+				transform = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&m_overlayJoints[i]));
 
+				XMStoreFloat4(&position, transform.r[3]);
 				XMStoreFloat4(&xOffset, transform.r[0]);
-				xOffset.w = 0.0f;
 				XMStoreFloat4(&yOffset, transform.r[1]);
-				yOffset.w = 0.0f;
 				XMStoreFloat4(&zOffset, transform.r[2]);
-				zOffset.w = 0.0f;
 
 				scaledDown = Float4Add(position, Float4MultiplyFloat(xOffset, lineLength));
 
@@ -544,54 +583,98 @@ namespace MRenderer
 
 				DebugRenderer::add_line(position, scaledDown, Color::Blue);
 
-				if (DefaultLineRenderer.animation.bindPose[i].parentIndex > -1)
+				if (clip.parents[i] > -1)
 				{
-					float p_x = DefaultLineRenderer.animation.keyframes[frame].poseData[DefaultLineRenderer.animation.keyframes[frame].poseData[i].parentIndex].transform.m[3][0];
-					float p_y = DefaultLineRenderer.animation.keyframes[frame].poseData[DefaultLineRenderer.animation.keyframes[frame].poseData[i].parentIndex].transform.m[3][1];
-					float p_z = DefaultLineRenderer.animation.keyframes[frame].poseData[DefaultLineRenderer.animation.keyframes[frame].poseData[i].parentIndex].transform.m[3][2];
-					float p_w = DefaultLineRenderer.animation.keyframes[frame].poseData[DefaultLineRenderer.animation.keyframes[frame].poseData[i].parentIndex].transform.m[3][3];
-					DebugRenderer::add_line({ position.x, position.y, position.z, position.w }, { p_x, p_y, p_z, p_w }, Color::White);
+					XMStoreFloat4(&parentPosition, XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&m_overlayJoints[clip.parents[i]])).r[3]);
+					DebugRenderer::add_line(position, parentPosition, Color::White);
 				}
 			}
 		}
 
-		D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
-		readRange.Begin = 0;
-		readRange.End = 0;
-		HRESULT hr = DefaultLineRenderer.vertexBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pDebugVertexDataBegin));
-		if (FAILED(hr))
+		PROFILE_ZONE("Update::Upload");
+
+		// Debug lines are rebuilt every frame, so they go straight into the upload ring.
+		frameResources->debugVertexCount = 0;
+		const UINT lineBytes = static_cast<UINT>(DebugRenderer::get_line_vert_count() * sizeof(Vertex));
+		if (lineBytes > 0)
 		{
-			std::cout << "Failed to map the vertex buffer. \n";
-			exit(hr);
+			UploadRing::Allocation lines = m_uploadRing.Allocate(lineBytes, sizeof(XMFLOAT4));
+			if (lines.Valid())
+			{
+				memcpy(lines.cpu, DebugRenderer::get_line_verts(), lineBytes);
+				frameResources->debugVertexBufferView.BufferLocation = lines.gpu;
+				frameResources->debugVertexBufferView.StrideInBytes = sizeof(Vertex);
+				frameResources->debugVertexBufferView.SizeInBytes = lineBytes;
+				frameResources->debugVertexCount = static_cast<UINT>(DebugRenderer::get_line_vert_count());
+			}
+		}
+
+		// Camera and lights often don't change from frame to frame. Bump the version only when they do,
+		// and only write a slot's mapped copy when it is behind.
+		if (memcmp(&m_perFrameData, &m_lastPerFrameData, sizeof(m_perFrameData)) != 0)
+		{
+			m_lastPerFrameData = m_perFrameData;
+			m_perFrameVersion++;
+		}
+		if (frameResources->perFrameVersion != m_perFrameVersion)
+		{
+			memcpy(frameResources->perFrameData, &m_perFrameData, sizeof(m_perFrameData));
+			frameResources->perFrameVersion = m_perFrameVersion;
 		}
-		memcpy(m_pDebugVertexDataBegin, DebugRenderer::get_line_verts(), DebugRenderer::get_line_vert_count() * sizeof(Vertex));
-		DefaultLineRenderer.vertexBuffer->Unmap(0, nullptr);
-		memcpy(m_pCbvDataBegin, &m_constantBufferData, sizeof(m_constantBufferData));
+
+		frameResources->perObjectAddress = ConstantPacker::push(m_uploadRing, m_perObjectData).gpu;
 	}
 
 	void GraphicsApplication::Render()
 	{
-		// Record all the commands we need to render the scene into the command list.
-		PopulateCommandList();
+		PROFILE_ZONE("Render");
 
-		// Execute the command list.
-		ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
-		m_commandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+		{
+			PROFILE_ZONE("Render::Record");
 
-		// Present the frame.
-		if (FAILED(m_swapChain->Present(1, 0)))
-			std::cout << "Presenting failed\n";
+			// Record all the commands we need to render the scene into the command list.
+			PopulateCommandList();
+		}
+
+		{
+			PROFILE_ZONE("Render::Submit");
+
+			// Execute the command list.
+			ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+			m_commandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+		}
+
+		{
+			PROFILE_ZONE("Render::Present");
+
+			// Present the frame.
+			if (FAILED(m_swapChain->Present(1, 0)))
+				std::cout << "Presenting failed\n";
+		}
+
+		// Don't wait for the GPU here; the next Update() only waits if it catches up to a frame still in flight.
+		const uint64_t fenceValue = m_frames.EndFrame();
+		m_uploadRing.EndFrame(fenceValue);
+		m_resources.EndFrame(fenceValue);
+		m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
 
-		WaitForPreviousFrame();
+		// Frames can't be paced without the fence, so a device that lost it is shut down.
+		if (FAILED(m_frameQueue.Status()))
+		{
+			std::cout << "The frame fence failed, closing\n";
+			PostQuitMessage(m_frameQueue.Status());
+		}
 	}
 
 	void GraphicsApplication::PopulateCommandList()
 	{
 		HRESULT hr;
+		FrameResources& frameResources = m_frames.Current();
+
 		// Command list allocators can only be reset when the associated 
-		// command lists have finished execution on the GPU; apps should use 
-		// fences to determine GPU execution progress.
-		hr = m_commandAllocator->Reset();
+		// command lists have finished execution on the GPU; the frame ring's
+		// fence has already guaranteed that for this frame's allocator.
+		hr = frameResources.commandAllocator->Reset();
 		if (FAILED(hr))
 		{
 			exit(hr);
@@ -600,20 +683,97 @@ namespace MRenderer
 		// However, when ExecuteCommandList() is called on a particular command 
 		// list, that command list can then be reset at any time and must be before 
 		// re-recording.
-		hr = m_commandList->Reset(m_commandAllocator.Get(), RenderObjects[0]->pipelineState.Get());
+		hr = m_commandList->Reset(frameResources.commandAllocator.Get(), RenderObjects[0]->pipelineState.Get());
 		if (FAILED(hr))
 		{
 			exit(hr);
 		}
+
+		// Everything created since the last frame (textures, a reloaded mesh's buffers) goes to the copy queue,
+		// and textures whose copies have finished replace their placeholders. A mesh swapped in this frame is
+		// drawn straight away, so the graphics queue waits on the GPU for its buffers' copy.
+		UploadPendingTextures();
+		m_resources.FlushUploads();
+		m_resources.Require(DefaultCube.vertexBuffer, m_commandQueue.Get());
+		m_resources.Require(DefaultCube.indexBuffer, m_commandQueue.Get());
+
+		// Each level of detail is skinned and drawn for the instances at that level, with constants of its own.
+		const Mesh& mesh = RenderObjects[0]->mesh;
+		auto LodConstants = [&](size_t level)
+		{
+			SkinningConstants constants = {};
+			constants.VertexCount = mesh.lods[level].vertexCount;
+			constants.InstanceCount = frameResources.lodInstances[level].count;
+			constants.FirstInstance = frameResources.lodInstances[level].first;
+			constants.FirstVertex = mesh.lods[level].vertexStart;
+			constants.VertexStride = mesh.skinnedVertexStride;
+			return constants;
+		};
+		const size_t lodCount = min(mesh.lods.size(), size_t(MaxLods));
+
+		// Skin every character once up front; everything that draws the mesh afterwards reads the result.
+		const bool preSkinned = m_preSkinning && frameResources.instanceCount > 0 && frameResources.instanceCount <= m_skinnedVertexCapacity;
+		if (preSkinned)
+		{
+			D3D12_RESOURCE_BARRIER toUnorderedAccess = CD3DX12_RESOURCE_BARRIER::Transition(m_skinnedVertexBuffer.Get(),
+				D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			m_commandList->ResourceBarrier(1, &toUnorderedAccess);
+
+			m_commandList->SetComputeRootSignature(m_computeRootSignature.Get());
+			m_commandList->SetComputeRootShaderResourceView(SKINNING_ROOT_INSTANCES, frameResources.instanceAddress);
+			m_commandList->SetComputeRootShaderResourceView(SKINNING_ROOT_PALETTES, frameResources.paletteAddress);
+			m_commandList->SetComputeRootShaderResourceView(SKINNING_ROOT_SOURCE, m_resources.Resource(RenderObjects[0]->vertexBuffer)->GetGPUVirtualAddress());
+			m_commandList->SetComputeRootUnorderedAccessView(SKINNING_ROOT_OUTPUT, m_skinnedVertexBuffer->GetGPUVirtualAddress());
+
+			// Each influence bucket of each level is skinned with the path for that many influences, a bucket at a
+			// time so the state changes once per bucket.
+			for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+			{
+				m_commandList->SetPipelineState(m_computeStates[bucket].Get());
+				for (size_t level = 0; level < lodCount; level++)
+				{
+					SkinningConstants constants = LodConstants(level);
+					constants.BucketStart = bucket_start(mesh.lodVertexBuckets[level], bucket);
+					constants.BucketVertexCount = mesh.lodVertexBuckets[level].counts[bucket];
+					if (constants.InstanceCount == 0 || constants.BucketVertexCount == 0)
+					{
+						continue;
+					}
+					m_commandList->SetComputeRoot32BitConstants(SKINNING_ROOT_CONSTANTS, sizeof(SkinningConstants) / 4, &constants, 0);
+
+					const SkinningDispatch dispatch = skinning_dispatch(constants.BucketVertexCount, constants.InstanceCount);
+					m_commandList->Dispatch(dispatch.groupsX, dispatch.groupsY, dispatch.groupsZ);
+				}
+			}
+
+			D3D12_RESOURCE_BARRIER toShaderResource = CD3DX12_RESOURCE_BARRIER::Transition(m_skinnedVertexBuffer.Get(),
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			m_commandList->ResourceBarrier(1, &toShaderResource);
+		}
+
 		// Set necessary state.
 		m_commandList->SetGraphicsRootSignature(m_rootSignature.Get());
 
 		ID3D12DescriptorHeap* ppHeaps[] = { m_cbvHeap.Get() };
 		m_commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
-		m_commandList->SetGraphicsRootDescriptorTable(0, m_cbvHeap->GetGPUDescriptorHandleForHeapStart());
-		CD3DX12_GPU_DESCRIPTOR_HANDLE cbvHandle(m_cbvHeap->GetGPUDescriptorHandleForHeapStart(), 1, m_cbvDescriptorSize);
-		m_commandList->SetGraphicsRootDescriptorTable(1, cbvHandle);
+		m_commandList->SetGraphicsRootConstantBufferView(ROOT_PER_FRAME, frameResources.perFrameBuffer->GetGPUVirtualAddress());
+		m_commandList->SetGraphicsRootConstantBufferView(ROOT_PER_MATERIAL, m_materialBuffer->GetGPUVirtualAddress());
+		m_commandList->SetGraphicsRootConstantBufferView(ROOT_PER_OBJECT, frameResources.perObjectAddress);
+		m_commandList->SetGraphicsRootShaderResourceView(ROOT_INSTANCES, frameResources.instanceAddress);
+		m_commandList->SetGraphicsRootShaderResourceView(ROOT_SKIN_PALETTES, frameResources.paletteAddress);
+		m_commandList->SetGraphicsRootShaderResourceView(ROOT_PRESKINNED_VERTICES, preSkinned ? m_skinnedVertexBuffer->GetGPUVirtualAddress() : 0);
+
+		// Refresh this frame's copy of the texture table from the resource manager's SRVs; it's a CPU side copy.
+		const UINT textureTable = m_frames.CurrentIndex() * TEXTURE_SLOT_COUNT;
+		for (UINT slot = 0; slot < TEXTURE_SLOT_COUNT; slot++)
+		{
+			const TextureHandle texture = m_textures[slot].bound ? m_textures[slot].bound->texture : m_placeholderTextures[slot];
+			m_device->CopyDescriptorsSimple(1,
+				CD3DX12_CPU_DESCRIPTOR_HANDLE(m_cbvHeap->GetCPUDescriptorHandleForHeapStart(), textureTable + slot, m_cbvDescriptorSize),
+				m_resources.Srv(texture), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+		}
+		m_commandList->SetGraphicsRootDescriptorTable(ROOT_TEXTURES, CD3DX12_GPU_DESCRIPTOR_HANDLE(m_cbvHeap->GetGPUDescriptorHandleForHeapStart(), textureTable, m_cbvDescriptorSize));
 		m_commandList->RSSetViewports(1, &m_viewport);
 		m_commandList->RSSetScissorRects(1, &m_scissorRect);
 		//CD3DX12_GPU_DESCRIPTOR_HANDLE cbvHandle(m_cbvHeap->GetGPUDescriptorHandleForHeapStart(), 2, m_cbvDescriptorSize);
@@ -651,19 +811,57 @@ namespace MRenderer
 		m_commandList->ClearDepthStencilView(m_dsvHeap->GetCPUDescriptorHandleForHeapStart(), D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
 
 		m_commandList->IASetPrimitiveTopology(RenderObjects[0]->PrimitiveTopology);
-		m_commandList->SetPipelineState(RenderObjects[0]->pipelineState.Get());
 		m_commandList->IASetVertexBuffers(0, 1, &RenderObjects[0]->vertexBufferView);
-		m_commandList->IASetVertexBuffers(1, 1, &RenderObjects[0]->instanceBufferView);
 		m_commandList->IASetIndexBuffer(&RenderObjects[0]->indexBufferView);
-		
-		m_commandList->DrawIndexedInstanced(RenderObjects[0]->mesh.indices.size(), 1, 0, 0, 0);
+
+		// Every character shares the mesh, the crowd is an instanced draw per level of detail per submesh, each with
+		// its material's slot of the material buffer. Textures still come from the first material, see RequestTextures().
+		// Skinning in the vertex shader, each influence bucket of a submesh is a draw of its own with the path for
+		// that many influences; pre-skinned, the buckets make no difference and a submesh is one draw.
+		if (frameResources.instanceCount > 0)
+		{
+			const UINT64 materialStride = ConstantPacker::aligned_size(sizeof(PerMaterialConstants));
+			const uint32_t passes = preSkinned ? 1 : InfluenceBucketCount;
+			for (uint32_t bucket = 0; bucket < passes; bucket++)
+			{
+				m_commandList->SetPipelineState(preSkinned ? m_preSkinnedState.Get() : m_skinnedStates[bucket].Get());
+				for (size_t level = 0; level < lodCount; level++)
+				{
+					const SkinningConstants constants = LodConstants(level);
+					if (constants.InstanceCount == 0)
+					{
+						continue;
+					}
+					m_commandList->SetGraphicsRoot32BitConstants(ROOT_SKINNING_CONSTANTS, sizeof(SkinningConstants) / 4, &constants, 0);
+
+					const Lod& lod = mesh.lods[level];
+					for (uint32_t s = lod.submeshStart; s < lod.submeshStart + lod.submeshCount; s++)
+					{
+						const Submesh& submesh = mesh.submeshes[s];
+						const UINT indexStart = submesh.indexStart + (preSkinned ? 0 : bucket_start(mesh.submeshIndexBuckets[s], bucket));
+						const UINT indexCount = preSkinned ? submesh.indexCount : mesh.submeshIndexBuckets[s].counts[bucket];
+						if (indexCount == 0)
+						{
+							continue;
+						}
+						const bool hasMaterial = submesh.material >= 0 && size_t(submesh.material) < mesh.materials.size();
+						m_commandList->SetGraphicsRootConstantBufferView(ROOT_PER_MATERIAL,
+							m_materialBuffer->GetGPUVirtualAddress() + (hasMaterial ? submesh.material : 0) * materialStride);
+						m_commandList->DrawIndexedInstanced(indexCount, constants.InstanceCount, indexStart, 0, 0);
+					}
+				}
+			}
+		}
 
 
 		m_commandList->IASetPrimitiveTopology(DefaultLineRenderer.PrimitiveTopology);
 		m_commandList->SetPipelineState(DefaultLineRenderer.pipelineState.Get());
-		m_commandList->IASetVertexBuffers(0, 1, &DefaultLineRenderer.vertexBufferView);
-		m_commandList->IASetVertexBuffers(1, 1, &DefaultLineRenderer.instanceBufferView);
-		m_commandList->DrawInstanced(DebugRenderer::get_line_vert_count(), 1, 0, 0);
+		if (frameResources.debugVertexCount > 0)
+		{
+			m_commandList->IASetVertexBuffers(0, 1, &frameResources.debugVertexBufferView);
+			m_commandList->IASetVertexBuffers(1, 1, &DefaultLineRenderer.instanceBufferView);
+			m_commandList->DrawInstanced(frameResources.debugVertexCount, 1, 0, 0);
+		}
 
 		// Indicate that the back buffer will now be used to present.
 		D3D12_RESOURCE_BARRIER resourceBarrier1;
@@ -679,78 +877,551 @@ namespace MRenderer
 		}
 	}
 
-	void GraphicsApplication::WaitForPreviousFrame()
+	void GraphicsApplication::WaitForGpu()
 	{
-		// WAITING FOR THE FRAME TO COMPLETE BEFORE CONTINUING IS NOT BEST PRACTICE.
-		// This is code implemented as such for simplicity. More advanced samples 
-		// illustrate how to use fences for efficient resource usage.
+		// Full flush, only for startup, shutdown and other points where every frame
+		// resource has to be idle. The render loop paces itself through m_frames.
+		m_frames.WaitForIdle();
+		m_resources.WaitForUploads();
 
-		// Signal and increment the fence value.
-		const UINT64 fence = m_fenceValue;
-		HRESULT hr = m_commandQueue->Signal(m_fence.Get(), fence);
-		if (FAILED(hr))
+		m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	}
+
+	void GraphicsApplication::BakeClip(const Mesh& mesh, const Animation& animation, SkinnedClip& clip)
+	{
+		clip = {};
+		clip.jointCount = static_cast<uint32_t>(animation.bindPose.size());
+		clip.duration = animation.duration;
+
+		clip.inverseBind.resize(clip.jointCount);
+		clip.parents.resize(clip.jointCount);
+		for (uint32_t i = 0; i < clip.jointCount; i++)
 		{
-			exit(hr);
+			XMFLOAT4X4 inverseBind;
+			XMStoreFloat4x4(&inverseBind, XMMatrixInverse(nullptr, XMLoadFloat4x4(&animation.bindPose[i].transform)));
+			memcpy(&clip.inverseBind[i], &inverseBind, sizeof(Matrix4));
+			clip.parents[i] = animation.bindPose[i].parentIndex;
 		}
-		m_fenceValue++;
 
-		// Wait until the previous frame is finished.
-		if (m_fence->GetCompletedValue() < fence)
+		// A clip too big to hold keeps only its keytimes, its poses are paged in as the crowd plays it.
+		const ClipStream::Source& source = animation.stream;
+		if (!source.blocks.empty())
 		{
-			hr = m_fence->SetEventOnCompletion(fence, m_fenceEvent);
-			if (FAILED(hr))
+			clip.stream = std::make_shared<ClipStream>(m_assetLoader, source);
+			if (clip.stream->Open())
 			{
-				exit(hr);
+				clip.keytimes = source.keytimes;
+				std::cout << "Streaming the clip from " << source.path << " in " << source.blocks.size() << " blocks of " << source.blockSeconds
+					<< " s, " << clip.stream->CacheBlocks() << " cached and " << clip.stream->PrefetchSeconds() << " s read ahead\n";
+			}
+			else
+			{
+				std::cout << "Could not read the clip's first keyframes from " << source.path << ", it won't play\n";
+				clip.stream.reset();
+			}
+		}
+		else
+		{
+			// XMFLOAT4X4 and Matrix4 share a layout, so the poses copy straight across.
+			clip.keytimes.resize(animation.keyframes.size());
+			clip.poses.resize(animation.keyframes.size() * clip.jointCount);
+			for (size_t k = 0; k < animation.keyframes.size(); k++)
+			{
+				const Keyframe& keyframe = animation.keyframes[k];
+				clip.keytimes[k] = keyframe.keytime;
+				for (uint32_t i = 0; i < clip.jointCount; i++)
+				{
+					memcpy(&clip.poses[k * clip.jointCount + i], &keyframe.poseData[i].transform, sizeof(Matrix4));
+				}
 			}
-			WaitForSingleObject(m_fenceEvent, INFINITE);
 		}
 
-		m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+		// Culling needs the mesh's bounds at every key. Files from before the exporter wrote them get them here,
+		// from the full detail level (every other level's vertices are a subset of its positions). Working them
+		// out, or baking palettes, would page a streamed clip in whole: without bounds it isn't culled, and its
+		// stepped instances sample it.
+		if (animation.keyBounds.size() == clip.keytimes.size())
+		{
+			clip.keyBounds = animation.keyBounds;
+		}
+		else if (!mesh.lods.empty() && !clip.stream)
+		{
+			const Lod& full = mesh.lods[0];
+			compute_key_bounds(clip, reinterpret_cast<const SkinningVertex*>(mesh.vertices.data() + full.vertexStart), full.vertexCount, clip.keyBounds);
+		}
+		if (!clip.stream)
+		{
+			bake_key_palettes(clip);
+		}
 	}
 
-	void GraphicsApplication::LoadMesh(GraphicsApplication::Mesh& mesh, GraphicsApplication::Animation& animation)
+	void GraphicsApplication::ResizeCrowd(UINT side)
 	{
-		GraphicsApplication::InputMesh inputMesh;
-		std::string meshFileName;
-		do {
+		if (side < 1)
+			side = 1;
+		if (side > MaxCrowdSide)
+			side = MaxCrowdSide;
+
+		// Rows run back from the origin and columns alternate either side of it, so the first character
+		// stays where the single mesh used to be. The debug line pass draws everything at half scale (its
+		// INSTANCEPOS adds 1 to w), the crowd is scaled to match.
+		const float spacing = 2.5f;
+		const size_t previousCount = m_crowd.size();
+		m_crowd.resize(side * side);
+		m_crowdSide = side;
+
+		for (size_t i = 0; i < m_crowd.size(); i++)
+		{
+			CrowdInstance& instance = m_crowd[i];
+
+			const UINT column = static_cast<UINT>(i % side);
+			const UINT row = static_cast<UINT>(i / side);
+			const float x = ((column + 1) / 2) * spacing * ((column % 2) ? 1.0f : -1.0f);
+			const float z = -(row * spacing);
+
+			XMFLOAT4X4 world;
+			XMStoreFloat4x4(&world, XMMatrixMultiply(XMMatrixScaling(0.5f, 0.5f, 0.5f), XMMatrixTranslation(x, 0.0f, z)));
+			memcpy(&instance.world, &world, sizeof(Matrix4));
+
+			// Characters already on screen keep their place in the clip; new ones start staggered so the crowd doesn't move in lockstep.
+			if (i >= previousCount)
+			{
+				instance.clip = 0;
+				instance.time = i * 0.37;
+				instance.speed = i == 0 ? 1.0f : 0.9f + 0.02f * static_cast<float>((i * 7) % 11);
+			}
+		}
+		m_crowdGrid.Build(m_crowd, m_clips);
+	}
 
-			meshFileName = OpenFileName(L"Morales Binary Mesh Files (*.mbm)\0*.mbm*\0", NULL);
+	void GraphicsApplication::BuildCrowd(FrameResources& frame, double deltaTime)
+	{
+		frame.instanceAddress = 0;
+		frame.paletteAddress = 0;
+		frame.instanceCount = 0;
+		for (InstanceRange& range : frame.lodInstances)
+		{
+			range = { 0, 0 };
+		}
 
-		} while (meshFileName.empty());
+		// Streamed clips ask for the blocks their characters are about to play, from where they were visible last
+		// frame. What arrives is pumped in before the next frame builds.
+		for (uint32_t c = 0; c < m_clips.size(); c++)
+		{
+			if (m_clips[c].stream)
+			{
+				m_clips[c].stream->Update(m_clips[c], m_crowd, c);
+			}
+		}
 
-		std::fstream file; //{ meshFileName, std::ios_base::in | std::ios_base::binary };
-		file.open(meshFileName, std::ios_base::in | std::ios_base::binary);
-		assert(file.is_open());
+		// Characters outside the frustum at the time they're about to be sampled get no pose, palette or record.
+		uint32_t visibleCount = static_cast<uint32_t>(m_crowd.size());
+		if (m_crowdGridQueries)
+		{
+			m_crowdGrid.Update(m_crowd, m_clips);
+		}
+		if (m_crowdCulling)
+		{
+			XMFLOAT4X4 viewProjection;
+			XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(m_MVP.View, m_MVP.Projection));
+			const Frustum frustum = frustum_from_matrix(reinterpret_cast<const Matrix4&>(viewProjection));
+			visibleCount = m_crowdGridQueries ? m_crowdCuller.Cull(m_crowd, m_clips, deltaTime, frustum, m_crowdGrid)
+				: m_crowdCuller.Cull(m_crowd, m_clips, deltaTime, frustum);
+		}
+		else
+		{
+			for (CrowdInstance& instance : m_crowd)
+			{
+				instance.visible = true;
+			}
+		}
+		if (visibleCount == 0)
+		{
+			// Nothing to draw, but every clip still moves on.
+			m_instanceBuilder.Build(m_crowd, m_clips, deltaTime, nullptr, nullptr);
+			return;
+		}
 
-		uint32_t player_index_count;
-		uint32_t player_vertex_count;
-		uint32_t player_material_count;
-		uint32_t player_material_path_count;
-		uint32_t bindpose_joint_count;
-		uint32_t joint_count;
-		uint32_t frame_count;
+		// The builder writes straight into this frame's slice of the upload ring, there is no staging copy.
+		const size_t paletteSize = InstanceBuilder::PaletteSize(m_crowd, m_clips);
+		UploadRing::Allocation instances = m_uploadRing.Allocate(visibleCount * sizeof(GpuInstance), 16);
+		UploadRing::Allocation palette = m_uploadRing.Allocate(paletteSize * sizeof(Matrix4), 16);
+		if (!instances.Valid() || !palette.Valid())
+		{
+			// Skip drawing the crowd for a frame rather than overwrite memory the GPU may still be reading, but
+			// keep every clip moving.
+			m_instanceBuilder.Build(m_crowd, m_clips, deltaTime, nullptr, nullptr);
+			return;
+		}
 
-		// Read the index count and all the indices.
+		// Each character's level of detail from how much of the screen it covers this frame.
+		const Mesh& mesh = DefaultCube.mesh;
+		LodSelection selection;
+		selection.lodCount = static_cast<uint32_t>(mesh.lods.size());
+		for (uint32_t lod = 0; lod < selection.lodCount && lod < MaxLods; lod++)
+		{
+			selection.switchSizes[lod] = mesh.lods[lod].switchSize;
+		}
+		selection.center[0] = mesh.boundsCenter.x;
+		selection.center[1] = mesh.boundsCenter.y;
+		selection.center[2] = mesh.boundsCenter.z;
+		selection.radius = mesh.boundsRadius;
+		selection.eye[0] = m_perFrameData.EyePosition.x;
+		selection.eye[1] = m_perFrameData.EyePosition.y;
+		selection.eye[2] = m_perFrameData.EyePosition.z;
+		selection.projectionScale = XMVectorGetY(m_projection.r[1]);
+		selection.bias = m_windowHeight / 1080.0f; // the exporter's switch sizes assume a 1080 pixel tall screen
+		selection.forcedLod = m_forcedLod;
+		selection.steppedSize = 0.02f; // about 20 pixels tall, too small for the motion between keys to show
+		if (m_crowdGridQueries)
+		{
+			select_lods(m_crowd, m_crowdGrid, selection);
+		}
+		else
+		{
+			select_lods(m_crowd, selection);
+		}
 
-		file.read((char*)&player_index_count, sizeof(uint32_t));
+		m_instanceBuilder.Build(m_crowd, m_clips, deltaTime, static_cast<GpuInstance*>(instances.cpu), static_cast<Matrix4*>(palette.cpu));
 
-		inputMesh.indices.resize(player_index_count);
+		frame.instanceAddress = instances.gpu;
+		frame.paletteAddress = palette.gpu;
+		frame.instanceCount = m_instanceBuilder.RecordCount();
+		for (uint32_t lod = 0; lod < MaxLods; lod++)
+		{
+			frame.lodInstances[lod] = m_instanceBuilder.LodRanges()[lod];
+		}
+	}
 
-		file.read((char*)inputMesh.indices.data(), sizeof(uint32_t) * player_index_count);
+	void GraphicsApplication::PrintClipStats(std::ostream& out) const
+	{
+		// How much of each streamed clip is resident, against holding all of its poses.
+		for (const SkinnedClip& clip : m_clips)
+		{
+			if (!clip.stream)
+			{
+				continue;
+			}
+			const ClipStream::Stats stats = clip.stream->GetStats();
+			const uint64_t wholeBytes = clip.keytimes.size() * clip.jointCount * sizeof(Matrix4);
+			out << "Clip stream: " << stats.residentBlocks << " of " << clip.stream->GetSource().blocks.size() << " blocks resident, "
+				<< stats.residentBytes / 1024 << " KB, peak " << stats.peakBytes / 1024 << " KB of " << wholeBytes / 1024 << " KB whole; "
+				<< stats.requests << " reads, " << stats.evictions << " evictions, " << stats.failures << " failed, "
+				<< stats.misses << " keys sampled before they arrived\n";
+		}
+	}
 
-		// Read the veretx count and all the vertices.
+	void GraphicsApplication::PrintClusterStats(std::ostream& out) const
+	{
+		// What culling meshlets against this frame's camera would leave of the crowd, by the CPU reference.
+		const Mesh& mesh = DefaultCube.mesh;
+		if (mesh.meshlets.empty())
+		{
+			out << "No meshlets in the mesh\n";
+			return;
+		}
 
-		file.read((char*)&player_vertex_count, sizeof(uint32_t));
+		XMFLOAT4X4 viewProjection;
+		XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(m_MVP.View, m_MVP.Projection));
+		const Frustum frustum = frustum_from_matrix(reinterpret_cast<const Matrix4&>(viewProjection));
+		const float eye[3] = { m_perFrameData.EyePosition.x, m_perFrameData.EyePosition.y, m_perFrameData.EyePosition.z };
 
-		inputMesh.vertices.resize(player_vertex_count);
+		// Meshlets are stored in submesh order, so each level's are one run.
+		struct MeshletRange
+		{
+			uint32_t first;
+			uint32_t count;
+		};
+		MeshletRange levels[MaxLods] = {};
+		for (uint32_t lod = 0; lod < mesh.lods.size(); lod++)
+		{
+			const Lod& level = mesh.lods[lod];
+			uint32_t first = 0;
+			while (first < mesh.meshlets.size() && mesh.meshlets[first].submesh < level.submeshStart)
+			{
+				first++;
+			}
+			uint32_t last = first;
+			while (last < mesh.meshlets.size() && mesh.meshlets[last].submesh < level.submeshStart + level.submeshCount)
+			{
+				last++;
+			}
+			levels[lod] = { first, last - first };
+		}
 
-		file.read((char*)inputMesh.vertices.data(), sizeof(InputVertex) * player_vertex_count);
+		ClusterCullStats stats;
+		std::vector<uint32_t> visible;
+		uint64_t triangles = 0;
+		uint64_t visibleTriangles = 0;
+		for (const CrowdInstance& instance : m_crowd)
+		{
+			if (!instance.visible)
+			{
+				continue;
+			}
+			const MeshletRange& level = levels[min(instance.lod, static_cast<uint32_t>(mesh.lods.size()) - 1)];
+			visible.clear();
+			cull_clusters(mesh.meshlets.data(), level.first, level.count, instance.world, frustum, eye, visible, stats);
+			for (uint32_t i = level.first; i < level.first + level.count; i++)
+			{
+				triangles += mesh.meshlets[i].triangleCount;
+			}
+			for (uint32_t i : visible)
+			{
+				visibleTriangles += mesh.meshlets[i].triangleCount;
+			}
+		}
 
-		// Read the material count and all the materials.
+		out << "Meshlets: " << stats.Visible() << " of " << stats.tested << " visible, " << stats.outsideFrustum << " outside the frustum, "
+			<< stats.backFacing << " back facing; " << visibleTriangles << " of " << triangles << " triangles\n";
+	}
 
-		file.read((char*)&player_material_count, sizeof(uint32_t));
+	void GraphicsApplication::WatchFiles()
+	{
+		// Only the compiled .cso files are watched; rebuilding a shader in the IDE is what triggers a reload.
+		m_fileWatcher.Watch(m_meshPath);
+		for (const ShaderFile& shader : m_shaderFiles)
+		{
+			m_fileWatcher.Watch(shader.path);
+		}
+		m_fileWatcher.Start();
+	}
 
-		mesh.materials.resize(player_material_count);
+	void GraphicsApplication::RequestHotReloads()
+	{
+		std::vector<FileChange> changes;
+		if (m_fileWatcher.Drain(changes) == 0)
+		{
+			return;
+		}
+
+		for (const FileChange& change : changes)
+		{
+			const bool isMesh = change.path == m_meshPath;
+
+			AssetLoader::Request request;
+			request.path = change.path;
+			request.priority = LOAD_PRIORITY_HIGH;
+
+			// Shaders are used as read, a mesh is parsed on the loader thread so the swap is only buffer creation.
+			// The mesh is read from the file rather than from its bytes, so a clip streamed from it never is whole.
+			if (isMesh)
+			{
+				request.size = 0;
+				request.decode = [](const std::string& path, std::vector<uint8_t>&, std::string& error) -> std::shared_ptr<void>
+				{
+					std::ifstream stream(path, std::ios_base::in | std::ios_base::binary);
+					std::shared_ptr<LoadedMesh> loaded = std::make_shared<LoadedMesh>();
+					if (!stream.is_open() || !ReadMesh(stream, path, loaded->mesh, loaded->animation) || loaded->mesh.vertices.empty() ||
+						loaded->animation.bindPose.empty())
+					{
+						error = "Failed to read " + path;
+						return nullptr;
+					}
+					return loaded;
+				};
+			}
+
+			const int64_t detected = change.detected;
+			request.onComplete = [this, isMesh, detected](const LoadResult& result)
+			{
+				if (result.status == LOAD_FAILED)
+				{
+					std::cout << result.error << ", keeping what's loaded\n";
+				}
+				if (result.status != LOAD_LOADED)
+				{
+					return;
+				}
+
+				HotReload reload;
+				reload.path = result.path;
+				reload.detected = detected;
+				if (isMesh)
+				{
+					reload.mesh = std::static_pointer_cast<LoadedMesh>(result.asset);
+				}
+				else
+				{
+					reload.shader = std::static_pointer_cast<std::vector<uint8_t>>(result.asset);
+				}
+				m_hotReloads.push_back(std::move(reload));
+			};
+
+			m_assetLoader.Load(std::move(request));
+		}
+	}
+
+	void GraphicsApplication::ApplyHotReloads(FrameResources& frame)
+	{
+		if (m_hotReloads.empty())
+		{
+			return;
+		}
+
+		PROFILE_ZONE("HotReload::Apply");
+
+		const int64_t begin = Profiler::now();
+
+		bool shadersChanged = false;
+		for (HotReload& reload : m_hotReloads)
+		{
+			if (reload.mesh)
+			{
+				SwapMesh(*reload.mesh, frame);
+				continue;
+			}
+
+			for (ShaderFile& shader : m_shaderFiles)
+			{
+				if (shader.path == reload.path)
+				{
+					shader.byteCode->assign(reload.shader->begin(), reload.shader->end());
+					shadersChanged = true;
+				}
+			}
+		}
+
+		if (shadersChanged)
+		{
+			RebuildPipelineStates(frame);
+		}
+
+		// Latency runs from the first write the watcher saw to now, the hitch is just the swap on this thread.
+		const int64_t end = Profiler::now();
+		const double ticksPerMs = Profiler::frequency() / 1000.0;
+		for (const HotReload& reload : m_hotReloads)
+		{
+			std::cout << "Reloaded " << reload.path << " " << (end - reload.detected) / ticksPerMs << " ms after it changed, "
+				<< (end - begin) / ticksPerMs << " ms frame hitch\n";
+		}
+		m_hotReloads.clear();
+	}
+
+	void GraphicsApplication::SwapMesh(LoadedMesh& loaded, FrameResources& frame)
+	{
+		PROFILE_ZONE("HotReload::SwapMesh");
+
+		const uint32_t previousVertexStride = DefaultCube.mesh.skinnedVertexStride;
+		const uint32_t previousJointCount = m_clips[0].jointCount;
+		const bool animating = DefaultLineRenderer.animation.enabled;
+
+		// Frames in flight still draw from the old buffers, the resource manager holds on to them until they retire.
+		m_resources.Release(DefaultCube.vertexBuffer);
+		m_resources.Release(DefaultCube.indexBuffer);
+		frame.retiredResources.push_back(m_materialBuffer);
+
+		DefaultCube.mesh = std::move(loaded.mesh);
+		DefaultCube.animation = std::move(loaded.animation);
+		DefaultLineRenderer.animation = DefaultCube.animation;
+		DefaultLineRenderer.animation.enabled = animating;
+
+		BakeClip(DefaultCube.mesh, DefaultCube.animation, m_clips[0]);
+		m_crowdGrid.Build(m_crowd, m_clips);
+
+		CreateVertexBuffers();
+		CreateIndexBuffers();
+		CreateMaterialBuffer();
+
+		if (DefaultCube.mesh.skinnedVertexStride != previousVertexStride)
+		{
+			frame.retiredResources.push_back(m_skinnedVertexBuffer);
+			m_skinnedVertexBuffer.Reset();
+			m_skinnedVertexCapacity = 0;
+			if (m_preSkinning)
+			{
+				CreateSkinnedVertexBuffer(static_cast<UINT>(m_crowd.size()));
+			}
+		}
+
+		// The upload ring was sized for the old skeleton's palettes. Growing it is the one step that has to
+		// wait for the GPU, and only happens when the new skeleton has more joints.
+		if (m_clips[0].jointCount > previousJointCount)
+		{
+			WaitForGpu();
+			m_uploadBuffer.Reset();
+			CreateUploadRing();
+		}
+
+		RequestTextures();
+	}
+
+	void GraphicsApplication::RebuildPipelineStates(FrameResources& frame)
+	{
+		PROFILE_ZONE("HotReload::PipelineStates");
+
+		// CreatePipelineStates() releases whatever the ComPtrs hold, keep the old states alive for the frames in flight.
+		frame.retiredResources.push_back(DefaultCube.pipelineState);
+		frame.retiredResources.push_back(DefaultLineRenderer.pipelineState);
+		frame.retiredResources.push_back(m_preSkinnedState);
+		for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+		{
+			frame.retiredResources.push_back(m_computeStates[bucket]);
+			frame.retiredResources.push_back(m_skinnedStates[bucket]);
+		}
+
+		CreatePipelineStates();
+	}
+
+	void GraphicsApplication::LoadMesh(GraphicsApplication::Mesh& mesh, GraphicsApplication::Animation& animation)
+	{
+		std::string meshFileName;
+		do {
+
+			meshFileName = OpenFileName(L"Morales Binary Mesh Files (*.mbm)\0*.mbm*\0", NULL);
+
+		} while (meshFileName.empty());
+
+		PROFILE_ZONE("LoadMesh");
+
+		std::fstream file; //{ meshFileName, std::ios_base::in | std::ios_base::binary };
+		file.open(meshFileName, std::ios_base::in | std::ios_base::binary);
+		assert(file.is_open());
+
+		ReadMesh(file, meshFileName, mesh, animation);
+
+		file.close();
+
+		// Watched from now on, see WatchFiles().
+		m_meshPath = meshFileName;
+
+		std::cout << "File Loaded\n";
+	}
+
+	bool GraphicsApplication::ReadMesh(std::istream& file, const std::string& path, GraphicsApplication::Mesh& mesh, GraphicsApplication::Animation& animation)
+	{
+		GraphicsApplication::InputMesh inputMesh;
+
+		// Left at 0 if the file runs out, a truncated file reads as empty rather than as garbage sizes.
+		uint32_t player_index_count = 0;
+		uint32_t player_vertex_count = 0;
+		uint32_t player_material_count = 0;
+		uint32_t player_material_path_count = 0;
+		uint32_t bindpose_joint_count = 0;
+		uint32_t joint_count = 0;
+		uint32_t frame_count = 0;
+
+		// Read the index count and all the indices.
+
+		file.read((char*)&player_index_count, sizeof(uint32_t));
+
+		inputMesh.indices.resize(player_index_count);
+
+		file.read((char*)inputMesh.indices.data(), sizeof(uint32_t) * player_index_count);
+
+		// Read the veretx count and all the vertices.
+
+		file.read((char*)&player_vertex_count, sizeof(uint32_t));
+
+		inputMesh.vertices.resize(player_vertex_count);
+
+		file.read((char*)inputMesh.vertices.data(), sizeof(InputVertex) * player_vertex_count);
+
+		// Read the material count and all the materials.
+
+		file.read((char*)&player_material_count, sizeof(uint32_t));
+
+		mesh.materials.resize(player_material_count);
 
 		file.read((char*)mesh.materials.data(), sizeof(Material) * player_material_count);
 
@@ -810,42 +1481,280 @@ namespace MRenderer
 		file.read((char*)&joint_count, sizeof(uint32_t));
 		file.read((char*)&frame_count, sizeof(uint32_t));
 
-		animation.keyframes.resize(frame_count);
-		for (uint32_t i = 0; i < frame_count; i++)
+		// The keyframes as they're stored, every one a record of the same size.
+		const auto readKeyframes = [&]()
 		{
-			file.read((char*)&animation.keyframes[i].keytime, sizeof(double));
-			animation.keyframes[i].poseData.resize(joint_count);
-			input_joints.clear();
-			input_joints.resize(joint_count);
-			file.read((char*)input_joints.data(), sizeof(Joint) * joint_count);
-
-			for (int j = 0; j < input_joints.size(); j++)
+			animation.keyframes.resize(frame_count);
+			for (uint32_t i = 0; i < frame_count; i++)
 			{
-				animation.keyframes[i].poseData[j].parentIndex = input_joints[j].parentIndex;
+				file.read((char*)&animation.keyframes[i].keytime, sizeof(double));
+				animation.keyframes[i].poseData.resize(joint_count);
+				input_joints.clear();
+				input_joints.resize(joint_count);
+				file.read((char*)input_joints.data(), sizeof(Joint) * joint_count);
+
+				for (int j = 0; j < input_joints.size(); j++)
+				{
+					animation.keyframes[i].poseData[j].parentIndex = input_joints[j].parentIndex;
 						  
-				animation.keyframes[i].poseData[j].transform.m[0][0] = input_joints[j].transform[0];
-				animation.keyframes[i].poseData[j].transform.m[0][1] = input_joints[j].transform[1];
-				animation.keyframes[i].poseData[j].transform.m[0][2] = input_joints[j].transform[2];
-				animation.keyframes[i].poseData[j].transform.m[0][3] = input_joints[j].transform[3];
+					animation.keyframes[i].poseData[j].transform.m[0][0] = input_joints[j].transform[0];
+					animation.keyframes[i].poseData[j].transform.m[0][1] = input_joints[j].transform[1];
+					animation.keyframes[i].poseData[j].transform.m[0][2] = input_joints[j].transform[2];
+					animation.keyframes[i].poseData[j].transform.m[0][3] = input_joints[j].transform[3];
 						  															
-				animation.keyframes[i].poseData[j].transform.m[1][0] = input_joints[j].transform[4];
-				animation.keyframes[i].poseData[j].transform.m[1][1] = input_joints[j].transform[5];
-				animation.keyframes[i].poseData[j].transform.m[1][2] = input_joints[j].transform[6];
-				animation.keyframes[i].poseData[j].transform.m[1][3] = input_joints[j].transform[7];
+					animation.keyframes[i].poseData[j].transform.m[1][0] = input_joints[j].transform[4];
+					animation.keyframes[i].poseData[j].transform.m[1][1] = input_joints[j].transform[5];
+					animation.keyframes[i].poseData[j].transform.m[1][2] = input_joints[j].transform[6];
+					animation.keyframes[i].poseData[j].transform.m[1][3] = input_joints[j].transform[7];
 						  															
-				animation.keyframes[i].poseData[j].transform.m[2][0] = input_joints[j].transform[8];
-				animation.keyframes[i].poseData[j].transform.m[2][1] = input_joints[j].transform[9];
-				animation.keyframes[i].poseData[j].transform.m[2][2] = input_joints[j].transform[10];
-				animation.keyframes[i].poseData[j].transform.m[2][3] = input_joints[j].transform[11];
+					animation.keyframes[i].poseData[j].transform.m[2][0] = input_joints[j].transform[8];
+					animation.keyframes[i].poseData[j].transform.m[2][1] = input_joints[j].transform[9];
+					animation.keyframes[i].poseData[j].transform.m[2][2] = input_joints[j].transform[10];
+					animation.keyframes[i].poseData[j].transform.m[2][3] = input_joints[j].transform[11];
 						  															
-				animation.keyframes[i].poseData[j].transform.m[3][0] = input_joints[j].transform[12];
-				animation.keyframes[i].poseData[j].transform.m[3][1] = input_joints[j].transform[13];
-				animation.keyframes[i].poseData[j].transform.m[3][2] = input_joints[j].transform[14];
-				animation.keyframes[i].poseData[j].transform.m[3][3] = input_joints[j].transform[15];
+					animation.keyframes[i].poseData[j].transform.m[3][0] = input_joints[j].transform[12];
+					animation.keyframes[i].poseData[j].transform.m[3][1] = input_joints[j].transform[13];
+					animation.keyframes[i].poseData[j].transform.m[3][2] = input_joints[j].transform[14];
+					animation.keyframes[i].poseData[j].transform.m[3][3] = input_joints[j].transform[15];
+				}
+			}
+		};
+
+		// A clip too big to hold is left in the file and paged in a block at a time, see ClipStream. Its block
+		// table is the last section, so the keyframes are skipped for now and only read if there isn't one.
+		static_assert(sizeof(InputJoint) == ClipStream::KeyJointBytes, "InputJoint must match a key record's joints");
+		const std::streamoff key_offset = file.tellg();
+		const uint64_t key_bytes = frame_count * (sizeof(double) + sizeof(InputJoint) * static_cast<uint64_t>(joint_count));
+		const bool streamed = !path.empty() && key_offset >= 0 && joint_count == bindpose_joint_count && key_bytes > ClipStream::StreamedClipBytes;
+		animation.keyframes.clear();
+		animation.stream = {};
+		if (streamed)
+		{
+			file.seekg(key_offset + static_cast<std::streamoff>(key_bytes));
+		}
+		else
+		{
+			readKeyframes();
+		}
+
+		if (!file)
+		{
+			return false;
+		}
+
+		// Submeshes come last. Files exported before them end here, and draw as one range with the first material.
+		uint32_t submesh_count = 0;
+		vector<Submesh> submeshes;
+		if (file.read((char*)&submesh_count, sizeof(uint32_t)) && submesh_count <= player_index_count / 3)
+		{
+			submeshes.resize(submesh_count);
+			file.read((char*)submeshes.data(), sizeof(Submesh) * submesh_count);
+			if (!file)
+			{
+				submeshes.clear();
 			}
 		}
 
-		file.close();
+		// A range outside the index list is kept, so the levels of detail still count submeshes right, but empty.
+		for (Submesh& submesh : submeshes)
+		{
+			if (submesh.indexStart > player_index_count || submesh.indexCount > player_index_count - submesh.indexStart)
+			{
+				submesh = { 0, 0, submesh.material };
+			}
+		}
+		if (submeshes.empty())
+		{
+			submeshes.push_back({ 0, player_index_count, 0 });
+		}
+		mesh.submeshes = std::move(submeshes);
+
+		// Levels of detail follow the submeshes. Without them, or if the first is broken, the whole mesh is one level.
+		uint32_t lod_count = 0;
+		vector<Lod> lods;
+		if (file.read((char*)&lod_count, sizeof(uint32_t)) && lod_count <= MaxLods)
+		{
+			lods.resize(lod_count);
+			file.read((char*)lods.data(), sizeof(Lod) * lod_count);
+			if (!file)
+			{
+				lods.clear();
+			}
+		}
+		submesh_count = static_cast<uint32_t>(mesh.submeshes.size());
+		mesh.lods.clear();
+		for (const Lod& lod : lods)
+		{
+			if (lod.submeshStart > submesh_count || lod.submeshCount > submesh_count - lod.submeshStart ||
+				lod.vertexStart > player_vertex_count || lod.vertexCount > player_vertex_count - lod.vertexStart)
+			{
+				break;
+			}
+			mesh.lods.push_back(lod);
+		}
+		if (mesh.lods.empty())
+		{
+			mesh.lods.push_back({ 0, submesh_count, 0, player_vertex_count, 0.0f, FLT_MAX });
+		}
+
+		// Meshlets follow the levels of detail. Any of them out of range and the mesh goes without.
+		uint32_t meshlet_count = 0;
+		uint32_t meshlet_vertex_count = 0;
+		uint32_t meshlet_triangle_count = 0;
+		mesh.meshlets.clear();
+		mesh.meshletVertices.clear();
+		mesh.meshletTriangles.clear();
+		if (file.read((char*)&meshlet_count, sizeof(uint32_t)) && meshlet_count <= player_index_count / 3)
+		{
+			mesh.meshlets.resize(meshlet_count);
+			file.read((char*)mesh.meshlets.data(), sizeof(Meshlet) * meshlet_count);
+			if (file.read((char*)&meshlet_vertex_count, sizeof(uint32_t)) && meshlet_vertex_count <= player_index_count)
+			{
+				mesh.meshletVertices.resize(meshlet_vertex_count);
+				file.read((char*)mesh.meshletVertices.data(), sizeof(uint32_t) * meshlet_vertex_count);
+			}
+			if (file.read((char*)&meshlet_triangle_count, sizeof(uint32_t)) && meshlet_triangle_count <= player_index_count / 3)
+			{
+				mesh.meshletTriangles.resize(meshlet_triangle_count * 3);
+				file.read((char*)mesh.meshletTriangles.data(), 3 * meshlet_triangle_count);
+			}
+		}
+		bool meshletsValid = static_cast<bool>(file) && mesh.meshletVertices.size() == meshlet_vertex_count &&
+			mesh.meshletTriangles.size() == meshlet_triangle_count * 3;
+		for (size_t i = 0; i < mesh.meshletVertices.size() && meshletsValid; i++)
+		{
+			meshletsValid = mesh.meshletVertices[i] < player_vertex_count;
+		}
+		for (size_t i = 0; i < mesh.meshlets.size() && meshletsValid; i++)
+		{
+			const Meshlet& meshlet = mesh.meshlets[i];
+			meshletsValid = meshlet.submesh < submesh_count &&
+				meshlet.vertexStart <= meshlet_vertex_count && meshlet.vertexCount <= meshlet_vertex_count - meshlet.vertexStart &&
+				meshlet.triangleStart <= meshlet_triangle_count && meshlet.triangleCount <= meshlet_triangle_count - meshlet.triangleStart;
+			for (uint32_t j = meshlet.triangleStart * 3; meshletsValid && j < (meshlet.triangleStart + meshlet.triangleCount) * 3; j++)
+			{
+				meshletsValid = mesh.meshletTriangles[j] < meshlet.vertexCount;
+			}
+		}
+		if (!meshletsValid)
+		{
+			mesh.meshlets.clear();
+			mesh.meshletVertices.clear();
+			mesh.meshletTriangles.clear();
+		}
+
+		// Then the mesh's bounds at each keyframe, kept only if there is one per keyframe.
+		uint32_t key_bounds_count = 0;
+		animation.keyBounds.clear();
+		if (file.read((char*)&key_bounds_count, sizeof(uint32_t)) && key_bounds_count == frame_count)
+		{
+			animation.keyBounds.resize(key_bounds_count);
+			file.read((char*)animation.keyBounds.data(), sizeof(Aabb) * key_bounds_count);
+			if (!file)
+			{
+				animation.keyBounds.clear();
+			}
+		}
+
+		// Then the influence buckets and the weights packed as the GPU reads them. Without them, or if any bucket
+		// holds something its path can't skin, the weights are packed here and every level and submesh is one
+		// bucket, skinned with all four influences.
+		uint32_t bucket_count = 0;
+		uint32_t lod_bucket_count = 0;
+		uint32_t submesh_bucket_count = 0;
+		uint32_t packed_weight_count = 0;
+		vector<uint32_t> packedWeights;
+		mesh.lodVertexBuckets.clear();
+		mesh.submeshIndexBuckets.clear();
+		if (file.read((char*)&bucket_count, sizeof(uint32_t)) && bucket_count == InfluenceBucketCount &&
+			file.read((char*)&lod_bucket_count, sizeof(uint32_t)) && lod_bucket_count == mesh.lods.size())
+		{
+			mesh.lodVertexBuckets.resize(lod_bucket_count);
+			file.read((char*)mesh.lodVertexBuckets.data(), sizeof(InfluenceBuckets) * lod_bucket_count);
+			if (file.read((char*)&submesh_bucket_count, sizeof(uint32_t)) && submesh_bucket_count == submesh_count)
+			{
+				mesh.submeshIndexBuckets.resize(submesh_bucket_count);
+				file.read((char*)mesh.submeshIndexBuckets.data(), sizeof(InfluenceBuckets) * submesh_bucket_count);
+			}
+			if (file.read((char*)&packed_weight_count, sizeof(uint32_t)) && packed_weight_count == player_vertex_count)
+			{
+				packedWeights.resize(packed_weight_count);
+				file.read((char*)packedWeights.data(), sizeof(uint32_t) * packed_weight_count);
+			}
+		}
+		bool bucketsValid = static_cast<bool>(file) && mesh.lodVertexBuckets.size() == mesh.lods.size() &&
+			mesh.submeshIndexBuckets.size() == mesh.submeshes.size() && packedWeights.size() == player_vertex_count;
+		for (size_t i = 0; i < mesh.lods.size() && bucketsValid; i++)
+		{
+			const Lod& lod = mesh.lods[i];
+			bucketsValid = vertex_buckets_valid(mesh.lodVertexBuckets[i], packedWeights.data() + lod.vertexStart, lod.vertexCount);
+		}
+		for (size_t i = 0; i < mesh.submeshes.size() && bucketsValid; i++)
+		{
+			const Submesh& submesh = mesh.submeshes[i];
+			bucketsValid = index_buckets_valid(mesh.submeshIndexBuckets[i], inputMesh.indices.data() + submesh.indexStart, submesh.indexCount,
+				packedWeights.data(), packedWeights.size());
+		}
+		if (!bucketsValid)
+		{
+			packedWeights.resize(player_vertex_count);
+			for (uint32_t i = 0; i < player_vertex_count; i++)
+			{
+				const InputVertex::Double4& weights = inputMesh.vertices[i].weights;
+				const double unpacked[4] = { weights.x, weights.y, weights.z, weights.w };
+				packedWeights[i] = quantize_weights(unpacked);
+			}
+			mesh.lodVertexBuckets.clear();
+			for (const Lod& lod : mesh.lods)
+			{
+				mesh.lodVertexBuckets.push_back(unsorted_buckets(lod.vertexCount));
+			}
+			mesh.submeshIndexBuckets.clear();
+			for (const Submesh& submesh : mesh.submeshes)
+			{
+				mesh.submeshIndexBuckets.push_back(unsorted_buckets(submesh.indexCount));
+			}
+		}
+
+		// Last, how a streamed clip's keyframes are grouped into blocks, and every keytime. Without a table that
+		// accounts for every keyframe, they're read whole after all.
+		if (streamed)
+		{
+			ClipStream::Source& source = animation.stream;
+			uint32_t block_count = 0;
+			uint32_t keytime_count = 0;
+			if (file.read((char*)&source.blockSeconds, sizeof(double)) &&
+				file.read((char*)&block_count, sizeof(uint32_t)) && block_count <= frame_count)
+			{
+				source.blocks.resize(block_count);
+				file.read((char*)source.blocks.data(), sizeof(ClipBlock) * block_count);
+				if (file.read((char*)&keytime_count, sizeof(uint32_t)) && keytime_count == frame_count)
+				{
+					source.keytimes.resize(keytime_count);
+					file.read((char*)source.keytimes.data(), sizeof(double) * keytime_count);
+				}
+			}
+			source.path = path;
+			source.keyOffset = static_cast<uint64_t>(key_offset);
+			source.jointCount = joint_count;
+			if (!file || !ClipStream::SourceValid(source, frame_count))
+			{
+				source = {};
+				file.clear();
+				file.seekg(key_offset);
+				readKeyframes();
+				if (!file)
+				{
+					return false;
+				}
+			}
+		}
+
+		mesh.skinnedVertexStride = 0;
+		for (const Lod& lod : mesh.lods)
+		{
+			mesh.skinnedVertexStride = max(mesh.skinnedVertexStride, lod.vertexCount);
+		}
 
 		mesh.indices.resize(player_index_count);
 		mesh.vertices.resize(player_vertex_count);
@@ -868,6 +1777,12 @@ namespace MRenderer
 			tri[0] = tri[2];
 			tri[2] = temp;
 		}
+		for (size_t i = 0; i < mesh.meshletTriangles.size(); i += 3)
+		{
+			uint8_t temp = mesh.meshletTriangles[i];
+			mesh.meshletTriangles[i] = mesh.meshletTriangles[i + 2];
+			mesh.meshletTriangles[i + 2] = temp;
+		}
 
 		for (int i = 0; i < inputMesh.vertices.size(); i++)
 		{
@@ -884,10 +1799,7 @@ namespace MRenderer
 			mesh.vertices[i].tex.y = inputMesh.vertices[i].tex.y;
 
 			mesh.vertices[i].joints = inputMesh.vertices[i].joints;
-			mesh.vertices[i].weights.x = inputMesh.vertices[i].weights.x;
-			mesh.vertices[i].weights.y = inputMesh.vertices[i].weights.y;
-			mesh.vertices[i].weights.z = inputMesh.vertices[i].weights.z;
-			mesh.vertices[i].weights.w = inputMesh.vertices[i].weights.w;
+			mesh.vertices[i].weights = packedWeights[i];
 
 		}
 		for (int i = 0; i < inputMesh.indices.size(); i++)
@@ -895,9 +1807,25 @@ namespace MRenderer
 			mesh.indices[i] = inputMesh.indices[i];
 		}
 
+		// Bounding sphere of the full detail level, about the centre of its bounds; levels of detail are picked by its size on screen.
+		const Lod& full = mesh.lods[0];
+		XMVECTOR lo = XMVectorReplicate(FLT_MAX);
+		XMVECTOR hi = XMVectorReplicate(-FLT_MAX);
+		for (uint32_t i = full.vertexStart; i < full.vertexStart + full.vertexCount; i++)
+		{
+			lo = XMVectorMin(lo, XMLoadFloat4(&mesh.vertices[i].position));
+			hi = XMVectorMax(hi, XMLoadFloat4(&mesh.vertices[i].position));
+		}
+		const XMVECTOR center = full.vertexCount > 0 ? XMVectorScale(XMVectorAdd(lo, hi), 0.5f) : XMVectorZero();
+		float radius = 0.0f;
+		for (uint32_t i = full.vertexStart; i < full.vertexStart + full.vertexCount; i++)
+		{
+			radius = max(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat4(&mesh.vertices[i].position), center))));
+		}
+		XMStoreFloat3(&mesh.boundsCenter, center);
+		mesh.boundsRadius = radius;
 
-
-		std::cout << "File Loaded\n";
+		return true;
 	}
 
 	bool GraphicsApplication::CreateDevice()
@@ -938,6 +1866,13 @@ namespace MRenderer
 			exit(hr);
 		}
 
+		// Create the fence the frame ring throttles on.
+		if (!m_frameQueue.Initialize(m_device.Get(), m_commandQueue.Get()))
+		{
+			return false;
+		}
+		m_frames.SetQueue(&m_frameQueue);
+
 		return true;
 	}
 
@@ -996,8 +1931,10 @@ namespace MRenderer
 
 
 			// Describe and create a constant buffer view (CBV) descriptor heap and a srv heap.
+			// Each frame in flight gets its own copy of the texture table, so a texture streamed in
+			// mid-run never changes descriptors a frame still on the GPU is using.
 			D3D12_DESCRIPTOR_HEAP_DESC cbvHeapDesc = {};
-			cbvHeapDesc.NumDescriptors = 4;
+			cbvHeapDesc.NumDescriptors = TEXTURE_SLOT_COUNT * m_frames.Latency();
 			cbvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 			cbvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 			cbvHeapDesc.NodeMask = 0;
@@ -1008,6 +1945,9 @@ namespace MRenderer
 				exit(hr);
 			}
 
+			// Every texture's SRV lives in the resource manager's CPU only heap and is copied into the frame's table.
+			m_resources.Initialize(m_device.Get(), MaxTextureDescriptors);
+
 			m_cbvDescriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
 			D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc = {};
@@ -1076,13 +2016,15 @@ namespace MRenderer
 
 	bool GraphicsApplication::CreateFrameAllocator()
 	{
-		
-		// Create the command allocator.
-		HRESULT hr = m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_commandAllocator));
-		if (FAILED(hr))
+		// Create a command allocator per frame in flight, one can only be reset once the GPU is done with it.
+		for (UINT i = 0; i < m_frames.Latency(); ++i)
 		{
-			std::cout << "Failed to create the Command Allocator\n";
-			exit(hr);
+			HRESULT hr = m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_frames[i].commandAllocator));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create the Command Allocator\n";
+				exit(hr);
+			}
 		}
 
 		return true;
@@ -1100,23 +2042,24 @@ namespace MRenderer
 			featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
 		}
 
-		// Create a root signature that has a descriptor table with one CBV and one SRV.
+		// Create a root signature that has four root CBVs and a descriptor table with three SRVs.
 		{
-			CD3DX12_DESCRIPTOR_RANGE1 ranges[2] = {};
-			CD3DX12_ROOT_PARAMETER1 rootParameters[2] = {};
-
-			ranges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
-			ranges[0].NumDescriptors = 1;
-			ranges[0].BaseShaderRegister = 0;
-			ranges[0].RegisterSpace = 0;
-			ranges[0].Flags = D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC;
-			ranges[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+			CD3DX12_DESCRIPTOR_RANGE1 ranges[1] = {};
+			CD3DX12_ROOT_PARAMETER1 rootParameters[ROOT_PARAMETER_COUNT] = {};
 
-			ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
+			ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
 			//ranges[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
 
-			rootParameters[0].InitAsDescriptorTable(1, &ranges[0], D3D12_SHADER_VISIBILITY_ALL);
-			rootParameters[1].InitAsDescriptorTable(1, &ranges[1], D3D12_SHADER_VISIBILITY_PIXEL);
+			// Constants are root CBVs split by update frequency (see ShaderConstants.hpp), so each can point
+			// at wherever this frame's copy lives without touching the descriptor heap.
+			rootParameters[ROOT_PER_FRAME].InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_ALL);
+			rootParameters[ROOT_PER_MATERIAL].InitAsConstantBufferView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_PIXEL);
+			rootParameters[ROOT_PER_OBJECT].InitAsConstantBufferView(2, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_ALL);
+			rootParameters[ROOT_INSTANCES].InitAsShaderResourceView(3, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+			rootParameters[ROOT_SKIN_PALETTES].InitAsShaderResourceView(4, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+			rootParameters[ROOT_SKINNING_CONSTANTS].InitAsConstants(sizeof(SkinningConstants) / 4, 3, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+			rootParameters[ROOT_PRESKINNED_VERTICES].InitAsShaderResourceView(5, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+			rootParameters[ROOT_TEXTURES].InitAsDescriptorTable(1, &ranges[0], D3D12_SHADER_VISIBILITY_PIXEL);
 			//rootParameters[2].(1, &ranges[2], D3D12_SHADER_VISIBILITY_PIXEL);
 
 			//rootParameters[1].InitAsShaderResourceView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_PIXEL);
@@ -1169,6 +2112,42 @@ namespace MRenderer
 			}
 		}
 
+		// Create the compute root signature for the pre-skinning pass, root descriptors only.
+		{
+			CD3DX12_ROOT_PARAMETER1 rootParameters[SKINNING_ROOT_PARAMETER_COUNT] = {};
+
+			rootParameters[SKINNING_ROOT_CONSTANTS].InitAsConstants(sizeof(SkinningConstants) / 4, 3);
+			rootParameters[SKINNING_ROOT_INSTANCES].InitAsShaderResourceView(3);
+			rootParameters[SKINNING_ROOT_PALETTES].InitAsShaderResourceView(4);
+			rootParameters[SKINNING_ROOT_SOURCE].InitAsShaderResourceView(6, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC);
+			rootParameters[SKINNING_ROOT_OUTPUT].InitAsUnorderedAccessView(0);
+
+			D3D12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDesc;
+
+			rootSignatureDesc.Version = D3D_ROOT_SIGNATURE_VERSION_1_1;
+			rootSignatureDesc.Desc_1_1.NumParameters = _countof(rootParameters);
+			rootSignatureDesc.Desc_1_1.pParameters = rootParameters;
+			rootSignatureDesc.Desc_1_1.NumStaticSamplers = 0;
+			rootSignatureDesc.Desc_1_1.pStaticSamplers = nullptr;
+			rootSignatureDesc.Desc_1_1.Flags = D3D12_ROOT_SIGNATURE_FLAG_NONE;
+
+			ComPtr<ID3DBlob> signature;
+			ComPtr<ID3DBlob> error;
+			hr = D3DX12SerializeVersionedRootSignature(&rootSignatureDesc, featureData.HighestVersion, &signature, &error);
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to serialize the compute root signature. \n";
+				exit(hr);
+			}
+
+			hr = m_device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&m_computeRootSignature));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create the compute root signature. \n";
+				exit(hr);
+			}
+		}
+
 		return true;
 	}
 
@@ -1186,17 +2165,17 @@ namespace MRenderer
 				{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 				{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 48, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 				{ "JOINTS", 0, DXGI_FORMAT_R32G32B32A32_SINT, 0, 56, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-				{ "WEIGHTS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 72, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+				{ "WEIGHTS", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 72, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 
-				{ "INSTANCEPOS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 0},
+				// No per-instance stream, the skinned vertex shader reads its instance from the Instances buffer.
 			};
 
 			// Describe and create the graphics pipeline state object (PSO).
 			D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
 			psoDesc.InputLayout = { inputElementDescs, _countof(inputElementDescs) };
 			psoDesc.pRootSignature = m_rootSignature.Get();
-			psoDesc.PS = { DefaultCube.pixelShaderByteCode, DefaultCube.pixelShaderByteCodeSize };
-			psoDesc.VS = { DefaultCube.vertexShaderByteCode, DefaultCube.vertexShaderByteCodeSize };
+			psoDesc.PS = { DefaultCube.pixelShaderByteCode.data(), DefaultCube.pixelShaderByteCode.size() };
+			psoDesc.VS = { DefaultCube.vertexShaderByteCode.data(), DefaultCube.vertexShaderByteCode.size() };
 
 			D3D12_RASTERIZER_DESC rasterizerDesc;
 			rasterizerDesc.FillMode = D3D12_FILL_MODE_SOLID;
@@ -1246,12 +2225,34 @@ namespace MRenderer
 				std::cout << "Failed to create the graphics pipeline state. \n";
 				exit(hr);
 			}
-		}
-		// Create the pipeline state, which includes loading shaders.
-		{
 
-			//CreateDDSTextureFromFile(m_device.Get(), L"../Macaw.dds", 0, false, nullptr, );
-				// Define the vertex input layout.
+			// Same state for the influence buckets with fewer than four influences, built for that many.
+			for (uint32_t bucket = 0; bucket + 1 < InfluenceBucketCount; bucket++)
+			{
+				psoDesc.VS = { m_skinnedVertexShaders[bucket].data(), m_skinnedVertexShaders[bucket].size() };
+				hr = m_device->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&m_skinnedStates[bucket]));
+				if (FAILED(hr))
+				{
+					std::cout << "Failed to create the skinned pipeline state for " << BucketInfluences[bucket] << " influences. \n";
+					exit(hr);
+				}
+			}
+			m_skinnedStates[InfluenceBucketCount - 1] = DefaultCube.pipelineState;
+
+			// Same state, but the vertex shader reads what the pre-skinning pass wrote.
+			psoDesc.VS = { m_preSkinnedVertexShader.data(), m_preSkinnedVertexShader.size() };
+			hr = m_device->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&m_preSkinnedState));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create the pre-skinned pipeline state. \n";
+				exit(hr);
+			}
+		}
+		// Create the pipeline state, which includes loading shaders.
+		{
+
+			//CreateDDSTextureFromFile(m_device.Get(), L"../Macaw.dds", 0, false, nullptr, );
+				// Define the vertex input layout.
 			D3D12_INPUT_ELEMENT_DESC inputElementDescs[] =
 			{
 				{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
@@ -1259,7 +2260,7 @@ namespace MRenderer
 				{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 				{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 48, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 				{ "JOINTS", 0, DXGI_FORMAT_R32G32B32A32_SINT, 0, 56, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-				{ "WEIGHTS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 72, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+				{ "WEIGHTS", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 72, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 
 				{ "INSTANCEPOS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 0},
 
@@ -1269,8 +2270,8 @@ namespace MRenderer
 			D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
 			psoDesc.InputLayout = { inputElementDescs, _countof(inputElementDescs) };
 			psoDesc.pRootSignature = m_rootSignature.Get();
-			psoDesc.PS = { DefaultLineRenderer.pixelShaderByteCode, DefaultLineRenderer.pixelShaderByteCodeSize };
-			psoDesc.VS = { DefaultLineRenderer.vertexShaderByteCode, DefaultLineRenderer.vertexShaderByteCodeSize };
+			psoDesc.PS = { DefaultLineRenderer.pixelShaderByteCode.data(), DefaultLineRenderer.pixelShaderByteCode.size() };
+			psoDesc.VS = { DefaultLineRenderer.vertexShaderByteCode.data(), DefaultLineRenderer.vertexShaderByteCode.size() };
 
 			D3D12_RASTERIZER_DESC rasterizerDesc;
 			rasterizerDesc.FillMode = D3D12_FILL_MODE_SOLID;
@@ -1321,6 +2322,20 @@ namespace MRenderer
 				exit(hr);
 			}
 		}
+		// Create the pre-skinning compute pipeline states, one per influence bucket.
+		for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+		{
+			D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+			psoDesc.pRootSignature = m_computeRootSignature.Get();
+			psoDesc.CS = { m_skinningComputeShaders[bucket].data(), m_skinningComputeShaders[bucket].size() };
+
+			HRESULT hr = m_device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_computeStates[bucket]));
+			if (FAILED(hr))
+			{
+				std::cout << "Failed to create the compute pipeline state for " << BucketInfluences[bucket] << " influences. \n";
+				exit(hr);
+			}
+		}
 
 		return true;
 	}
@@ -1328,7 +2343,7 @@ namespace MRenderer
 	bool GraphicsApplication::CreateCommandList()
 	{
 		// Create the command list.
-		HRESULT hr = m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_commandAllocator.Get(), DefaultCube.pipelineState.Get(), IID_PPV_ARGS(&m_commandList));
+		HRESULT hr = m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_frames[0].commandAllocator.Get(), DefaultCube.pipelineState.Get(), IID_PPV_ARGS(&m_commandList));
 		if (FAILED(hr))
 		{
 			std::cout << "Failed to create the command list. \n";
@@ -1397,50 +2412,29 @@ namespace MRenderer
 
 	bool GraphicsApplication::CreateShaders()
 	{
+		// Every compiled shader the viewer uses. WatchFiles() reloads them from here when they're rebuilt.
+		m_shaderFiles =
+		{
+			{ "../x64/Debug/BlinnPhongPixel.cso", &DefaultCube.pixelShaderByteCode },
+			{ "../x64/Debug/BlinnPhongVertex.cso", &DefaultCube.vertexShaderByteCode },
+			{ "../x64/Debug/BlinnPhongVertex1.cso", &m_skinnedVertexShaders[0] },
+			{ "../x64/Debug/BlinnPhongVertex2.cso", &m_skinnedVertexShaders[1] },
+			{ "../x64/Debug/DebugLinePixel.cso", &DefaultLineRenderer.pixelShaderByteCode },
+			{ "../x64/Debug/DebugLineVertex.cso", &DefaultLineRenderer.vertexShaderByteCode },
+			{ "../x64/Debug/SkinningCompute1.cso", &m_skinningComputeShaders[0] },
+			{ "../x64/Debug/SkinningCompute2.cso", &m_skinningComputeShaders[1] },
+			{ "../x64/Debug/SkinningCompute.cso", &m_skinningComputeShaders[2] },
+			{ "../x64/Debug/PreSkinnedVertex.cso", &m_preSkinnedVertexShader },
+		};
+
+		for (const ShaderFile& shader : m_shaderFiles)
 		{
 			std::fstream fin;
 			//char d[MAX_PATH];
 
 			//GetCurrentDirectoryA(MAX_PATH, d);
 
-			fin.open("../x64/Debug/BlinnPhongPixel.cso", std::ios_base::in | std::ios_base::binary);
-
-			assert(fin.is_open());
-
-			fin.seekg(0, fin.end);
-			size_t length = fin.tellg();
-			fin.seekg(0, fin.beg);
-
-			DefaultCube.pixelShaderByteCode = new char[length];
-			DefaultCube.pixelShaderByteCodeSize = length;
-
-			fin.read(DefaultCube.pixelShaderByteCode, length);
-
-			fin.close();
-
-			fin.open("../x64/Debug/BlinnPhongVertex.cso", std::ios_base::in | std::ios_base::binary);
-
-			assert(fin.is_open());
-
-			fin.seekg(0, fin.end);
-			length = fin.tellg();
-			fin.seekg(0, fin.beg);
-
-			DefaultCube.vertexShaderByteCode = new char[length];
-			DefaultCube.vertexShaderByteCodeSize = length;
-
-			fin.read(DefaultCube.vertexShaderByteCode, length);
-
-			fin.close();
-		}
-
-		{
-			std::fstream fin;
-			//char d[MAX_PATH];
-
-			//GetCurrentDirectoryA(MAX_PATH, d);
-
-			fin.open("../x64/Debug/DebugLinePixel.cso", std::ios_base::in | std::ios_base::binary);
+			fin.open(shader.path, std::ios_base::in | std::ios_base::binary);
 
 			assert(fin.is_open());
 
@@ -1448,25 +2442,8 @@ namespace MRenderer
 			size_t length = fin.tellg();
 			fin.seekg(0, fin.beg);
 
-			DefaultLineRenderer.pixelShaderByteCode = new char[length];
-			DefaultLineRenderer.pixelShaderByteCodeSize = length;
-
-			fin.read(DefaultLineRenderer.pixelShaderByteCode, length);
-
-			fin.close();
-
-			fin.open("../x64/Debug/DebugLineVertex.cso", std::ios_base::in | std::ios_base::binary);
-
-			assert(fin.is_open());
-
-			fin.seekg(0, fin.end);
-			length = fin.tellg();
-			fin.seekg(0, fin.beg);
-
-			DefaultLineRenderer.vertexShaderByteCode = new char[length];
-			DefaultLineRenderer.vertexShaderByteCodeSize = length;
-
-			fin.read(DefaultLineRenderer.vertexShaderByteCode, length);
+			shader.byteCode->resize(length);
+			fin.read(shader.byteCode->data(), length);
 
 			fin.close();
 		}
@@ -1487,7 +2464,7 @@ namespace MRenderer
 
 			D3D12_RESOURCE_DESC resourceDesc;
 			resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-			resourceDesc.Width = 1024 * 64;
+			resourceDesc.Width = ConstantPacker::aligned_size(sizeof(PerFrameConstants));
 			resourceDesc.Alignment = 0;
 			resourceDesc.Height = 1;
 			resourceDesc.DepthOrArraySize = 1;
@@ -1498,32 +2475,32 @@ namespace MRenderer
 			resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
 			resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
 
-			HRESULT hr = m_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
-				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr,
-				IID_PPV_ARGS(&m_constantBuffer));
-			if (FAILED(hr))
+			// One per-frame constant buffer per frame in flight, bound as a root CBV, so Update() never
+			// writes over constants the GPU is still reading. Per-object constants and palettes come from the upload ring.
+			for (UINT i = 0; i < m_frames.Latency(); ++i)
 			{
-				std::cout << "Failed to create the descriptor heap for the constant buffer. \n";
-				exit(hr);
-			}
+				FrameResources& frame = m_frames[i];
 
-			// Create the constant buffer view
-			D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
-			cbvDesc.BufferLocation = m_constantBuffer->GetGPUVirtualAddress();
-			cbvDesc.SizeInBytes = (sizeof(ConstantBuffer) + 255) & ~255;
-			m_device->CreateConstantBufferView(&cbvDesc, m_cbvHeap->GetCPUDescriptorHandleForHeapStart());
+				HRESULT hr = m_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+					D3D12_RESOURCE_STATE_GENERIC_READ, nullptr,
+					IID_PPV_ARGS(&frame.perFrameBuffer));
+				if (FAILED(hr))
+				{
+					std::cout << "Failed to create the descriptor heap for the constant buffer. \n";
+					exit(hr);
+				}
 
-			// Create the constant buffer
-			D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
-			readRange.Begin = 0;
-			readRange.End = 0;
-			hr = m_constantBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pCbvDataBegin));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to map the constant buffer. \n";
-				exit(hr);
+				// Upload heaps stay mapped for the lifetime of the resource.
+				D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
+				readRange.Begin = 0;
+				readRange.End = 0;
+				hr = frame.perFrameBuffer->Map(0, &readRange, reinterpret_cast<void**>(&frame.perFrameData));
+				if (FAILED(hr))
+				{
+					std::cout << "Failed to map the constant buffer. \n";
+					exit(hr);
+				}
 			}
-			memcpy(m_pCbvDataBegin, &m_constantBufferData, sizeof(m_constantBufferData));
 
 			// Create the shader resource view
 
@@ -1547,64 +2524,39 @@ namespace MRenderer
 			m_projection = XMMatrixPerspectiveFovLH(XM_PIDIV4, m_windowWidth / (FLOAT)m_windowHeight, 0.01f, 100.0f);
 
 
-			m_constantBufferData.GlobalAmbient = { 0.2f, 0.2f, 0.2f, 0.2f };
-
-			m_constantBufferData.Material.Ambient = { 1.0f, 1.0f, 1.0f, 1.0f };
-			m_constantBufferData.Material.AmbientFactor = 1.0f;
-			m_constantBufferData.Material.SpecularPower = 3.0f;
-
-			m_constantBufferData.Material.UseTexture = 1;
-
-			m_constantBufferData.Material.Diffuse.x = DefaultCube.mesh.materials[0][Material::DIFFUSE].value[0];
-			m_constantBufferData.Material.Diffuse.y = DefaultCube.mesh.materials[0][Material::DIFFUSE].value[1];
-			m_constantBufferData.Material.Diffuse.z = DefaultCube.mesh.materials[0][Material::DIFFUSE].value[2];
-			m_constantBufferData.Material.Diffuse.w = 1.0f;
+			m_perFrameData.GlobalAmbient = { 0.2f, 0.2f, 0.2f, 0.2f };
 
-			m_constantBufferData.Material.DiffuseFactor = DefaultCube.mesh.materials[0][Material::DIFFUSE].factor;
-
-			m_constantBufferData.Material.Emissive.x = DefaultCube.mesh.materials[0][Material::EMISSIVE].value[0];
-			m_constantBufferData.Material.Emissive.y = DefaultCube.mesh.materials[0][Material::EMISSIVE].value[1];
-			m_constantBufferData.Material.Emissive.z = DefaultCube.mesh.materials[0][Material::EMISSIVE].value[2];
-			m_constantBufferData.Material.Emissive.w = 1.0f;
-
-			m_constantBufferData.Material.EmissiveFactor = DefaultCube.mesh.materials[0][Material::EMISSIVE].factor;
-
-			m_constantBufferData.Material.Specular.x = DefaultCube.mesh.materials[0][Material::SPECULAR].value[0];
-			m_constantBufferData.Material.Specular.y = DefaultCube.mesh.materials[0][Material::SPECULAR].value[1];
-			m_constantBufferData.Material.Specular.z = DefaultCube.mesh.materials[0][Material::SPECULAR].value[2];
-			m_constantBufferData.Material.Specular.w = 1.0f;
-
-			m_constantBufferData.Material.SpecularFactor = DefaultCube.mesh.materials[0][Material::SPECULAR].factor;
+			CreateMaterialBuffer();
 
 			for (size_t i = 0; i < MAX_LIGHTS; i++)
 			{
-				m_constantBufferData.Lights[i].Enabled = 0;
+				m_perFrameData.Lights[i].Enabled = 0;
 			}
 
-			m_constantBufferData.Lights[0].Color = { 1.0f, 1.0f, 1.0f, 1.0f };
-			m_constantBufferData.Lights[0].LightType = ShaderLightType::POINT_LIGHT;
-			m_constantBufferData.Lights[0].Enabled = 1;
-			m_constantBufferData.Lights[0].LightPower = 1.0f;
+			m_perFrameData.Lights[0].Color = { 1.0f, 1.0f, 1.0f, 1.0f };
+			m_perFrameData.Lights[0].LightType = ShaderLightType::POINT_LIGHT;
+			m_perFrameData.Lights[0].Enabled = 1;
+			m_perFrameData.Lights[0].LightPower = 1.0f;
 
-			m_constantBufferData.Lights[0].ConstantAttenuation = 1.0f;
-			m_constantBufferData.Lights[0].LinearAttenuation = 0.2f;
-			m_constantBufferData.Lights[0].QuadraticAttenuation = 0.1f;
+			m_perFrameData.Lights[0].ConstantAttenuation = 1.0f;
+			m_perFrameData.Lights[0].LinearAttenuation = 0.2f;
+			m_perFrameData.Lights[0].QuadraticAttenuation = 0.1f;
 
-			m_constantBufferData.Lights[0].Position = { -1.0f, 2.5f, 2.0f, 1.0f };
+			m_perFrameData.Lights[0].Position = { -1.0f, 2.5f, 2.0f, 1.0f };
 
-			m_constantBufferData.Lights[1].Color = { 1.0f, 1.0f, 1.0f, 1.0f };
-			m_constantBufferData.Lights[1].LightType = ShaderLightType::DIRECTIONAL_LIGHT;
-			m_constantBufferData.Lights[1].Enabled = 1;
-			m_constantBufferData.Lights[1].LightPower = 1.0f;
+			m_perFrameData.Lights[1].Color = { 1.0f, 1.0f, 1.0f, 1.0f };
+			m_perFrameData.Lights[1].LightType = ShaderLightType::DIRECTIONAL_LIGHT;
+			m_perFrameData.Lights[1].Enabled = 1;
+			m_perFrameData.Lights[1].LightPower = 1.0f;
 										
-			m_constantBufferData.Lights[1].Direction = { 0.0f, -0.5f, 1.0f, 1.0f };
+			m_perFrameData.Lights[1].Direction = { 0.0f, -0.5f, 1.0f, 1.0f };
 
-			m_constantBufferData.Lights[2].Color = { 1.0f, 1.0f, 1.0f, 1.0f };
-			m_constantBufferData.Lights[2].LightType = ShaderLightType::DIRECTIONAL_LIGHT;
-			m_constantBufferData.Lights[2].Enabled = 1;
-			m_constantBufferData.Lights[2].LightPower = 0.25f;
+			m_perFrameData.Lights[2].Color = { 1.0f, 1.0f, 1.0f, 1.0f };
+			m_perFrameData.Lights[2].LightType = ShaderLightType::DIRECTIONAL_LIGHT;
+			m_perFrameData.Lights[2].Enabled = 1;
+			m_perFrameData.Lights[2].LightPower = 0.25f;
 										
-			m_constantBufferData.Lights[2].Direction = { 0.0f, -0.5f, -1.0f, 1.0f };
+			m_perFrameData.Lights[2].Direction = { 0.0f, -0.5f, -1.0f, 1.0f };
 
 			//m_constantBufferData.vLightDir[0] = { -0.577f, 0.577f, -0.577f, 1.0f };
 			//m_constantBufferData.vLightDir[1] = { 10.0f, 0.0f, 0.0f, 1.0f };
@@ -1639,6 +2591,158 @@ namespace MRenderer
 		return true;
 	}
 
+	bool GraphicsApplication::CreateMaterialBuffer()
+	{
+		// Materials only change when the mesh is (re)loaded, so they get one static buffer with a 256 byte aligned slot each.
+		const UINT64 materialStride = ConstantPacker::aligned_size(sizeof(PerMaterialConstants));
+		const UINT64 bufferSize = materialStride * max(DefaultCube.mesh.materials.size(), size_t(1));
+
+		HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
+			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr,
+			IID_PPV_ARGS(&m_materialBuffer));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the material constant buffer. \n";
+			exit(hr);
+		}
+
+		UINT8* materialData = nullptr;
+		D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
+		readRange.Begin = 0;
+		readRange.End = 0;
+		hr = m_materialBuffer->Map(0, &readRange, reinterpret_cast<void**>(&materialData));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to map the material constant buffer. \n";
+			exit(hr);
+		}
+
+		for (size_t i = 0; i < DefaultCube.mesh.materials.size(); i++)
+		{
+			PerMaterialConstants material = {};
+
+			material.Material.Ambient = { 1.0f, 1.0f, 1.0f, 1.0f };
+			material.Material.AmbientFactor = 1.0f;
+			material.Material.SpecularPower = 3.0f;
+
+			material.Material.UseTexture = 1;
+
+			material.Material.Diffuse.x = DefaultCube.mesh.materials[i][Material::DIFFUSE].value[0];
+			material.Material.Diffuse.y = DefaultCube.mesh.materials[i][Material::DIFFUSE].value[1];
+			material.Material.Diffuse.z = DefaultCube.mesh.materials[i][Material::DIFFUSE].value[2];
+			material.Material.Diffuse.w = 1.0f;
+
+			material.Material.DiffuseFactor = DefaultCube.mesh.materials[i][Material::DIFFUSE].factor;
+
+			material.Material.Emissive.x = DefaultCube.mesh.materials[i][Material::EMISSIVE].value[0];
+			material.Material.Emissive.y = DefaultCube.mesh.materials[i][Material::EMISSIVE].value[1];
+			material.Material.Emissive.z = DefaultCube.mesh.materials[i][Material::EMISSIVE].value[2];
+			material.Material.Emissive.w = 1.0f;
+
+			material.Material.EmissiveFactor = DefaultCube.mesh.materials[i][Material::EMISSIVE].factor;
+
+			material.Material.Specular.x = DefaultCube.mesh.materials[i][Material::SPECULAR].value[0];
+			material.Material.Specular.y = DefaultCube.mesh.materials[i][Material::SPECULAR].value[1];
+			material.Material.Specular.z = DefaultCube.mesh.materials[i][Material::SPECULAR].value[2];
+			material.Material.Specular.w = 1.0f;
+
+			material.Material.SpecularFactor = DefaultCube.mesh.materials[i][Material::SPECULAR].factor;
+
+			memcpy(materialData + i * materialStride, &material, sizeof(material));
+		}
+		m_materialBuffer->Unmap(0, nullptr);
+
+		return true;
+	}
+
+	bool GraphicsApplication::CreateUploadRing()
+	{
+		// Room for a full debug line buffer, the object constants and the largest crowd from every frame in flight.
+		// The extra frame covers alignment and the padding lost when an allocation wraps.
+		const UINT64 crowdBytes = UINT64(MaxCrowdSide) * MaxCrowdSide * (sizeof(GpuInstance) + m_clips[0].jointCount * sizeof(Matrix4));
+		const UINT64 frameBytes = DebugRenderer::get_line_vert_capacity() * sizeof(Vertex)
+			+ ConstantPacker::aligned_size(sizeof(PerObjectConstants)) + crowdBytes;
+		const UINT64 ringSize = (m_frames.Latency() + 1) * frameBytes;
+
+		D3D12_HEAP_PROPERTIES heapProperties;
+		heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
+		heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
+		heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+		heapProperties.CreationNodeMask = 1;
+		heapProperties.VisibleNodeMask = 1;
+
+		D3D12_RESOURCE_DESC resourceDesc;
+		resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		resourceDesc.Width = ringSize;
+		resourceDesc.Alignment = 0;
+		resourceDesc.Height = 1;
+		resourceDesc.DepthOrArraySize = 1;
+		resourceDesc.MipLevels = 1;
+		resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
+		resourceDesc.SampleDesc.Count = 1;
+		resourceDesc.SampleDesc.Quality = 0;
+		resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+		resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+		HRESULT hr = m_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr,
+			IID_PPV_ARGS(&m_uploadBuffer));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the upload ring buffer. \n";
+			exit(hr);
+		}
+
+		// Mapped once and left mapped until shutdown.
+		void* ringData = nullptr;
+		D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
+		readRange.Begin = 0;
+		readRange.End = 0;
+		hr = m_uploadBuffer->Map(0, &readRange, &ringData);
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to map the upload ring buffer. \n";
+			exit(hr);
+		}
+
+		m_uploadRing.Initialize(ringData, m_uploadBuffer->GetGPUVirtualAddress(), ringSize);
+
+		return true;
+	}
+
+	bool GraphicsApplication::CreateSkinnedVertexBuffer(UINT instanceCount)
+	{
+		if (instanceCount <= m_skinnedVertexCapacity)
+		{
+			return true;
+		}
+
+		// Only grows, and only when the crowd does. The old buffer may still be in use by frames in flight,
+		// unless the caller has already retired it.
+		if (m_skinnedVertexBuffer)
+		{
+			WaitForGpu();
+		}
+		m_skinnedVertexBuffer.Reset();
+		m_skinnedVertexCapacity = 0;
+
+		const UINT64 bufferSize = UINT64(instanceCount) * DefaultCube.mesh.skinnedVertexStride * sizeof(SkinnedVertex);
+
+		CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+		CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(bufferSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		HRESULT hr = m_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, nullptr,
+			IID_PPV_ARGS(&m_skinnedVertexBuffer));
+		if (FAILED(hr))
+		{
+			std::cout << "Failed to create the skinned vertex buffer. \n";
+			exit(hr);
+		}
+
+		m_skinnedVertexCapacity = instanceCount;
+		return true;
+	}
+
 	bool GraphicsApplication::CreateVertexBuffers()
 	{
 		// Create the vertex buffer.
@@ -1682,131 +2786,16 @@ namespace MRenderer
 			//DefaultCube.mesh.vertices.resize(_countof(vertices));
 			//memcpy(DefaultCube.mesh.vertices.data(), vertices, vertexBufferSize);
 
-			// Note: using upload heaps to transfer static data like vert buffers is not 
-			// recommended. Every time the GPU needs it, the upload heap will be marshalled 
-			// over. Please read up on Default Heap usage. An upload heap is used here for 
-			// code simplicity and because there are very few verts to actually transfer.
-			D3D12_HEAP_PROPERTIES heapProperties;
-			heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
-			heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-			heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-			heapProperties.CreationNodeMask = 1;
-			heapProperties.VisibleNodeMask = 1;
-
-			D3D12_RESOURCE_DESC resourceDesc;
-			resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-			resourceDesc.Width = vertexBufferSize;
-			resourceDesc.Alignment = 0;
-			resourceDesc.Height = 1;
-			resourceDesc.DepthOrArraySize = 1;
-			resourceDesc.MipLevels = 1;
-			resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
-			resourceDesc.SampleDesc.Count = 1;
-			resourceDesc.SampleDesc.Quality = 0;
-			resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-			resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-
-
-			HRESULT hr = (m_device->CreateCommittedResource(
-				&heapProperties,
-				D3D12_HEAP_FLAG_NONE,
-				&resourceDesc,
-				D3D12_RESOURCE_STATE_GENERIC_READ,
-				nullptr,
-				IID_PPV_ARGS(&DefaultCube.vertexBuffer)));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to create the committed resource. \n";
-				exit(hr);
-			}
-
-			// Copy the triangle data to the vertex buffer.
-			UINT8* pVertexDataBegin;
-			D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
-			readRange.Begin = 0;
-			readRange.End = 0;
-			hr = DefaultCube.vertexBuffer->Map(0, &readRange, reinterpret_cast<void**>(&pVertexDataBegin));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to map the vertex buffer. \n";
-				exit(hr);
-			}
-			memcpy(pVertexDataBegin, DefaultCube.mesh.vertices.data(), vertexBufferSize);
-			DefaultCube.vertexBuffer->Unmap(0, nullptr);
+			// A default heap buffer, filled on the copy queue by the next FlushUploads(). The pre-skinning
+			// pass reads it as a structured buffer too.
+			DefaultCube.vertexBuffer = m_resources.CreateBuffer(DefaultCube.mesh.vertices.data(), vertexBufferSize);
 
 			// Initialize the vertex buffer view.
-			DefaultCube.vertexBufferView.BufferLocation = DefaultCube.vertexBuffer->GetGPUVirtualAddress();
+			DefaultCube.vertexBufferView.BufferLocation = m_resources.Resource(DefaultCube.vertexBuffer)->GetGPUVirtualAddress();
 			DefaultCube.vertexBufferView.StrideInBytes = sizeof(Vertex);
 			DefaultCube.vertexBufferView.SizeInBytes = vertexBufferSize;
 		}
 
-		// Create the vertex buffer.
-		{
-			const UINT vertexBufferSize = DebugRenderer::get_line_vert_capacity() * sizeof(Vertex);
-
-			//DefaultCube.mesh.vertices.resize(_countof(vertices));
-			//memcpy(DefaultCube.mesh.vertices.data(), vertices, vertexBufferSize);
-
-			// Note: using upload heaps to transfer static data like vert buffers is not 
-			// recommended. Every time the GPU needs it, the upload heap will be marshalled 
-			// over. Please read up on Default Heap usage. An upload heap is used here for 
-			// code simplicity and because there are very few verts to actually transfer.
-			D3D12_HEAP_PROPERTIES heapProperties;
-			heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
-			heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-			heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-			heapProperties.CreationNodeMask = 1;
-			heapProperties.VisibleNodeMask = 1;
-
-			D3D12_RESOURCE_DESC resourceDesc;
-			resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-			resourceDesc.Width = vertexBufferSize;
-			resourceDesc.Alignment = 0;
-			resourceDesc.Height = 1;
-			resourceDesc.DepthOrArraySize = 1;
-			resourceDesc.MipLevels = 1;
-			resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
-			resourceDesc.SampleDesc.Count = 1;
-			resourceDesc.SampleDesc.Quality = 0;
-			resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-			resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-
-
-			HRESULT hr = (m_device->CreateCommittedResource(
-				&heapProperties,
-				D3D12_HEAP_FLAG_NONE,
-				&resourceDesc,
-				D3D12_RESOURCE_STATE_GENERIC_READ,
-				nullptr,
-				IID_PPV_ARGS(&DefaultLineRenderer.vertexBuffer)));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to create the committed resource. \n";
-				exit(hr);
-			}
-
-			// Copy the triangle data to the vertex buffer.
-			//UINT8* pVertexDataBegin;
-			D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
-			readRange.Begin = 0;
-			readRange.End = 0;
-			hr = DefaultLineRenderer.vertexBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pDebugVertexDataBegin));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to map the vertex buffer. \n";
-				exit(hr);
-			}
-			memcpy(m_pDebugVertexDataBegin, DebugRenderer::get_line_verts(), vertexBufferSize);
-			DefaultLineRenderer.vertexBuffer->Unmap(0, nullptr);
-
-			// Initialize the vertex buffer view.
-			DefaultLineRenderer.vertexBufferView.BufferLocation = DefaultLineRenderer.vertexBuffer->GetGPUVirtualAddress();
-			DefaultLineRenderer.vertexBufferView.StrideInBytes = sizeof(Vertex);
-			DefaultLineRenderer.vertexBufferView.SizeInBytes = vertexBufferSize;
-		}
-
 		return true;
 	}
 
@@ -1840,55 +2829,10 @@ namespace MRenderer
 			//memcpy(DefaultCube.mesh.indices.data(), indices, indexBufferSize);
 
 
-			D3D12_HEAP_PROPERTIES heapProperties;
-			heapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
-			heapProperties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-			heapProperties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
-			heapProperties.CreationNodeMask = 1;
-			heapProperties.VisibleNodeMask = 1;
-
-			D3D12_RESOURCE_DESC resourceDesc;
-			resourceDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-			resourceDesc.Width = indexBufferSize;
-			resourceDesc.Alignment = 0;
-			resourceDesc.Height = 1;
-			resourceDesc.DepthOrArraySize = 1;
-			resourceDesc.MipLevels = 1;
-			resourceDesc.Format = DXGI_FORMAT_UNKNOWN;
-			resourceDesc.SampleDesc.Count = 1;
-			resourceDesc.SampleDesc.Quality = 0;
-			resourceDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-			resourceDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-			HRESULT hr = (m_device->CreateCommittedResource(
-				&heapProperties,
-				D3D12_HEAP_FLAG_NONE,
-				&resourceDesc,
-				D3D12_RESOURCE_STATE_GENERIC_READ,
-				nullptr,
-				IID_PPV_ARGS(&DefaultCube.indexBuffer)));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to create the committed resource. \n";
-				exit(hr);
-			}
-
-			// Copy the index data to the index buffer.
-			UINT32* pIndexDataBegin;
-			D3D12_RANGE readRange;	// We do not intend to read from this resource on the CPU.
-			readRange.Begin = 0;
-			readRange.End = 0;
-			hr = DefaultCube.indexBuffer->Map(0, &readRange, reinterpret_cast<void**>(&pIndexDataBegin));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to map the index buffer. \n";
-				exit(hr);
-			}
-			memcpy(pIndexDataBegin, DefaultCube.mesh.indices.data(), sizeof(UINT32) * DefaultCube.mesh.indices.size());
-			DefaultCube.indexBuffer->Unmap(0, nullptr);
+			DefaultCube.indexBuffer = m_resources.CreateBuffer(DefaultCube.mesh.indices.data(), indexBufferSize);
 
 			// Initialize the index buffer view.
-			DefaultCube.indexBufferView.BufferLocation = DefaultCube.indexBuffer->GetGPUVirtualAddress();
+			DefaultCube.indexBufferView.BufferLocation = m_resources.Resource(DefaultCube.indexBuffer)->GetGPUVirtualAddress();
 			DefaultCube.indexBufferView.SizeInBytes = indexBufferSize;
 			DefaultCube.indexBufferView.Format = DXGI_FORMAT_R32_UINT;
 		}
@@ -1898,41 +2842,8 @@ namespace MRenderer
 
 	bool GraphicsApplication::CreateInstanceBuffers()
 	{
-		// Create the instance buffer
-		{
-			InstanceData instances[1];
-			instances[0] = { {0.0f, 0.0f, 0.0f, 1.0f} };
-
-			UINT instanceBufferSize = sizeof(instances);
-
-			HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-				D3D12_HEAP_FLAG_NONE,
-				&CD3DX12_RESOURCE_DESC::Buffer(instanceBufferSize),
-				D3D12_RESOURCE_STATE_GENERIC_READ,
-				nullptr,
-				IID_PPV_ARGS(&DefaultCube.instanceBuffer));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to create the instance buffer.\n";
-				return hr;
-			}
-
-			UINT8* pInstanceDataBegin;
-			hr = DefaultCube.instanceBuffer->Map(0, &CD3DX12_RANGE(0, 0),
-				reinterpret_cast<void**>(&pInstanceDataBegin));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to map the vertex buffer. \n";
-				return E_FAIL;
-			}
-			memcpy(pInstanceDataBegin, instances, instanceBufferSize);
-			DefaultCube.instanceBuffer->Unmap(0, nullptr);
-
-			// Initialize the vertex buffer view.
-			DefaultCube.instanceBufferView.BufferLocation = DefaultCube.instanceBuffer->GetGPUVirtualAddress();
-			DefaultCube.instanceBufferView.StrideInBytes = sizeof(InstanceData);
-			DefaultCube.instanceBufferView.SizeInBytes = instanceBufferSize;
-		}
+		// Only the debug lines still take their offset from a vertex stream, the crowd reads its instances
+		// from a structured buffer built each frame.
 		// Create the instance buffer
 		{
 			InstanceData instances[1];
@@ -1974,254 +2885,200 @@ namespace MRenderer
 
 	bool GraphicsApplication::CreateTextures()
 	{
-		// TODO::
-		// Need to get DirectXTex to compile and run, need to make sure that the filepath is correct and points to the correct place, need to make sure that the texture shows up and populates on the model itself. 
-		// Need to get other textures up and running and into the shader as well.
-		// Just got the .lib file from the github repo and placed it into the project, still need to include the library since I went to bed.
-
-
+		PROFILE_ZONE("CreateTextures");
 
-		// Create the diffuse texture
+		// Every slot starts out as a 1x1 texture that leaves the material's own colour unchanged, so the
+		// mesh can be drawn straight away while the real images stream in on the asset loader.
+		const uint8_t placeholderColors[TEXTURE_SLOT_COUNT][4] =
 		{
+			{ 255, 255, 255, 255 }, // TEXTURE_DIFFUSE
+			{ 0, 0, 0, 255 },       // TEXTURE_EMISSIVE
+			{ 255, 255, 255, 255 }, // TEXTURE_SPECULAR
+		};
 
-			TexMetadata texMetaData;
-			ScratchImage scratchImage;
-			//TextureUsage
-
-			std::string filepath = DefaultCube.mesh.materialPaths[DefaultCube.mesh.materials[0][Material::DIFFUSE].input].c_str();
-			std::wstring filepathw = std::wstring(filepath.begin(), filepath.end());
-			LoadFromWICFile(filepathw.c_str(), WIC_FLAGS_FORCE_RGB, &texMetaData, scratchImage); //used for .png .bmp or whatever WIC has.
-
-			D3D12_RESOURCE_DESC textureDesc = {};
-			textureDesc.MipLevels = 1;
-			textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-			textureDesc.Width = texMetaData.width;
-			textureDesc.Height = texMetaData.height;
-			textureDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-			textureDesc.DepthOrArraySize = texMetaData.arraySize;
-			textureDesc.SampleDesc.Count = 1;
-			textureDesc.SampleDesc.Quality = 0;
-			textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-
-			HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_texture));
-			if (FAILED(hr))
-			{
-				std::cout << "Failed to create the descriptor heap for the constant buffer. \n";
-				return E_FAIL;
-			}
-
-			const UINT64 uploadBufferSize = GetRequiredIntermediateSize(m_texture.Get(), 0, scratchImage.GetImageCount());
-			//m_device->GetCopyableFootprints(&m_texture->GetDesc(), 0, 1, 0, nullptr, nullptr, nullptr, &RequiredSize);
-
-			hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE, &CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize), D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&textureUploadHeap));
+		for (UINT slot = 0; slot < TEXTURE_SLOT_COUNT; slot++)
+		{
+			std::shared_ptr<ScratchImage> placeholder = std::make_shared<ScratchImage>();
+			HRESULT hr = placeholder->Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1, 1, 1);
 			if (FAILED(hr))
 			{
-				std::cout << "Cannot create committed resource\n";
-				return E_FAIL;
-			}
-
-			//std::vector<UINT8> texture;
-			//texture.resize(scratchImage.GetPixelsSize() * 4);
-			//memcpy(texture.data(), scratchImage.GetPixels(), texture.size());
-			//char temp = 0;
-			//for (int i = 0; i < texture.size(); i += 4)
-			//{
-			//	temp = texture[i];
-			//	texture[i] = texture[i + 3];
-			//	texture[i + 3] = temp;
-			//	temp = texture[i + 1];
-			//	texture[i + 1] = texture[i + 2];
-			//	texture[i + 2] = temp;
-			//}
-
-			std::vector<D3D12_SUBRESOURCE_DATA> subresources(scratchImage.GetImageCount());
-			const Image* pImages = scratchImage.GetImages();
-			for (int i = 0; i < scratchImage.GetImageCount(); ++i)
-			{
-				auto& subresource = subresources[i];
-				subresource.RowPitch = pImages[i].rowPitch;
-				subresource.SlicePitch = pImages[i].slicePitch;
-				subresource.pData = pImages[i].pixels;
+				std::cout << "Failed to create a placeholder texture\n";
+				exit(hr);
 			}
+			memcpy(placeholder->GetPixels(), placeholderColors[slot], sizeof(placeholderColors[slot]));
 
-			UpdateSubresources(m_commandList.Get(), m_texture.Get(), textureUploadHeap.Get(), 0, 0, subresources.size(), &subresources[0]);
-
-			m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_texture.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
-
-			// Describe and create a SRV for the texture.
-			D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-			srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-			srvDesc.Format = textureDesc.Format;
-			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-			srvDesc.Texture2D.MipLevels = 1;
-			srvDesc.Texture2D.MostDetailedMip = 0;
-
-			CD3DX12_CPU_DESCRIPTOR_HANDLE cbvHandle(m_cbvHeap->GetCPUDescriptorHandleForHeapStart(), 1, m_cbvDescriptorSize);
-
-			m_device->CreateShaderResourceView(m_texture.Get(), &srvDesc, cbvHandle);
+			m_placeholderTextures[slot] = m_resources.CreateTexture(placeholder);
 		}
 
-		// Create the emissive texture
-		{
+		RequestTextures();
 
-			TexMetadata texMetaData;
-			ScratchImage scratchImage;
-			//TextureUsage
+		return true;
+	}
 
-			std::string filepath = DefaultCube.mesh.materialPaths[DefaultCube.mesh.materials[0][Material::EMISSIVE].input].c_str();
-			std::wstring filepathw = std::wstring(filepath.begin(), filepath.end());
-			LoadFromWICFile(filepathw.c_str(), WIC_FLAGS_FORCE_RGB, &texMetaData, scratchImage); //used for .png .bmp or whatever WIC has.
+	void GraphicsApplication::RequestTextures()
+	{
+		const Material::ComponentType components[TEXTURE_SLOT_COUNT] = { Material::DIFFUSE, Material::EMISSIVE, Material::SPECULAR };
+		const TextureUsage usages[TEXTURE_SLOT_COUNT] = { TEXTURE_USAGE_COLOR, TEXTURE_USAGE_MASK, TEXTURE_USAGE_MASK };
 
-			D3D12_RESOURCE_DESC textureDesc = {};
-			textureDesc.MipLevels = 1;
-			textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-			textureDesc.Width = texMetaData.width;
-			textureDesc.Height = texMetaData.height;
-			textureDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-			textureDesc.DepthOrArraySize = texMetaData.arraySize;
-			textureDesc.SampleDesc.Count = 1;
-			textureDesc.SampleDesc.Quality = 0;
-			textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+		m_textureCache.Prune();
 
-			HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_texture1));
-			if (FAILED(hr))
+		for (UINT slot = 0; slot < TEXTURE_SLOT_COUNT; slot++)
+		{
+			StreamedTexture& texture = m_textures[slot];
+			if (texture.request != AssetLoader::InvalidRequest)
 			{
-				std::cout << "Failed to create the descriptor heap for the constant buffer. \n";
-				return E_FAIL;
+				m_assetLoader.Cancel(texture.request);
+				texture.request = AssetLoader::InvalidRequest;
 			}
 
-			const UINT64 uploadBufferSize = GetRequiredIntermediateSize(m_texture1.Get(), 0, scratchImage.GetImageCount());
-			//m_device->GetCopyableFootprints(&m_texture->GetDesc(), 0, 1, 0, nullptr, nullptr, nullptr, &RequiredSize);
-
-			hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE, &CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize), D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&textureUploadHeap1));
-			if (FAILED(hr))
+			if (DefaultCube.mesh.materials.empty())
 			{
-				std::cout << "Cannot create committed resource\n";
-				return E_FAIL;
+				continue;
 			}
 
-			//std::vector<UINT8> texture;
-			//texture.resize(scratchImage.GetPixelsSize() * 4);
-			//memcpy(texture.data(), scratchImage.GetPixels(), texture.size());
-			//char temp = 0;
-			//for (int i = 0; i < texture.size(); i += 4)
-			//{
-			//	temp = texture[i];
-			//	texture[i] = texture[i + 3];
-			//	texture[i + 3] = temp;
-			//	temp = texture[i + 1];
-			//	texture[i + 1] = texture[i + 2];
-			//	texture[i + 2] = temp;
-			//}
+			const int64_t input = DefaultCube.mesh.materials[0][components[slot]].input;
+			if (input < 0 || input >= static_cast<int64_t>(DefaultCube.mesh.materialPaths.size()))
+			{
+				continue;
+			}
 
-			std::vector<D3D12_SUBRESOURCE_DATA> subresources(scratchImage.GetImageCount());
-			const Image* pImages = scratchImage.GetImages();
-			for (int i = 0; i < scratchImage.GetImageCount(); ++i)
+			// Content that's already resident, for another slot, an earlier mesh or the one being reloaded,
+			// is bound by the next frame without touching the file.
+			const std::string& sourcePath = DefaultCube.mesh.materialPaths[input];
+			std::shared_ptr<SharedTexture> resident = m_textureCache.FindPath(sourcePath);
+			if (resident)
 			{
-				auto& subresource = subresources[i];
-				subresource.RowPitch = pImages[i].rowPitch;
-				subresource.SlicePitch = pImages[i].slicePitch;
-				subresource.pData = pImages[i].pixels;
+				texture.shared = resident;
+				continue;
 			}
 
-			UpdateSubresources(m_commandList.Get(), m_texture1.Get(), textureUploadHeap1.Get(), 0, 0, subresources.size(), &subresources[0]);
+			// Load the cooked DDS when it's up to date, it only needs copying into the upload heap. Otherwise
+			// the source is cooked on the loader thread once and the result saved for the next run.
+			const std::string cookedPath = cooked_texture_path(sourcePath);
+			const bool cooked = cooked_texture_current(sourcePath);
+			const TextureUsage usage = usages[slot];
 
-			m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_texture1.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+			AssetLoader::Request request;
+			request.path = cooked ? cookedPath : sourcePath;
+			request.priority = slot == TEXTURE_DIFFUSE ? LOAD_PRIORITY_HIGH : LOAD_PRIORITY_NORMAL;
 
-			// Describe and create a SRV for the texture.
-			D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-			srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-			srvDesc.Format = textureDesc.Format;
-			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-			srvDesc.Texture2D.MipLevels = 1;
-			srvDesc.Texture2D.MostDetailedMip = 0;
+			// Decoding runs on a loader thread; WIC is free threaded once COM is up on that thread.
+			// A store path carries its hash in the name, anything else is keyed by a hash of the bytes read.
+			request.decode = [cooked, sourcePath, cookedPath, usage](const std::string& path, std::vector<uint8_t>& bytes, std::string& error) -> std::shared_ptr<void>
+			{
+				std::shared_ptr<DecodedTexture> decoded = std::make_shared<DecodedTexture>();
+				if (!content_hash_from_path(sourcePath, decoded->hash))
+				{
+					PROFILE_ZONE("ContentHash");
+					decoded->hash = content_hash(bytes.data(), bytes.size());
+				}
 
-			CD3DX12_CPU_DESCRIPTOR_HANDLE cbvHandle(m_cbvHeap->GetCPUDescriptorHandleForHeapStart(), 2, m_cbvDescriptorSize);
+				std::shared_ptr<ScratchImage> image = std::make_shared<ScratchImage>();
+				decoded->image = image;
+				if (cooked)
+				{
+					HRESULT hr = LoadFromDDSMemory(bytes.data(), bytes.size(), DDS_FLAGS_NONE, nullptr, *image);
+					if (FAILED(hr))
+					{
+						error = "Failed to read " + path;
+						return nullptr;
+					}
+					return decoded;
+				}
 
-			m_device->CreateShaderResourceView(m_texture1.Get(), &srvDesc, cbvHandle);
-		}
+				ScratchImage source;
+				HRESULT hr = LoadFromWICMemory(bytes.data(), bytes.size(), WIC_FLAGS_FORCE_RGB, nullptr, source); //used for .png .bmp or whatever WIC has.
+				if (FAILED(hr))
+				{
+					error = "Failed to decode " + path;
+					return nullptr;
+				}
 
-		// Create the specular texture
-		{
+				hr = cook_image(source, usage, *image);
+				if (FAILED(hr))
+				{
+					error = "Failed to cook " + path;
+					return nullptr;
+				}
 
-			TexMetadata texMetaData;
-			ScratchImage scratchImage;
-			//TextureUsage
+				// Not fatal, the next run just cooks it again.
+				if (FAILED(save_cooked_texture(*image, cookedPath)))
+				{
+					std::cout << "Failed to write " << cookedPath << "\n";
+				}
+				return decoded;
+			};
 
-			std::string filepath = DefaultCube.mesh.materialPaths[DefaultCube.mesh.materials[0][Material::SPECULAR].input].c_str();
-			std::wstring filepathw = std::wstring(filepath.begin(), filepath.end());
-			LoadFromWICFile(filepathw.c_str(), WIC_FLAGS_FORCE_RGB, &texMetaData, scratchImage); //used for .png .bmp or whatever WIC has.
+			// Runs from m_assetLoader.Pump() in Update, the upload itself waits for the next command list.
+			request.onComplete = [this, slot, sourcePath](const LoadResult& result)
+			{
+				StreamedTexture& texture = m_textures[slot];
+				if (texture.request != result.id)
+				{
+					return; // superseded by a newer request for this slot
+				}
+				texture.request = AssetLoader::InvalidRequest;
+
+				if (result.status == LOAD_LOADED)
+				{
+					std::shared_ptr<DecodedTexture> decoded = std::static_pointer_cast<DecodedTexture>(result.asset);
+					m_textureCache.Alias(sourcePath, decoded->hash);
+
+					// Another copy of the same bytes may have finished first, e.g. the same image under two paths.
+					std::shared_ptr<SharedTexture> shared = m_textureCache.Find(decoded->hash);
+					if (shared)
+					{
+						texture.shared = shared;
+						std::cout << "Loaded " << result.path << ", same content as a resident texture, sharing it\n";
+						return;
+					}
+
+					shared = std::make_shared<SharedTexture>();
+					shared->hash = decoded->hash;
+					shared->pending = decoded->image;
+					texture.shared = m_textureCache.Insert(decoded->hash, shared);
+
+					const TexMetadata& metadata = shared->pending->GetMetadata();
+					std::cout << "Loaded " << result.path << ", " << metadata.width << "x" << metadata.height << ", " << metadata.mipLevels
+						<< " mips, " << shared->pending->GetPixelsSize() / 1024 << " KB" << (IsCompressed(metadata.format) ? " block compressed\n" : "\n");
+				}
+				else if (result.status == LOAD_FAILED)
+				{
+					std::cout << result.error << ", keeping the placeholder\n";
+				}
+			};
 
-			D3D12_RESOURCE_DESC textureDesc = {};
-			textureDesc.MipLevels = 1;
-			textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-			textureDesc.Width = texMetaData.width;
-			textureDesc.Height = texMetaData.height;
-			textureDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-			textureDesc.DepthOrArraySize = texMetaData.arraySize;
-			textureDesc.SampleDesc.Count = 1;
-			textureDesc.SampleDesc.Quality = 0;
-			textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+			texture.request = m_assetLoader.Load(std::move(request)).id;
+		}
+	}
 
-			HRESULT hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), D3D12_HEAP_FLAG_NONE, &textureDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_texture2));
-			if (FAILED(hr))
+	void GraphicsApplication::UploadPendingTextures()
+	{
+		for (UINT slot = 0; slot < TEXTURE_SLOT_COUNT; slot++)
+		{
+			StreamedTexture& texture = m_textures[slot];
+			if (!texture.shared)
 			{
-				std::cout << "Failed to create the descriptor heap for the constant buffer. \n";
-				return E_FAIL;
+				continue;
 			}
 
-			const UINT64 uploadBufferSize = GetRequiredIntermediateSize(m_texture2.Get(), 0, scratchImage.GetImageCount());
-			//m_device->GetCopyableFootprints(&m_texture->GetDesc(), 0, 1, 0, nullptr, nullptr, nullptr, &RequiredSize);
-
-			hr = m_device->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE, &CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize), D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&textureUploadHeap2));
-			if (FAILED(hr))
+			// Slots sharing content create it once, the first one here queues the upload.
+			SharedTexture& shared = *texture.shared;
+			if (!shared.texture.Valid() && shared.pending)
 			{
-				std::cout << "Cannot create committed resource\n";
-				return E_FAIL;
+				shared.texture = m_resources.CreateTexture(shared.pending);
+				shared.owner = &m_resources;
+				shared.pending.reset();
 			}
 
-			//std::vector<UINT8> texture;
-			//texture.resize(scratchImage.GetPixelsSize() * 4);
-			//memcpy(texture.data(), scratchImage.GetPixels(), texture.size());
-			//char temp = 0;
-			//for (int i = 0; i < texture.size(); i += 4)
-			//{
-			//	temp = texture[i];
-			//	texture[i] = texture[i + 3];
-			//	texture[i + 3] = temp;
-			//	temp = texture[i + 1];
-			//	texture[i + 1] = texture[i + 2];
-			//	texture[i + 2] = temp;
-			//}
-
-			std::vector<D3D12_SUBRESOURCE_DATA> subresources(scratchImage.GetImageCount());
-			const Image* pImages = scratchImage.GetImages();
-			for (int i = 0; i < scratchImage.GetImageCount(); ++i)
+			// The slot keeps showing what it had until the copy queue has filled the texture. Whatever it showed
+			// before is released once nothing holds it, and the resource manager keeps it alive for the frames
+			// still in flight.
+			if (shared.texture.Valid() && texture.bound != texture.shared && m_resources.Ready(shared.texture))
 			{
-				auto& subresource = subresources[i];
-				subresource.RowPitch = pImages[i].rowPitch;
-				subresource.SlicePitch = pImages[i].slicePitch;
-				subresource.pData = pImages[i].pixels;
+				texture.bound = texture.shared;
 			}
-
-			UpdateSubresources(m_commandList.Get(), m_texture2.Get(), textureUploadHeap2.Get(), 0, 0, subresources.size(), &subresources[0]);
-
-			m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_texture2.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
-
-			// Describe and create a SRV for the texture.
-			D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-			srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-			srvDesc.Format = textureDesc.Format;
-			srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-			srvDesc.Texture2D.MipLevels = 1;
-			srvDesc.Texture2D.MostDetailedMip = 0;
-
-			CD3DX12_CPU_DESCRIPTOR_HANDLE cbvHandle(m_cbvHeap->GetCPUDescriptorHandleForHeapStart(), 3, m_cbvDescriptorSize);
-
-			m_device->CreateShaderResourceView(m_texture2.Get(), &srvDesc, cbvHandle);
 		}
-
-		return true;
 	}
 
 	bool GraphicsApplication::ExecuteCommandList()
@@ -34,7 +34,26 @@
 //#include "interstellar.h"
 #include <vector>
 #include <fstream>
+#include <sstream>
+#include <cfloat>
 #include "XTime.h"
+#include "Profiler.hpp"
+#include "FrameRing.hpp"
+#include "D3D12FrameQueue.hpp"
+#include "UploadRing.hpp"
+#include "ShaderConstants.hpp"
+#include "InstanceBuilder.hpp"
+#include "PreSkinning.hpp"
+#include "SkinWeights.hpp"
+#include "ClusterCulling.hpp"
+#include "CrowdCulling.hpp"
+#include "CrowdGrid.hpp"
+#include "AssetLoader.hpp"
+#include "ClipStream.hpp"
+#include "TextureCooker.hpp"
+#include "ContentCache.hpp"
+#include "D3D12ResourceManager.hpp"
+#include "FileWatcher.hpp"
 #include "Shaders\utility.hlsl"
 #include "DebugRenderer.hpp"
 
@@ -77,10 +96,40 @@ namespace MRenderer
 			Component components[COUNT];
 		};
 
+		// A run of indices drawn with one material, one draw each.
+		struct Submesh
+		{
+			uint32_t indexStart;
+			uint32_t indexCount;
+			int32_t material; // into Mesh::materials, -1 for none
+		};
+
+		// A level of detail: vertices and submeshes of its own, drawn while the mesh covers at most switchSize
+		// of the screen height.
+		struct Lod
+		{
+			uint32_t submeshStart;
+			uint32_t submeshCount;
+			uint32_t vertexStart;
+			uint32_t vertexCount;
+			float error;      // furthest the surface moved from the full mesh, in model units
+			float switchSize;
+		};
+
 		struct Mesh
 		{
 			std::vector<Vertex> vertices;
 			std::vector<int> indices;
+			std::vector<Submesh> submeshes; // each level's after the one before, never empty once read
+			std::vector<Lod> lods;          // full detail first, never empty once read
+			uint32_t skinnedVertexStride = 0; // vertices of the largest level
+			XMFLOAT3 boundsCenter = {};     // bounding sphere of the bind pose
+			float boundsRadius = 0.0f;
+			std::vector<Meshlet> meshlets;         // each submesh's after the one before, empty if the file has none
+			std::vector<uint32_t> meshletVertices; // into vertices
+			std::vector<uint8_t> meshletTriangles; // corners into their meshlet's vertices, wound like indices
+			std::vector<InfluenceBuckets> lodVertexBuckets;    // each level's vertices by influence bucket, see SkinWeights.hpp
+			std::vector<InfluenceBuckets> submeshIndexBuckets; // each submesh's indices by the bucket of their triangle
 			std::vector<Material> materials;
 			std::vector<std::string> materialPaths;
 		};
@@ -97,60 +146,6 @@ namespace MRenderer
 			int parentIndex;
 		};
 
-		struct ShaderLight
-		{
-			XMFLOAT4 Position; // 16 bytes
-			//----------------------------------- (16 byte boundary)
-			XMFLOAT4 Direction; // 16 bytes
-			//----------------------------------- (16 byte boundary)
-			XMFLOAT4 Color; // 16 bytes
-			//----------------------------------- (16 byte boundary)
-			float SpotAngle; // 4 bytes
-			float ConstantAttenuation; // 4 bytes
-			float LinearAttenuation; // 4 bytes
-			float QuadraticAttenuation; // 4 bytes
-			//----------------------------------- (16 byte boundary)
-			int LightType; // 4 bytes
-			float LightPower; // 4 bytes
-			int Enabled; // 4 bytes
-			int Padding; // 4 bytes
-			//----------------------------------- (16 byte boundary)
-		}; // Total:                           // 80 bytes (5 * 16)
-
-		struct ShaderMaterial
-		{
-			XMFLOAT4 Emissive; // 16 bytes
-			//----------------------------------- (16 byte boundary)
-			XMFLOAT4 Ambient; // 16 bytes
-			//------------------------------------(16 byte boundary)
-			XMFLOAT4 Diffuse; // 16 bytes
-			//----------------------------------- (16 byte boundary)
-			XMFLOAT4 Specular; // 16 bytes
-			//----------------------------------- (16 byte boundary)
-			float EmissiveFactor; // 4 bytes
-			float AmbientFactor; // 4 bytes
-			float DiffuseFactor; // 4 bytes
-			float SpecularFactor; // 4 bytes
-			//----------------------------------- (16 byte boundary)
-			float SpecularPower; // 4 bytes
-			int UseTexture; // 4 bytes
-			int Padding[2]; // 8 bytes
-			//----------------------------------- (16 byte boundary)
-		}; // Total:               // 80 bytes ( 5 * 16 )
-
-		struct ConstantBuffer
-		{
-			XMMATRIX World;
-			XMMATRIX InverseTransposeWorldMatrix;
-			XMMATRIX MVP;
-			ShaderMaterial Material;
-			XMFLOAT4 EyePosition;
-			XMFLOAT4 GlobalAmbient;
-
-			ShaderLight Lights[MAX_LIGHTS];
-			XMMATRIX JointTransforms[64];
-		};
-
 		struct MVP
 		{
 			XMMATRIX World;
@@ -198,6 +193,8 @@ namespace MRenderer
 			double currentTime = 0.0;
 			vector<Keyframe> keyframes;
 			Pose bindPose;
+			vector<Aabb> keyBounds; // model space bounds of the skinned mesh at each keyframe, empty if the file has none
+			ClipStream::Source stream; // where a clip too big to hold is paged in from, keyframes is then empty
 
 		};
 
@@ -205,10 +202,10 @@ namespace MRenderer
 		{
 			Mesh mesh;
 
-			ComPtr<ID3D12Resource>          vertexBuffer;
+			BufferHandle                    vertexBuffer; // see m_resources
 			D3D12_VERTEX_BUFFER_VIEW        vertexBufferView;
 
-			ComPtr<ID3D12Resource>          indexBuffer;
+			BufferHandle                    indexBuffer;
 			D3D12_INDEX_BUFFER_VIEW         indexBufferView;
 
 			ComPtr<ID3D12Resource>          instanceBuffer;
@@ -216,23 +213,101 @@ namespace MRenderer
 
 			ComPtr<ID3D12PipelineState>     pipelineState;
 
-			char*							pixelShaderByteCode;
-			size_t							pixelShaderByteCodeSize;
-
-			char*							vertexShaderByteCode;
-			size_t							vertexShaderByteCodeSize;
+			std::vector<char>				pixelShaderByteCode;
+			std::vector<char>				vertexShaderByteCode;
 
 			D3D12_PRIMITIVE_TOPOLOGY		PrimitiveTopology;
 
 			Animation animation;
 
-			XMMATRIX InverseBind[64];
+		};
+
+		// Everything the CPU writes while recording a frame. One set per frame in flight.
+		struct FrameResources
+		{
+			ComPtr<ID3D12CommandAllocator>  commandAllocator;
+
+			// PerFrameConstants, persistently mapped; only rewritten when perFrameVersion falls behind.
+			ComPtr<ID3D12Resource>          perFrameBuffer;
+			UINT8*                          perFrameData;
+			UINT64                          perFrameVersion; // m_perFrameVersion last written to perFrameBuffer
+
+			// Per-draw data lives in the upload ring, addresses are 0 if the allocation failed.
+			D3D12_GPU_VIRTUAL_ADDRESS       perObjectAddress;
+			D3D12_GPU_VIRTUAL_ADDRESS       instanceAddress;   // GpuInstance[instanceCount]
+			D3D12_GPU_VIRTUAL_ADDRESS       paletteAddress;    // every instance's skinning palette, back to back
+			UINT                            instanceCount;
+			InstanceRange                   lodInstances[MaxLods]; // records drawn at each level of detail
+
+			// Points into the upload ring, only valid for the frame that allocated it.
+			D3D12_VERTEX_BUFFER_VIEW        debugVertexBufferView;
+			UINT                            debugVertexCount;
+
+			// Resources and pipeline states replaced or uploaded while recording this frame, released once its fence has passed.
+			std::vector<ComPtr<ID3D12Pageable>> retiredResources;
+		};
+
+		enum TextureSlot { TEXTURE_DIFFUSE = 0, TEXTURE_EMISSIVE, TEXTURE_SPECULAR, TEXTURE_SLOT_COUNT };
+
+		// One texture's content, shared by every slot and every mesh that references the same bytes, see
+		// ContentCache.hpp. Decoded once and uploaded once; released when the last slot lets go of it.
+		struct SharedTexture
+		{
+			uint64_t                        hash = 0;
+			TextureHandle                   texture;  // null until the next frame that records creates it
+			std::shared_ptr<ScratchImage>   pending;  // decoded, handed to the resource manager by the next frame that records
+			D3D12ResourceManager*           owner = nullptr;
+
+			SharedTexture() = default;
+			SharedTexture(const SharedTexture&) = delete;
+			SharedTexture& operator=(const SharedTexture&) = delete;
+			~SharedTexture() { if (owner) owner->Release(texture); }
+		};
+
+		// What a texture request decodes to on a loader thread.
+		struct DecodedTexture
+		{
+			uint64_t                        hash = 0;
+			std::shared_ptr<ScratchImage>   image;
+		};
+
+		// A texture the pixel shader samples. Starts as a 1x1 placeholder and is swapped for the real image
+		// once the asset loader has decoded it, so drawing never waits on a file.
+		struct StreamedTexture
+		{
+			AssetLoader::RequestId          request = AssetLoader::InvalidRequest;
+			std::shared_ptr<SharedTexture>  shared;   // what the slot should show, once its texture has been copied
+			std::shared_ptr<SharedTexture>  bound;    // what it shows now, null for the placeholder
+		};
+
+		// What a .mbm decodes to, built on a loader thread.
+		struct LoadedMesh
+		{
+			Mesh mesh;
+			Animation animation;
+		};
+
+		// A watched file that changed on disk and has been read (and for a mesh, parsed) off the main thread.
+		// Swapped in by ApplyHotReloads() between frames.
+		struct HotReload
+		{
+			std::string                         path;
+			int64_t                             detected = 0; // Profiler::now() when the write was first seen
+			std::shared_ptr<LoadedMesh>         mesh;
+			std::shared_ptr<std::vector<uint8_t>> shader;
+		};
 
+		// A compiled shader the viewer loaded, and where its byte code lives.
+		struct ShaderFile
+		{
+			std::string                     path;
+			std::vector<char>*              byteCode;
 		};
 	public:
 
 		// Constructors
-		GraphicsApplication(int width, int height);
+		// frameLatency is how many frames the CPU may record ahead of the GPU.
+		GraphicsApplication(int width, int height, UINT frameLatency = 2);
 
 		// Destructors
 		~GraphicsApplication();
@@ -248,10 +323,21 @@ namespace MRenderer
 
 	private:
 
-		void WaitForPreviousFrame();
+		void WaitForGpu();
 		void GetHardwareAdapter(IDXGIFactory4* pFactory, IDXGIAdapter1** ppAdapter);
 		void PopulateCommandList();
 		void LoadMesh(Mesh& mesh, Animation& animation);
+		static bool ReadMesh(std::istream& file, const std::string& path, Mesh& mesh, Animation& animation);
+		void WatchFiles();
+		void RequestHotReloads();
+		void ApplyHotReloads(FrameResources& frame);
+		void SwapMesh(LoadedMesh& loaded, FrameResources& frame);
+		void RebuildPipelineStates(FrameResources& frame);
+		void BakeClip(const Mesh& mesh, const Animation& animation, SkinnedClip& clip);
+		void ResizeCrowd(UINT side);
+		void BuildCrowd(FrameResources& frame, double deltaTime);
+		void PrintClusterStats(std::ostream& out) const;
+		void PrintClipStats(std::ostream& out) const;
 
 		bool CreateDevice();
 		bool CreateCommandQueue();
@@ -267,6 +353,8 @@ namespace MRenderer
 		bool CreateIndexBuffers();
 		bool CreateInstanceBuffers();
 		bool CreateTextures();
+		void RequestTextures();
+		void UploadPendingTextures();
 		bool ExecuteCommandList();
 		bool SetupDepthStencil();
 		//bool SetupRasterizer();
@@ -275,6 +363,9 @@ namespace MRenderer
 
 		bool CreateShaders();
 		bool CreateConstantBuffers();
+		bool CreateMaterialBuffer();
+		bool CreateUploadRing();
+		bool CreateSkinnedVertexBuffer(UINT instanceCount);
 		std::string OpenFileName(const wchar_t* filter, HWND owner);
 
 
@@ -292,13 +383,12 @@ namespace MRenderer
 	private:
 
 		static const UINT FrameCount = 2;
+		static const UINT MaxCrowdSide = 32; // the crowd is at most MaxCrowdSide x MaxCrowdSide characters
+		static const UINT MaxTextureDescriptors = 256; // SRVs the resource manager can hand out at once
 
 		// Factory objects.
 		ComPtr<IDXGIFactory4>				factory;
 		ComPtr<IDXGIAdapter1>				hardwareAdapter;
-		ComPtr<ID3D12Resource>				textureUploadHeap;
-		ComPtr<ID3D12Resource>				textureUploadHeap1;
-		ComPtr<ID3D12Resource>				textureUploadHeap2;
 
 		// Pipeline objects.
 		float								m_clearColor[4] = {0.25f, 0.25f, 0.25f, 1.0f};
@@ -307,24 +397,44 @@ namespace MRenderer
 		ComPtr<IDXGISwapChain3>             m_swapChain;
 		ComPtr<ID3D12Device>                m_device;
 		ComPtr<ID3D12Resource>              m_renderTargets[FrameCount];
-		ComPtr<ID3D12CommandAllocator>      m_commandAllocator;
 		ComPtr<ID3D12CommandQueue>          m_commandQueue;
 		ComPtr<ID3D12RootSignature>         m_rootSignature;
 		ComPtr<ID3D12RootSignature>         m_computeRootSignature;
 		ComPtr<ID3D12DescriptorHeap>        m_rtvHeap;
-		ComPtr<ID3D12PipelineState>			m_computeState;
+		ComPtr<ID3D12PipelineState>			m_computeStates[InfluenceBucketCount]; // pre-skinning pass, one per influence bucket
+		ComPtr<ID3D12PipelineState>			m_skinnedStates[InfluenceBucketCount]; // mesh PSOs skinning in the vertex shader, the last is DefaultCube's
+		ComPtr<ID3D12PipelineState>			m_preSkinnedState; // mesh PSO that reads the pre-skinned vertices
 		ComPtr<ID3D12GraphicsCommandList>   m_commandList;
 		UINT                                m_rtvDescriptorSize = 0;
 
 		// App resources.
 
-		ComPtr<ID3D12Resource>          m_constantBuffer;
 		ComPtr<ID3D12DescriptorHeap>    m_cbvHeap;
 		UINT                            m_cbvDescriptorSize = 0;
 		MVP								m_MVP;
-		ConstantBuffer                  m_constantBufferData;
-		UINT8*							m_pCbvDataBegin;
-		UINT8*							m_pDebugVertexDataBegin;
+		PerFrameConstants               m_perFrameData;
+		PerFrameConstants               m_lastPerFrameData;
+		UINT64                          m_perFrameVersion;
+		PerObjectConstants              m_perObjectData;
+		std::vector<SkinnedClip>        m_clips;
+		std::vector<CrowdInstance>      m_crowd; // m_crowd[0] is the character the skeleton overlay follows
+		UINT                            m_crowdSide;
+		InstanceBuilder                 m_instanceBuilder;
+		CrowdCuller                     m_crowdCuller;
+		bool                            m_crowdCulling; // skip characters outside the view frustum
+		CrowdGrid                       m_crowdGrid;
+		bool                            m_crowdGridQueries; // cull and pick levels a grid cell at a time rather than per character
+		std::vector<Matrix4>            m_overlayJoints;
+		bool                            m_preSkinning; // skin once per frame in a compute pass instead of in every vertex shader
+		int                             m_forcedLod; // level of detail every instance is drawn at, -1 to select by screen size
+		ComPtr<ID3D12Resource>          m_skinnedVertexBuffer; // SkinnedVertex per vertex of the largest level per instance, rewritten every frame
+		UINT                            m_skinnedVertexCapacity; // instances m_skinnedVertexBuffer has room for
+		std::vector<char>               m_skinningComputeShaders[InfluenceBucketCount];
+		std::vector<char>               m_skinnedVertexShaders[InfluenceBucketCount - 1]; // the last bucket's is DefaultCube's
+		std::vector<char>               m_preSkinnedVertexShader;
+		ComPtr<ID3D12Resource>          m_materialBuffer; // one 256 byte aligned PerMaterialConstants per mesh material
+		ComPtr<ID3D12Resource>          m_uploadBuffer;
+		UploadRing                      m_uploadRing;
 		ComPtr<ID3D12Resource>          m_depthStencil;
 		ComPtr<ID3D12DescriptorHeap>    m_dsvHeap;
 		ComPtr<ID3D12Resource>          m_sampler;
@@ -332,9 +442,15 @@ namespace MRenderer
 		ComPtr<ID3D12Resource>          m_shaderResourceView;
 		ComPtr<ID3D12Resource>          m_shaderResourceView1;
 		ComPtr<ID3D12DescriptorHeap>    m_srvHeap;
-		ComPtr<ID3D12Resource>			m_texture;
-		ComPtr<ID3D12Resource>			m_texture1;
-		ComPtr<ID3D12Resource>			m_texture2;
+		D3D12ResourceManager			m_resources; // textures and mesh buffers; declared first so it outlives their handles
+		TextureHandle					m_placeholderTextures[TEXTURE_SLOT_COUNT];
+		StreamedTexture					m_textures[TEXTURE_SLOT_COUNT];
+		ContentCache<SharedTexture>		m_textureCache; // by content hash, across meshes and hot reloads
+		AssetLoader						m_assetLoader;
+		FileWatcher						m_fileWatcher; // the mesh and every compiled shader, see WatchFiles()
+		std::string						m_meshPath;
+		std::vector<ShaderFile>			m_shaderFiles;
+		std::vector<HotReload>			m_hotReloads; // loaded, waiting for ApplyHotReloads()
 		XMMATRIX                        m_world;
 		XMMATRIX                        m_view;
 		XMMATRIX                        m_projection;
@@ -357,10 +473,9 @@ namespace MRenderer
 
 
 		// Synchronization objects.
-		UINT                m_frameIndex = 0;
-		HANDLE              m_fenceEvent = nullptr;
-		ComPtr<ID3D12Fence> m_fence;
-		UINT64              m_fenceValue = 0;
+		UINT                            m_frameIndex = 0; // current back buffer
+		D3D12FrameQueue                 m_frameQueue;
+		FrameRing<FrameResources>       m_frames;
 
 #if defined _DEBUG
 		// Debug objects.
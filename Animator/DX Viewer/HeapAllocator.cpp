@@ -0,0 +1,515 @@
+#include "HeapAllocator.hpp"
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+// Anonymous namespace
+namespace
+{
+	uint32_t lowest_bit(uint64_t value)
+	{
+#if defined _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return index;
+#else
+		return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+	}
+
+	uint32_t highest_bit(uint64_t value)
+	{
+#if defined _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return index;
+#else
+		return 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+	}
+
+	uint64_t align_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+namespace MRenderer
+{
+	void TlsfAllocator::Initialize(uint64_t capacity, uint64_t granularity)
+	{
+		m_granularity = granularity;
+		m_capacity = capacity / granularity;
+		m_used = 0;
+		m_allocations = 0;
+
+		m_nodes.clear();
+		m_unusedNodes.clear();
+		m_firstLevelMap = 0;
+		for (uint32_t i = 0; i < FirstLevelCount; i++)
+		{
+			m_secondLevelMap[i] = 0;
+			for (uint32_t j = 0; j < SecondLevelCount; j++)
+			{
+				m_heads[i][j] = InvalidNode;
+			}
+		}
+
+		if (m_capacity > 0)
+		{
+			const uint32_t node = NewNode();
+			m_nodes[node].offset = 0;
+			m_nodes[node].size = m_capacity;
+			InsertFree(node);
+		}
+	}
+
+	void TlsfAllocator::mapping(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel)
+	{
+		// Below SecondLevelCount units every size gets its own class in the first row.
+		if (size < SecondLevelCount)
+		{
+			firstLevel = 0;
+			secondLevel = static_cast<uint32_t>(size);
+			return;
+		}
+
+		const uint32_t top = highest_bit(size);
+		firstLevel = top - SecondLevelLog2 + 1;
+		secondLevel = static_cast<uint32_t>(size >> (top - SecondLevelLog2)) - SecondLevelCount;
+	}
+
+	uint32_t TlsfAllocator::FindFree(uint64_t size) const
+	{
+		// Round up to the next class boundary, so any block in the class found is big enough.
+		uint64_t search = size;
+		if (search >= SecondLevelCount)
+		{
+			search += (uint64_t(1) << (highest_bit(search) - SecondLevelLog2)) - 1;
+		}
+
+		uint32_t firstLevel, secondLevel;
+		mapping(search, firstLevel, secondLevel);
+		if (firstLevel >= FirstLevelCount)
+		{
+			return InvalidNode;
+		}
+
+		uint32_t secondLevelMap = m_secondLevelMap[firstLevel] & (~0u << secondLevel);
+		if (secondLevelMap == 0)
+		{
+			const uint64_t firstLevelMap = firstLevel + 1 < FirstLevelCount ? m_firstLevelMap & (~uint64_t(0) << (firstLevel + 1)) : 0;
+			if (firstLevelMap == 0)
+			{
+				return InvalidNode;
+			}
+			firstLevel = lowest_bit(firstLevelMap);
+			secondLevelMap = m_secondLevelMap[firstLevel];
+		}
+		return m_heads[firstLevel][lowest_bit(secondLevelMap)];
+	}
+
+	bool TlsfAllocator::Allocate(uint64_t size, uint64_t alignment, Allocation& allocation)
+	{
+		allocation = Allocation();
+
+		const uint64_t units = size > 0 ? (size + m_granularity - 1) / m_granularity : 1;
+		const uint64_t alignUnits = alignment > m_granularity ? alignment / m_granularity : 1;
+
+		uint32_t node = FindFree(units + alignUnits - 1);
+		if (node == InvalidNode && alignUnits > 1)
+		{
+			// The worst case padding didn't fit anywhere, but a block that happens to be aligned might.
+			node = FindFree(units);
+			if (node != InvalidNode && align_up(m_nodes[node].offset, alignUnits) + units > m_nodes[node].offset + m_nodes[node].size)
+			{
+				node = InvalidNode;
+			}
+		}
+		if (node == InvalidNode)
+		{
+			return false;
+		}
+		RemoveFree(node);
+
+		// Padding in front becomes a free block of its own. The block before is in use, free neighbours are always merged.
+		const uint64_t start = align_up(m_nodes[node].offset, alignUnits);
+		if (start > m_nodes[node].offset)
+		{
+			const uint32_t padding = NewNode();
+			Node& block = m_nodes[node];
+			Node& front = m_nodes[padding];
+			front.offset = block.offset;
+			front.size = start - block.offset;
+			front.prevPhysical = block.prevPhysical;
+			front.nextPhysical = node;
+			if (block.prevPhysical != InvalidNode)
+			{
+				m_nodes[block.prevPhysical].nextPhysical = padding;
+			}
+			block.prevPhysical = padding;
+			block.offset = start;
+			block.size -= front.size;
+			InsertFree(padding);
+		}
+
+		// So does whatever is left over behind it.
+		if (m_nodes[node].size > units)
+		{
+			const uint32_t rest = NewNode();
+			Node& block = m_nodes[node];
+			Node& back = m_nodes[rest];
+			back.offset = block.offset + units;
+			back.size = block.size - units;
+			back.prevPhysical = node;
+			back.nextPhysical = block.nextPhysical;
+			if (block.nextPhysical != InvalidNode)
+			{
+				m_nodes[block.nextPhysical].prevPhysical = rest;
+			}
+			block.nextPhysical = rest;
+			block.size = units;
+			InsertFree(rest);
+		}
+
+		m_used += units;
+		m_allocations++;
+
+		allocation.offset = m_nodes[node].offset * m_granularity;
+		allocation.size = units * m_granularity;
+		allocation.node = node;
+		return true;
+	}
+
+	void TlsfAllocator::Free(const Allocation& allocation)
+	{
+		if (!allocation.Valid())
+		{
+			return;
+		}
+
+		uint32_t node = allocation.node;
+		m_used -= m_nodes[node].size;
+		m_allocations--;
+
+		const uint32_t previous = m_nodes[node].prevPhysical;
+		if (previous != InvalidNode && m_nodes[previous].free)
+		{
+			RemoveFree(previous);
+			m_nodes[previous].size += m_nodes[node].size;
+			m_nodes[previous].nextPhysical = m_nodes[node].nextPhysical;
+			if (m_nodes[node].nextPhysical != InvalidNode)
+			{
+				m_nodes[m_nodes[node].nextPhysical].prevPhysical = previous;
+			}
+			DeleteNode(node);
+			node = previous;
+		}
+
+		const uint32_t next = m_nodes[node].nextPhysical;
+		if (next != InvalidNode && m_nodes[next].free)
+		{
+			RemoveFree(next);
+			m_nodes[node].size += m_nodes[next].size;
+			m_nodes[node].nextPhysical = m_nodes[next].nextPhysical;
+			if (m_nodes[next].nextPhysical != InvalidNode)
+			{
+				m_nodes[m_nodes[next].nextPhysical].prevPhysical = node;
+			}
+			DeleteNode(next);
+		}
+
+		InsertFree(node);
+	}
+
+	HeapStats TlsfAllocator::Stats() const
+	{
+		HeapStats stats;
+		stats.capacity = m_capacity * m_granularity;
+		stats.used = m_used * m_granularity;
+		stats.allocations = m_allocations;
+
+		for (uint32_t i = 0; i < FirstLevelCount; i++)
+		{
+			for (uint32_t j = 0; j < SecondLevelCount; j++)
+			{
+				for (uint32_t node = m_heads[i][j]; node != InvalidNode; node = m_nodes[node].nextFree)
+				{
+					stats.freeBlocks++;
+					if (m_nodes[node].size * m_granularity > stats.largestFree)
+					{
+						stats.largestFree = m_nodes[node].size * m_granularity;
+					}
+				}
+			}
+		}
+		return stats;
+	}
+
+	bool TlsfAllocator::Validate() const
+	{
+		// Physical chain: starts at 0, contiguous, covers the capacity, no two free neighbours.
+		uint32_t first = InvalidNode;
+		size_t liveNodes = 0;
+		for (uint32_t i = 0; i < m_nodes.size(); i++)
+		{
+			if (m_nodes[i].size == 0)
+			{
+				continue; // unused
+			}
+			liveNodes++;
+			if (m_nodes[i].prevPhysical == InvalidNode)
+			{
+				if (first != InvalidNode)
+				{
+					return false;
+				}
+				first = i;
+			}
+		}
+		if (m_capacity == 0)
+		{
+			return liveNodes == 0;
+		}
+		if (first == InvalidNode || m_nodes[first].offset != 0)
+		{
+			return false;
+		}
+
+		uint64_t end = 0;
+		uint64_t used = 0;
+		size_t chained = 0;
+		size_t freeBlocks = 0;
+		for (uint32_t node = first; node != InvalidNode; node = m_nodes[node].nextPhysical)
+		{
+			const Node& block = m_nodes[node];
+			if (block.offset != end || block.size == 0)
+			{
+				return false;
+			}
+			if (block.nextPhysical != InvalidNode && (m_nodes[block.nextPhysical].prevPhysical != node || (block.free && m_nodes[block.nextPhysical].free)))
+			{
+				return false;
+			}
+			end += block.size;
+			used += block.free ? 0 : block.size;
+			freeBlocks += block.free ? 1 : 0;
+			chained++;
+		}
+		if (end != m_capacity || used != m_used || chained != liveNodes)
+		{
+			return false;
+		}
+
+		// Free lists: every entry free and in the right class, bitmaps set exactly for the non-empty lists.
+		size_t listed = 0;
+		for (uint32_t i = 0; i < FirstLevelCount; i++)
+		{
+			for (uint32_t j = 0; j < SecondLevelCount; j++)
+			{
+				const bool bit = (m_secondLevelMap[i] & (1u << j)) != 0;
+				if (bit != (m_heads[i][j] != InvalidNode))
+				{
+					return false;
+				}
+				for (uint32_t node = m_heads[i][j]; node != InvalidNode; node = m_nodes[node].nextFree)
+				{
+					uint32_t firstLevel, secondLevel;
+					mapping(m_nodes[node].size, firstLevel, secondLevel);
+					if (!m_nodes[node].free || firstLevel != i || secondLevel != j)
+					{
+						return false;
+					}
+					listed++;
+				}
+			}
+			if (((m_firstLevelMap >> i) & 1) != (m_secondLevelMap[i] != 0 ? 1u : 0u))
+			{
+				return false;
+			}
+		}
+		return listed == freeBlocks;
+	}
+
+	uint32_t TlsfAllocator::NewNode()
+	{
+		uint32_t node;
+		if (!m_unusedNodes.empty())
+		{
+			node = m_unusedNodes.back();
+			m_unusedNodes.pop_back();
+		}
+		else
+		{
+			node = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.emplace_back();
+		}
+		m_nodes[node] = { 0, 0, InvalidNode, InvalidNode, InvalidNode, InvalidNode, false };
+		return node;
+	}
+
+	void TlsfAllocator::DeleteNode(uint32_t node)
+	{
+		m_nodes[node].size = 0;
+		m_nodes[node].free = false;
+		m_unusedNodes.push_back(node);
+	}
+
+	void TlsfAllocator::InsertFree(uint32_t node)
+	{
+		uint32_t firstLevel, secondLevel;
+		mapping(m_nodes[node].size, firstLevel, secondLevel);
+
+		const uint32_t head = m_heads[firstLevel][secondLevel];
+		m_nodes[node].free = true;
+		m_nodes[node].prevFree = InvalidNode;
+		m_nodes[node].nextFree = head;
+		if (head != InvalidNode)
+		{
+			m_nodes[head].prevFree = node;
+		}
+		m_heads[firstLevel][secondLevel] = node;
+		m_firstLevelMap |= uint64_t(1) << firstLevel;
+		m_secondLevelMap[firstLevel] |= 1u << secondLevel;
+	}
+
+	void TlsfAllocator::RemoveFree(uint32_t node)
+	{
+		uint32_t firstLevel, secondLevel;
+		mapping(m_nodes[node].size, firstLevel, secondLevel);
+
+		Node& block = m_nodes[node];
+		if (block.prevFree != InvalidNode)
+		{
+			m_nodes[block.prevFree].nextFree = block.nextFree;
+		}
+		else
+		{
+			m_heads[firstLevel][secondLevel] = block.nextFree;
+		}
+		if (block.nextFree != InvalidNode)
+		{
+			m_nodes[block.nextFree].prevFree = block.prevFree;
+		}
+		block.free = false;
+		block.prevFree = InvalidNode;
+		block.nextFree = InvalidNode;
+
+		if (m_heads[firstLevel][secondLevel] == InvalidNode)
+		{
+			m_secondLevelMap[firstLevel] &= ~(1u << secondLevel);
+			if (m_secondLevelMap[firstLevel] == 0)
+			{
+				m_firstLevelMap &= ~(uint64_t(1) << firstLevel);
+			}
+		}
+	}
+
+	void HeapPool::Initialize(uint64_t heapSize, uint64_t granularity)
+	{
+		m_heapSize = heapSize;
+		m_granularity = granularity;
+		m_heaps.clear();
+	}
+
+	bool HeapPool::Allocate(uint64_t size, uint64_t alignment, Allocation& allocation, bool& createdHeap)
+	{
+		allocation = Allocation();
+		createdHeap = false;
+		if (size > m_heapSize || alignment > m_heapSize)
+		{
+			return false;
+		}
+
+		for (uint32_t id = 0; id < m_heaps.size(); id++)
+		{
+			if (m_heaps[id].live && m_heaps[id].allocator.Allocate(size, alignment, allocation.placement))
+			{
+				allocation.heap = id;
+				return true;
+			}
+		}
+
+		// Reuse the slot of a trimmed heap before growing the list.
+		uint32_t id = 0;
+		while (id < m_heaps.size() && m_heaps[id].live)
+		{
+			id++;
+		}
+		if (id == m_heaps.size())
+		{
+			m_heaps.emplace_back();
+		}
+
+		Heap& heap = m_heaps[id];
+		heap.allocator.Initialize(m_heapSize, m_granularity);
+		heap.live = true;
+		createdHeap = true;
+
+		// Offset 0 of an empty heap fits anything that passed the checks above.
+		heap.allocator.Allocate(size, alignment, allocation.placement);
+		allocation.heap = id;
+		return true;
+	}
+
+	void HeapPool::Free(const Allocation& allocation)
+	{
+		if (allocation.Valid())
+		{
+			m_heaps[allocation.heap].allocator.Free(allocation.placement);
+		}
+	}
+
+	void HeapPool::TrimEmpty(std::vector<uint32_t>& released)
+	{
+		bool keptOne = false;
+		for (uint32_t id = 0; id < m_heaps.size(); id++)
+		{
+			Heap& heap = m_heaps[id];
+			if (!heap.live || !heap.allocator.Empty())
+			{
+				continue;
+			}
+			if (!keptOne)
+			{
+				keptOne = true;
+				continue;
+			}
+			heap.live = false;
+			released.push_back(id);
+		}
+	}
+
+	size_t HeapPool::HeapCount() const
+	{
+		size_t count = 0;
+		for (const Heap& heap : m_heaps)
+		{
+			count += heap.live ? 1 : 0;
+		}
+		return count;
+	}
+
+	HeapStats HeapPool::Stats() const
+	{
+		HeapStats total;
+		for (const Heap& heap : m_heaps)
+		{
+			if (!heap.live)
+			{
+				continue;
+			}
+			const HeapStats stats = heap.allocator.Stats();
+			total.capacity += stats.capacity;
+			total.used += stats.used;
+			total.allocations += stats.allocations;
+			total.freeBlocks += stats.freeBlocks;
+			if (stats.largestFree > total.largestFree)
+			{
+				total.largestFree = stats.largestFree;
+			}
+		}
+		return total;
+	}
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sub-allocation of large GPU heaps. TlsfAllocator places ranges inside one heap; HeapPool grows a set of
+// equally sized heaps and places each request in the first one with room. Both work in offsets only, the
+// caller creates a heap per HeapPool id and places resources at the offsets handed out. No D3D12 or
+// Windows dependency.
+namespace MRenderer
+{
+	struct HeapStats
+	{
+		uint64_t capacity = 0;
+		uint64_t used = 0;
+		uint64_t largestFree = 0;
+		uint32_t allocations = 0;
+		uint32_t freeBlocks = 0;
+
+		uint64_t Free() const { return capacity - used; }
+
+		// 0 when all the free space is one block, towards 1 as it splits into pieces too small to use.
+		float Fragmentation() const { return Free() > 0 ? 1.0f - float(largestFree) / float(Free()) : 0.0f; }
+	};
+
+	// Two-level segregated fit: free blocks sit in lists by size class, a power of two split into 16 linear
+	// steps, with a bitmap per level, so finding a block that fits is a couple of bit scans and a free
+	// merges with its neighbours in constant time. Offsets and sizes are multiples of the granularity
+	// given to Initialize(); larger alignments split off the padding as a free block.
+	class TlsfAllocator
+	{
+	public:
+		static const uint32_t InvalidNode = UINT32_MAX;
+
+		struct Allocation
+		{
+			uint64_t offset = 0;
+			uint64_t size = 0;
+			uint32_t node = InvalidNode;
+
+			bool Valid() const { return node != InvalidNode; }
+		};
+
+		// granularity must be a power of two.
+		void Initialize(uint64_t capacity, uint64_t granularity);
+
+		// False, leaving allocation invalid, if no free block can hold size at alignment (a power of two).
+		bool Allocate(uint64_t size, uint64_t alignment, Allocation& allocation);
+
+		void Free(const Allocation& allocation);
+
+		bool Empty() const { return m_allocations == 0; }
+		uint64_t Capacity() const { return m_capacity * m_granularity; }
+		HeapStats Stats() const;
+
+		// Walks every block and checks the lists, bitmaps and neighbours agree. Slow, for debugging.
+		bool Validate() const;
+
+	private:
+		static const uint32_t SecondLevelLog2 = 4;
+		static const uint32_t SecondLevelCount = 1 << SecondLevelLog2;
+		static const uint32_t FirstLevelCount = 64;
+
+		struct Node
+		{
+			uint64_t offset;   // in units of m_granularity
+			uint64_t size;
+			uint32_t prevPhysical;
+			uint32_t nextPhysical;
+			uint32_t prevFree;
+			uint32_t nextFree;
+			bool free;
+		};
+
+		static void mapping(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel);
+
+		uint32_t NewNode();
+		void DeleteNode(uint32_t node);
+		void InsertFree(uint32_t node);
+		void RemoveFree(uint32_t node);
+		uint32_t FindFree(uint64_t size) const;
+
+		uint64_t m_capacity = 0;    // in units
+		uint64_t m_granularity = 1;
+		uint64_t m_used = 0;        // in units
+		uint32_t m_allocations = 0;
+
+		std::vector<Node> m_nodes;
+		std::vector<uint32_t> m_unusedNodes;
+
+		uint64_t m_firstLevelMap = 0;
+		uint32_t m_secondLevelMap[FirstLevelCount] = {};
+		uint32_t m_heads[FirstLevelCount][SecondLevelCount];
+	};
+
+	// Heaps of one size, created as needed. A request bigger than a heap isn't placed at all, the caller
+	// gives it its own allocation.
+	class HeapPool
+	{
+	public:
+		static const uint32_t InvalidHeap = UINT32_MAX;
+
+		struct Allocation
+		{
+			uint32_t heap = InvalidHeap;
+			TlsfAllocator::Allocation placement;
+
+			bool Valid() const { return heap != InvalidHeap; }
+		};
+
+		void Initialize(uint64_t heapSize, uint64_t granularity);
+
+		// Sets createdHeap when the allocation needed a new heap, the caller creates it with that id.
+		// Fails, without creating a heap, for a request larger than HeapSize() or aligned beyond it.
+		bool Allocate(uint64_t size, uint64_t alignment, Allocation& allocation, bool& createdHeap);
+
+		void Free(const Allocation& allocation);
+
+		// Drops every empty heap but one, appending their ids for the caller to destroy.
+		void TrimEmpty(std::vector<uint32_t>& released);
+
+		uint64_t HeapSize() const { return m_heapSize; }
+		size_t HeapCount() const;
+		HeapStats Stats() const;
+
+	private:
+		struct Heap
+		{
+			TlsfAllocator allocator;
+			bool live = false;
+		};
+
+		uint64_t m_heapSize = 0;
+		uint64_t m_granularity = 1;
+		std::vector<Heap> m_heaps; // by id
+	};
+}
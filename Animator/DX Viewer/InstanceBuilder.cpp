@@ -0,0 +1,474 @@
+#include "InstanceBuilder.hpp"
+#include "ClipStream.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Anonymous namespace
+namespace
+{
+	using MRenderer::Matrix4;
+
+	struct Quaternion
+	{
+		float x, y, z, w;
+	};
+
+	Matrix4 multiply(const Matrix4& a, const Matrix4& b)
+	{
+		Matrix4 r;
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+			}
+		}
+		return r;
+	}
+
+	Matrix4 transpose(const Matrix4& a)
+	{
+		Matrix4 r;
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				r.m[i][j] = a.m[j][i];
+			}
+		}
+		return r;
+	}
+
+	// Rotation part of a row-vector matrix, same convention as XMQuaternionRotationMatrix.
+	Quaternion rotation_from_matrix(const Matrix4& a)
+	{
+		const float (&m)[4][4] = a.m;
+		Quaternion q;
+		float trace = m[0][0] + m[1][1] + m[2][2];
+		if (trace > 0.0f)
+		{
+			float s = std::sqrt(trace + 1.0f) * 2.0f;
+			q.w = 0.25f * s;
+			q.x = (m[1][2] - m[2][1]) / s;
+			q.y = (m[2][0] - m[0][2]) / s;
+			q.z = (m[0][1] - m[1][0]) / s;
+		}
+		else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+		{
+			float s = std::sqrt(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+			q.w = (m[1][2] - m[2][1]) / s;
+			q.x = 0.25f * s;
+			q.y = (m[1][0] + m[0][1]) / s;
+			q.z = (m[2][0] + m[0][2]) / s;
+		}
+		else if (m[1][1] > m[2][2])
+		{
+			float s = std::sqrt(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+			q.w = (m[2][0] - m[0][2]) / s;
+			q.x = (m[1][0] + m[0][1]) / s;
+			q.y = 0.25f * s;
+			q.z = (m[2][1] + m[1][2]) / s;
+		}
+		else
+		{
+			float s = std::sqrt(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+			q.w = (m[0][1] - m[1][0]) / s;
+			q.x = (m[2][0] + m[0][2]) / s;
+			q.y = (m[2][1] + m[1][2]) / s;
+			q.z = 0.25f * s;
+		}
+		return q;
+	}
+
+	// Shortest arc slerp, falling back to a normalized lerp when the two are nearly parallel.
+	Quaternion slerp(Quaternion a, const Quaternion& b, float t)
+	{
+		float cosOmega = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+		if (cosOmega < 0.0f)
+		{
+			a = { -a.x, -a.y, -a.z, -a.w };
+			cosOmega = -cosOmega;
+		}
+
+		float scaleA;
+		float scaleB;
+		if (cosOmega > 0.9999f)
+		{
+			scaleA = 1.0f - t;
+			scaleB = t;
+		}
+		else
+		{
+			float omega = std::acos(cosOmega);
+			float sinOmega = std::sin(omega);
+			scaleA = std::sin((1.0f - t) * omega) / sinOmega;
+			scaleB = std::sin(t * omega) / sinOmega;
+		}
+
+		Quaternion r = { scaleA * a.x + scaleB * b.x, scaleA * a.y + scaleB * b.y, scaleA * a.z + scaleB * b.z, scaleA * a.w + scaleB * b.w };
+		float length = std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w);
+		return { r.x / length, r.y / length, r.z / length, r.w / length };
+	}
+
+	// Rotation from q followed by a translation, row-vector convention.
+	Matrix4 compose(const Quaternion& q, float tx, float ty, float tz)
+	{
+		float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+		Matrix4 r;
+		r.m[0][0] = 1.0f - 2.0f * (yy + zz); r.m[0][1] = 2.0f * (xy + wz);        r.m[0][2] = 2.0f * (xz - wy);        r.m[0][3] = 0.0f;
+		r.m[1][0] = 2.0f * (xy - wz);        r.m[1][1] = 1.0f - 2.0f * (xx + zz); r.m[1][2] = 2.0f * (yz + wx);        r.m[1][3] = 0.0f;
+		r.m[2][0] = 2.0f * (xz + wy);        r.m[2][1] = 2.0f * (yz - wx);        r.m[2][2] = 1.0f - 2.0f * (xx + yy); r.m[2][3] = 0.0f;
+		r.m[3][0] = tx;                      r.m[3][1] = ty;                      r.m[3][2] = tz;                      r.m[3][3] = 1.0f;
+		return r;
+	}
+}
+
+namespace MRenderer
+{
+	double wrap_clip_time(double time, double duration)
+	{
+		if (duration <= 0.0)
+		{
+			return 0.0;
+		}
+		time = std::fmod(time, duration);
+		return time < 0.0 ? time + duration : time;
+	}
+
+	ClipKeys find_clip_keys(const SkinnedClip& clip, double time)
+	{
+		const size_t keyCount = clip.keytimes.size();
+		time = wrap_clip_time(time, clip.duration);
+
+		size_t next = std::upper_bound(clip.keytimes.begin(), clip.keytimes.end(), time) - clip.keytimes.begin();
+		size_t previous;
+		double t0;
+		double t1;
+		if (next == 0)
+		{
+			previous = keyCount - 1;
+			t0 = clip.keytimes[previous] - clip.duration;
+			t1 = clip.keytimes[next];
+		}
+		else if (next == keyCount)
+		{
+			previous = keyCount - 1;
+			next = 0;
+			t0 = clip.keytimes[previous];
+			t1 = clip.keytimes[next] + clip.duration;
+		}
+		else
+		{
+			previous = next - 1;
+			t0 = clip.keytimes[previous];
+			t1 = clip.keytimes[next];
+		}
+
+		ClipKeys keys;
+		keys.previous = previous;
+		keys.next = next;
+		keys.delta = t1 > t0 ? static_cast<float>((time - t0) / (t1 - t0)) : 0.0f;
+		return keys;
+	}
+
+	void sample_clip_pose(const SkinnedClip& clip, double time, Matrix4* outJoints)
+	{
+		const size_t keyCount = clip.keytimes.size();
+		if (keyCount == 0)
+		{
+			for (uint32_t i = 0; i < clip.jointCount; i++)
+			{
+				outJoints[i] = compose({ 0.0f, 0.0f, 0.0f, 1.0f }, 0.0f, 0.0f, 0.0f);
+			}
+			return;
+		}
+
+		const ClipKeys keys = find_clip_keys(clip, time);
+		const float delta = keys.delta;
+
+		const Matrix4* poseA = clip_key_pose(clip, keys.previous);
+		const Matrix4* poseB = clip_key_pose(clip, keys.next);
+		for (uint32_t i = 0; i < clip.jointCount; i++)
+		{
+			const Matrix4& a = poseA[i];
+			const Matrix4& b = poseB[i];
+
+			Quaternion rotation = slerp(rotation_from_matrix(a), rotation_from_matrix(b), delta);
+			outJoints[i] = compose(rotation,
+				a.m[3][0] + (b.m[3][0] - a.m[3][0]) * delta,
+				a.m[3][1] + (b.m[3][1] - a.m[3][1]) * delta,
+				a.m[3][2] + (b.m[3][2] - a.m[3][2]) * delta);
+		}
+	}
+
+	const Matrix4* clip_key_pose(const SkinnedClip& clip, size_t key)
+	{
+		return clip.stream ? clip.stream->KeyPose(key) : &clip.poses[key * clip.jointCount];
+	}
+
+	void build_skin_palette(const SkinnedClip& clip, const Matrix4* joints, Matrix4* outPalette)
+	{
+		for (uint32_t i = 0; i < clip.jointCount; i++)
+		{
+			outPalette[i] = transpose(multiply(clip.inverseBind[i], joints[i]));
+		}
+	}
+
+	void bake_key_palettes(SkinnedClip& clip)
+	{
+		const size_t keyCount = clip.keytimes.size();
+		clip.keyPalettes.resize(keyCount * clip.jointCount);
+		for (size_t k = 0; k < keyCount; k++)
+		{
+			build_skin_palette(clip, &clip.poses[k * clip.jointCount], &clip.keyPalettes[k * clip.jointCount]);
+		}
+	}
+
+	float projected_screen_size(float radius, float distance, float projectionScale)
+	{
+		return distance > radius ? radius * projectionScale / distance : FLT_MAX;
+	}
+
+	uint32_t select_lod(const float* switchSizes, uint32_t lodCount, float screenSize)
+	{
+		for (uint32_t lod = std::min(lodCount, MaxLods); lod > 1; lod--)
+		{
+			if (screenSize <= switchSizes[lod - 1])
+			{
+				return lod - 1;
+			}
+		}
+		return 0;
+	}
+
+	void select_lods(std::vector<CrowdInstance>& instances, const LodSelection& selection)
+	{
+		PROFILE_ZONE("Crowd::SelectLods");
+
+		for (CrowdInstance& instance : instances)
+		{
+			select_instance_lod(instance, selection);
+		}
+	}
+
+	void select_instance_lod(CrowdInstance& instance, const LodSelection& selection)
+	{
+		const float (&m)[4][4] = instance.world.m;
+		float center[3];
+		for (int j = 0; j < 3; j++)
+		{
+			center[j] = selection.center[0] * m[0][j] + selection.center[1] * m[1][j] + selection.center[2] * m[2][j] + m[3][j];
+		}
+		const float dx = center[0] - selection.eye[0];
+		const float dy = center[1] - selection.eye[1];
+		const float dz = center[2] - selection.eye[2];
+		const float scale = std::sqrt(m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2]);
+
+		const float size = projected_screen_size(selection.radius * scale, std::sqrt(dx * dx + dy * dy + dz * dz), selection.projectionScale) * selection.bias;
+		instance.lod = lod_for_screen_size(selection, size);
+		instance.stepped = stepped_for_screen_size(selection, size);
+	}
+
+	uint32_t lod_for_screen_size(const LodSelection& selection, float screenSize)
+	{
+		const uint32_t lodCount = std::max(1u, std::min(selection.lodCount, MaxLods));
+		if (selection.forcedLod >= 0)
+		{
+			return std::min(static_cast<uint32_t>(selection.forcedLod), lodCount - 1);
+		}
+		return select_lod(selection.switchSizes, lodCount, screenSize);
+	}
+
+	bool stepped_for_screen_size(const LodSelection& selection, float screenSize)
+	{
+		return selection.steppedSize > 0.0f && screenSize <= selection.steppedSize;
+	}
+
+	size_t InstanceBuilder::PaletteSize(const std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips)
+	{
+		size_t size = 0;
+		for (const CrowdInstance& instance : instances)
+		{
+			size += instance.visible ? clips[instance.clip].jointCount : 0;
+		}
+		return size;
+	}
+
+	InstanceBuilder::~InstanceBuilder()
+	{
+		StopWorkers();
+	}
+
+	void InstanceBuilder::Build(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime,
+		GpuInstance* outInstances, Matrix4* outPalette, unsigned workerCount)
+	{
+		PROFILE_ZONE("Crowd::Build");
+
+		// Without anywhere to write them there are no records, the clips only move on.
+		const bool writing = outInstances != nullptr && outPalette != nullptr;
+
+		// Palette offsets are a prefix sum, so they are laid out up front and each worker writes a disjoint range.
+		m_paletteOffsets.resize(instances.size());
+		uint32_t offset = 0;
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			m_paletteOffsets[i] = offset;
+			offset += instances[i].visible ? clips[instances[i].clip].jointCount : 0;
+		}
+
+		// Records go out grouped by level, a counting sort that keeps instance order within each.
+		uint32_t counts[MaxLods] = {};
+		for (const CrowdInstance& instance : instances)
+		{
+			counts[std::min(instance.lod, MaxLods - 1)] += instance.visible && writing ? 1 : 0;
+		}
+		uint32_t next[MaxLods];
+		uint32_t first = 0;
+		for (uint32_t lod = 0; lod < MaxLods; lod++)
+		{
+			m_lodRanges[lod] = { first, counts[lod] };
+			next[lod] = first;
+			first += counts[lod];
+		}
+		m_recordCount = first;
+		m_recordSlots.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			m_recordSlots[i] = instances[i].visible && writing ? next[std::min(instances[i].lod, MaxLods - 1)]++ : UINT32_MAX;
+		}
+
+		if (workerCount == 0)
+		{
+			workerCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		const size_t ranges = std::min<size_t>(workerCount, std::max<size_t>(1, instances.size() / MinInstancesPerWorker));
+		const size_t chunk = (instances.size() + ranges - 1) / ranges;
+		if (ranges == 1)
+		{
+			BuildRange(instances, clips, deltaTime, outInstances, outPalette, 0, instances.size());
+			return;
+		}
+
+		// The pool is sized for workerCount and kept from one frame to the next.
+		if (m_workers.size() != workerCount - 1)
+		{
+			StopWorkers();
+			StartWorkers(workerCount - 1);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = { &instances, &clips, deltaTime, outInstances, outPalette, chunk, ranges };
+			m_jobIndex++;
+			m_busy = m_workers.size();
+		}
+		m_wake.notify_all();
+
+		// The calling thread takes the first range rather than sitting idle.
+		BuildRange(instances, clips, deltaTime, outInstances, outPalette, 0, std::min(instances.size(), chunk));
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_finished.wait(lock, [this] { return m_busy == 0; });
+	}
+
+	void InstanceBuilder::StartWorkers(size_t count)
+	{
+		m_stopping = false;
+		for (size_t w = 0; w < count; w++)
+		{
+			m_workers.emplace_back(&InstanceBuilder::WorkerMain, this, w + 1, m_jobIndex);
+		}
+	}
+
+	void InstanceBuilder::StopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& worker : m_workers)
+		{
+			worker.join();
+		}
+		m_workers.clear();
+	}
+
+	void InstanceBuilder::WorkerMain(size_t range, uint64_t done)
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this, done] { return m_stopping || m_jobIndex != done; });
+				if (m_stopping)
+				{
+					return;
+				}
+				job = m_job;
+				done = m_jobIndex;
+			}
+
+			// A build with fewer ranges than workers leaves the rest with nothing to do.
+			const size_t begin = range * job.chunk;
+			const size_t end = std::min(job.instances->size(), begin + job.chunk);
+			if (range < job.ranges && begin < end)
+			{
+				BuildRange(*job.instances, *job.clips, job.deltaTime, job.outInstances, job.outPalette, begin, end);
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_busy == 0)
+			{
+				m_finished.notify_one();
+			}
+		}
+	}
+
+	void InstanceBuilder::BuildRange(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime,
+		GpuInstance* outInstances, Matrix4* outPalette, size_t begin, size_t end)
+	{
+		PROFILE_ZONE("Crowd::BuildRange");
+
+		std::vector<Matrix4> joints;
+		for (size_t i = begin; i < end; i++)
+		{
+			CrowdInstance& instance = instances[i];
+			const SkinnedClip& clip = clips[instance.clip];
+
+			instance.time = wrap_clip_time(instance.time + deltaTime * instance.speed, clip.duration);
+			if (m_recordSlots[i] == UINT32_MAX)
+			{
+				continue;
+			}
+
+			if (instance.stepped && !clip.keyPalettes.empty())
+			{
+				// Too small on screen for the motion between keys to show, the nearest key's palette is baked.
+				const ClipKeys keys = find_clip_keys(clip, instance.time);
+				const Matrix4* key = &clip.keyPalettes[(keys.delta < 0.5f ? keys.previous : keys.next) * clip.jointCount];
+				std::copy(key, key + clip.jointCount, outPalette + m_paletteOffsets[i]);
+			}
+			else
+			{
+				joints.resize(clip.jointCount);
+				sample_clip_pose(clip, instance.time, joints.data());
+				build_skin_palette(clip, joints.data(), outPalette + m_paletteOffsets[i]);
+			}
+
+			GpuInstance& out = outInstances[m_recordSlots[i]];
+			out.world = transpose(instance.world);
+			out.paletteOffset = m_paletteOffsets[i];
+			out.clip = instance.clip;
+			out.clipTime = static_cast<float>(instance.time);
+			out.padding = 0;
+		}
+	}
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// CPU side of crowd rendering: advances every character's clip, samples it and writes the per-instance
+// records and skinning palettes the instanced draw reads. Plain C++ with no D3D12 or DirectXMath so it
+// can be built and checked on any platform.
+namespace MRenderer
+{
+	// Most levels of detail a mesh may have.
+	static const uint32_t MaxLods = 8;
+
+	// Row-major 4x4 with the same memory layout as XMFLOAT4X4, row vectors, translation in m[3].
+	struct Matrix4
+	{
+		float m[4][4];
+	};
+
+	// Axis aligned box.
+	struct Aabb
+	{
+		float min[3];
+		float max[3];
+	};
+
+	class ClipStream;
+
+	// A clip baked into flat arrays at load time so sampling doesn't chase a vector per keyframe.
+	struct SkinnedClip
+	{
+		uint32_t jointCount = 0;
+		double duration = 0.0;
+		std::vector<double> keytimes;       // ascending, one per keyframe
+		std::vector<Matrix4> poses;         // keytimes.size() * jointCount model space joint transforms, keyframe major
+		std::vector<Matrix4> inverseBind;   // jointCount
+		std::vector<int> parents;           // jointCount, -1 for roots
+		std::vector<Aabb> keyBounds;        // model space bounds of the skinned mesh at each keyframe, see CrowdCulling.hpp
+		std::vector<Matrix4> keyPalettes;   // keytimes.size() * jointCount skinning matrices, see bake_key_palettes()
+		std::shared_ptr<ClipStream> stream; // pages the poses in when they're too many to hold, poses and keyPalettes are then empty
+	};
+
+	// The keyframes either side of a time and how far between them it is.
+	struct ClipKeys
+	{
+		size_t previous;
+		size_t next;
+		float delta; // 0 at previous, 1 at next
+	};
+
+	// One animated character.
+	struct CrowdInstance
+	{
+		Matrix4 world;
+		uint32_t clip = 0;
+		double time = 0.0;
+		float speed = 1.0f;
+		uint32_t lod = 0;     // level of detail it's drawn at, see select_lods()
+		bool visible = true;  // false skips sampling and drawing it, its clip still advances, see CrowdCuller
+		bool stepped = false; // steps through its clip's keys instead of interpolating, see LodSelection::steppedSize
+	};
+
+	// The mesh's levels of detail and the camera, for select_lods().
+	struct LodSelection
+	{
+		uint32_t lodCount = 1;
+		float switchSizes[MaxLods] = {}; // level i is drawn while the screen size is at most switchSizes[i], descending
+		float center[3] = {};            // model space bounding sphere of the mesh
+		float radius = 0.0f;
+		float eye[3] = {};
+		float projectionScale = 1.0f;    // projection[1][1]
+		float bias = 1.0f;               // scales every screen size, above 1 keeps detail further out
+		int forcedLod = -1;              // every instance at this level, -1 to select by size
+		float steppedSize = 0.0f;        // at or below this screen size instances step through keys, 0 never
+	};
+
+	// Contiguous instance records, see InstanceBuilder::LodRanges().
+	struct InstanceRange
+	{
+		uint32_t first;
+		uint32_t count;
+	};
+
+	// What the vertex shader reads per instance, mirrors InstanceData in utility.hlsl.
+	struct GpuInstance
+	{
+		Matrix4 world;          // transposed for HLSL
+		uint32_t paletteOffset; // index of this instance's first matrix in the palette buffer
+		uint32_t clip;
+		float clipTime;
+		uint32_t padding;
+	};
+
+	static_assert(sizeof(Matrix4) == 64, "Matrix4 must match XMFLOAT4X4");
+	static_assert(sizeof(GpuInstance) == 80, "GpuInstance must match InstanceData in utility.hlsl");
+	static_assert(offsetof(GpuInstance, paletteOffset) == 64, "GpuInstance must match InstanceData in utility.hlsl");
+
+	// Wraps time into [0, duration), 0 for a clip with no length.
+	double wrap_clip_time(double time, double duration);
+
+	// The keys around time, wrapped into the clip; before the first key or after the last the pair wraps around
+	// the loop. The clip must have at least one key.
+	ClipKeys find_clip_keys(const SkinnedClip& clip, double time);
+
+	// Fills clip.keyPalettes from its poses, so a stepped instance copies its palette instead of sampling.
+	void bake_key_palettes(SkinnedClip& clip);
+
+	// A key's jointCount joint transforms, from the clip's poses or, for a streamed clip, its stream.
+	const Matrix4* clip_key_pose(const SkinnedClip& clip, size_t key);
+
+	// Joint transforms of a clip at time (wrapped into the clip), lerping translation and slerping rotation
+	// between the keys either side of it.
+	void sample_clip_pose(const SkinnedClip& clip, double time, Matrix4* outJoints);
+
+	// outPalette[i] = transpose(inverseBind[i] * joints[i]), ready for the shader.
+	void build_skin_palette(const SkinnedClip& clip, const Matrix4* joints, Matrix4* outPalette);
+
+	// Fraction of the screen height a sphere at distance covers, radius * projectionScale / distance. Anything
+	// the camera is inside of covers the whole screen and more.
+	float projected_screen_size(float radius, float distance, float projectionScale);
+
+	// The coarsest level whose switch size is at least screenSize, 0 if none is.
+	uint32_t select_lod(const float* switchSizes, uint32_t lodCount, float screenSize);
+
+	// Sets every instance's lod, and whether it's stepped, from the size of the mesh's bounding sphere on screen,
+	// placed and scaled by the instance's world transform.
+	void select_lods(std::vector<CrowdInstance>& instances, const LodSelection& selection);
+
+	// What select_lods() picks for one instance: its level of detail and whether it's stepped.
+	void select_instance_lod(CrowdInstance& instance, const LodSelection& selection);
+
+	// The level select_lods() gives an instance covering screenSize, bias already applied, and whether it's stepped.
+	uint32_t lod_for_screen_size(const LodSelection& selection, float screenSize);
+	bool stepped_for_screen_size(const LodSelection& selection, float screenSize);
+
+	class InstanceBuilder
+	{
+	public:
+		// Instances per worker below which splitting the work costs more than it saves.
+		static const size_t MinInstancesPerWorker = 16;
+
+		InstanceBuilder() = default;
+		InstanceBuilder(const InstanceBuilder&) = delete;
+		InstanceBuilder& operator=(const InstanceBuilder&) = delete;
+		~InstanceBuilder();
+
+		// Number of palette matrices Build() will write for the visible instances.
+		static size_t PaletteSize(const std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips);
+
+		// Advances every instance by deltaTime and writes a record for each visible one to outInstances and
+		// PaletteSize() matrices to outPalette. Instances that aren't visible are only advanced, and so is every
+		// instance when outInstances and outPalette are null. Records are grouped by CrowdInstance::lod so each
+		// level is one instanced draw, palettes stay in instance order. The instances are split into contiguous
+		// ranges, one per worker; workerCount 0 uses every hardware thread. The workers other than the calling
+		// thread are started by the first Build() that needs them and wait for the next one in between.
+		void Build(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime,
+			GpuInstance* outInstances, Matrix4* outPalette, unsigned workerCount = 0);
+
+		// Where the last Build() put each level's records, MaxLods of them, empty for levels no instance used.
+		const InstanceRange* LodRanges() const { return m_lodRanges; }
+
+		// Records the last Build() wrote, one per visible instance.
+		uint32_t RecordCount() const { return m_recordCount; }
+
+	private:
+		// One Build()'s arguments, read by the workers while it runs.
+		struct Job
+		{
+			std::vector<CrowdInstance>* instances;
+			const std::vector<SkinnedClip>* clips;
+			double deltaTime;
+			GpuInstance* outInstances;
+			Matrix4* outPalette;
+			size_t chunk;   // instances per range
+			size_t ranges;  // ranges in this build, the calling thread takes the first
+		};
+
+		void BuildRange(std::vector<CrowdInstance>& instances, const std::vector<SkinnedClip>& clips, double deltaTime,
+			GpuInstance* outInstances, Matrix4* outPalette, size_t begin, size_t end);
+
+		void StartWorkers(size_t count);
+		void StopWorkers();
+		void WorkerMain(size_t range, uint64_t done); // done is the last job index it has already seen
+
+		std::vector<uint32_t> m_paletteOffsets;
+		std::vector<uint32_t> m_recordSlots; // each visible instance's record in outInstances
+		InstanceRange m_lodRanges[MaxLods] = {};
+		uint32_t m_recordCount = 0;
+
+		std::vector<std::thread> m_workers; // worker i builds range i + 1
+		std::mutex m_mutex;
+		std::condition_variable m_wake;     // a new job, or stopping
+		std::condition_variable m_finished; // the last worker is done with the job
+		Job m_job = {};
+		uint64_t m_jobIndex = 0;            // bumped for every job handed to the workers
+		size_t m_busy = 0;                  // workers yet to finish the current job
+		bool m_stopping = false;
+	};
+}
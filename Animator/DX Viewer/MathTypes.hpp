@@ -1,5 +1,6 @@
 #pragma once
 #include <DirectXMath.h>
+#include <cstdint>
 
 namespace MRenderer
 {
@@ -10,7 +11,7 @@ namespace MRenderer
 		DirectX::XMFLOAT4 color;
 		DirectX::XMFLOAT2 tex;
 		DirectX::XMINT4 joints;
-		DirectX::XMFLOAT4 weights;
+		uint32_t weights; // four UNORM8s, see SkinWeights.hpp
 	};
 
 	static DirectX::XMFLOAT4 Float4Lerp(const DirectX::XMFLOAT4& a, const DirectX::XMFLOAT4& b, float t)
@@ -0,0 +1,107 @@
+#include "PreSkinning.hpp"
+
+// Anonymous namespace
+namespace
+{
+	using MRenderer::Matrix4;
+
+	// mul_ordered() in utility.hlsl. The matrices are stored transposed for HLSL, so the shader's m[i][j]
+	// is stored.m[j][i]; the terms are summed x, y, z, w, exactly as the shader adds them.
+	void mul_ordered(const float v[4], const Matrix4& stored, float out[4])
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			out[j] = v[0] * stored.m[j][0];
+		}
+		for (int i = 1; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				out[j] += v[i] * stored.m[j][i];
+			}
+		}
+	}
+
+	// The shader's loop over SKIN_INFLUENCES, unrolled the same way for each count.
+	template <int Influences>
+	MRenderer::SkinnedVertex skin_influences(const MRenderer::SkinningVertex& vertex, const MRenderer::GpuInstance& instance,
+		const Matrix4* palette)
+	{
+		const float position[4] = { vertex.position[0], vertex.position[1], vertex.position[2], 1.0f };
+		const float normal[4] = { vertex.normal[0], vertex.normal[1], vertex.normal[2], 0.0f };
+
+		float skinnedPosition[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float skinnedNormal[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int j = 0; j < Influences; j++)
+		{
+			const Matrix4& joint = palette[instance.paletteOffset + vertex.joints[j]];
+			const float weight = MRenderer::unpack_weight(vertex.weights, j);
+
+			float p[4];
+			float n[4];
+			mul_ordered(position, joint, p);
+			mul_ordered(normal, joint, n);
+			for (int c = 0; c < 4; c++)
+			{
+				skinnedPosition[c] += p[c] * weight;
+				skinnedNormal[c] += n[c] * weight;
+			}
+		}
+
+		MRenderer::SkinnedVertex out;
+		mul_ordered(skinnedPosition, instance.world, out.positionWS);
+		mul_ordered(skinnedNormal, instance.world, out.normalWS);
+		return out;
+	}
+}
+
+namespace MRenderer
+{
+	SkinningDispatch skinning_dispatch(uint32_t vertexCount, uint32_t instanceCount)
+	{
+		SkinningDispatch dispatch;
+		dispatch.groupsX = (vertexCount + SkinningGroupSize - 1) / SkinningGroupSize;
+		dispatch.groupsY = instanceCount;
+		dispatch.groupsZ = 1;
+		return dispatch;
+	}
+
+	SkinnedVertex skin_vertex(const SkinningVertex& vertex, const GpuInstance& instance, const Matrix4* palette, uint32_t influences)
+	{
+		switch (influences)
+		{
+		case 1:
+			return skin_influences<1>(vertex, instance, palette);
+		case 2:
+			return skin_influences<2>(vertex, instance, palette);
+		default:
+			return skin_influences<4>(vertex, instance, palette);
+		}
+	}
+
+	void pre_skin_reference(const SkinningVertex* vertices, const GpuInstance* instances, const Matrix4* palette,
+		const SkinningRange& range, uint32_t influences, SkinnedVertex* outVertices)
+	{
+		const SkinningDispatch dispatch = skinning_dispatch(range.bucketVertexCount, range.instanceCount);
+		for (uint32_t groupY = 0; groupY < dispatch.groupsY; groupY++)
+		{
+			for (uint32_t groupX = 0; groupX < dispatch.groupsX; groupX++)
+			{
+				for (uint32_t thread = 0; thread < SkinningGroupSize; thread++)
+				{
+					// SV_DispatchThreadID, and the same early out the shader takes.
+					uint32_t vertex = groupX * SkinningGroupSize + thread;
+					const uint32_t instance = groupY;
+					if (vertex >= range.bucketVertexCount || instance >= range.instanceCount)
+					{
+						continue;
+					}
+
+					vertex += range.bucketStart;
+					outVertices[skinned_vertex_index(range.firstInstance + instance, vertex, range.vertexStride)] =
+						skin_vertex(vertices[range.firstVertex + vertex], instances[range.firstInstance + instance], palette, influences);
+				}
+			}
+		}
+	}
+}
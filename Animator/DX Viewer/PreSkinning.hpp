@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "InstanceBuilder.hpp"
+#include "SkinWeights.hpp"
+
+// CPU reference for the pre-skinning compute pass (Shaders/SkinningCompute.hlsl). The pass skins every
+// vertex of every instance once per frame into a transient buffer that the draws then read instead of
+// skinning in the vertex shader. Everything here mirrors the shader operation for operation, so the
+// dispatch size, the output indexing and the skinned results can all be checked without a GPU.
+namespace MRenderer
+{
+	// Threads per group along x, must match SKINNING_GROUP_SIZE in utility.hlsl.
+	static const uint32_t SkinningGroupSize = 64;
+
+	// The source vertex as the compute pass reads it, same layout as Vertex in MathTypes.hpp.
+	struct SkinningVertex
+	{
+		float position[4];
+		float normal[4];
+		float color[4];
+		float texcoord[2];
+		int32_t joints[4];
+		uint32_t weights; // four UNORM8s, see SkinWeights.hpp
+	};
+
+	// One skinned vertex of one instance, already in world space. Mirrors SkinnedVertex in utility.hlsl.
+	struct SkinnedVertex
+	{
+		float positionWS[4];
+		float normalWS[4];
+	};
+
+	static_assert(sizeof(SkinningVertex) == 76, "SkinningVertex must match Vertex");
+	static_assert(offsetof(SkinningVertex, joints) == 56, "SkinningVertex must match Vertex");
+	static_assert(sizeof(SkinnedVertex) == 32, "SkinnedVertex must match SkinnedVertex in utility.hlsl");
+
+	// What one dispatch skins: one influence bucket of one level of detail's vertices, for the instances drawn at
+	// that level. Mirrors SkinningConstants in ShaderConstants.hpp.
+	struct SkinningRange
+	{
+		uint32_t vertexCount;   // the level's
+		uint32_t instanceCount;
+		uint32_t firstInstance; // of the level's instance records, which Build() groups by level
+		uint32_t firstVertex;   // the level's first vertex in the mesh
+		uint32_t vertexStride;  // output vertices per instance, the largest level's vertex count
+		uint32_t bucketStart;   // the bucket's first vertex, counted from the level's first
+		uint32_t bucketVertexCount;
+	};
+
+	struct SkinningDispatch
+	{
+		uint32_t groupsX; // vertices, SkinningGroupSize per group
+		uint32_t groupsY; // one row of groups per instance
+		uint32_t groupsZ;
+	};
+
+	// Thread groups needed to skin vertexCount vertices for each of instanceCount instances.
+	SkinningDispatch skinning_dispatch(uint32_t vertexCount, uint32_t instanceCount);
+
+	// Where a vertex (counted from its level's first) of an instance lands in the output, instances are laid
+	// out back to back, vertexStride apart whatever level they're drawn at.
+	inline size_t skinned_vertex_index(uint32_t instance, uint32_t vertex, uint32_t vertexStride)
+	{
+		return static_cast<size_t>(instance) * vertexStride + vertex;
+	}
+
+	// skin_vertex() in utility.hlsl built with SKIN_INFLUENCES set to influences (1, 2 or 4, anything else is 4):
+	// blend the first influences joints of the instance's palette, then apply its world. Every product and sum
+	// is done in the same order as the shader, which marks its results precise.
+	SkinnedVertex skin_vertex(const SkinningVertex& vertex, const GpuInstance& instance, const Matrix4* palette, uint32_t influences);
+
+	// Runs the dispatch skinning_dispatch() describes for range's bucket one thread at a time with the path for
+	// influences, including the threads of the last group that fall past the end of the bucket, and writes the
+	// range's instanceCount * bucketVertexCount results. vertices and instances are the whole mesh's and the
+	// whole crowd's.
+	void pre_skin_reference(const SkinningVertex* vertices, const GpuInstance* instances, const Matrix4* palette,
+		const SkinningRange& range, uint32_t influences, SkinnedVertex* outVertices);
+}
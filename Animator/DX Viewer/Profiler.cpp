@@ -0,0 +1,315 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#if defined _WIN32
+#include <Windows.h>
+#else
+#include <chrono>
+#include <functional>
+#include <thread>
+#endif
+
+// Anonymous namespace
+namespace
+{
+	using MRenderer::Profiler::ZoneEvent;
+
+	// Zones kept per thread before the oldest ones are overwritten. Must be a power of two.
+	constexpr size_t RING_CAPACITY = 1 << 16;
+	constexpr size_t RING_MASK = RING_CAPACITY - 1;
+
+	// Single producer (the owning thread), any number of readers.
+	// The producer publishes each slot with a release store of head; readers copy the
+	// window they want and then re-check head to discard slots that were overwritten meanwhile.
+	struct ThreadRing
+	{
+		std::array<ZoneEvent, RING_CAPACITY> events;
+		std::atomic<uint64_t> head{ 0 };
+		std::atomic<uint64_t> cleared{ 0 }; // everything before this index has been discarded by clear()
+		uint32_t threadId = 0;
+	};
+
+	// Rings are owned here rather than by the thread so they survive thread exit until exported.
+	std::mutex registry_mutex;
+	std::vector<std::unique_ptr<ThreadRing>> registry;
+
+	std::atomic<uint32_t> frame_index{ 0 };
+	int64_t frame_begin = 0;
+
+	uint32_t current_thread_id()
+	{
+#if defined _WIN32
+		return static_cast<uint32_t>(GetCurrentThreadId());
+#else
+		return static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#endif
+	}
+
+	ThreadRing* register_thread()
+	{
+		// Only taken the first time a thread records a zone.
+		std::unique_ptr<ThreadRing> ring = std::make_unique<ThreadRing>();
+		ring->threadId = current_thread_id();
+
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		registry.push_back(std::move(ring));
+		return registry.back().get();
+	}
+
+	// Plain pointer rather than a dynamically initialized thread_local, so the hot path skips the init guard.
+	thread_local ThreadRing* local_ring = nullptr;
+
+	// The oldest event still safe to read in a ring at head. The next record() writes slot head before it
+	// publishes head + 1, and once the ring has wrapped that slot holds the oldest event.
+	uint64_t first_readable(uint64_t head)
+	{
+		return head + 1 > RING_CAPACITY ? head + 1 - RING_CAPACITY : 0;
+	}
+
+	// Copies whatever is still valid in a ring, oldest first.
+	void snapshot(const ThreadRing& ring, std::vector<ZoneEvent>& out)
+	{
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		uint64_t first = first_readable(head);
+		first = std::max(first, ring.cleared.load(std::memory_order_acquire));
+
+		size_t start = out.size();
+		for (uint64_t i = first; i < head; ++i)
+		{
+			out.push_back(ring.events[i & RING_MASK]);
+		}
+
+		// Anything the producer lapped while we were copying is unreliable, drop it.
+		uint64_t headAfter = ring.head.load(std::memory_order_acquire);
+		uint64_t firstValid = first_readable(headAfter);
+		if (firstValid > first)
+		{
+			size_t torn = static_cast<size_t>(std::min<uint64_t>(firstValid - first, head - first));
+			out.erase(out.begin() + start, out.begin() + start + torn);
+		}
+	}
+
+	double ticks_to_ms(int64_t ticks)
+	{
+		return static_cast<double>(ticks) * 1000.0 / static_cast<double>(MRenderer::Profiler::frequency());
+	}
+
+	double ticks_to_us(int64_t ticks)
+	{
+		return static_cast<double>(ticks) * 1000000.0 / static_cast<double>(MRenderer::Profiler::frequency());
+	}
+
+	// Zone names are emitted verbatim, so keep them to plain identifiers; only quotes and backslashes are escaped.
+	void write_json_string(std::ostream& out, const char* s)
+	{
+		out << '"';
+		for (; *s; ++s)
+		{
+			if (*s == '"' || *s == '\\')
+				out << '\\';
+			out << *s;
+		}
+		out << '"';
+	}
+}
+
+namespace MRenderer
+{
+	namespace Profiler
+	{
+		int64_t now()
+		{
+#if defined _WIN32
+			LARGE_INTEGER t;
+			QueryPerformanceCounter(&t);
+			return t.QuadPart;
+#else
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+		}
+
+		int64_t frequency()
+		{
+#if defined _WIN32
+			static const int64_t freq = []()
+			{
+				LARGE_INTEGER f;
+				QueryPerformanceFrequency(&f);
+				return f.QuadPart;
+			}();
+			return freq;
+#else
+			return 1000000000;
+#endif
+		}
+
+		void begin_frame()
+		{
+			int64_t t = now();
+			if (frame_begin != 0)
+			{
+				record("Frame", frame_begin, t);
+			}
+			frame_begin = t;
+			frame_index.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		uint32_t current_frame()
+		{
+			return frame_index.load(std::memory_order_relaxed);
+		}
+
+		void record(const char* name, int64_t begin, int64_t end)
+		{
+			if (local_ring == nullptr)
+			{
+				local_ring = register_thread();
+			}
+
+			ThreadRing& ring = *local_ring;
+			uint64_t head = ring.head.load(std::memory_order_relaxed);
+			ring.events[head & RING_MASK] = { name, begin, end, frame_index.load(std::memory_order_relaxed) };
+			ring.head.store(head + 1, std::memory_order_release);
+		}
+
+		bool write_chrome_trace(const char* path)
+		{
+			std::ofstream file(path, std::ios::trunc | std::ios::out);
+			if (!file.is_open())
+			{
+				return false;
+			}
+
+			std::vector<ZoneEvent> events;
+			std::vector<uint32_t> threadIds;
+			std::vector<size_t> threadEnds;
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex);
+				for (auto& ring : registry)
+				{
+					snapshot(*ring, events);
+					threadIds.push_back(ring->threadId);
+					threadEnds.push_back(events.size());
+				}
+			}
+
+			// Timestamps are rebased to the oldest event so the trace starts at zero.
+			int64_t origin = INT64_MAX;
+			for (const ZoneEvent& e : events)
+			{
+				origin = std::min(origin, e.begin);
+			}
+
+			file << "{\"traceEvents\":[\n";
+			bool first = true;
+			size_t threadSlot = 0;
+			for (size_t i = 0; i < events.size(); ++i)
+			{
+				while (i >= threadEnds[threadSlot])
+				{
+					threadSlot++;
+				}
+
+				const ZoneEvent& e = events[i];
+				if (!first)
+				{
+					file << ",\n";
+				}
+				first = false;
+
+				file << "{\"name\":";
+				write_json_string(file, e.name);
+				file << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << threadIds[threadSlot];
+				file << std::fixed << std::setprecision(3);
+				file << ",\"ts\":" << ticks_to_us(e.begin - origin) << ",\"dur\":" << ticks_to_us(e.end - e.begin);
+				file << ",\"args\":{\"frame\":" << e.frame << "}}";
+			}
+			file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+			return file.good();
+		}
+
+		std::vector<ZoneStats> collect_stats()
+		{
+			std::vector<ZoneEvent> events;
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex);
+				for (auto& ring : registry)
+				{
+					snapshot(*ring, events);
+				}
+			}
+
+			// The same literal can have different addresses across translation units, so group by contents.
+			std::map<std::string, std::vector<int64_t>> durations;
+			std::map<std::string, const char*> names;
+			for (const ZoneEvent& e : events)
+			{
+				durations[e.name].push_back(e.end - e.begin);
+				names[e.name] = e.name;
+			}
+
+			std::vector<ZoneStats> stats;
+			for (auto& entry : durations)
+			{
+				std::vector<int64_t>& d = entry.second;
+				std::sort(d.begin(), d.end());
+
+				int64_t total = 0;
+				for (int64_t v : d)
+				{
+					total += v;
+				}
+
+				size_t p99 = static_cast<size_t>(std::ceil(0.99 * d.size())) - 1;
+
+				ZoneStats s;
+				s.name = names[entry.first];
+				s.count = static_cast<uint32_t>(d.size());
+				s.minMs = ticks_to_ms(d.front());
+				s.avgMs = ticks_to_ms(total) / d.size();
+				s.p99Ms = ticks_to_ms(d[p99]);
+				s.maxMs = ticks_to_ms(d.back());
+				stats.push_back(s);
+			}
+
+			return stats;
+		}
+
+		void print_stats(std::ostream& out)
+		{
+			std::vector<ZoneStats> stats = collect_stats();
+
+			out << std::left << std::setw(28) << "Zone" << std::right << std::setw(8) << "Count"
+				<< std::setw(10) << "Min ms" << std::setw(10) << "Avg ms" << std::setw(10) << "P99 ms" << std::setw(10) << "Max ms" << '\n';
+			out << std::fixed << std::setprecision(3);
+			for (const ZoneStats& s : stats)
+			{
+				out << std::left << std::setw(28) << s.name << std::right << std::setw(8) << s.count
+					<< std::setw(10) << s.minMs << std::setw(10) << s.avgMs << std::setw(10) << s.p99Ms << std::setw(10) << s.maxMs << '\n';
+			}
+			out << std::defaultfloat;
+		}
+
+		void clear()
+		{
+			// Only the producer may write head, so clearing just moves the readers' watermark up to it.
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			for (auto& ring : registry)
+			{
+				ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+			}
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <iosfwd>
+
+// Interface to the hot-path profiler.
+// Zones are recorded into a lock-free ring buffer owned by the thread that ran them, so opening
+// and closing a zone never takes a lock. Reading (stats and trace export) may happen from any thread.
+namespace MRenderer
+{
+	namespace Profiler
+	{
+		// One closed zone, as recorded by the thread that ran it.
+		struct ZoneEvent
+		{
+			const char* name; // must be a string literal (or otherwise outlive the profiler)
+			int64_t begin;    // ticks, see now()
+			int64_t end;      // ticks, see now()
+			uint32_t frame;   // frame index at the time the zone was closed
+		};
+
+		// Per-zone timing summary, in milliseconds.
+		struct ZoneStats
+		{
+			const char* name;
+			uint32_t count;
+			double minMs;
+			double avgMs;
+			double p99Ms;
+			double maxMs;
+		};
+
+		// Current time in ticks. Cheap enough to call twice per zone.
+		int64_t now();
+
+		// Ticks per second for the values returned by now().
+		int64_t frequency();
+
+		// Marks a frame boundary. Call once per frame on the main thread.
+		void begin_frame();
+
+		uint32_t current_frame();
+
+		// Appends a closed zone to the calling thread's ring buffer.
+		void record(const char* name, int64_t begin, int64_t end);
+
+		// Writes every buffered zone of every thread as Chrome trace-event JSON (chrome://tracing, Perfetto).
+		bool write_chrome_trace(const char* path);
+
+		// Min, avg, p99 and max per zone name over everything currently buffered.
+		std::vector<ZoneStats> collect_stats();
+
+		void print_stats(std::ostream& out);
+
+		// Drops everything recorded so far on every thread.
+		void clear();
+
+		// Records the lifetime of the enclosing scope as a zone.
+		class ScopedZone
+		{
+		public:
+			explicit ScopedZone(const char* name) : m_name(name), m_begin(now()) {}
+			~ScopedZone() { record(m_name, m_begin, now()); }
+
+			ScopedZone(const ScopedZone&) = delete;
+			ScopedZone& operator=(const ScopedZone&) = delete;
+
+		private:
+			const char* m_name;
+			int64_t m_begin;
+		};
+	}
+}
+
+#define MPROFILE_CONCAT_INNER(a, b) a##b
+#define MPROFILE_CONCAT(a, b) MPROFILE_CONCAT_INNER(a, b)
+
+// Define MRENDERER_DISABLE_PROFILER to compile every zone out.
+#if defined MRENDERER_DISABLE_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) MRenderer::Profiler::ScopedZone MPROFILE_CONCAT(profileZone_, __LINE__)(name)
+#endif
@@ -0,0 +1,190 @@
+#include "ResourceManager.hpp"
+
+#include <algorithm>
+
+// Anonymous namespace
+namespace
+{
+	uint64_t align_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+namespace MRenderer
+{
+	void DescriptorAllocator::Initialize(uint32_t capacity)
+	{
+		m_capacity = capacity;
+		m_used = 0;
+		m_free.clear();
+		m_deferred.Flush([](const Range&) {});
+		if (capacity > 0)
+		{
+			m_free.push_back({ 0, capacity });
+		}
+	}
+
+	uint32_t DescriptorAllocator::Allocate(uint32_t count)
+	{
+		if (count == 0)
+		{
+			return InvalidIndex;
+		}
+
+		for (auto range = m_free.begin(); range != m_free.end(); ++range)
+		{
+			if (range->count < count)
+			{
+				continue;
+			}
+
+			const uint32_t index = range->begin;
+			range->begin += count;
+			range->count -= count;
+			if (range->count == 0)
+			{
+				m_free.erase(range);
+			}
+			m_used += count;
+			return index;
+		}
+		return InvalidIndex;
+	}
+
+	void DescriptorAllocator::Free(uint32_t index, uint32_t count)
+	{
+		if (index != InvalidIndex && count > 0)
+		{
+			m_deferred.Push({ index, count });
+		}
+	}
+
+	void DescriptorAllocator::Retire(uint64_t completedValue)
+	{
+		m_deferred.Retire(completedValue, [this](const Range& range) { Release(range); });
+	}
+
+	void DescriptorAllocator::Release(Range range)
+	{
+		m_used -= range.count;
+
+		auto next = std::lower_bound(m_free.begin(), m_free.end(), range, [](const Range& a, const Range& b) { return a.begin < b.begin; });
+
+		// Merge into the neighbour on either side when they touch.
+		if (next != m_free.begin())
+		{
+			auto previous = next - 1;
+			if (previous->begin + previous->count == range.begin)
+			{
+				previous->count += range.count;
+				if (next != m_free.end() && previous->begin + previous->count == next->begin)
+				{
+					previous->count += next->count;
+					m_free.erase(next);
+				}
+				return;
+			}
+		}
+		if (next != m_free.end() && range.begin + range.count == next->begin)
+		{
+			next->begin = range.begin;
+			next->count += range.count;
+			return;
+		}
+		m_free.insert(next, range);
+	}
+
+	StagingPool::Block StagingPool::Acquire(uint64_t size)
+	{
+		// Smallest free block that fits.
+		auto best = m_free.end();
+		for (auto id = m_free.begin(); id != m_free.end(); ++id)
+		{
+			if (m_sizes[*id] >= size && (best == m_free.end() || m_sizes[*id] < m_sizes[*best]))
+			{
+				best = id;
+			}
+		}
+
+		if (best != m_free.end())
+		{
+			Block block = { *best, m_sizes[*best], false };
+			m_free.erase(best);
+			return block;
+		}
+
+		uint64_t blockSize = MinBlockSize;
+		while (blockSize < size)
+		{
+			blockSize <<= 1;
+		}
+
+		uint32_t id;
+		if (!m_unusedIds.empty())
+		{
+			id = m_unusedIds.back();
+			m_unusedIds.pop_back();
+			m_sizes[id] = blockSize;
+		}
+		else
+		{
+			id = static_cast<uint32_t>(m_sizes.size());
+			m_sizes.push_back(blockSize);
+		}
+		m_totalSize += blockSize;
+		return { id, blockSize, true };
+	}
+
+	void StagingPool::Retire(uint64_t completedValue)
+	{
+		m_inFlight.Retire(completedValue, [this](uint32_t id) { m_free.push_back(id); });
+	}
+
+	void StagingPool::Trim(uint64_t keepBytes, std::vector<uint32_t>& destroyed)
+	{
+		std::sort(m_free.begin(), m_free.end(), [this](uint32_t a, uint32_t b) { return m_sizes[a] < m_sizes[b]; });
+
+		uint64_t freeSize = FreeSize();
+		while (freeSize > keepBytes && !m_free.empty())
+		{
+			const uint32_t id = m_free.back();
+			m_free.pop_back();
+
+			freeSize -= m_sizes[id];
+			m_totalSize -= m_sizes[id];
+			m_sizes[id] = 0;
+			m_unusedIds.push_back(id);
+			destroyed.push_back(id);
+		}
+	}
+
+	uint64_t StagingPool::FreeSize() const
+	{
+		uint64_t size = 0;
+		for (uint32_t id : m_free)
+		{
+			size += m_sizes[id];
+		}
+		return size;
+	}
+
+	uint64_t plan_upload_batch(const std::vector<UploadRequest>& requests, uint64_t budget, std::vector<uint64_t>& offsets)
+	{
+		offsets.clear();
+
+		uint64_t total = 0;
+		for (const UploadRequest& request : requests)
+		{
+			const uint64_t offset = align_up(total, request.alignment);
+			if (!offsets.empty() && offset + request.size > budget)
+			{
+				break;
+			}
+
+			offsets.push_back(offset);
+			total = offset + request.size;
+		}
+		return total;
+	}
+}
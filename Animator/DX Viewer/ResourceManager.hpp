@@ -0,0 +1,263 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+// The bookkeeping half of the resource manager: handles, descriptor allocation, the staging pool and
+// upload batching. D3D12ResourceManager puts device objects behind it; everything here only deals in
+// indices, sizes and fence values, so it can be driven without a device. No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	// Refers to a slot in a HandleTable. The slot's generation changes whenever it's freed, so a handle
+	// kept past its release stops resolving instead of aliasing whatever took the slot next.
+	template <typename Tag>
+	struct Handle
+	{
+		uint32_t index = 0;
+		uint32_t generation = 0; // 0 is never handed out, a default constructed handle is null
+
+		bool Valid() const { return generation != 0; }
+		bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+		bool operator!=(const Handle& other) const { return !(*this == other); }
+	};
+
+	struct TextureTag;
+	struct BufferTag;
+	using TextureHandle = Handle<TextureTag>;
+	using BufferHandle = Handle<BufferTag>;
+
+	template <typename T, typename Tag>
+	class HandleTable
+	{
+	public:
+		Handle<Tag> Add(T value)
+		{
+			uint32_t index;
+			if (!m_free.empty())
+			{
+				index = m_free.back();
+				m_free.pop_back();
+			}
+			else
+			{
+				index = static_cast<uint32_t>(m_slots.size());
+				m_slots.emplace_back();
+			}
+
+			Slot& slot = m_slots[index];
+			slot.value = std::move(value);
+			slot.used = true;
+			m_size++;
+
+			Handle<Tag> handle;
+			handle.index = index;
+			handle.generation = slot.generation;
+			return handle;
+		}
+
+		// Null for a null, stale or foreign handle.
+		T* Get(Handle<Tag> handle)
+		{
+			return Resolves(handle) ? &m_slots[handle.index].value : nullptr;
+		}
+
+		const T* Get(Handle<Tag> handle) const
+		{
+			return Resolves(handle) ? &m_slots[handle.index].value : nullptr;
+		}
+
+		// Moves the value out into removed, if given. False if the handle didn't resolve.
+		bool Remove(Handle<Tag> handle, T* removed = nullptr)
+		{
+			if (!Resolves(handle))
+			{
+				return false;
+			}
+
+			Slot& slot = m_slots[handle.index];
+			if (removed)
+			{
+				*removed = std::move(slot.value);
+			}
+			slot.value = T();
+			slot.used = false;
+			slot.generation = slot.generation == UINT32_MAX ? 1 : slot.generation + 1;
+			m_free.push_back(handle.index);
+			m_size--;
+			return true;
+		}
+
+		void Clear()
+		{
+			for (uint32_t i = 0; i < m_slots.size(); i++)
+			{
+				if (m_slots[i].used)
+				{
+					Handle<Tag> handle;
+					handle.index = i;
+					handle.generation = m_slots[i].generation;
+					Remove(handle);
+				}
+			}
+		}
+
+		size_t Size() const { return m_size; }
+
+	private:
+		struct Slot
+		{
+			T value = T();
+			uint32_t generation = 1;
+			bool used = false;
+		};
+
+		bool Resolves(Handle<Tag> handle) const
+		{
+			return handle.Valid() && handle.index < m_slots.size() && m_slots[handle.index].used && m_slots[handle.index].generation == handle.generation;
+		}
+
+		std::vector<Slot> m_slots;
+		std::vector<uint32_t> m_free;
+		size_t m_size = 0;
+	};
+
+	// Things that can only be given back once the GPU is done with the frame that last used them. Push()
+	// adds to the open frame, EndFrame() tags it with the frame's fence value like UploadRing::EndFrame(),
+	// and Retire() hands back everything whose fence has been reached.
+	template <typename T>
+	class DeferredQueue
+	{
+	public:
+		void Push(T value)
+		{
+			m_open.push_back(std::move(value));
+		}
+
+		void EndFrame(uint64_t fenceValue)
+		{
+			for (T& value : m_open)
+			{
+				m_closed.emplace_back(fenceValue, std::move(value));
+			}
+			m_open.clear();
+		}
+
+		template <typename Release>
+		void Retire(uint64_t completedValue, Release release)
+		{
+			while (!m_closed.empty() && m_closed.front().first <= completedValue)
+			{
+				release(m_closed.front().second);
+				m_closed.pop_front();
+			}
+		}
+
+		// Everything, closed or not. Only once the GPU is idle.
+		template <typename Release>
+		void Flush(Release release)
+		{
+			Retire(UINT64_MAX, release);
+			for (T& value : m_open)
+			{
+				release(value);
+			}
+			m_open.clear();
+		}
+
+		size_t Size() const { return m_open.size() + m_closed.size(); }
+
+	private:
+		std::vector<T> m_open;
+		std::deque<std::pair<uint64_t, T>> m_closed;
+	};
+
+	// Ranges of descriptor indices in one heap of fixed size. First fit over a free list sorted by start,
+	// neighbours merge when a range comes back. Free() is deferred until the frames that could still read
+	// the descriptor have retired.
+	class DescriptorAllocator
+	{
+	public:
+		static const uint32_t InvalidIndex = UINT32_MAX;
+
+		void Initialize(uint32_t capacity);
+
+		// The first index of count consecutive descriptors, or InvalidIndex if no free range is long enough.
+		uint32_t Allocate(uint32_t count = 1);
+
+		void Free(uint32_t index, uint32_t count = 1);
+
+		void EndFrame(uint64_t fenceValue) { m_deferred.EndFrame(fenceValue); }
+		void Retire(uint64_t completedValue);
+
+		uint32_t Capacity() const { return m_capacity; }
+		uint32_t Used() const { return m_used; } // including frees that haven't retired yet
+		size_t FreeRanges() const { return m_free.size(); }
+
+	private:
+		struct Range
+		{
+			uint32_t begin;
+			uint32_t count;
+		};
+
+		void Release(Range range);
+
+		uint32_t m_capacity = 0;
+		uint32_t m_used = 0;
+		std::vector<Range> m_free;
+		DeferredQueue<Range> m_deferred;
+	};
+
+	// Upload buffers for copies into default heap resources, reused from one batch to the next instead of
+	// being created per upload. Block sizes are powers of two from MinBlockSize up; Acquire() takes the
+	// smallest free block that fits and Release() returns it once the frame that used it has retired.
+	// Blocks are just ids and sizes here, the caller keeps a buffer per id.
+	class StagingPool
+	{
+	public:
+		static const uint64_t MinBlockSize = 1 << 16;
+
+		struct Block
+		{
+			uint32_t id;
+			uint64_t size;
+			bool created; // the caller has to create the buffer for this id
+		};
+
+		Block Acquire(uint64_t size);
+
+		void Release(uint32_t id) { m_inFlight.Push(id); }
+
+		void EndFrame(uint64_t fenceValue) { m_inFlight.EndFrame(fenceValue); }
+		void Retire(uint64_t completedValue);
+
+		// Forgets free blocks, largest first, until no more than keepBytes of free blocks are left, so a
+		// burst of loading doesn't pin its peak forever. Appends the ids whose buffers should be destroyed.
+		void Trim(uint64_t keepBytes, std::vector<uint32_t>& destroyed);
+
+		uint64_t TotalSize() const { return m_totalSize; }
+		uint64_t FreeSize() const;
+		size_t BlockCount() const { return m_sizes.size() - m_unusedIds.size(); }
+
+	private:
+		std::vector<uint64_t> m_sizes;      // by id, 0 once trimmed
+		std::vector<uint32_t> m_free;       // ids ready for Acquire()
+		std::vector<uint32_t> m_unusedIds;  // trimmed, can be handed out again
+		DeferredQueue<uint32_t> m_inFlight;
+		uint64_t m_totalSize = 0;
+	};
+
+	struct UploadRequest
+	{
+		uint64_t size;
+		uint64_t alignment; // power of two
+	};
+
+	// Packs uploads back to back into one staging block, in order, each at its own alignment, and stops
+	// before the one that would take the total past budget. The first always goes in, however large, so a
+	// big upload is never starved. Fills offsets for the ones that fit and returns the bytes they need.
+	uint64_t plan_upload_batch(const std::vector<UploadRequest>& requests, uint64_t budget, std::vector<uint64_t>& offsets);
+}
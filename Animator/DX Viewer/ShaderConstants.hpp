@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <DirectXMath.h>
+
+#include "UploadRing.hpp"
+#include "PreSkinning.hpp"
+#include "Shaders\utility.hlsl"
+
+// C++ mirrors of the constant buffers declared in Shaders/utility.hlsl.
+// HLSL packs cbuffer members into 16 byte registers and never lets one straddle a register boundary;
+// the static_asserts below pin every member to the offset the shader expects, so a change on one side
+// that isn't made on the other fails to compile instead of rendering garbage.
+namespace MRenderer
+{
+	// Root signature parameter order. Root CBVs on b0-b2, then root SRVs on t3-t4 for the instanced characters,
+	// root constants on b3 and the pre-skinned vertices on t5.
+	enum RootParameter : uint32_t
+	{
+		ROOT_PER_FRAME = 0,
+		ROOT_PER_MATERIAL,
+		ROOT_PER_OBJECT,
+		ROOT_INSTANCES,
+		ROOT_SKIN_PALETTES,
+		ROOT_SKINNING_CONSTANTS,
+		ROOT_PRESKINNED_VERTICES,
+		ROOT_TEXTURES,
+		ROOT_PARAMETER_COUNT
+	};
+
+	// Compute root signature of the pre-skinning pass (Shaders/SkinningCompute.hlsl).
+	enum SkinningRootParameter : uint32_t
+	{
+		SKINNING_ROOT_CONSTANTS = 0,  // b3
+		SKINNING_ROOT_INSTANCES,      // t3
+		SKINNING_ROOT_PALETTES,       // t4
+		SKINNING_ROOT_SOURCE,         // t6
+		SKINNING_ROOT_OUTPUT,         // u0
+		SKINNING_ROOT_PARAMETER_COUNT
+	};
+
+	struct ShaderLight
+	{
+		DirectX::XMFLOAT4 Position; // 16 bytes
+		//----------------------------------- (16 byte boundary)
+		DirectX::XMFLOAT4 Direction; // 16 bytes
+		//----------------------------------- (16 byte boundary)
+		DirectX::XMFLOAT4 Color; // 16 bytes
+		//----------------------------------- (16 byte boundary)
+		float SpotAngle; // 4 bytes
+		float ConstantAttenuation; // 4 bytes
+		float LinearAttenuation; // 4 bytes
+		float QuadraticAttenuation; // 4 bytes
+		//----------------------------------- (16 byte boundary)
+		int LightType; // 4 bytes
+		float LightPower; // 4 bytes
+		int Enabled; // 4 bytes
+		int Padding; // 4 bytes
+		//----------------------------------- (16 byte boundary)
+	}; // Total:                           // 80 bytes (5 * 16)
+
+	struct ShaderMaterial
+	{
+		DirectX::XMFLOAT4 Emissive; // 16 bytes
+		//----------------------------------- (16 byte boundary)
+		DirectX::XMFLOAT4 Ambient; // 16 bytes
+		//------------------------------------(16 byte boundary)
+		DirectX::XMFLOAT4 Diffuse; // 16 bytes
+		//----------------------------------- (16 byte boundary)
+		DirectX::XMFLOAT4 Specular; // 16 bytes
+		//----------------------------------- (16 byte boundary)
+		float EmissiveFactor; // 4 bytes
+		float AmbientFactor; // 4 bytes
+		float DiffuseFactor; // 4 bytes
+		float SpecularFactor; // 4 bytes
+		//----------------------------------- (16 byte boundary)
+		float SpecularPower; // 4 bytes
+		int UseTexture; // 4 bytes
+		int Padding[2]; // 8 bytes
+		//----------------------------------- (16 byte boundary)
+	}; // Total:               // 96 bytes ( 6 * 16 )
+
+	// b0, written once per frame: camera and lights.
+	struct PerFrameConstants
+	{
+		DirectX::XMMATRIX ViewProjectionMatrix;
+		DirectX::XMFLOAT4 EyePosition;
+		DirectX::XMFLOAT4 GlobalAmbient;
+		ShaderLight Lights[MAX_LIGHTS];
+	};
+
+	// b1, written when a material is loaded.
+	struct PerMaterialConstants
+	{
+		ShaderMaterial Material;
+	};
+
+	// b2, written once per draw.
+	struct PerObjectConstants
+	{
+		DirectX::XMMATRIX World;
+		DirectX::XMMATRIX InverseTransposeWorldMatrix;
+		DirectX::XMMATRIX MVP;
+	};
+
+	// b3, root constants for the pre-skinning pass and the draws, set per level of detail and, for the pass, per
+	// influence bucket. Same fields as SkinningRange in PreSkinning.hpp.
+	struct SkinningConstants
+	{
+		uint32_t VertexCount;
+		uint32_t InstanceCount;
+		uint32_t FirstInstance;
+		uint32_t FirstVertex;
+		uint32_t VertexStride;
+		uint32_t BucketStart;
+		uint32_t BucketVertexCount;
+		uint32_t Padding;
+	};
+
+	static_assert(sizeof(ShaderLight) == 80, "ShaderLight must match Light in utility.hlsl");
+	static_assert(offsetof(ShaderLight, Direction) == 16, "ShaderLight must match Light in utility.hlsl");
+	static_assert(offsetof(ShaderLight, Color) == 32, "ShaderLight must match Light in utility.hlsl");
+	static_assert(offsetof(ShaderLight, SpotAngle) == 48, "ShaderLight must match Light in utility.hlsl");
+	static_assert(offsetof(ShaderLight, LightType) == 64, "ShaderLight must match Light in utility.hlsl");
+	static_assert(offsetof(ShaderLight, Enabled) == 72, "ShaderLight must match Light in utility.hlsl");
+
+	static_assert(sizeof(ShaderMaterial) == 96, "ShaderMaterial must match _Material in utility.hlsl");
+	static_assert(offsetof(ShaderMaterial, Diffuse) == 32, "ShaderMaterial must match _Material in utility.hlsl");
+	static_assert(offsetof(ShaderMaterial, EmissiveFactor) == 64, "ShaderMaterial must match _Material in utility.hlsl");
+	static_assert(offsetof(ShaderMaterial, SpecularPower) == 80, "ShaderMaterial must match _Material in utility.hlsl");
+	static_assert(offsetof(ShaderMaterial, UseTexture) == 84, "ShaderMaterial must match _Material in utility.hlsl");
+
+	static_assert(offsetof(PerFrameConstants, EyePosition) == 64, "PerFrameConstants must match cbuffer PerFrame");
+	static_assert(offsetof(PerFrameConstants, GlobalAmbient) == 80, "PerFrameConstants must match cbuffer PerFrame");
+	static_assert(offsetof(PerFrameConstants, Lights) == 96, "PerFrameConstants must match cbuffer PerFrame");
+	static_assert(sizeof(PerFrameConstants) == 736, "PerFrameConstants must match cbuffer PerFrame");
+
+	static_assert(sizeof(PerMaterialConstants) == 96, "PerMaterialConstants must match cbuffer PerMaterial");
+
+	static_assert(offsetof(PerObjectConstants, InverseTransposeWorldMatrix) == 64, "PerObjectConstants must match cbuffer PerObject");
+	static_assert(offsetof(PerObjectConstants, MVP) == 128, "PerObjectConstants must match cbuffer PerObject");
+	static_assert(sizeof(PerObjectConstants) == 192, "PerObjectConstants must match cbuffer PerObject");
+
+	static_assert(sizeof(SkinningConstants) == 32, "SkinningConstants must match cbuffer Skinning");
+	static_assert(offsetof(SkinningConstants, VertexStride) == 16, "SkinningConstants must match cbuffer Skinning");
+	static_assert(offsetof(SkinningConstants, BucketVertexCount) == 24, "SkinningConstants must match cbuffer Skinning");
+	static_assert(SkinningGroupSize == SKINNING_GROUP_SIZE, "PreSkinning.hpp and utility.hlsl disagree on the group size");
+
+	namespace ConstantPacker
+	{
+		// D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, kept here so this header doesn't need d3d12.h.
+		constexpr uint64_t CONSTANT_BUFFER_ALIGNMENT = 256;
+
+		constexpr uint64_t aligned_size(uint64_t size)
+		{
+			return (size + CONSTANT_BUFFER_ALIGNMENT - 1) & ~(CONSTANT_BUFFER_ALIGNMENT - 1);
+		}
+
+		// Copies a constant block into the ring at a CBV-legal address. Returns an invalid allocation if the ring is full.
+		template <typename T>
+		UploadRing::Allocation push(UploadRing& ring, const T& data)
+		{
+			static_assert(sizeof(T) % 16 == 0, "Constant blocks must be a whole number of 16 byte registers");
+
+			UploadRing::Allocation allocation = ring.Allocate(sizeof(T), CONSTANT_BUFFER_ALIGNMENT);
+			if (allocation.Valid())
+			{
+				memcpy(allocation.cpu, &data, sizeof(T));
+			}
+			return allocation;
+		}
+	}
+}
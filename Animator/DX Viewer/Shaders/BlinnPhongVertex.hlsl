@@ -1,23 +1,17 @@
 #include "utility.hlsl"
 
-VertexShaderOutput main(AppData IN) //Simple vertex shader
+// Skins in the vertex shader, used when the pre-skinning pass is turned off (see PreSkinnedVertex.hlsl).
+// Built once per influence bucket (BlinnPhongVertex1.hlsl, BlinnPhongVertex2.hlsl, this one for four influences).
+VertexShaderOutput main(SkinnedAppData IN, uint instanceID : SV_InstanceID) //Simple vertex shader
 {
     VertexShaderOutput OUT;
     
-    float4 skinned_pos = { 0.0f, 0.0f, 0.0f, 0.0f };
-    float4 skinned_norm = { 0.0f, 0.0f, 0.0f, 0.0f };
-    [unroll]
-    for (int j = 0; j < 4; ++j)
-    {
-        skinned_pos += mul(float4(IN.Position.xyz, 1.0f), JointTransforms[IN.Joints[j]]) * IN.Weights[j];
-        skinned_norm += mul(float4(IN.Normal.xyz, 0.0f), JointTransforms[IN.Joints[j]]) * IN.Weights[j];
-    }
+    // SV_InstanceID starts at 0 for every draw, each level of detail's records start at SkinningFirstInstance.
+    SkinnedVertex skinned = skin_vertex(IN.Position, IN.Normal, IN.Joints, weights_from_bytes(IN.Weights), Instances[SkinningFirstInstance + instanceID]);
     
-    OUT.Position = skinned_pos + IN.InstancePos;
- 
-    OUT.Position = mul(OUT.Position, WorldViewProjectionMatrix);
-    OUT.PositionWS = mul(skinned_pos, WorldMatrix);
-    OUT.NormalWS = mul(skinned_norm, InverseTransposeWorldMatrix).xyz;
+    OUT.PositionWS = skinned.PositionWS;
+    OUT.Position = mul(OUT.PositionWS, ViewProjectionMatrix);
+    OUT.NormalWS = skinned.NormalWS.xyz;
     OUT.TexCoord = IN.TexCoord;
  
     return OUT;
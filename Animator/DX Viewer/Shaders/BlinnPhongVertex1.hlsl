@@ -0,0 +1,3 @@
+// Vertex shader skinning for the triangles whose corners have at most one influence, see BlinnPhongVertex.hlsl.
+#define SKIN_INFLUENCES 1
+#include "BlinnPhongVertex.hlsl"
@@ -0,0 +1,3 @@
+// Vertex shader skinning for the triangles whose corners have at most two influences, see BlinnPhongVertex.hlsl.
+#define SKIN_INFLUENCES 2
+#include "BlinnPhongVertex.hlsl"
@@ -0,0 +1,20 @@
+#include "utility.hlsl"
+
+// Written by SkinningCompute.hlsl earlier in the frame, SkinningVertexStride vertices per instance.
+StructuredBuffer<SkinnedVertex> PreSkinnedVertices : register(t5);
+
+// Same output as BlinnPhongVertex.hlsl, but the skinning has already been done once for every pass.
+VertexShaderOutput main(SkinnedAppData IN, uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+    VertexShaderOutput OUT;
+    
+    // The level's indices point into the whole mesh, with no base vertex, so vertexID is the mesh's vertex.
+    SkinnedVertex skinned = PreSkinnedVertices[(SkinningFirstInstance + instanceID) * SkinningVertexStride + vertexID - SkinningFirstVertex];
+    
+    OUT.PositionWS = skinned.PositionWS;
+    OUT.Position = mul(OUT.PositionWS, ViewProjectionMatrix);
+    OUT.NormalWS = skinned.NormalWS.xyz;
+    OUT.TexCoord = IN.TexCoord;
+ 
+    return OUT;
+}
@@ -0,0 +1,26 @@
+#include "utility.hlsl"
+
+// The mesh's own vertex buffer, read as a structured buffer.
+StructuredBuffer<SkinningVertex> SourceVertices : register(t6);
+
+// SkinningVertexStride vertices per instance, instances back to back.
+RWStructuredBuffer<SkinnedVertex> SkinnedVertices : register(u0);
+
+// One thread per vertex of one influence bucket of the level along x, one row of groups per instance drawn at it
+// along y. Built once per bucket (SkinningCompute1.hlsl, SkinningCompute2.hlsl, this one for four influences).
+// pre_skin_reference() in PreSkinning.cpp walks the same grid on the CPU.
+[numthreads(SKINNING_GROUP_SIZE, 1, 1)]
+void main(uint3 dispatchThreadID : SV_DispatchThreadID)
+{
+    uint vertex = dispatchThreadID.x;
+    uint instance = dispatchThreadID.y;
+    if (vertex >= SkinningBucketVertexCount || instance >= SkinningInstanceCount)
+    {
+        return;
+    }
+
+    vertex += SkinningBucketStart;
+    instance += SkinningFirstInstance;
+    SkinningVertex IN = SourceVertices[SkinningFirstVertex + vertex];
+    SkinnedVertices[instance * SkinningVertexStride + vertex] = skin_vertex(IN.Position, IN.Normal, IN.Joints, unpack_weights(IN.Weights), Instances[instance]);
+}
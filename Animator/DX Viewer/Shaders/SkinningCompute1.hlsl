@@ -0,0 +1,3 @@
+// The pre-skinning pass for the vertices with at most one influence, see SkinningCompute.hlsl.
+#define SKIN_INFLUENCES 1
+#include "SkinningCompute.hlsl"
@@ -0,0 +1,3 @@
+// The pre-skinning pass for the vertices with at most two influences, see SkinningCompute.hlsl.
+#define SKIN_INFLUENCES 2
+#include "SkinningCompute.hlsl"
@@ -49,6 +49,14 @@
 //#define PS_Input VS_Output // The output of the Vertex shader is the input of the Pixel shader.
 
 #define MAX_LIGHTS 8
+
+// Threads per group of the pre-skinning pass, PreSkinning.hpp holds the same value as SkinningGroupSize.
+#define SKINNING_GROUP_SIZE 64
+
+// Influences skin_vertex() blends, set by the variants built for each influence bucket (SkinWeights.hpp).
+#ifndef SKIN_INFLUENCES
+#define SKIN_INFLUENCES 4
+#endif
  
 // Light types.
 
@@ -83,6 +91,18 @@ struct AppData
     float4 InstancePos : INSTANCEPOS;
 };
 
+// AppData without the per-instance stream, instanced characters read their instance from Instances instead.
+// The weights come in as their bytes, see weights_from_bytes().
+struct SkinnedAppData
+{
+    float4 Position : POSITION;
+    float4 Normal : NORMAL;
+    float4 Color : COLOR;
+    float2 TexCoord : TEXCOORD;
+    int4 Joints : JOINTS;
+    uint4 Weights : WEIGHTS;
+};
+
 struct VertexShaderOutput
 {
     float4 PositionWS : TEXCOORD1;
@@ -124,7 +144,7 @@ struct _Material
     float2 Padding; // 8 bytes
     //----------------------------------- (16 byte boundary)
     
-}; // Total:               // 80 bytes ( 5 * 16 )
+}; // Total:               // 96 bytes ( 6 * 16 )
 
 //cbuffer MaterialProperties : register(b0)
 //{
@@ -153,23 +173,121 @@ struct Light
     //----------------------------------- (16 byte boundary)
 }; // Total:                           // 80 bytes (5 * 16)
  
-cbuffer PerObject : register(b0)
+// Constant buffers are split by how often they change. ShaderConstants.hpp mirrors these layouts
+// and checks every offset at compile time, keep the two in sync.
+
+cbuffer PerFrame : register(b0)
 {
-    matrix WorldMatrix; 
-    matrix InverseTransposeWorldMatrix;
-    matrix WorldViewProjectionMatrix;
-    _Material Material;
-    
+    matrix ViewProjectionMatrix; // 64 bytes
+    //----------------------------------- (16 byte boundary)
     float4 EyePosition; // 16 bytes
     //----------------------------------- (16 byte boundary)
     float4 GlobalAmbient; // 16 bytes
     //----------------------------------- (16 byte boundary)
     Light Lights[MAX_LIGHTS]; // 80 * 8 = 640 bytes
-    //
-    matrix JointTransforms[64];
-    
-    
-};  // Total:                           // 672 bytes (42 * 16)
+};  // Total:                           // 736 bytes (46 * 16)
+
+cbuffer PerMaterial : register(b1)
+{
+    _Material Material; // 96 bytes
+};  // Total:                           // 96 bytes (6 * 16)
+
+cbuffer PerObject : register(b2)
+{
+    matrix WorldMatrix;
+    matrix InverseTransposeWorldMatrix;
+    matrix WorldViewProjectionMatrix;
+};  // Total:                           // 192 bytes (12 * 16)
+
+// One per instanced character, mirrors GpuInstance in InstanceBuilder.hpp. Structured buffers are tightly packed.
+struct InstanceData
+{
+    matrix World; // 64 bytes, rigid transform plus uniform scale so it can transform normals too
+    uint PaletteOffset; // 4 bytes, first matrix of this instance in SkinPalettes
+    uint Clip; // 4 bytes
+    float ClipTime; // 4 bytes
+    uint Padding; // 4 bytes
+}; // Total:                           // 80 bytes
+
+StructuredBuffer<InstanceData> Instances : register(t3);
+StructuredBuffer<matrix> SkinPalettes : register(t4);
+
+// Root constants shared by the pre-skinning pass and the draws, set per level of detail,
+// mirrors SkinningConstants in ShaderConstants.hpp.
+cbuffer Skinning : register(b3)
+{
+    uint SkinningVertexCount; // 4 bytes, vertices of the level
+    uint SkinningInstanceCount; // 4 bytes, instances drawn at the level
+    uint SkinningFirstInstance; // 4 bytes, the level's first record in Instances
+    uint SkinningFirstVertex; // 4 bytes, the level's first vertex in the mesh
+    //----------------------------------- (16 byte boundary)
+    uint SkinningVertexStride; // 4 bytes, pre-skinned vertices per instance
+    uint SkinningBucketStart; // 4 bytes, the influence bucket's first vertex counted from the level's, pre-skinning only
+    uint SkinningBucketVertexCount; // 4 bytes, pre-skinning only
+    uint SkinningPadding; // 4 bytes
+};  // Total:                           // 32 bytes
+
+// A mesh vertex as the pre-skinning pass reads it, mirrors Vertex in MathTypes.hpp.
+struct SkinningVertex
+{
+    float4 Position; // 16 bytes
+    float4 Normal; // 16 bytes
+    float4 Color; // 16 bytes
+    float2 TexCoord; // 8 bytes
+    int4 Joints; // 16 bytes
+    uint Weights; // 4 bytes, four UNORM8s, the first influence in the low byte
+}; // Total:                           // 76 bytes
+
+// One vertex of one instance written by the pre-skinning pass, mirrors SkinnedVertex in PreSkinning.hpp.
+struct SkinnedVertex
+{
+    float4 PositionWS; // 16 bytes
+    float4 NormalWS; // 16 bytes
+}; // Total:                           // 32 bytes
+
+// mul(v, m) with the terms summed in a fixed order, so the CPU reference in PreSkinning.cpp can match it.
+float4 mul_ordered(float4 v, matrix m)
+{
+    precise float4 r = v.x * m[0];
+    r += v.y * m[1];
+    r += v.z * m[2];
+    r += v.w * m[3];
+    return r;
+}
+
+// UNORM8 weights to floats, multiplied rather than divided so unpack_weight() in SkinWeights.hpp gets the same bits.
+// The vertex shaders read the bytes as R8G8B8A8_UINT instead of letting the input assembler convert them, so both
+// skinning paths unpack them this one way.
+float4 weights_from_bytes(uint4 bytes)
+{
+    return float4(bytes) * (1.0f / 255.0f);
+}
+
+float4 unpack_weights(uint packed)
+{
+    return weights_from_bytes(uint4(packed & 0xFF, (packed >> 8) & 0xFF, (packed >> 16) & 0xFF, packed >> 24));
+}
+
+// Linear blend skinning with the instance's palette followed by its world transform, blending the first
+// SKIN_INFLUENCES joints; a vertex's influence bucket guarantees the rest weigh nothing.
+// Used by both skinning paths so the vertex shader and the pre-skinning pass agree exactly.
+SkinnedVertex skin_vertex(float4 position, float4 normal, int4 joints, float4 weights, InstanceData instance)
+{
+    precise float4 skinned_pos = { 0.0f, 0.0f, 0.0f, 0.0f };
+    precise float4 skinned_norm = { 0.0f, 0.0f, 0.0f, 0.0f };
+    [unroll]
+    for (int j = 0; j < SKIN_INFLUENCES; ++j)
+    {
+        matrix joint = SkinPalettes[instance.PaletteOffset + joints[j]];
+        skinned_pos += mul_ordered(float4(position.xyz, 1.0f), joint) * weights[j];
+        skinned_norm += mul_ordered(float4(normal.xyz, 0.0f), joint) * weights[j];
+    }
+
+    SkinnedVertex OUT;
+    OUT.PositionWS = mul_ordered(skinned_pos, instance.World);
+    OUT.NormalWS = mul_ordered(skinned_norm, instance.World);
+    return OUT;
+}
 
 struct LightingResult
 {
@@ -0,0 +1,120 @@
+#include "SkinWeights.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace MRenderer
+{
+	uint32_t quantize_weights(const double weights[4])
+	{
+		double sum = 0.0;
+		for (int i = 0; i < 4; i++)
+		{
+			sum += std::max(weights[i], 0.0);
+		}
+		if (sum <= 0.0)
+		{
+			return 0;
+		}
+
+		int steps[4];
+		double remainders[4];
+		int left = 255;
+		for (int i = 0; i < 4; i++)
+		{
+			const double scaled = std::max(weights[i], 0.0) / sum * 255.0;
+			steps[i] = static_cast<int>(std::floor(scaled));
+			remainders[i] = scaled - steps[i];
+			left -= steps[i];
+		}
+		for (; left > 0; left--)
+		{
+			const int most = static_cast<int>(std::max_element(remainders, remainders + 4) - remainders);
+			steps[most]++;
+			remainders[most] = -1.0;
+		}
+
+		uint32_t packed = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			packed |= static_cast<uint32_t>(steps[i]) << (8 * i);
+		}
+		return packed;
+	}
+
+	uint32_t influence_bucket(uint32_t packed)
+	{
+		uint32_t used = 0;
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			if ((packed >> (8 * i)) & 0xFF)
+			{
+				used = i + 1;
+			}
+		}
+		uint32_t bucket = 0;
+		while (bucket + 1 < InfluenceBucketCount && BucketInfluences[bucket] < used)
+		{
+			bucket++;
+		}
+		return bucket;
+	}
+
+	uint32_t bucket_start(const InfluenceBuckets& buckets, uint32_t bucket)
+	{
+		uint32_t start = 0;
+		for (uint32_t b = 0; b < bucket; b++)
+		{
+			start += buckets.counts[b];
+		}
+		return start;
+	}
+
+	InfluenceBuckets unsorted_buckets(uint32_t count)
+	{
+		InfluenceBuckets buckets = {};
+		buckets.counts[InfluenceBucketCount - 1] = count;
+		return buckets;
+	}
+
+	bool vertex_buckets_valid(const InfluenceBuckets& buckets, const uint32_t* weights, uint32_t vertexCount)
+	{
+		uint32_t vertex = 0;
+		for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+		{
+			if (buckets.counts[bucket] > vertexCount - vertex)
+			{
+				return false;
+			}
+			for (const uint32_t end = vertex + buckets.counts[bucket]; vertex < end; vertex++)
+			{
+				if (influence_bucket(weights[vertex]) > bucket)
+				{
+					return false;
+				}
+			}
+		}
+		return vertex == vertexCount;
+	}
+
+	bool index_buckets_valid(const InfluenceBuckets& buckets, const int* indices, uint32_t indexCount, const uint32_t* weights,
+		size_t vertexCount)
+	{
+		uint32_t index = 0;
+		for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+		{
+			if (buckets.counts[bucket] % 3 != 0 || buckets.counts[bucket] > indexCount - index)
+			{
+				return false;
+			}
+			for (const uint32_t end = index + buckets.counts[bucket]; index < end; index++)
+			{
+				if (indices[index] < 0 || static_cast<size_t>(indices[index]) >= vertexCount || influence_bucket(weights[indices[index]]) > bucket)
+				{
+					return false;
+				}
+			}
+		}
+		return index == indexCount;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Skin weights as the viewer stores them: four UNORM8s packed in one uint32_t, the first influence in the low
+// byte, always summing to exactly 255 steps. The exporter sorts each level's vertices, and each submesh's
+// triangles, into influence buckets so the GPU can skin every bucket with a path that blends only as many
+// influences as it needs. Files from before it are quantized on load and left in the last bucket whole.
+// No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	static const uint32_t InfluenceBucketCount = 3;
+
+	// Influences each bucket's skinning path blends, the SKIN_INFLUENCES its shader variants are built with.
+	static const uint32_t BucketInfluences[InfluenceBucketCount] = { 1, 2, 4 };
+
+	// How many of a run of vertices, or of indices, fall in each bucket, in bucket order.
+	struct InfluenceBuckets
+	{
+		uint32_t counts[InfluenceBucketCount];
+	};
+
+	// Rounds the weights to UNORM8 as the exporter does: each is floored and the ones that lost the most get
+	// the leftover steps back, so they sum to exactly 255 unless they were all zero. Negative weights count as 0.
+	uint32_t quantize_weights(const double weights[4]);
+
+	// One of the packed weights, exactly as weights_from_bytes() in utility.hlsl unpacks it.
+	inline float unpack_weight(uint32_t packed, int influence)
+	{
+		return static_cast<float>((packed >> (influence * 8)) & 0xFF) * (1.0f / 255.0f);
+	}
+
+	// The first bucket whose path reaches the last nonzero weight of packed.
+	uint32_t influence_bucket(uint32_t packed);
+
+	// Where bucket starts in a run sorted into buckets, counted from the run's first.
+	uint32_t bucket_start(const InfluenceBuckets& buckets, uint32_t bucket);
+
+	// All of a run in the last bucket, for one that was never sorted.
+	InfluenceBuckets unsorted_buckets(uint32_t count);
+
+	// Whether buckets add up to vertexCount and every vertex of the run starting at weights is in a bucket whose
+	// path reaches all of its weights.
+	bool vertex_buckets_valid(const InfluenceBuckets& buckets, const uint32_t* weights, uint32_t vertexCount);
+
+	// Whether buckets add up to indexCount in whole triangles, every index is below vertexCount and every corner
+	// of a triangle is reached by the path of the triangle's bucket.
+	bool index_buckets_valid(const InfluenceBuckets& buckets, const int* indices, uint32_t indexCount, const uint32_t* weights,
+		size_t vertexCount);
+}
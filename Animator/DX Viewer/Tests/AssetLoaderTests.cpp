@@ -0,0 +1,397 @@
+#include "AssetLoader.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// AssetLoader against real files in a scratch directory: the first argument, else TMPDIR, else /tmp. Workers
+// are held inside a decoder to line up queued and running requests deterministically.
+namespace
+{
+	using namespace MRenderer;
+
+	std::string g_directory;
+	std::vector<std::string> g_files;
+
+	// Writes size bytes counting up from 0, so any byte's value is its offset mod 256.
+	std::string write_file(const std::string& name, size_t size)
+	{
+		const std::string path = g_directory + "/AssetLoaderTests." + name;
+		std::ofstream file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		for (size_t i = 0; i < size; i++)
+		{
+			file.put(static_cast<char>(i & 0xff));
+		}
+		g_files.push_back(path);
+		return path;
+	}
+
+	// Opened once by the test, waited on by whoever needs to be held until then.
+	class Gate
+	{
+	public:
+		void Open()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_open = true;
+			m_changed.notify_all();
+		}
+
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_changed.wait(lock, [this] { return m_open; });
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		bool m_open = false;
+	};
+
+	// A decoder that says it started, then holds its worker until released.
+	AssetLoader::Request blocking_request(const std::string& path, Gate& started, Gate& release)
+	{
+		AssetLoader::Request request;
+		request.path = path;
+		request.decode = [&started, &release](const std::string&, std::vector<uint8_t>& bytes, std::string&)
+		{
+			started.Open();
+			release.Wait();
+			return std::make_shared<size_t>(bytes.size());
+		};
+		return request;
+	}
+
+	bool ready(const AssetLoader::Ticket& ticket)
+	{
+		return ticket.result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	const std::vector<uint8_t>* bytes_of(const LoadResult& result)
+	{
+		return static_cast<const std::vector<uint8_t>*>(result.asset.get());
+	}
+
+	void test_priority_order()
+	{
+		const std::string path = write_file("priority", 16);
+		AssetLoader loader;
+		loader.Start(1);
+
+		Gate started, release;
+		AssetLoader::Ticket blocker = loader.Load(blocking_request(path, started, release));
+		started.Wait();
+
+		// Queued behind the blocker on the only worker: highest priority first, in order within a priority.
+		std::mutex orderMutex;
+		std::vector<int> order;
+		const LoadPriority priorities[] = { LOAD_PRIORITY_LOW, LOAD_PRIORITY_NORMAL, LOAD_PRIORITY_HIGH, LOAD_PRIORITY_LOW, LOAD_PRIORITY_HIGH };
+		std::vector<AssetLoader::Ticket> tickets;
+		for (int i = 0; i < 5; i++)
+		{
+			AssetLoader::Request request;
+			request.path = path;
+			request.priority = priorities[i];
+			request.decode = [i, &orderMutex, &order](const std::string&, std::vector<uint8_t>&, std::string&)
+			{
+				std::lock_guard<std::mutex> lock(orderMutex);
+				order.push_back(i);
+				return std::make_shared<int>(i);
+			};
+			tickets.push_back(loader.Load(request));
+		}
+		CHECK(loader.InFlight() == 6);
+
+		release.Open();
+		for (const AssetLoader::Ticket& ticket : tickets)
+		{
+			CHECK(ticket.result.get().status == LOAD_LOADED);
+		}
+		CHECK(blocker.result.get().status == LOAD_LOADED);
+		CHECK((order == std::vector<int>{ 2, 4, 1, 0, 3 }));
+		loader.Stop();
+	}
+
+	void test_cancel_while_queued()
+	{
+		const std::string path = write_file("cancel_queued", 16);
+		AssetLoader loader;
+		loader.Start(1);
+
+		Gate started, release;
+		AssetLoader::Ticket blocker = loader.Load(blocking_request(path, started, release));
+		started.Wait();
+
+		bool decoded = false;
+		LoadStatus called = LOAD_PENDING;
+		AssetLoader::Request request;
+		request.path = path;
+		request.decode = [&decoded](const std::string&, std::vector<uint8_t>&, std::string&)
+		{
+			decoded = true;
+			return std::make_shared<int>(0);
+		};
+		request.onComplete = [&called](const LoadResult& result) { called = result.status; };
+		AssetLoader::Ticket queued = loader.Load(request);
+
+		// Dropped at once, without waiting for the worker.
+		CHECK(loader.Cancel(queued.id));
+		CHECK(ready(queued));
+		CHECK(queued.result.get().status == LOAD_CANCELLED);
+		CHECK(queued.result.get().id == queued.id);
+		CHECK(!loader.Cancel(queued.id));
+		CHECK(loader.Pump() == 1);
+		CHECK(called == LOAD_CANCELLED);
+
+		release.Open();
+		CHECK(blocker.result.get().status == LOAD_LOADED);
+		loader.Stop();
+		CHECK(!decoded);
+		CHECK(!loader.Cancel(blocker.id));
+	}
+
+	void test_cancel_while_running()
+	{
+		const std::string path = write_file("cancel_running", 64);
+		AssetLoader loader;
+		loader.Start(1);
+
+		Gate started, release;
+		LoadStatus called = LOAD_PENDING;
+		AssetLoader::Request request = blocking_request(path, started, release);
+		request.onComplete = [&called](const LoadResult& result) { called = result.status; };
+		AssetLoader::Ticket running = loader.Load(request);
+		started.Wait();
+
+		// On a worker it can only be abandoned once the decoder returns, and what it decoded is thrown away.
+		CHECK(loader.Cancel(running.id));
+		CHECK(!ready(running));
+		release.Open();
+		const LoadResult result = running.result.get();
+		CHECK(result.status == LOAD_CANCELLED);
+		CHECK(!result.asset);
+		CHECK(loader.InFlight() == 0);
+		loader.Pump();
+		CHECK(called == LOAD_CANCELLED);
+		loader.Stop();
+	}
+
+	void test_failures()
+	{
+		const std::string path = write_file("short", 10);
+		AssetLoader loader;
+		loader.Start(2);
+
+		AssetLoader::Request missing;
+		missing.path = g_directory + "/AssetLoaderTests.missing";
+		AssetLoader::Request beyond;
+		beyond.path = path;
+		beyond.offset = 11;
+		AssetLoader::Request tooShort;
+		tooShort.path = path;
+		tooShort.offset = 4;
+		tooShort.size = 7;
+		AssetLoader::Request rejected;
+		rejected.path = path;
+		rejected.decode = [](const std::string&, std::vector<uint8_t>&, std::string& error)
+		{
+			error = "Not a mesh";
+			return std::shared_ptr<void>();
+		};
+
+		const LoadResult missingResult = loader.Load(missing).result.get();
+		CHECK(missingResult.status == LOAD_FAILED);
+		CHECK(!missingResult.error.empty() && !missingResult.asset);
+		CHECK(missingResult.path == missing.path);
+		CHECK(loader.Load(beyond).result.get().status == LOAD_FAILED);
+		CHECK(loader.Load(tooShort).result.get().status == LOAD_FAILED);
+		const LoadResult rejectedResult = loader.Load(rejected).result.get();
+		CHECK(rejectedResult.status == LOAD_FAILED && rejectedResult.error == "Not a mesh");
+
+		// Just fitting isn't short.
+		tooShort.size = 6;
+		const LoadResult fits = loader.Load(tooShort).result.get();
+		CHECK(fits.status == LOAD_LOADED && bytes_of(fits)->size() == 6);
+		loader.Stop();
+	}
+
+	void test_ranged_reads()
+	{
+		const std::string path = write_file("ranged", 1000);
+		AssetLoader loader;
+		loader.Start(2);
+
+		AssetLoader::Request request;
+		request.path = path;
+		request.offset = 300;
+		request.size = 20;
+		LoadResult result = loader.Load(request).result.get();
+		CHECK(result.status == LOAD_LOADED);
+		const std::vector<uint8_t>* bytes = bytes_of(result);
+		CHECK(bytes->size() == 20 && (*bytes)[0] == (300 & 0xff) && (*bytes)[19] == (319 & 0xff));
+
+		// WholeFile reads to the end, from the offset.
+		request.size = AssetLoader::WholeFile;
+		result = loader.Load(request).result.get();
+		CHECK(result.status == LOAD_LOADED && bytes_of(result)->size() == 700);
+		request.offset = 1000;
+		result = loader.Load(request).result.get();
+		CHECK(result.status == LOAD_LOADED && bytes_of(result)->empty());
+
+		// 0 reads nothing, not even whether the file is there; the decoder sees no bytes.
+		size_t decodedBytes = 1;
+		request.path = g_directory + "/AssetLoaderTests.missing";
+		request.offset = 0;
+		request.size = 0;
+		request.decode = [&decodedBytes](const std::string&, std::vector<uint8_t>& bytes, std::string&)
+		{
+			decodedBytes = bytes.size();
+			return std::make_shared<int>(0);
+		};
+		CHECK(loader.Load(request).result.get().status == LOAD_LOADED);
+		CHECK(decodedBytes == 0);
+		loader.Stop();
+	}
+
+	void test_callbacks_only_run_in_pump()
+	{
+		const std::string path = write_file("pump", 32);
+		AssetLoader loader;
+		loader.Start(1);
+
+		Gate started, release;
+		std::vector<LoadResult> called;
+		AssetLoader::Request request = blocking_request(path, started, release);
+		request.onComplete = [&called](const LoadResult& result) { called.push_back(result); };
+		AssetLoader::Ticket ticket = loader.Load(request);
+		started.Wait();
+
+		// Pumped before the future is ready there's nothing to run.
+		CHECK(loader.Pump() == 0);
+		CHECK(called.empty());
+
+		// Once the future is ready its callback is already queued, and it waits for Pump().
+		release.Open();
+		const LoadResult result = ticket.result.get();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		CHECK(called.empty());
+		CHECK(loader.Pump() == 1);
+		CHECK(called.size() == 1 && called[0].id == ticket.id && called[0].status == result.status);
+		CHECK(called[0].asset == result.asset);
+		CHECK(loader.Pump() == 0);
+
+		// maxCallbacks runs that many and leaves the rest queued, in completion order.
+		std::vector<AssetLoader::Ticket> tickets;
+		for (int i = 0; i < 3; i++)
+		{
+			AssetLoader::Request more;
+			more.path = path;
+			more.onComplete = [&called](const LoadResult& result) { called.push_back(result); };
+			tickets.push_back(loader.Load(more));
+		}
+		for (const AssetLoader::Ticket& t : tickets)
+		{
+			t.result.wait();
+		}
+		CHECK(loader.Pump(2) == 2);
+		CHECK(loader.Pump() == 1);
+		CHECK(called.size() == 4 && called[1].id == tickets[0].id && called[3].id == tickets[2].id);
+		loader.Stop();
+	}
+
+	void test_stop_with_work_queued()
+	{
+		const std::string path = write_file("stop", 32);
+		AssetLoader loader;
+		loader.Start(1);
+
+		Gate started, release;
+		int callbacks = 0;
+		bool decoded = false;
+		AssetLoader::Request request = blocking_request(path, started, release);
+		request.onComplete = [&callbacks](const LoadResult&) { callbacks++; };
+		AssetLoader::Ticket running = loader.Load(request);
+		started.Wait();
+
+		std::vector<AssetLoader::Ticket> queued;
+		for (int i = 0; i < 4; i++)
+		{
+			AssetLoader::Request waiting;
+			waiting.path = path;
+			waiting.decode = [&decoded](const std::string&, std::vector<uint8_t>&, std::string&)
+			{
+				decoded = true;
+				return std::make_shared<int>(0);
+			};
+			waiting.onComplete = [&callbacks](const LoadResult&) { callbacks++; };
+			queued.push_back(loader.Load(waiting));
+		}
+
+		std::thread stopper([&loader] { loader.Stop(); });
+
+		// Stop() has taken the queue once the loader turns requests away; only then is the worker let go.
+		for (;;)
+		{
+			AssetLoader::Request probe;
+			probe.path = path;
+			probe.decode = [&decoded](const std::string&, std::vector<uint8_t>&, std::string&)
+			{
+				decoded = true;
+				return std::make_shared<int>(0);
+			};
+			probe.onComplete = [&callbacks](const LoadResult&) { callbacks++; };
+			AssetLoader::Ticket ticket = loader.Load(probe);
+			if (ready(ticket) && ticket.result.get().status == LOAD_CANCELLED && !ticket.result.get().error.empty())
+			{
+				break;
+			}
+			queued.push_back(ticket);
+			std::this_thread::yield();
+		}
+		release.Open();
+		stopper.join();
+
+		// Everything ends cancelled and every callback has run by the time Stop() returns, the turned away
+		// probe's included.
+		CHECK(running.result.get().status == LOAD_CANCELLED);
+		bool allCancelled = true;
+		for (const AssetLoader::Ticket& ticket : queued)
+		{
+			allCancelled &= ready(ticket) && ticket.result.get().status == LOAD_CANCELLED;
+		}
+		CHECK(allCancelled);
+		CHECK(!decoded);
+		CHECK(callbacks == static_cast<int>(queued.size()) + 2);
+		CHECK(loader.InFlight() == 0);
+		CHECK(loader.WorkerCount() == 0);
+		CHECK(loader.Load(request).result.get().status == LOAD_CANCELLED);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* temp = std::getenv("TMPDIR");
+	g_directory = argc > 1 ? argv[1] : (temp ? temp : "/tmp");
+
+	test_priority_order();
+	test_cancel_while_queued();
+	test_cancel_while_running();
+	test_failures();
+	test_ranged_reads();
+	test_callbacks_only_run_in_pump();
+	test_stop_with_work_queued();
+
+	for (const std::string& path : g_files)
+	{
+		std::remove(path.c_str());
+	}
+	return MRenderer::Tests::finish("AssetLoaderTests");
+}
@@ -0,0 +1,319 @@
+#include "ClipStream.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ClipStream paging a clip in from a scratch file laid out as the exporter writes one: the first argument,
+// else TMPDIR, else /tmp. The loader has one worker, which a request can hold, so reads stay queued while the
+// test cancels and asks again.
+namespace
+{
+	using namespace MRenderer;
+
+	const uint32_t JointCount = 2;
+	const uint32_t BlockCount = 10;
+	const uint32_t KeysPerBlock = 4;
+	const uint32_t KeyCount = BlockCount * KeysPerBlock;
+	const double KeySeconds = 0.25; // so a block is a second
+	const uint64_t JunkBytes = 100;
+
+	std::string g_directory;
+	std::vector<std::string> g_files;
+
+	// Opened once by the test, waited on by whoever needs to be held until then.
+	class Gate
+	{
+	public:
+		void Open()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_open = true;
+			m_changed.notify_all();
+		}
+
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_changed.wait(lock, [this] { return m_open; });
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		bool m_open = false;
+	};
+
+	// Key k's joint j is translated by (k, j, 0), so a pose says which key it came from.
+	Matrix4 key_joint(uint32_t key, uint32_t joint)
+	{
+		Matrix4 m = {};
+		for (int i = 0; i < 4; i++)
+		{
+			m.m[i][i] = 1.0f;
+		}
+		m.m[3][0] = static_cast<float>(key);
+		m.m[3][1] = static_cast<float>(joint);
+		return m;
+	}
+
+	// Junk, every key record (its time then each joint's transform and parent), junk; and where the keys are.
+	ClipStream::Source write_clip(const std::string& name)
+	{
+		ClipStream::Source source;
+		source.path = g_directory + "/ClipStreamTests." + name;
+		source.keyOffset = JunkBytes;
+		source.jointCount = JointCount;
+		source.blockSeconds = KeysPerBlock * KeySeconds;
+
+		std::ofstream file(source.path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		const std::vector<char> junk(JunkBytes, 'x');
+		file.write(junk.data(), junk.size());
+		for (uint32_t k = 0; k < KeyCount; k++)
+		{
+			const double keytime = k * KeySeconds;
+			source.keytimes.push_back(keytime);
+			file.write(reinterpret_cast<const char*>(&keytime), sizeof(double));
+			for (uint32_t j = 0; j < JointCount; j++)
+			{
+				const Matrix4 transform = key_joint(k, j);
+				const int32_t parent = static_cast<int32_t>(j) - 1;
+				file.write(reinterpret_cast<const char*>(&transform), sizeof(Matrix4));
+				file.write(reinterpret_cast<const char*>(&parent), sizeof(int32_t));
+			}
+		}
+		file.write(junk.data(), junk.size());
+		g_files.push_back(source.path);
+
+		for (uint32_t b = 0; b < BlockCount; b++)
+		{
+			source.blocks.push_back({ b * KeysPerBlock, KeysPerBlock });
+		}
+		return source;
+	}
+
+	SkinnedClip streamed_clip(const ClipStream::Source& source)
+	{
+		SkinnedClip clip;
+		clip.jointCount = JointCount;
+		clip.duration = KeyCount * KeySeconds;
+		clip.keytimes = source.keytimes;
+		return clip;
+	}
+
+	// One instance standing still at time, so it wants only the block under it.
+	std::vector<CrowdInstance> standing_at(double time)
+	{
+		std::vector<CrowdInstance> instances(1);
+		instances[0].time = time;
+		instances[0].speed = 0.0f;
+		return instances;
+	}
+
+	// Which key the pose KeyPose() gave came from, -1 for none.
+	int key_of(const ClipStream& stream, size_t key)
+	{
+		const Matrix4* pose = stream.KeyPose(key);
+		return pose ? static_cast<int>(pose[0].m[3][0]) : -1;
+	}
+
+	// Waits for every read to finish, then runs their callbacks.
+	void settle(AssetLoader& loader)
+	{
+		while (loader.InFlight() > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		loader.Pump();
+	}
+
+	// Holds the loader's only worker until release opens, so what's asked for meanwhile stays queued.
+	AssetLoader::Ticket hold_worker(AssetLoader& loader, Gate& release)
+	{
+		Gate started;
+		AssetLoader::Request request;
+		request.path = g_files.front();
+		request.size = 0;
+		request.decode = [&started, &release](const std::string&, std::vector<uint8_t>&, std::string&)
+		{
+			started.Open();
+			release.Wait();
+			return std::make_shared<int>(0);
+		};
+		AssetLoader::Ticket ticket = loader.Load(std::move(request));
+		started.Wait();
+		return ticket;
+	}
+
+	void test_key_pose_falls_back()
+	{
+		AssetLoader loader;
+		loader.Start(1);
+		const ClipStream::Source source = write_clip("fallback");
+		CHECK(ClipStream::SourceValid(source, KeyCount));
+		const SkinnedClip clip = streamed_clip(source);
+		ClipStream stream(loader, source, 4, 0.0);
+
+		CHECK(stream.KeyPose(0) == nullptr);
+		CHECK(stream.Open());
+		const uint64_t missed = stream.GetStats().misses;
+		CHECK(key_of(stream, 1) == 1);
+		CHECK(stream.GetStats().misses == missed);
+
+		// Block 3 isn't resident: the last key of the nearest resident block before it.
+		CHECK(key_of(stream, 13) == 3);
+		CHECK(stream.GetStats().misses == missed + 1);
+
+		stream.Update(clip, standing_at(2.5), 0);
+		settle(loader);
+		CHECK(key_of(stream, 9) == 9);
+		CHECK(key_of(stream, 13) == 11);
+		CHECK(key_of(stream, 39) == 11);
+		CHECK(stream.GetStats().misses == missed + 3);
+		loader.Stop();
+	}
+
+	void test_trim_evicts_least_recently_wanted()
+	{
+		AssetLoader loader;
+		loader.Start(1);
+		const ClipStream::Source source = write_clip("trim");
+		const SkinnedClip clip = streamed_clip(source);
+		ClipStream stream(loader, source, 2, 0.0);
+		CHECK(stream.Open());
+
+		for (double time : { 1.5, 2.5, 3.5 })
+		{
+			stream.Update(clip, standing_at(time), 0);
+			settle(loader);
+		}
+		// Two blocks fit besides the first, so block 1, wanted longest ago, made room for block 3.
+		const ClipStream::Stats stats = stream.GetStats();
+		CHECK(stats.requests == 3);
+		CHECK(stats.evictions == 1);
+		CHECK(stats.residentBlocks == 3);
+		CHECK(stats.residentBytes == 3 * KeysPerBlock * JointCount * sizeof(Matrix4));
+		CHECK(key_of(stream, 5) == 3);
+		CHECK(key_of(stream, 9) == 9);
+		CHECK(key_of(stream, 14) == 14);
+		loader.Stop();
+	}
+
+	void test_stale_read_cancelled()
+	{
+		AssetLoader loader;
+		loader.Start(1);
+		const ClipStream::Source source = write_clip("stale");
+		const SkinnedClip clip = streamed_clip(source);
+		ClipStream stream(loader, source, 1, 0.0);
+		CHECK(stream.Open());
+
+		Gate release;
+		AssetLoader::Ticket held = hold_worker(loader, release);
+
+		// Block 5's read is still queued when the playhead moves on to block 7, and one block fits: the read
+		// nobody wants any more is cancelled for the one that is.
+		stream.Update(clip, standing_at(5.5), 0);
+		stream.Update(clip, standing_at(7.5), 0);
+		CHECK(stream.GetStats().requests == 2);
+
+		release.Open();
+		settle(loader);
+		CHECK(held.result.get().status == LOAD_LOADED);
+		CHECK(key_of(stream, 21) == 3);
+		CHECK(key_of(stream, 29) == 29);
+		CHECK(stream.GetStats().residentBlocks == 2);
+		CHECK(stream.GetStats().evictions == 0);
+		loader.Stop();
+	}
+
+	void test_outdated_arrival_ignored()
+	{
+		AssetLoader loader;
+		loader.Start(1);
+		const ClipStream::Source source = write_clip("outdated");
+		const SkinnedClip clip = streamed_clip(source);
+		ClipStream stream(loader, source, 1, 0.0);
+		CHECK(stream.Open());
+
+		Gate release;
+		hold_worker(loader, release);
+
+		// Block 5 is asked for, cancelled for block 7, then asked for again. The first read's cancellation
+		// arrives while the second is on its way, and mustn't be taken for it.
+		stream.Update(clip, standing_at(5.5), 0);
+		stream.Update(clip, standing_at(7.5), 0);
+		stream.Update(clip, standing_at(5.5), 0);
+		CHECK(stream.GetStats().requests == 3);
+
+		release.Open();
+		settle(loader);
+		CHECK(key_of(stream, 21) == 21);
+		CHECK(key_of(stream, 29) == 23);
+		CHECK(stream.GetStats().residentBlocks == 2);
+		CHECK(stream.GetStats().failures == 0);
+
+		// Nothing is left pending, so it isn't asked for again.
+		stream.Update(clip, standing_at(5.5), 0);
+		CHECK(stream.GetStats().requests == 3);
+		loader.Stop();
+	}
+
+	void test_shrinking_the_cache()
+	{
+		AssetLoader loader;
+		loader.Start(1);
+		const ClipStream::Source source = write_clip("shrink");
+		const SkinnedClip clip = streamed_clip(source);
+		ClipStream stream(loader, source, 4, 3.0);
+		CHECK(stream.Open());
+
+		// Playing forwards from 1.1s with 3s of prefetch wants blocks 1 to 4.
+		std::vector<CrowdInstance> instances = standing_at(1.1);
+		instances[0].speed = 1.0f;
+		stream.Update(clip, instances, 0);
+		settle(loader);
+		CHECK(stream.GetStats().residentBlocks == 5);
+
+		// Down to one block, the one under the playhead, at the next update.
+		stream.SetCacheBlocks(1);
+		CHECK(stream.CacheBlocks() == 1);
+		stream.Update(clip, instances, 0);
+		const ClipStream::Stats stats = stream.GetStats();
+		CHECK(stats.residentBlocks == 2);
+		CHECK(stats.evictions == 3);
+		CHECK(stats.residentBytes == 2 * KeysPerBlock * JointCount * sizeof(Matrix4));
+		CHECK(stats.peakBytes == 5 * KeysPerBlock * JointCount * sizeof(Matrix4));
+		CHECK(key_of(stream, 5) == 5);
+		CHECK(key_of(stream, 9) == 7);
+
+		stream.SetCacheBlocks(0);
+		CHECK(stream.CacheBlocks() == 1);
+		loader.Stop();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* temp = std::getenv("TMPDIR");
+	g_directory = argc > 1 ? argv[1] : (temp ? temp : "/tmp");
+
+	test_key_pose_falls_back();
+	test_trim_evicts_least_recently_wanted();
+	test_stale_read_cancelled();
+	test_outdated_arrival_ignored();
+	test_shrinking_the_cache();
+
+	for (const std::string& path : g_files)
+	{
+		std::remove(path.c_str());
+	}
+	return MRenderer::Tests::finish("ClipStreamTests");
+}
@@ -0,0 +1,197 @@
+#include "ClusterCulling.hpp"
+#include "TestCheck.hpp"
+
+#include <cmath>
+#include <vector>
+
+// cull_cluster() against a camera at the origin looking down +z with a 90 degree field of view, so the side
+// planes are x = +-z and y = +-z, near is z = 1 and far z = 100.
+namespace
+{
+	using namespace MRenderer;
+
+	const float Eye[3] = { 0.0f, 0.0f, 0.0f };
+
+	Matrix4 identity()
+	{
+		Matrix4 m = {};
+		for (int i = 0; i < 4; i++)
+		{
+			m.m[i][i] = 1.0f;
+		}
+		return m;
+	}
+
+	Matrix4 placed(float scaleX, float scaleY, float scaleZ, float x, float y, float z)
+	{
+		Matrix4 m = identity();
+		m.m[0][0] = scaleX;
+		m.m[1][1] = scaleY;
+		m.m[2][2] = scaleZ;
+		m.m[3][0] = x;
+		m.m[3][1] = y;
+		m.m[3][2] = z;
+		return m;
+	}
+
+	// Left handed, row vectors, depth 0 to w, as XMMatrixPerspectiveFovLH.
+	Frustum camera_frustum()
+	{
+		const float nearZ = 1.0f;
+		const float farZ = 100.0f;
+		Matrix4 projection = {};
+		projection.m[0][0] = 1.0f;
+		projection.m[1][1] = 1.0f;
+		projection.m[2][2] = farZ / (farZ - nearZ);
+		projection.m[2][3] = 1.0f;
+		projection.m[3][2] = -nearZ * farZ / (farZ - nearZ);
+		return frustum_from_matrix(projection);
+	}
+
+	Meshlet meshlet(float x, float y, float z, float radius)
+	{
+		Meshlet cluster = {};
+		cluster.vertexCount = 3;
+		cluster.triangleCount = 1;
+		cluster.center[0] = x;
+		cluster.center[1] = y;
+		cluster.center[2] = z;
+		cluster.radius = radius;
+		return cluster;
+	}
+
+	Meshlet coned(float x, float y, float z, float radius, float axisX, float axisY, float axisZ, float cutoff)
+	{
+		Meshlet cluster = meshlet(x, y, z, radius);
+		cluster.coneAxis[0] = axisX;
+		cluster.coneAxis[1] = axisY;
+		cluster.coneAxis[2] = axisZ;
+		cluster.coneCutoff = cutoff;
+		return cluster;
+	}
+
+	ClusterVisibility cull(const Meshlet& cluster, const Matrix4& world = identity())
+	{
+		static const Frustum frustum = camera_frustum();
+		return cull_cluster(cluster, world, frustum, Eye);
+	}
+
+	void test_frustum_planes()
+	{
+		const Frustum frustum = camera_frustum();
+		const float inside[3] = { 0.0f, 0.0f, 10.0f };
+		bool allInside = true;
+		for (const float (&plane)[4] : frustum.planes)
+		{
+			allInside &= plane[0] * inside[0] + plane[1] * inside[1] + plane[2] * inside[2] + plane[3] > 0.0f;
+			allInside &= std::fabs(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2] - 1.0f) < 1e-5f;
+		}
+		CHECK(allInside);
+
+		// Near and far sit where the projection put them.
+		CHECK(std::fabs(frustum.planes[4][2] * 1.0f + frustum.planes[4][3]) < 1e-4f);
+		CHECK(std::fabs(frustum.planes[5][2] * 100.0f + frustum.planes[5][3]) < 1e-3f);
+	}
+
+	void test_outside_one_plane()
+	{
+		// Well inside every plane but one.
+		CHECK(cull(meshlet(20.0f, 0.0f, 10.0f, 1.0f)) == ClusterVisibility::OutsideFrustum);  // right
+		CHECK(cull(meshlet(-20.0f, 0.0f, 10.0f, 1.0f)) == ClusterVisibility::OutsideFrustum); // left
+		CHECK(cull(meshlet(0.0f, 20.0f, 10.0f, 1.0f)) == ClusterVisibility::OutsideFrustum);  // top
+		CHECK(cull(meshlet(0.0f, 0.0f, -5.0f, 1.0f)) == ClusterVisibility::OutsideFrustum);   // behind near
+		CHECK(cull(meshlet(0.0f, 0.0f, 120.0f, 1.0f)) == ClusterVisibility::OutsideFrustum);  // past far
+		CHECK(cull(meshlet(0.0f, 0.0f, 10.0f, 1.0f)) == ClusterVisibility::Visible);
+
+		// Placed by the instance: the same cluster moved out of view.
+		CHECK(cull(meshlet(0.0f, 0.0f, 10.0f, 1.0f), placed(1, 1, 1, 30.0f, 0.0f, 0.0f)) == ClusterVisibility::OutsideFrustum);
+	}
+
+	void test_straddling_a_plane()
+	{
+		// The centre is outside the right plane, x = z, but by less than the radius, so part of it shows.
+		CHECK(cull(meshlet(10.5f, 0.0f, 10.0f, 1.0f)) == ClusterVisibility::Visible);
+		CHECK(cull(meshlet(11.5f, 0.0f, 10.0f, 1.0f)) == ClusterVisibility::OutsideFrustum);
+
+		// Across the near plane, and across both a side and near at once.
+		CHECK(cull(meshlet(0.0f, 0.0f, 0.5f, 1.0f)) == ClusterVisibility::Visible);
+		CHECK(cull(meshlet(1.2f, 0.0f, 0.8f, 1.0f)) == ClusterVisibility::Visible);
+
+		// The radius grows by the instance's largest scale, so a cluster just outside straddles when scaled up.
+		const Meshlet cluster = meshlet(0.0f, 0.0f, 0.0f, 0.5f);
+		CHECK(cull(cluster, placed(1, 1, 1, 2.0f, 0.0f, 1.0f)) == ClusterVisibility::OutsideFrustum);
+		CHECK(cull(cluster, placed(1, 3, 1, 2.0f, 0.0f, 1.0f)) == ClusterVisibility::Visible);
+	}
+
+	void test_cone_back_face()
+	{
+		const float cos30 = std::cos(3.14159265f / 6.0f);
+
+		// Straight ahead of the eye with every normal within 30 degrees of +z, all facing away.
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, cos30)) == ClusterVisibility::BackFacing);
+
+		// Facing the eye, or side on with a cone wide enough to reach it, it shows.
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, -1.0f, cos30)) == ClusterVisibility::Visible);
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 1.0f, 0.0f, 0.0f, cos30)) == ClusterVisibility::Visible);
+
+		// Facing away, but a cone wider than 90 degrees less the view angle has normals towards the eye.
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.05f)) == ClusterVisibility::Visible);
+
+		// The sphere's size counts: seen from close up, part of it is viewed edge on.
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 9.0f, 0.0f, 0.0f, 1.0f, cos30)) == ClusterVisibility::Visible);
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 20.0f, 0.0f, 0.0f, 1.0f, 1.0f)) == ClusterVisibility::Visible);
+
+		// A cutoff of 0 or less means the normals face every way, never back facing however they point.
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f)) == ClusterVisibility::Visible);
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, -0.5f)) == ClusterVisibility::Visible);
+
+		// The axis is turned with the instance: rotated half a turn about y, +z faces the eye.
+		Matrix4 turned = identity();
+		turned.m[0][0] = -1.0f;
+		turned.m[2][2] = -1.0f;
+		turned.m[3][2] = 20.0f;
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, cos30), turned) == ClusterVisibility::Visible);
+		CHECK(cull(coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, -1.0f, cos30), turned) == ClusterVisibility::BackFacing);
+
+		// A uniform scale keeps the test, a non-uniform one skips it.
+		const Meshlet away = coned(0.0f, 0.0f, 5.0f, 0.5f, 0.0f, 0.0f, 1.0f, cos30);
+		CHECK(cull(away, placed(2, 2, 2, 0.0f, 0.0f, 0.0f)) == ClusterVisibility::BackFacing);
+		CHECK(cull(away, placed(1, 1, 2, 0.0f, 0.0f, 0.0f)) == ClusterVisibility::Visible);
+	}
+
+	void test_cull_clusters_range_and_stats()
+	{
+		const float cos30 = std::cos(3.14159265f / 6.0f);
+		const std::vector<Meshlet> meshlets = {
+			meshlet(0.0f, 0.0f, 10.0f, 1.0f),                              // not in the range
+			meshlet(20.0f, 0.0f, 10.0f, 1.0f),                             // outside
+			coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, cos30),       // back facing
+			meshlet(10.5f, 0.0f, 10.0f, 1.0f),                             // straddling
+			coned(0.0f, 0.0f, 10.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f),        // faces every way
+			meshlet(0.0f, 0.0f, -5.0f, 1.0f),                              // behind
+		};
+
+		const Frustum frustum = camera_frustum();
+		std::vector<uint32_t> visible = { 99 };
+		ClusterCullStats stats;
+		cull_clusters(meshlets.data(), 1, 5, identity(), frustum, Eye, visible, stats);
+
+		// Appended as indices into the whole array, after what was there.
+		CHECK((visible == std::vector<uint32_t>{ 99, 3, 4 }));
+		CHECK(stats.tested == 5 && stats.outsideFrustum == 2 && stats.backFacing == 1 && stats.Visible() == 2);
+
+		// Stats add up across calls.
+		cull_clusters(meshlets.data(), 0, 1, identity(), frustum, Eye, visible, stats);
+		CHECK(stats.tested == 6 && stats.Visible() == 3 && visible.back() == 0);
+	}
+}
+
+int main()
+{
+	test_frustum_planes();
+	test_outside_one_plane();
+	test_straddling_a_plane();
+	test_cone_back_face();
+	test_cull_clusters_range_and_stats();
+	return MRenderer::Tests::finish("ClusterCullingTests");
+}
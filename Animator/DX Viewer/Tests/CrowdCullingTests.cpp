@@ -0,0 +1,198 @@
+#include "CrowdCulling.hpp"
+#include "TestCheck.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Key bounds against brute force: a clip whose joints turn a long way between keys, sampled finely, skinned
+// exactly as the renderer does, and every vertex checked against clip_bounds() at that time.
+namespace
+{
+	using namespace MRenderer;
+
+	std::mt19937 g_random(44);
+
+	float random_float(float low, float high)
+	{
+		return std::uniform_real_distribution<float>(low, high)(g_random);
+	}
+
+	// A random rotation, as a unit quaternion turned into a row-major matrix, and translation.
+	Matrix4 random_rigid()
+	{
+		float q[4];
+		float length = 0.0f;
+		for (float& c : q)
+		{
+			c = random_float(-1.0f, 1.0f);
+			length += c * c;
+		}
+		length = std::sqrt(length);
+		const float x = q[0] / length, y = q[1] / length, z = q[2] / length, w = q[3] / length;
+
+		Matrix4 m = {};
+		m.m[0][0] = 1.0f - 2.0f * (y * y + z * z);
+		m.m[0][1] = 2.0f * (x * y + z * w);
+		m.m[0][2] = 2.0f * (x * z - y * w);
+		m.m[1][0] = 2.0f * (x * y - z * w);
+		m.m[1][1] = 1.0f - 2.0f * (x * x + z * z);
+		m.m[1][2] = 2.0f * (y * z + x * w);
+		m.m[2][0] = 2.0f * (x * z + y * w);
+		m.m[2][1] = 2.0f * (y * z - x * w);
+		m.m[2][2] = 1.0f - 2.0f * (x * x + y * y);
+		for (int j = 0; j < 3; j++)
+		{
+			m.m[3][j] = random_float(-0.5f, 0.5f);
+		}
+		m.m[3][3] = 1.0f;
+		return m;
+	}
+
+	SkinnedClip make_clip(uint32_t jointCount, uint32_t keyCount)
+	{
+		SkinnedClip clip;
+		clip.jointCount = jointCount;
+		clip.duration = keyCount * 0.5;
+		for (uint32_t k = 0; k < keyCount; k++)
+		{
+			clip.keytimes.push_back(k * 0.5);
+			for (uint32_t j = 0; j < jointCount; j++)
+			{
+				clip.poses.push_back(random_rigid());
+			}
+		}
+		for (uint32_t j = 0; j < jointCount; j++)
+		{
+			clip.inverseBind.push_back(random_rigid());
+			clip.parents.push_back(-1);
+		}
+		return clip;
+	}
+
+	std::vector<SkinningVertex> make_vertices(size_t count, uint32_t jointCount)
+	{
+		std::vector<SkinningVertex> vertices(count);
+		for (SkinningVertex& vertex : vertices)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				vertex.position[c] = random_float(-1.0f, 1.0f);
+			}
+			vertex.position[3] = 1.0f;
+			const uint32_t influences = 1 + g_random() % 4;
+			double weights[4] = {};
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				vertex.joints[i] = static_cast<int32_t>(g_random() % jointCount);
+				weights[i] = i < influences ? random_float(0.1f, 1.0f) : 0.0;
+			}
+			vertex.weights = quantize_weights(weights);
+		}
+		return vertices;
+	}
+
+	// How far outside box the point is along any axis, 0 inside it.
+	float outside_by(const Aabb& box, const float* p)
+	{
+		float distance = 0.0f;
+		for (int j = 0; j < 3; j++)
+		{
+			distance = std::max(distance, std::max(box.min[j] - p[j], p[j] - box.max[j]));
+		}
+		return distance;
+	}
+
+	void test_key_bounds_hold_every_interpolated_pose()
+	{
+		const uint32_t jointCount = 4;
+		const SkinnedClip clip = make_clip(jointCount, 5);
+		const std::vector<SkinningVertex> vertices = make_vertices(300, jointCount);
+
+		SkinnedClip bounded = clip;
+		compute_key_bounds(bounded, vertices.data(), vertices.size(), bounded.keyBounds);
+		CHECK(bounded.keyBounds.size() == clip.keytimes.size());
+
+		// The boxes of the keys alone, skinned at each key with nothing grown.
+		std::vector<Aabb> tight(clip.keytimes.size());
+		GpuInstance instance = {};
+		for (int j = 0; j < 4; j++)
+		{
+			instance.world.m[j][j] = 1.0f;
+		}
+		std::vector<Matrix4> joints(jointCount);
+		std::vector<Matrix4> palette(jointCount);
+		for (size_t k = 0; k < clip.keytimes.size(); k++)
+		{
+			sample_clip_pose(clip, clip.keytimes[k], joints.data());
+			build_skin_palette(clip, joints.data(), palette.data());
+			tight[k] = { { 1e30f, 1e30f, 1e30f }, { -1e30f, -1e30f, -1e30f } };
+			for (const SkinningVertex& vertex : vertices)
+			{
+				const SkinnedVertex skinned = skin_vertex(vertex, instance, palette.data(), 4);
+				for (int j = 0; j < 3; j++)
+				{
+					tight[k].min[j] = std::min(tight[k].min[j], skinned.positionWS[j]);
+					tight[k].max[j] = std::max(tight[k].max[j], skinned.positionWS[j]);
+				}
+			}
+		}
+
+		// Every sample, the wrap from the last key back to the first included, is inside the bounds; the keys'
+		// boxes alone aren't enough.
+		float worstInside = 0.0f;
+		float worstTight = 0.0f;
+		const int samples = 2000;
+		for (int s = 0; s <= samples; s++)
+		{
+			const double time = clip.duration * s / samples;
+			sample_clip_pose(clip, time, joints.data());
+			build_skin_palette(clip, joints.data(), palette.data());
+			Aabb box;
+			CHECK(clip_bounds(bounded, time, box));
+			const ClipKeys keys = find_clip_keys(clip, time);
+			Aabb keysOnly;
+			for (int j = 0; j < 3; j++)
+			{
+				keysOnly.min[j] = std::min(tight[keys.previous].min[j], tight[keys.next].min[j]);
+				keysOnly.max[j] = std::max(tight[keys.previous].max[j], tight[keys.next].max[j]);
+			}
+			for (const SkinningVertex& vertex : vertices)
+			{
+				const SkinnedVertex skinned = skin_vertex(vertex, instance, palette.data(), 4);
+				worstInside = std::max(worstInside, outside_by(box, skinned.positionWS));
+				worstTight = std::max(worstTight, outside_by(keysOnly, skinned.positionWS));
+			}
+		}
+		CHECK(worstInside < 1e-4f);
+		CHECK(worstTight > 1e-2f);
+	}
+
+	void test_key_turn()
+	{
+		Matrix4 identity = {};
+		Matrix4 turned = {};
+		for (int j = 0; j < 4; j++)
+		{
+			identity.m[j][j] = 1.0f;
+		}
+		// A quarter turn about z, translated, which doesn't count.
+		turned.m[0][1] = 1.0f;
+		turned.m[1][0] = -1.0f;
+		turned.m[2][2] = 1.0f;
+		turned.m[3][0] = 5.0f;
+		turned.m[3][3] = 1.0f;
+
+		CHECK(std::fabs(key_turn(identity, identity)) < 1e-6f);
+		CHECK(std::fabs(key_turn(identity, turned) - (1.0f - std::cos(0.25f * 3.14159265f))) < 1e-5f);
+		CHECK(std::fabs(key_turn(turned, identity) - key_turn(identity, turned)) < 1e-6f);
+	}
+}
+
+int main()
+{
+	test_key_turn();
+	test_key_bounds_hold_every_interpolated_pose();
+	return MRenderer::Tests::finish("CrowdCullingTests");
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "FrameRing.hpp"
+
+// An IFrameQueue with no GPU behind it: work finishes only when the test says so, or when the CPU blocks on
+// it, and every wait is remembered. No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	namespace Tests
+	{
+		class FakeFrameQueue : public IFrameQueue
+		{
+		public:
+			uint64_t Signal() override { return ++m_signalled; }
+			uint64_t CompletedValue() override { return m_completed; }
+
+			void WaitForValue(uint64_t value) override
+			{
+				waits.push_back(value);
+				Complete(value);
+			}
+
+			// The queue catching up to value.
+			void Complete(uint64_t value)
+			{
+				m_completed = value > m_completed ? value : m_completed;
+			}
+
+			uint64_t Signalled() const { return m_signalled; }
+
+			std::vector<uint64_t> waits;
+
+		private:
+			uint64_t m_signalled = 0;
+			uint64_t m_completed = 0;
+		};
+	}
+}
@@ -0,0 +1,162 @@
+#include "FileWatcher.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// FileWatcher against real files in a scratch directory: the first argument, else TMPDIR, else /tmp. Every test
+// runs once with the polling backend and once with inotify where there is one. Timing is generous rather than
+// tight: a change has to settle for SettleMs, and the checks wait several times that.
+namespace
+{
+	using namespace MRenderer;
+
+	const int SettleMs = 150;
+
+	std::string g_directory;
+	std::vector<std::string> g_files;
+
+	std::string scratch_path(const std::string& name)
+	{
+		const std::string path = g_directory + "/FileWatcherTests." + name;
+		g_files.push_back(path);
+		return path;
+	}
+
+	void write_file(const std::string& path, const std::string& contents)
+	{
+		std::ofstream file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		file << contents;
+	}
+
+	void sleep_ms(int ms)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	}
+
+	// Long enough for the watcher thread to pick up Watch() calls, or for anything written to settle and be drained.
+	void let_settle()
+	{
+		sleep_ms(SettleMs * 5);
+	}
+
+	std::vector<FileChange> drain(FileWatcher& watcher)
+	{
+		std::vector<FileChange> changes;
+		watcher.Drain(changes);
+		return changes;
+	}
+
+	// Editors write a file several times when saving. All of it is one change, reported once, as the path was
+	// given to Watch(). Another save of the same size straight after is a change too, even in the same second.
+	void test_burst_settles_once(const std::function<std::unique_ptr<FileWatchBackend>()>& backend)
+	{
+		const std::string path = scratch_path("burst");
+		write_file(path, "0");
+
+		FileWatcher watcher;
+		watcher.Start(backend(), SettleMs);
+		watcher.Watch(path);
+		let_settle();
+		CHECK(drain(watcher).empty());
+
+		for (int i = 1; i <= 5; i++)
+		{
+			write_file(path, std::string(i, 'a'));
+			sleep_ms(10);
+		}
+		let_settle();
+		std::vector<FileChange> changes = drain(watcher);
+		CHECK(changes.size() == 1);
+		CHECK(!changes.empty() && changes[0].path == path);
+
+		write_file(path, "bbbbb");
+		let_settle();
+		CHECK(drain(watcher).size() == 1);
+
+		let_settle();
+		CHECK(drain(watcher).empty());
+	}
+
+	// Saving by writing a new file and renaming it over the old one is a change to the watched path, and the
+	// watch keeps working for the saves after it.
+	void test_rename_over_save(const std::function<std::unique_ptr<FileWatchBackend>()>& backend)
+	{
+		const std::string path = scratch_path("renamed");
+		const std::string temporary = scratch_path("renamed.tmp");
+		write_file(path, "original");
+
+		FileWatcher watcher;
+		watcher.Start(backend(), SettleMs);
+		watcher.Watch(path);
+		let_settle();
+
+		write_file(temporary, "saved by rename");
+		CHECK(std::rename(temporary.c_str(), path.c_str()) == 0);
+		let_settle();
+		std::vector<FileChange> changes = drain(watcher);
+		CHECK(changes.size() == 1);
+		CHECK(!changes.empty() && changes[0].path == path);
+
+		write_file(temporary, "saved by rename again");
+		CHECK(std::rename(temporary.c_str(), path.c_str()) == 0);
+		let_settle();
+		CHECK(drain(watcher).size() == 1);
+	}
+
+	// A backend may see a whole directory; writes to files nobody asked about aren't reported.
+	void test_unwatched_files_ignored(const std::function<std::unique_ptr<FileWatchBackend>()>& backend)
+	{
+		const std::string watched = scratch_path("watched");
+		const std::string neighbour = scratch_path("neighbour");
+		write_file(watched, "watched");
+		write_file(neighbour, "neighbour");
+
+		FileWatcher watcher;
+		watcher.Start(backend(), SettleMs);
+		watcher.Watch(watched);
+		let_settle();
+
+		write_file(neighbour, "written");
+		write_file(scratch_path("created"), "created");
+		let_settle();
+		CHECK(drain(watcher).empty());
+
+		write_file(watched, "written");
+		let_settle();
+		std::vector<FileChange> changes = drain(watcher);
+		CHECK(changes.size() == 1);
+		CHECK(!changes.empty() && changes[0].path == watched);
+	}
+
+	void run_all(const std::function<std::unique_ptr<FileWatchBackend>()>& backend)
+	{
+		test_burst_settles_once(backend);
+		test_rename_over_save(backend);
+		test_unwatched_files_ignored(backend);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* temp = std::getenv("TMPDIR");
+	g_directory = argc > 1 ? argv[1] : (temp ? temp : "/tmp");
+
+	run_all(MRenderer::create_polling_backend);
+	if (MRenderer::create_inotify_backend())
+	{
+		run_all(MRenderer::create_inotify_backend);
+	}
+
+	for (const std::string& path : g_files)
+	{
+		std::remove(path.c_str());
+	}
+	return MRenderer::Tests::finish("FileWatcherTests");
+}
@@ -0,0 +1,89 @@
+#include "FrameRing.hpp"
+#include "FakeFrameQueue.hpp"
+#include "TestCheck.hpp"
+
+// FrameRing driven by a fake queue: no GPU, the test decides when each fence value is reached.
+namespace
+{
+	using namespace MRenderer;
+
+	using FakeQueue = Tests::FakeFrameQueue;
+
+	struct Frame
+	{
+		int recorded = 0;
+	};
+
+	void test_frame_waits_for_the_frame_latency_ago()
+	{
+		FakeQueue queue;
+		FrameRing<Frame> ring(3);
+		ring.SetQueue(&queue);
+
+		// The first Latency() frames have fresh slots and never wait.
+		uint64_t fences[6] = {};
+		for (int frame = 0; frame < 3; frame++)
+		{
+			ring.BeginFrame().recorded = frame;
+			fences[frame] = ring.EndFrame();
+		}
+		CHECK(queue.waits.empty());
+		CHECK(ring.StallCount() == 0);
+		CHECK(ring.CurrentIndex() == 0);
+
+		// Frame 3 reuses frame 0's slot while the GPU hasn't finished anything, so it waits on exactly frame 0's fence.
+		CHECK(ring.BeginFrame().recorded == 0);
+		CHECK(queue.waits.size() == 1 && queue.waits[0] == fences[0]);
+		CHECK(ring.StallCount() == 1);
+		fences[3] = ring.EndFrame();
+
+		// Once the GPU is past frame 1, frame 4 takes its slot without waiting.
+		queue.Complete(fences[1]);
+		CHECK(ring.BeginFrame().recorded == 1);
+		CHECK(queue.waits.size() == 1);
+		fences[4] = ring.EndFrame();
+
+		// Frame 5 waits on frame 2 and on nothing newer.
+		ring.BeginFrame();
+		CHECK(queue.waits.size() == 2 && queue.waits[1] == fences[2]);
+		CHECK(queue.CompletedValue() < fences[3]);
+		fences[5] = ring.EndFrame();
+		CHECK(ring.FenceValue(2) == fences[5]);
+		CHECK(ring.StallCount() == 2);
+	}
+
+	void test_wait_for_idle_waits_for_everything_submitted()
+	{
+		FakeQueue queue;
+		FrameRing<Frame> ring(2);
+		ring.SetQueue(&queue);
+
+		ring.BeginFrame();
+		const uint64_t last = ring.EndFrame();
+		ring.WaitForIdle();
+		CHECK(queue.waits.size() == 1 && queue.waits[0] > last);
+		CHECK(queue.CompletedValue() > last);
+
+		// Everything's done, so nothing waits until the ring laps the GPU again.
+		ring.BeginFrame();
+		ring.EndFrame();
+		ring.BeginFrame();
+		CHECK(queue.waits.size() == 1);
+	}
+
+	void test_latency_is_clamped()
+	{
+		FrameRing<Frame> none(0);
+		CHECK(none.Latency() == 1);
+		FrameRing<Frame> many(FrameRing<Frame>::MaxLatency + 3);
+		CHECK(many.Latency() == FrameRing<Frame>::MaxLatency);
+	}
+}
+
+int main()
+{
+	test_frame_waits_for_the_frame_latency_ago();
+	test_wait_for_idle_waits_for_everything_submitted();
+	test_latency_is_clamped();
+	return MRenderer::Tests::finish("FrameRingTests");
+}
@@ -0,0 +1,285 @@
+#include "HeapAllocator.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+// TlsfAllocator and HeapPool on offsets alone, no heaps behind them. The fuzz loop at the end doubles as a
+// benchmark and prints what an allocate and free pair costs.
+namespace
+{
+	using namespace MRenderer;
+
+	const uint64_t KiB = 1024;
+	const uint64_t MiB = 1024 * KiB;
+
+	// Live allocations by offset, to catch any two handed out over each other.
+	class Ranges
+	{
+	public:
+		// False if [offset, offset + size) overlaps one already held.
+		bool Add(uint64_t offset, uint64_t size)
+		{
+			auto next = m_ranges.lower_bound(offset);
+			if (next != m_ranges.end() && next->first < offset + size)
+			{
+				return false;
+			}
+			if (next != m_ranges.begin() && std::prev(next)->second > offset)
+			{
+				return false;
+			}
+			m_ranges[offset] = offset + size;
+			return true;
+		}
+
+		void Remove(uint64_t offset) { m_ranges.erase(offset); }
+
+	private:
+		std::map<uint64_t, uint64_t> m_ranges;
+	};
+
+	void test_granularity_and_alignment()
+	{
+		TlsfAllocator heap;
+		heap.Initialize(4 * MiB, 256);
+		CHECK(heap.Capacity() == 4 * MiB);
+
+		// Sizes round up to the granularity, an empty request still takes a unit.
+		TlsfAllocator::Allocation tiny, empty;
+		CHECK(heap.Allocate(1, 1, tiny) && tiny.size == 256 && tiny.offset == 0);
+		CHECK(heap.Allocate(0, 1, empty) && empty.size == 256);
+
+		Ranges ranges;
+		ranges.Add(tiny.offset, tiny.size);
+		ranges.Add(empty.offset, empty.size);
+		bool overlapped = false;
+		for (uint64_t alignment = 1; alignment <= MiB; alignment *= 2)
+		{
+			TlsfAllocator::Allocation allocation;
+			CHECK(heap.Allocate(300, alignment, allocation));
+			CHECK(allocation.offset % alignment == 0 && allocation.offset % 256 == 0);
+			CHECK(allocation.size == 512);
+			overlapped |= !ranges.Add(allocation.offset, allocation.size);
+		}
+		CHECK(!overlapped);
+		CHECK(heap.Validate());
+
+		// Alignment padding is split off as a free block, not counted as used.
+		const HeapStats stats = heap.Stats();
+		CHECK(stats.allocations == 23);
+		CHECK(stats.used == 2 * 256 + 21 * 512);
+		CHECK(stats.freeBlocks > 1);
+		CHECK(stats.Fragmentation() > 0.0f && stats.Fragmentation() < 1.0f);
+	}
+
+	void test_alignment_when_only_an_aligned_block_fits()
+	{
+		// Size plus worst case padding is more than the heap, but the one free block starts aligned.
+		TlsfAllocator heap;
+		heap.Initialize(64 * KiB, 1 * KiB);
+		TlsfAllocator::Allocation whole;
+		CHECK(heap.Allocate(64 * KiB, 64 * KiB, whole) && whole.offset == 0);
+		TlsfAllocator::Allocation none;
+		CHECK(!heap.Allocate(1, 1, none) && !none.Valid());
+		heap.Free(whole);
+
+		// A block that isn't aligned and has no room for padding is turned down.
+		TlsfAllocator::Allocation front, aligned;
+		CHECK(heap.Allocate(1 * KiB, 1, front));
+		CHECK(!heap.Allocate(63 * KiB, 32 * KiB, aligned));
+		CHECK(heap.Allocate(32 * KiB, 32 * KiB, aligned) && aligned.offset == 32 * KiB);
+		CHECK(heap.Validate());
+	}
+
+	void test_coalescing()
+	{
+		TlsfAllocator heap;
+		heap.Initialize(1 * MiB, 4 * KiB);
+		TlsfAllocator::Allocation a, b, c, d;
+		CHECK(heap.Allocate(256 * KiB, 1, a));
+		CHECK(heap.Allocate(256 * KiB, 1, b));
+		CHECK(heap.Allocate(256 * KiB, 1, c));
+		CHECK(heap.Allocate(256 * KiB, 1, d));
+		CHECK(heap.Stats().freeBlocks == 0 && heap.Stats().Free() == 0);
+
+		// Apart, a and c stay two blocks; freeing b between them merges all three.
+		heap.Free(a);
+		heap.Free(c);
+		CHECK(heap.Stats().freeBlocks == 2 && heap.Stats().largestFree == 256 * KiB);
+		CHECK(heap.Stats().Fragmentation() == 0.5f);
+		heap.Free(b);
+		CHECK(heap.Stats().freeBlocks == 1 && heap.Stats().largestFree == 768 * KiB);
+		CHECK(heap.Validate());
+
+		// Merging with the block after, then everything back into one.
+		heap.Free(d);
+		CHECK(heap.Empty());
+		CHECK(heap.Stats().freeBlocks == 1 && heap.Stats().largestFree == 1 * MiB);
+		CHECK(heap.Stats().Fragmentation() == 0.0f);
+
+		// Padding split off for alignment merges back too.
+		TlsfAllocator::Allocation small, aligned;
+		CHECK(heap.Allocate(4 * KiB, 1, small));
+		CHECK(heap.Allocate(4 * KiB, 512 * KiB, aligned) && aligned.offset == 512 * KiB);
+		CHECK(heap.Stats().freeBlocks == 2);
+		heap.Free(aligned);
+		heap.Free(small);
+		CHECK(heap.Stats().freeBlocks == 1 && heap.Stats().largestFree == 1 * MiB);
+		CHECK(heap.Validate());
+
+		// Freeing an invalid allocation is a no-op.
+		heap.Free(TlsfAllocator::Allocation());
+		CHECK(heap.Empty() && heap.Validate());
+	}
+
+	void test_pool_and_trim()
+	{
+		HeapPool pool;
+		pool.Initialize(4 * MiB, 64 * KiB);
+
+		HeapPool::Allocation a, b, c, tooBig;
+		bool created = false;
+		CHECK(pool.Allocate(3 * MiB, 64 * KiB, a, created) && created && a.heap == 0);
+		CHECK(pool.Allocate(512 * KiB, 64 * KiB, b, created) && !created && b.heap == 0);
+		CHECK(pool.Allocate(3 * MiB, 64 * KiB, c, created) && created && c.heap == 1);
+		CHECK(!pool.Allocate(4 * MiB + 1, 1, tooBig, created) && !created && !tooBig.Valid());
+		CHECK(!pool.Allocate(1, 8 * MiB, tooBig, created) && !created);
+		CHECK(pool.HeapCount() == 2);
+		CHECK(pool.Stats().capacity == 8 * MiB && pool.Stats().used == 6 * MiB + 512 * KiB);
+
+		// Nothing to trim while both heaps hold something.
+		std::vector<uint32_t> released;
+		pool.TrimEmpty(released);
+		CHECK(released.empty());
+
+		// Only one empty heap is kept.
+		pool.Free(a);
+		pool.Free(b);
+		pool.Free(c);
+		pool.TrimEmpty(released);
+		CHECK(released.size() == 1 && released[0] == 1);
+		CHECK(pool.HeapCount() == 1);
+		pool.TrimEmpty(released);
+		CHECK(released.size() == 1);
+
+		// The kept heap is used first, then the trimmed id comes back.
+		CHECK(pool.Allocate(4 * MiB, 4 * MiB, a, created) && !created && a.heap == 0);
+		CHECK(pool.Allocate(1, 1, b, created) && created && b.heap == 1);
+		CHECK(pool.HeapCount() == 2);
+	}
+
+	// Random sizes and alignments over a full heap, checking the placements and the allocator's own structures.
+	// Timed on its own without the checks, for the cost of an allocate and free pair.
+	void test_fuzz()
+	{
+		const uint64_t capacity = 256 * MiB;
+		const uint64_t granularity = 64 * KiB;
+		std::mt19937_64 random(20260419);
+		std::uniform_int_distribution<uint64_t> sizes(1, 4 * MiB);
+		std::uniform_int_distribution<uint32_t> alignments(0, 22); // up to 4 MiB
+		std::uniform_int_distribution<int> coin(0, 99);
+
+		TlsfAllocator heap;
+		heap.Initialize(capacity, granularity);
+		Ranges ranges;
+		std::vector<TlsfAllocator::Allocation> live;
+		bool overlapped = false;
+		bool misaligned = false;
+		bool valid = true;
+		uint64_t failed = 0;
+		for (int i = 0; i < 200000; i++)
+		{
+			// Lean towards allocating until the heap is mostly full, then churn close to it.
+			const bool allocate = live.empty() || coin(random) < (heap.Stats().used < capacity * 3 / 4 ? 70 : 52);
+			if (allocate)
+			{
+				const uint64_t alignment = uint64_t(1) << alignments(random);
+				TlsfAllocator::Allocation allocation;
+				if (!heap.Allocate(sizes(random), alignment, allocation))
+				{
+					failed++;
+					continue;
+				}
+				misaligned |= allocation.offset % alignment != 0 || allocation.offset + allocation.size > capacity;
+				overlapped |= !ranges.Add(allocation.offset, allocation.size);
+				live.push_back(allocation);
+			}
+			else
+			{
+				const size_t index = random() % live.size();
+				ranges.Remove(live[index].offset);
+				heap.Free(live[index]);
+				live[index] = live.back();
+				live.pop_back();
+			}
+			if (i % 1000 == 0)
+			{
+				valid &= heap.Validate();
+			}
+		}
+		CHECK(!overlapped);
+		CHECK(!misaligned);
+		CHECK(valid && heap.Validate());
+		CHECK(heap.Stats().allocations == live.size());
+		CHECK(failed > 0);
+
+		for (const TlsfAllocator::Allocation& allocation : live)
+		{
+			heap.Free(allocation);
+		}
+		CHECK(heap.Empty() && heap.Stats().freeBlocks == 1 && heap.Validate());
+
+		// The same mix again, only the allocator's calls inside the timer.
+		std::vector<uint64_t> requests(1 << 16);
+		for (uint64_t& request : requests)
+		{
+			request = sizes(random) | (uint64_t(alignments(random)) << 56);
+		}
+		live.clear();
+		live.reserve(requests.size());
+		const int rounds = 20;
+		uint64_t pairs = 0;
+		const auto begin = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; round++)
+		{
+			for (uint64_t request : requests)
+			{
+				TlsfAllocator::Allocation allocation;
+				if (heap.Allocate(request & ((uint64_t(1) << 56) - 1), uint64_t(1) << (request >> 56), allocation))
+				{
+					live.push_back(allocation);
+				}
+				if (live.size() > 1000 || (request & 1))
+				{
+					const size_t index = (request >> 8) % live.size();
+					heap.Free(live[index]);
+					live[index] = live.back();
+					live.pop_back();
+					pairs++;
+				}
+			}
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		const HeapStats stats = heap.Stats();
+		std::cout << "fuzz: " << failed << " of the checked requests didn't fit; timed " << pairs << " allocate and free pairs, "
+			<< seconds * 1e9 / double(pairs) << " ns each; " << stats.allocations << " left live, "
+			<< stats.freeBlocks << " free blocks, fragmentation " << stats.Fragmentation() << "\n";
+		CHECK(heap.Validate());
+	}
+}
+
+int main()
+{
+	test_granularity_and_alignment();
+	test_alignment_when_only_an_aligned_block_fits();
+	test_coalescing();
+	test_pool_and_trim();
+	test_fuzz();
+	return MRenderer::Tests::finish("HeapAllocatorTests");
+}
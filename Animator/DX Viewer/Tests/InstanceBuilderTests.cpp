@@ -0,0 +1,267 @@
+#include "InstanceBuilder.hpp"
+#include "TestCheck.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// InstanceBuilder::Build() on small hand made clips: where records and palettes land, and that how the work is
+// split between workers doesn't change a byte of it.
+namespace
+{
+	using namespace MRenderer;
+
+	Matrix4 translation(float x, float y, float z)
+	{
+		Matrix4 m = {};
+		for (int i = 0; i < 4; i++)
+		{
+			m.m[i][i] = 1.0f;
+		}
+		m.m[3][0] = x;
+		m.m[3][1] = y;
+		m.m[3][2] = z;
+		return m;
+	}
+
+	// Two keys a second apart in a two second loop, each joint moving along x and turning about z.
+	SkinnedClip make_clip(uint32_t jointCount)
+	{
+		SkinnedClip clip;
+		clip.jointCount = jointCount;
+		clip.duration = 2.0;
+		clip.keytimes = { 0.0, 1.0 };
+		for (size_t key = 0; key < clip.keytimes.size(); key++)
+		{
+			for (uint32_t j = 0; j < jointCount; j++)
+			{
+				const float angle = 0.3f * float(key) + 0.1f * float(j);
+				Matrix4 pose = translation(float(key) + float(j), float(j), 0.0f);
+				pose.m[0][0] = std::cos(angle);
+				pose.m[0][1] = std::sin(angle);
+				pose.m[1][0] = -std::sin(angle);
+				pose.m[1][1] = std::cos(angle);
+				clip.poses.push_back(pose);
+			}
+		}
+		clip.inverseBind.assign(jointCount, translation(0.0f, -1.0f, 0.0f));
+		clip.parents.assign(jointCount, -1);
+		return clip;
+	}
+
+	// Instance i sits at x = i, so a record says which instance it came from.
+	std::vector<CrowdInstance> make_crowd(size_t count, uint32_t clipCount)
+	{
+		std::vector<CrowdInstance> crowd(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			crowd[i].world = translation(float(i), 0.0f, 0.0f);
+			crowd[i].clip = static_cast<uint32_t>(i % clipCount);
+			crowd[i].time = 0.01 * double(i);
+			crowd[i].speed = i % 3 == 0 ? -1.0f : 1.5f;
+			crowd[i].lod = static_cast<uint32_t>((i * 7) % 5);
+			crowd[i].visible = i % 4 != 1;
+		}
+		return crowd;
+	}
+
+	// The instance a record was written for; GpuInstance::world is transposed, so its x is m[0][3].
+	size_t source_of(const GpuInstance& record)
+	{
+		return static_cast<size_t>(record.world.m[0][3]);
+	}
+
+	void test_palette_offsets_skip_invisible_instances()
+	{
+		const std::vector<SkinnedClip> clips = { make_clip(3), make_clip(5) };
+		std::vector<CrowdInstance> crowd = make_crowd(8, 2);
+		for (CrowdInstance& instance : crowd)
+		{
+			instance.lod = 0;
+		}
+
+		// Visible: 0 (3 joints), 2 (3), 3 (5), 4 (3), 6 (3), 7 (5); 1 and 5 aren't.
+		const size_t paletteSize = InstanceBuilder::PaletteSize(crowd, clips);
+		CHECK(paletteSize == 22);
+
+		std::vector<GpuInstance> records(crowd.size());
+		std::vector<Matrix4> palette(paletteSize);
+		InstanceBuilder builder;
+		builder.Build(crowd, clips, 0.0, records.data(), palette.data(), 1);
+		CHECK(builder.RecordCount() == 6);
+
+		const uint32_t expected[] = { 0, 3, 6, 11, 14, 17 };
+		const size_t sources[] = { 0, 2, 3, 4, 6, 7 };
+		bool offsets = true;
+		bool palettes = true;
+		std::vector<Matrix4> joints(5), reference(5);
+		for (uint32_t r = 0; r < builder.RecordCount(); r++)
+		{
+			offsets &= records[r].paletteOffset == expected[r] && source_of(records[r]) == sources[r];
+
+			// Each palette is the one sampled for its own instance.
+			const CrowdInstance& instance = crowd[sources[r]];
+			const SkinnedClip& clip = clips[instance.clip];
+			sample_clip_pose(clip, instance.time, joints.data());
+			build_skin_palette(clip, joints.data(), reference.data());
+			palettes &= std::memcmp(&palette[expected[r]], reference.data(), clip.jointCount * sizeof(Matrix4)) == 0;
+			palettes &= records[r].clip == instance.clip && records[r].clipTime == static_cast<float>(instance.time);
+		}
+		CHECK(offsets);
+		CHECK(palettes);
+	}
+
+	void test_records_grouped_by_lod()
+	{
+		const std::vector<SkinnedClip> clips = { make_clip(2) };
+		std::vector<CrowdInstance> crowd = make_crowd(9, 1);
+		const uint32_t lods[] = { 2, 0, 2, 1, MaxLods + 3, 0, 1, 2, MaxLods - 1 };
+		const bool visible[] = { true, true, true, false, true, true, true, true, true };
+		for (size_t i = 0; i < crowd.size(); i++)
+		{
+			crowd[i].lod = lods[i];
+			crowd[i].visible = visible[i];
+		}
+
+		std::vector<GpuInstance> records(crowd.size());
+		std::vector<Matrix4> palette(InstanceBuilder::PaletteSize(crowd, clips));
+		InstanceBuilder builder;
+		builder.Build(crowd, clips, 0.0, records.data(), palette.data(), 1);
+
+		// Level 0: 1, 5. Level 1: 6 (3 isn't visible). Level 2: 0, 2, 7. Past the last level clamps to it: 4, 8.
+		const InstanceRange* ranges = builder.LodRanges();
+		CHECK(ranges[0].first == 0 && ranges[0].count == 2);
+		CHECK(ranges[1].first == 2 && ranges[1].count == 1);
+		CHECK(ranges[2].first == 3 && ranges[2].count == 3);
+		bool empty = true;
+		for (uint32_t lod = 3; lod < MaxLods - 1; lod++)
+		{
+			empty &= ranges[lod].count == 0 && ranges[lod].first == 6;
+		}
+		CHECK(empty);
+		CHECK(ranges[MaxLods - 1].first == 6 && ranges[MaxLods - 1].count == 2);
+		CHECK(builder.RecordCount() == 8);
+
+		const size_t order[] = { 1, 5, 6, 0, 2, 7, 4, 8 };
+		bool stable = true;
+		for (uint32_t r = 0; r < builder.RecordCount(); r++)
+		{
+			stable &= source_of(records[r]) == order[r];
+		}
+		CHECK(stable);
+
+		// Palettes stay in instance order whatever the levels.
+		CHECK(records[3].paletteOffset == 0 && records[0].paletteOffset == 2 && records[6].paletteOffset == 6);
+	}
+
+	void test_worker_count_does_not_change_the_output()
+	{
+		const std::vector<SkinnedClip> clips = { make_clip(4), make_clip(7), make_clip(1) };
+		const std::vector<CrowdInstance> start = make_crowd(1000, 3);
+		const size_t paletteSize = InstanceBuilder::PaletteSize(start, clips);
+
+		struct Run
+		{
+			std::vector<CrowdInstance> crowd;
+			std::vector<GpuInstance> records;
+			std::vector<Matrix4> palette;
+		};
+		auto run = [&](InstanceBuilder& builder, unsigned workers, Run& out, int frames)
+		{
+			out.crowd = start;
+			out.records.assign(start.size(), GpuInstance());
+			out.palette.assign(paletteSize, Matrix4());
+			for (int frame = 0; frame < frames; frame++)
+			{
+				builder.Build(out.crowd, clips, 1.0 / 60.0, out.records.data(), out.palette.data(), workers);
+			}
+		};
+		auto same = [](const Run& a, const Run& b)
+		{
+			bool times = true;
+			for (size_t i = 0; i < a.crowd.size(); i++)
+			{
+				times &= a.crowd[i].time == b.crowd[i].time;
+			}
+			return times && std::memcmp(a.records.data(), b.records.data(), a.records.size() * sizeof(GpuInstance)) == 0 &&
+				std::memcmp(a.palette.data(), b.palette.data(), a.palette.size() * sizeof(Matrix4)) == 0;
+		};
+
+		InstanceBuilder single;
+		Run reference;
+		run(single, 1, reference, 30);
+
+		// The same builder keeps its workers across frames and resizes them when asked for a different count,
+		// including more workers than there are ranges worth splitting.
+		InstanceBuilder pooled;
+		const unsigned counts[] = { 4, 4, 3, 8, 100, 2 };
+		for (unsigned workers : counts)
+		{
+			Run result;
+			run(pooled, workers, result, 30);
+			CHECK(same(reference, result));
+		}
+
+		// A crowd too small to split still gives the same result on a builder with a pool.
+		std::vector<CrowdInstance> few(start.begin(), start.begin() + 5);
+		std::vector<CrowdInstance> fewAgain = few;
+		std::vector<GpuInstance> a(5), b(5);
+		std::vector<Matrix4> pa(InstanceBuilder::PaletteSize(few, clips)), pb(pa.size());
+		single.Build(few, clips, 0.5, a.data(), pa.data(), 1);
+		pooled.Build(fewAgain, clips, 0.5, b.data(), pb.data(), 8);
+		CHECK(std::memcmp(a.data(), b.data(), single.RecordCount() * sizeof(GpuInstance)) == 0);
+		CHECK(std::memcmp(pa.data(), pb.data(), pa.size() * sizeof(Matrix4)) == 0);
+	}
+
+	void test_clip_time_wraps()
+	{
+		CHECK(wrap_clip_time(-0.25, 2.0) == 1.75);
+		CHECK(wrap_clip_time(-4.5, 2.0) == 1.5);
+		CHECK(wrap_clip_time(5.0, 2.0) == 1.0);
+		CHECK(wrap_clip_time(1.0, 0.0) == 0.0);
+
+		// Played backwards past the start, an instance comes round from the end of the loop.
+		const std::vector<SkinnedClip> clips = { make_clip(2) };
+		std::vector<CrowdInstance> crowd(2);
+		crowd[0].time = 0.25;
+		crowd[0].speed = -1.0f;
+		crowd[1].time = 0.25;
+		crowd[1].speed = -2.0f;
+		crowd[1].visible = false;
+		std::vector<GpuInstance> records(2);
+		std::vector<Matrix4> palette(InstanceBuilder::PaletteSize(crowd, clips));
+		InstanceBuilder builder;
+		builder.Build(crowd, clips, 0.5, records.data(), palette.data(), 1);
+		CHECK(crowd[0].time == 1.75 && records[0].clipTime == 1.75f);
+		CHECK(crowd[1].time == 1.25);
+
+		// The sampled pose at the wrapped time is between the last key and the first one again.
+		const ClipKeys keys = find_clip_keys(clips[0], crowd[0].time);
+		CHECK(keys.previous == 1 && keys.next == 0 && keys.delta == 0.75f);
+	}
+
+	void test_without_outputs_clips_only_advance()
+	{
+		const std::vector<SkinnedClip> clips = { make_clip(3) };
+		std::vector<CrowdInstance> crowd = make_crowd(200, 1);
+		InstanceBuilder builder;
+		builder.Build(crowd, clips, 0.5, nullptr, nullptr, 4);
+		CHECK(builder.RecordCount() == 0);
+		bool advanced = true;
+		for (size_t i = 0; i < crowd.size(); i++)
+		{
+			advanced &= crowd[i].time == wrap_clip_time(0.01 * double(i) + 0.5 * crowd[i].speed, 2.0);
+		}
+		CHECK(advanced);
+	}
+}
+
+int main()
+{
+	test_palette_offsets_skip_invisible_instances();
+	test_records_grouped_by_lod();
+	test_worker_count_does_not_change_the_output();
+	test_clip_time_wraps();
+	test_without_outputs_clips_only_advance();
+	return MRenderer::Tests::finish("InstanceBuilderTests");
+}
@@ -0,0 +1,242 @@
+#include "PreSkinning.hpp"
+#include "TestCheck.hpp"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+// The pre-skinning pass's CPU reference on a made up two level mesh: how many groups a dispatch needs, where each
+// instance's vertices land, and that the cheaper paths skin a vertex whose weights fit them bit for bit like the
+// four influence one.
+namespace
+{
+	using namespace MRenderer;
+
+	const uint32_t JointCount = 6;
+
+	std::mt19937 g_random(31);
+
+	float random_float(float low, float high)
+	{
+		return std::uniform_real_distribution<float>(low, high)(g_random);
+	}
+
+	Matrix4 random_matrix()
+	{
+		Matrix4 m;
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				m.m[i][j] = random_float(-2.0f, 2.0f);
+			}
+		}
+		return m;
+	}
+
+	// A vertex whose nonzero weights are its first influences, so it belongs in the bucket that blends that many.
+	SkinningVertex random_vertex(uint32_t influences)
+	{
+		SkinningVertex vertex = {};
+		for (int c = 0; c < 3; c++)
+		{
+			vertex.position[c] = random_float(-1.0f, 1.0f);
+			vertex.normal[c] = random_float(-1.0f, 1.0f);
+		}
+		vertex.position[3] = 1.0f;
+		double weights[4] = {};
+		for (uint32_t j = 0; j < 4; j++)
+		{
+			vertex.joints[j] = static_cast<int32_t>(g_random() % JointCount);
+			weights[j] = j < influences ? random_float(0.1f, 1.0f) : 0.0;
+		}
+		vertex.weights = quantize_weights(weights);
+		return vertex;
+	}
+
+	GpuInstance random_instance(uint32_t index)
+	{
+		GpuInstance instance = {};
+		instance.world = random_matrix();
+		instance.paletteOffset = index * JointCount;
+		return instance;
+	}
+
+	bool same_bits(const SkinnedVertex& a, const SkinnedVertex& b)
+	{
+		return std::memcmp(&a, &b, sizeof(SkinnedVertex)) == 0;
+	}
+
+	void test_dispatch_rounds_up_to_whole_groups()
+	{
+		struct Case
+		{
+			uint32_t vertices, instances, groupsX;
+		};
+		const Case cases[] = { { 0, 5, 0 }, { 1, 3, 1 }, { 63, 1, 1 }, { 64, 1, 1 }, { 65, 2, 2 }, { 130, 7, 3 }, { 1000, 13, 16 }, { 200, 0, 4 } };
+		bool rounded = true;
+		for (const Case& c : cases)
+		{
+			const SkinningDispatch dispatch = skinning_dispatch(c.vertices, c.instances);
+			rounded &= dispatch.groupsX == c.groupsX && dispatch.groupsY == c.instances && dispatch.groupsZ == 1;
+			rounded &= dispatch.groupsX * SkinningGroupSize >= c.vertices && (dispatch.groupsX == 0 || (dispatch.groupsX - 1) * SkinningGroupSize < c.vertices);
+		}
+		CHECK(rounded);
+	}
+
+	void test_output_indexing()
+	{
+		// Instances back to back, vertexStride apart.
+		CHECK(skinned_vertex_index(0, 0, 100) == 0);
+		CHECK(skinned_vertex_index(0, 99, 100) == 99);
+		CHECK(skinned_vertex_index(2, 5, 100) == 205);
+		CHECK(skinned_vertex_index(70000, 3, 70000) == size_t(70000) * 70000 + 3);
+
+		// Two levels: 0 has 100 vertices in buckets of 30, 50 and 20, 1 has 37 in buckets of 10, 0 and 27 and
+		// starts at vertex 100 of the mesh. Records 0 to 2 are drawn at level 0, 3 and 4 at level 1.
+		struct Level
+		{
+			uint32_t firstVertex;
+			InfluenceBuckets buckets;
+			uint32_t firstInstance;
+			uint32_t instanceCount;
+		};
+		const Level levels[] = { { 0, { { 30, 50, 20 } }, 0, 3 }, { 100, { { 10, 0, 27 } }, 3, 2 } };
+		const uint32_t vertexStride = 100;
+		const uint32_t instanceCount = 5;
+
+		std::vector<SkinningVertex> vertices;
+		for (const Level& level : levels)
+		{
+			for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+			{
+				for (uint32_t v = 0; v < level.buckets.counts[bucket]; v++)
+				{
+					vertices.push_back(random_vertex(BucketInfluences[bucket]));
+				}
+			}
+		}
+		std::vector<GpuInstance> instances;
+		std::vector<Matrix4> palette;
+		for (uint32_t i = 0; i < instanceCount; i++)
+		{
+			instances.push_back(random_instance(i));
+			for (uint32_t j = 0; j < JointCount; j++)
+			{
+				palette.push_back(random_matrix());
+			}
+		}
+
+		// Every slot starts as a marker no skinned vertex can be.
+		SkinnedVertex marker;
+		std::memset(&marker, 0xFF, sizeof(marker));
+		std::vector<SkinnedVertex> output(instanceCount * vertexStride, marker);
+
+		// One dispatch per bucket of each level, as the renderer issues them. The first bucket alone writes only
+		// its own vertices of its own instances.
+		bool onlyItsOwn = true;
+		for (const Level& level : levels)
+		{
+			uint32_t vertexCount = 0;
+			for (uint32_t count : level.buckets.counts)
+			{
+				vertexCount += count;
+			}
+			for (uint32_t bucket = 0; bucket < InfluenceBucketCount; bucket++)
+			{
+				SkinningRange range;
+				range.vertexCount = vertexCount;
+				range.instanceCount = level.instanceCount;
+				range.firstInstance = level.firstInstance;
+				range.firstVertex = level.firstVertex;
+				range.vertexStride = vertexStride;
+				range.bucketStart = bucket_start(level.buckets, bucket);
+				range.bucketVertexCount = level.buckets.counts[bucket];
+				pre_skin_reference(vertices.data(), instances.data(), palette.data(), range, BucketInfluences[bucket], output.data());
+
+				if (&level == &levels[0] && bucket == 0)
+				{
+					for (size_t slot = 0; slot < output.size(); slot++)
+					{
+						const bool own = slot < 3 * vertexStride && slot % vertexStride < 30;
+						onlyItsOwn &= same_bits(output[slot], marker) != own;
+					}
+				}
+			}
+		}
+		CHECK(onlyItsOwn);
+
+		// Each instance's level vertices are at instance * vertexStride + vertex, skinned with its own world
+		// and palette; past its level's count its row is untouched.
+		bool placed = true;
+		bool untouched = true;
+		for (const Level& level : levels)
+		{
+			const uint32_t vertexCount = level.buckets.counts[0] + level.buckets.counts[1] + level.buckets.counts[2];
+			for (uint32_t i = level.firstInstance; i < level.firstInstance + level.instanceCount; i++)
+			{
+				for (uint32_t v = 0; v < vertexStride; v++)
+				{
+					const SkinnedVertex& out = output[skinned_vertex_index(i, v, vertexStride)];
+					if (v < vertexCount)
+					{
+						placed &= same_bits(out, skin_vertex(vertices[level.firstVertex + v], instances[i], palette.data(), 4));
+					}
+					else
+					{
+						untouched &= same_bits(out, marker);
+					}
+				}
+			}
+		}
+		CHECK(placed);
+		CHECK(untouched);
+	}
+
+	void test_paths_agree_on_weights_that_fit()
+	{
+		std::vector<Matrix4> palette;
+		for (uint32_t j = 0; j < 2 * JointCount; j++)
+		{
+			palette.push_back(random_matrix());
+		}
+
+		bool one = true;
+		bool two = true;
+		int differs = 0;
+		for (int i = 0; i < 2000; i++)
+		{
+			const GpuInstance instance = random_instance(i % 2);
+
+			// One influence: every path gives the same bits.
+			const SkinningVertex single = random_vertex(1);
+			const SkinnedVertex reference1 = skin_vertex(single, instance, palette.data(), 4);
+			one &= same_bits(skin_vertex(single, instance, palette.data(), 1), reference1);
+			one &= same_bits(skin_vertex(single, instance, palette.data(), 2), reference1);
+
+			// Two: the two and four influence paths.
+			const SkinningVertex pair = random_vertex(2);
+			two &= same_bits(skin_vertex(pair, instance, palette.data(), 2), skin_vertex(pair, instance, palette.data(), 4));
+
+			// A vertex that needs all four isn't skinned right by a cheaper path, so the comparisons above can fail.
+			const SkinningVertex full = random_vertex(4);
+			differs += same_bits(skin_vertex(full, instance, palette.data(), 2), skin_vertex(full, instance, palette.data(), 4)) ? 0 : 1;
+		}
+		CHECK(one);
+		CHECK(two);
+		CHECK(differs == 2000);
+
+		// Influences other than 1, 2 or 4 take the four influence path.
+		const SkinningVertex full = random_vertex(4);
+		const GpuInstance instance = random_instance(0);
+		CHECK(same_bits(skin_vertex(full, instance, palette.data(), 3), skin_vertex(full, instance, palette.data(), 4)));
+	}
+}
+
+int main()
+{
+	test_dispatch_rounds_up_to_whole_groups();
+	test_output_indexing();
+	test_paths_agree_on_weights_that_fit();
+	return MRenderer::Tests::finish("PreSkinningTests");
+}
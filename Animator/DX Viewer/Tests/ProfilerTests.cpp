@@ -0,0 +1,94 @@
+#include "Profiler.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// What PROFILE_ZONE costs, against the 50 ns a zone is allowed. Built twice, once with MRENDERER_DISABLE_PROFILER,
+// so the same loop with the zones compiled out gives the baseline.
+namespace
+{
+	using namespace MRenderer;
+
+	const int ZoneCount = 4000000;
+	const double ZoneBudgetNs = 50.0;
+
+	volatile uint32_t g_sink = 0;
+
+	// An empty zone, all but the store that keeps the loop from being optimized away.
+	void empty_zone(uint32_t i)
+	{
+		PROFILE_ZONE("EmptyZone");
+		g_sink = i;
+	}
+
+	// Nanoseconds per call of f, the best of a few runs so a descheduled one doesn't count.
+	template <typename F>
+	double time_calls(F f)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 5; run++)
+		{
+			const auto begin = std::chrono::steady_clock::now();
+			for (int i = 0; i < ZoneCount; i++)
+			{
+				f(static_cast<uint32_t>(i));
+			}
+			const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+			best = ns < best ? ns : best;
+		}
+		return best / ZoneCount;
+	}
+
+	void test_zones_are_recorded()
+	{
+#if !defined MRENDERER_DISABLE_PROFILER
+		Profiler::clear();
+		for (uint32_t i = 0; i < 1000; i++)
+		{
+			empty_zone(i);
+		}
+		uint32_t count = 0;
+		for (const Profiler::ZoneStats& stats : Profiler::collect_stats())
+		{
+			count += std::strcmp(stats.name, "EmptyZone") == 0 ? stats.count : 0;
+		}
+		CHECK(count == 1000);
+#endif
+	}
+
+	void test_zone_cost()
+	{
+		// Warm up: the first zone on a thread registers its ring.
+		empty_zone(0);
+		const double zone = time_calls(empty_zone);
+#if defined MRENDERER_DISABLE_PROFILER
+		std::cout << "profiler disabled: " << zone << " ns per empty zone\n";
+#else
+		// A zone is two reads of the platform's clock and a record(); the clock's share is timed on its own.
+		const double clock = time_calls([](uint32_t) { g_sink = static_cast<uint32_t>(Profiler::now()); });
+		const double recording = zone - 2.0 * clock;
+		std::cout << "profiler enabled: " << zone << " ns per empty zone, budget " << ZoneBudgetNs << " ns; "
+			<< clock << " ns per Profiler::now(), " << recording << " ns recording\n";
+		if (zone >= ZoneBudgetNs)
+		{
+			std::cout << "over budget: this platform's clock alone takes " << 2.0 * clock << " ns of it\n";
+		}
+
+		// Only an optimized build says anything about the cost. The clock is the platform's; what the profiler
+		// adds to it has to fit the budget with room to spare.
+#if defined NDEBUG || defined __OPTIMIZE__
+		CHECK(recording < ZoneBudgetNs / 2.0);
+#endif
+#endif
+	}
+}
+
+int main()
+{
+	test_zones_are_recorded();
+	test_zone_cost();
+	return MRenderer::Tests::finish("ProfilerTests");
+}
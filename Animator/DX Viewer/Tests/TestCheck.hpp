@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+
+// Just enough of a harness for the headless tests: CHECK() reports a failed expression with where it is and
+// carries on, finish() prints the tally and gives the test's exit code. No D3D12 or Windows dependency.
+namespace MRenderer
+{
+	namespace Tests
+	{
+		inline int& failures()
+		{
+			static int count = 0;
+			return count;
+		}
+
+		inline bool check(bool passed, const char* expression, const char* file, int line)
+		{
+			if (!passed)
+			{
+				std::cout << file << "(" << line << "): CHECK(" << expression << ") failed\n";
+				failures()++;
+			}
+			return passed;
+		}
+
+		inline int finish(const char* suite)
+		{
+			std::cout << suite << ": " << (failures() == 0 ? "passed" : "FAILED") << ", " << failures() << " failed checks\n";
+			return failures() == 0 ? 0 : 1;
+		}
+	}
+}
+
+#define CHECK(expression) MRenderer::Tests::check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
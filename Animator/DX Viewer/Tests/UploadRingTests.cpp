@@ -0,0 +1,207 @@
+#include "UploadRing.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// UploadRing over plain memory: the fence values are made up, there's no GPU to pass them.
+namespace
+{
+	using namespace MRenderer;
+
+	const uint64_t GpuBase = 0x10000;
+
+	struct Ring
+	{
+		explicit Ring(uint64_t capacity) : memory(capacity)
+		{
+			ring.Initialize(memory.data(), GpuBase, capacity);
+		}
+
+		// Whether allocation came from this ring at offset with the CPU and GPU addresses agreeing.
+		bool At(const UploadRing::Allocation& allocation, uint64_t offset) const
+		{
+			return allocation.Valid() && allocation.offset == offset && allocation.cpu == memory.data() + offset &&
+				allocation.gpu == GpuBase + offset;
+		}
+
+		std::vector<uint8_t> memory;
+		UploadRing ring;
+	};
+
+	void test_alignment()
+	{
+		Ring r(1024);
+		const UploadRing::Allocation odd = r.ring.Allocate(3, 1);
+		CHECK(r.At(odd, 0));
+
+		for (uint64_t alignment = 1; alignment <= 256; alignment *= 2)
+		{
+			const UploadRing::Allocation allocation = r.ring.Allocate(5, alignment);
+			CHECK(allocation.Valid());
+			CHECK(allocation.offset % alignment == 0);
+			CHECK(allocation.size == 5);
+		}
+
+		// The padding skipped for alignment counts as used until the frame retires.
+		const uint64_t used = r.ring.Used();
+		const UploadRing::Allocation aligned = r.ring.Allocate(1, 256);
+		CHECK(aligned.Valid() && aligned.offset % 256 == 0);
+		CHECK(r.ring.Used() > used + 1);
+		r.ring.EndFrame(1);
+		r.ring.Retire(1);
+		CHECK(r.ring.Used() == 0);
+	}
+
+	void test_allocation_straddling_the_end_wraps_whole()
+	{
+		Ring r(100);
+		CHECK(r.At(r.ring.Allocate(30, 1), 0));
+		r.ring.EndFrame(1);
+		CHECK(r.At(r.ring.Allocate(60, 1), 30));
+		r.ring.EndFrame(2);
+		r.ring.Retire(1);
+
+		// 20 bytes from 90 would run past the end, so the tail is skipped and the allocation starts at zero.
+		const UploadRing::Allocation wrapped = r.ring.Allocate(20, 1);
+		CHECK(r.At(wrapped, 0));
+		CHECK(r.ring.Used() == 60 + 10 + 20);
+
+		// Aligning 110 up to 128 lands on the end, so that wraps too.
+		Ring aligned(128);
+		aligned.ring.Allocate(100, 1);
+		aligned.ring.EndFrame(1);
+		aligned.ring.Allocate(10, 1);
+		aligned.ring.EndFrame(2);
+		aligned.ring.Retire(1);
+		CHECK(aligned.At(aligned.ring.Allocate(16, 32), 0));
+		CHECK(aligned.ring.Used() == 10 + 18 + 16);
+	}
+
+	void test_full_ring_rejects_while_fences_are_outstanding()
+	{
+		Ring r(64);
+		CHECK(r.ring.Allocate(40, 1).Valid());
+		r.ring.EndFrame(1);
+		CHECK(r.ring.Allocate(24, 1).Valid());
+		r.ring.EndFrame(2);
+
+		// Nothing has retired, so nothing fits, and nothing that is live gets handed out again.
+		CHECK(!r.ring.Allocate(1, 1).Valid());
+		r.ring.Retire(0);
+		CHECK(!r.ring.Allocate(1, 1).Valid());
+		CHECK(r.ring.FailedAllocations() == 2);
+		CHECK(r.ring.Used() == 64);
+
+		// Bigger than the ring, or empty, never fits.
+		CHECK(!r.ring.Allocate(65, 1).Valid());
+		CHECK(!r.ring.Allocate(0, 1).Valid());
+		CHECK(r.ring.FailedAllocations() == 4);
+
+		// Frame 1's 40 bytes free up, 48 don't fit in them.
+		r.ring.Retire(1);
+		CHECK(!r.ring.Allocate(48, 1).Valid());
+		CHECK(r.ring.Allocate(40, 1).Valid());
+		CHECK(r.ring.PeakUsed() == 64);
+	}
+
+	void test_reuse_after_retire()
+	{
+		Ring r(256);
+		const UploadRing::Allocation first = r.ring.Allocate(200, 16);
+		r.ring.EndFrame(7);
+		CHECK(!r.ring.Allocate(100, 16).Valid());
+
+		// A frame retires with the first completed value at or past its fence, and only whole frames do.
+		r.ring.Retire(6);
+		CHECK(r.ring.Used() == 200);
+		r.ring.Retire(7);
+		CHECK(r.ring.Used() == 0);
+
+		// With nothing live the ring starts over at zero instead of padding out the tail.
+		const UploadRing::Allocation again = r.ring.Allocate(200, 16);
+		CHECK(again.Valid() && again.cpu == first.cpu && again.gpu == first.gpu);
+
+		// Retiring several frames at once frees all of them, the still open frame stays.
+		r.ring.EndFrame(8);
+		r.ring.Allocate(16, 16);
+		r.ring.EndFrame(9);
+		r.ring.Allocate(8, 8);
+		r.ring.Retire(9);
+		CHECK(r.ring.Used() == 8);
+
+		r.ring.Reset();
+		CHECK(r.ring.Used() == 0 && r.ring.PeakUsed() == 0 && r.ring.FailedAllocations() == 0);
+		CHECK(r.At(r.ring.Allocate(1, 1), 0));
+	}
+
+	// Many frames of mixed allocations with the GPU a couple of frames behind: nothing handed out overlaps
+	// anything still live, and everything stays inside the buffer.
+	void test_live_allocations_never_overlap()
+	{
+		struct Live
+		{
+			uint64_t fence;
+			uint64_t begin;
+			uint64_t end;
+		};
+
+		const uint64_t capacity = 4096;
+		Ring r(capacity);
+		std::vector<Live> live;
+		uint32_t seed = 12345;
+		bool overlapped = false;
+		bool outside = false;
+		uint64_t granted = 0;
+
+		for (uint64_t frame = 1; frame <= 2000; frame++)
+		{
+			const uint64_t completed = frame > 3 ? frame - 3 : 0;
+			r.ring.Retire(completed);
+			std::vector<Live> still;
+			for (const Live& l : live)
+			{
+				if (l.fence > completed)
+				{
+					still.push_back(l);
+				}
+			}
+			live.swap(still);
+
+			for (int i = 0; i < 6; i++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				const uint64_t size = 1 + (seed >> 8) % 700;
+				const uint64_t alignment = uint64_t(1) << ((seed >> 20) % 9);
+				const UploadRing::Allocation allocation = r.ring.Allocate(size, alignment);
+				if (!allocation.Valid())
+				{
+					continue;
+				}
+				granted++;
+				outside |= allocation.offset + size > capacity || allocation.offset % alignment != 0;
+				for (const Live& l : live)
+				{
+					overlapped |= allocation.offset < l.end && l.begin < allocation.offset + size;
+				}
+				live.push_back({ frame, allocation.offset, allocation.offset + size });
+			}
+			r.ring.EndFrame(frame);
+		}
+
+		CHECK(!overlapped);
+		CHECK(!outside);
+		CHECK(granted > 0 && r.ring.FailedAllocations() > 0);
+		CHECK(r.ring.PeakUsed() <= capacity);
+	}
+}
+
+int main()
+{
+	test_alignment();
+	test_allocation_straddling_the_end_wraps_whole();
+	test_full_ring_rejects_while_fences_are_outstanding();
+	test_reuse_after_retire();
+	test_live_allocations_never_overlap();
+	return MRenderer::Tests::finish("UploadRingTests");
+}
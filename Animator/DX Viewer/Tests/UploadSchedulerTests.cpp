@@ -0,0 +1,233 @@
+#include "UploadScheduler.hpp"
+#include "ResourceManager.hpp"
+#include "FakeFrameQueue.hpp"
+#include "TestCheck.hpp"
+
+#include <deque>
+#include <vector>
+
+// Upload batching as D3D12ResourceManager::SubmitBatch() does it, on a fake copy queue: a scheduler slot,
+// then as many queued uploads as fit the budget, one staging block for them, released with the batch's fence.
+namespace
+{
+	using namespace MRenderer;
+
+	const uint64_t MiB = 1 << 20;
+
+	struct Batch
+	{
+		uint32_t slot;
+		uint64_t fence;
+		uint64_t bytes;
+		uint32_t stagingBlock;
+		bool createdBlock;
+		std::vector<int> uploads; // their ids, in batch order
+	};
+
+	class Copier
+	{
+	public:
+		Copier(uint32_t batchesInFlight, uint64_t budget) : scheduler(batchesInFlight), m_budget(budget)
+		{
+			scheduler.SetQueue(&queue);
+		}
+
+		void Queue(int id, uint64_t size, uint64_t alignment = 256)
+		{
+			m_pending.push_back({ id, { size, alignment } });
+		}
+
+		// False if nothing was queued or every slot was still copying.
+		bool Submit(bool wait)
+		{
+			if (m_pending.empty())
+			{
+				return false;
+			}
+			const uint32_t slot = scheduler.BeginBatch(wait);
+			if (slot == UploadScheduler::InvalidSlot)
+			{
+				return false;
+			}
+
+			std::vector<UploadRequest> requests;
+			for (const auto& upload : m_pending)
+			{
+				requests.push_back(upload.second);
+			}
+			std::vector<uint64_t> offsets;
+			Batch batch;
+			batch.slot = slot;
+			batch.bytes = plan_upload_batch(requests, m_budget, offsets);
+			const StagingPool::Block block = staging.Acquire(batch.bytes);
+			batch.stagingBlock = block.id;
+			batch.createdBlock = block.created;
+			batch.fence = scheduler.EndBatch(slot);
+			for (size_t i = 0; i < offsets.size(); i++)
+			{
+				batch.uploads.push_back(m_pending[i].first);
+			}
+
+			staging.Release(block.id);
+			staging.EndFrame(batch.fence);
+			m_pending.erase(m_pending.begin(), m_pending.begin() + offsets.size());
+			batches.push_back(batch);
+			return true;
+		}
+
+		// The once per frame retirement, against what the copy queue has finished.
+		void Retire() { staging.Retire(queue.CompletedValue()); }
+
+		size_t Pending() const { return m_pending.size(); }
+
+		Tests::FakeFrameQueue queue;
+		UploadScheduler scheduler;
+		StagingPool staging;
+		std::vector<Batch> batches;
+
+	private:
+		uint64_t m_budget;
+		std::deque<std::pair<int, UploadRequest>> m_pending;
+	};
+
+	void test_plan_upload_batch()
+	{
+		std::vector<uint64_t> offsets;
+		CHECK(plan_upload_batch({}, MiB, offsets) == 0 && offsets.empty());
+
+		// Back to back at each one's alignment, stopping before the one past the budget even if a later one fits.
+		const std::vector<UploadRequest> requests = { { 100, 1 }, { 200, 256 }, { 4, 512 }, { 1000, 4 }, { 1, 1 } };
+		CHECK(plan_upload_batch(requests, 1024, offsets) == 516);
+		CHECK((offsets == std::vector<uint64_t>{ 0, 256, 512 }));
+		CHECK(plan_upload_batch(requests, 2000, offsets) == 1517);
+		CHECK(offsets.size() == 5 && offsets[3] == 516 && offsets[4] == 1516);
+
+		// The first goes in however big, nothing after it does.
+		CHECK(plan_upload_batch({ { 3 * MiB, 256 }, { 1, 1 } }, MiB, offsets) == 3 * MiB);
+		CHECK(offsets.size() == 1);
+	}
+
+	void test_batches_split_by_budget()
+	{
+		Copier copier(3, 64 * MiB);
+		for (int id = 0; id < 7; id++)
+		{
+			copier.Queue(id, 24 * MiB);
+		}
+		copier.Queue(7, 100 * MiB);
+		copier.Queue(8, 1 * MiB);
+
+		// Two 24 MiB uploads to a batch; the oversized one goes alone, and what follows it waits its turn.
+		while (copier.Pending() > 0)
+		{
+			CHECK(copier.Submit(true));
+		}
+		const std::vector<std::vector<int>> expected = { { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6 }, { 7 }, { 8 } };
+		bool split = copier.batches.size() == expected.size();
+		for (size_t i = 0; split && i < expected.size(); i++)
+		{
+			split = copier.batches[i].uploads == expected[i];
+		}
+		CHECK(split);
+		CHECK(copier.batches[0].bytes == 48 * MiB && copier.batches[4].bytes == 100 * MiB);
+
+		// Fences go up a batch at a time, and LastSubmitted() follows them.
+		bool ascending = true;
+		for (size_t i = 0; i < copier.batches.size(); i++)
+		{
+			ascending &= copier.batches[i].fence == i + 1;
+		}
+		CHECK(ascending && copier.scheduler.LastSubmitted() == copier.batches.size());
+	}
+
+	void test_full_slots_defer_instead_of_waiting()
+	{
+		Copier copier(2, 8 * MiB);
+		for (int id = 0; id < 4; id++)
+		{
+			copier.Queue(id, 6 * MiB);
+		}
+		CHECK(copier.Submit(false));
+		CHECK(copier.Submit(false));
+		CHECK(copier.scheduler.Busy() == 2);
+
+		// Both slots copying: the uploads stay queued and nobody waits.
+		CHECK(!copier.Submit(false));
+		CHECK(copier.Pending() == 2);
+		CHECK(copier.scheduler.DeferredCount() == 1 && copier.scheduler.StallCount() == 0);
+		CHECK(copier.queue.waits.empty());
+
+		// Once the first batch finishes its slot is reused, the other one is still busy.
+		copier.queue.Complete(copier.batches[0].fence);
+		CHECK(copier.scheduler.Complete(copier.batches[0].fence) && !copier.scheduler.Complete(copier.batches[1].fence));
+		CHECK(copier.scheduler.Busy() == 1);
+		CHECK(copier.Submit(false));
+		CHECK(copier.batches[2].slot == copier.batches[0].slot);
+
+		// Told to wait, it blocks on the oldest batch in flight and nothing newer.
+		CHECK(copier.Submit(true));
+		CHECK(copier.queue.waits.size() == 1 && copier.queue.waits[0] == copier.batches[1].fence);
+		CHECK(copier.batches[3].slot == copier.batches[1].slot);
+		CHECK(copier.scheduler.StallCount() == 1);
+		CHECK(!copier.scheduler.Complete(copier.batches[2].fence));
+
+		// 0 is what an upload that was never submitted waits for.
+		CHECK(copier.scheduler.Complete(0));
+		copier.scheduler.WaitForIdle();
+		CHECK(copier.queue.waits.back() == copier.batches[3].fence);
+		CHECK(copier.scheduler.Busy() == 0);
+	}
+
+	void test_staging_retires_with_the_batch_fence()
+	{
+		Copier copier(3, 4 * MiB);
+		copier.Queue(0, 3 * MiB);
+		copier.Queue(1, 3 * MiB);
+		CHECK(copier.Submit(false));
+
+		// The first batch's block is still being copied from, so the second gets a new one.
+		copier.Retire();
+		CHECK(copier.Submit(false));
+		CHECK(copier.batches[0].createdBlock && copier.batches[1].createdBlock);
+		CHECK(copier.batches[0].stagingBlock != copier.batches[1].stagingBlock);
+		CHECK(copier.staging.FreeSize() == 0);
+
+		// Retiring before the copy queue gets there changes nothing; once it's past the first batch, that
+		// batch's block is handed out again and no new one is made.
+		copier.Retire();
+		CHECK(copier.staging.FreeSize() == 0);
+		copier.queue.Complete(copier.batches[0].fence);
+		copier.Retire();
+		CHECK(copier.staging.FreeSize() == 4 * MiB);
+		copier.Queue(2, 2 * MiB);
+		CHECK(copier.Submit(false));
+		CHECK(!copier.batches[2].createdBlock && copier.batches[2].stagingBlock == copier.batches[0].stagingBlock);
+		CHECK(copier.staging.BlockCount() == 2);
+
+		// Everything finished: both blocks come back, and a trim down to one block's worth drops the other.
+		copier.scheduler.WaitForIdle();
+		copier.Retire();
+		CHECK(copier.staging.FreeSize() == 8 * MiB);
+		std::vector<uint32_t> destroyed;
+		copier.staging.Trim(4 * MiB, destroyed);
+		CHECK(destroyed.size() == 1 && copier.staging.BlockCount() == 1);
+	}
+
+	void test_batches_in_flight_is_clamped()
+	{
+		UploadScheduler none(0);
+		CHECK(none.BatchesInFlight() == 1);
+		UploadScheduler many(UploadScheduler::MaxBatches + 1);
+		CHECK(many.BatchesInFlight() == UploadScheduler::MaxBatches);
+	}
+}
+
+int main()
+{
+	test_plan_upload_batch();
+	test_batches_split_by_budget();
+	test_full_slots_defer_instead_of_waiting();
+	test_staging_retires_with_the_batch_fence();
+	test_batches_in_flight_is_clamped();
+	return MRenderer::Tests::finish("UploadSchedulerTests");
+}
@@ -0,0 +1,152 @@
+#include "TextureCooker.hpp"
+#include "Profiler.hpp"
+
+#include <cctype>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Anonymous namespace
+namespace
+{
+	std::wstring widen(const std::string& path)
+	{
+		return std::wstring(path.begin(), path.end());
+	}
+
+	bool modified_time(const std::string& path, int64_t& modified)
+	{
+		struct _stat64 info;
+		if (_stat64(path.c_str(), &info) != 0)
+		{
+			return false;
+		}
+		modified = static_cast<int64_t>(info.st_mtime);
+		return true;
+	}
+
+	bool ends_with(const std::string& text, const char* suffix)
+	{
+		const std::string ending(suffix);
+		if (text.size() < ending.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < ending.size(); i++)
+		{
+			if (tolower(static_cast<unsigned char>(text[text.size() - ending.size() + i])) != tolower(static_cast<unsigned char>(ending[i])))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+namespace MRenderer
+{
+	DXGI_FORMAT cooked_format(TextureUsage usage, bool hasAlpha)
+	{
+		switch (usage)
+		{
+		case TEXTURE_USAGE_NORMAL:
+			return DXGI_FORMAT_BC5_UNORM;
+		case TEXTURE_USAGE_MASK:
+			return hasAlpha ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_BC1_UNORM;
+		case TEXTURE_USAGE_COLOR:
+		default:
+			return DXGI_FORMAT_BC7_UNORM;
+		}
+	}
+
+	TextureUsage texture_usage_from_name(const std::string& path)
+	{
+		const std::string stem = path.substr(0, path.find_last_of('.'));
+		if (ends_with(stem, "_N") || ends_with(stem, "_normal"))
+		{
+			return TEXTURE_USAGE_NORMAL;
+		}
+		if (ends_with(stem, "_spec") || ends_with(stem, "_S") || ends_with(stem, "_emissive") || ends_with(stem, "_E"))
+		{
+			return TEXTURE_USAGE_MASK;
+		}
+		return TEXTURE_USAGE_COLOR;
+	}
+
+	std::string cooked_texture_path(const std::string& sourcePath)
+	{
+		return sourcePath + ".dds";
+	}
+
+	bool cooked_texture_current(const std::string& sourcePath)
+	{
+		int64_t sourceTime = 0;
+		int64_t cookedTime = 0;
+		if (!modified_time(cooked_texture_path(sourcePath), cookedTime))
+		{
+			return false;
+		}
+
+		// A cooked file without its source is still usable.
+		return !modified_time(sourcePath, sourceTime) || cookedTime >= sourceTime;
+	}
+
+	HRESULT cook_image(const ScratchImage& source, TextureUsage usage, ScratchImage& cooked)
+	{
+		PROFILE_ZONE("TextureCooker::Cook");
+
+		const TexMetadata& metadata = source.GetMetadata();
+		if (IsCompressed(metadata.format))
+		{
+			return E_INVALIDARG;
+		}
+
+		// Box filtered from the top level down to 1x1, alpha filtered on its own so it doesn't bleed into the colour.
+		ScratchImage mips;
+		HRESULT hr = GenerateMipMaps(*source.GetImage(0, 0, 0), TEX_FILTER_FANT | TEX_FILTER_SEPARATE_ALPHA, 0, mips);
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+
+		if (metadata.width % 4 != 0 || metadata.height % 4 != 0)
+		{
+			cooked = std::move(mips);
+			return S_OK;
+		}
+
+		const DXGI_FORMAT format = cooked_format(usage, !mips.IsAlphaAllOpaque());
+		return Compress(mips.GetImages(), mips.GetImageCount(), mips.GetMetadata(), format, TEX_COMPRESS_PARALLEL, TEX_THRESHOLD_DEFAULT, cooked);
+	}
+
+	HRESULT save_cooked_texture(const ScratchImage& cooked, const std::string& path)
+	{
+		return SaveToDDSFile(cooked.GetImages(), cooked.GetImageCount(), cooked.GetMetadata(), DDS_FLAGS_NONE, widen(path).c_str());
+	}
+
+	HRESULT cook_texture(const std::string& sourcePath, TextureUsage usage, std::string& error)
+	{
+		ScratchImage source;
+		HRESULT hr = LoadFromWICFile(widen(sourcePath).c_str(), WIC_FLAGS_FORCE_RGB, nullptr, source);
+		if (FAILED(hr))
+		{
+			error = "Failed to read " + sourcePath;
+			return hr;
+		}
+
+		ScratchImage cooked;
+		hr = cook_image(source, usage, cooked);
+		if (FAILED(hr))
+		{
+			error = "Failed to cook " + sourcePath;
+			return hr;
+		}
+
+		hr = save_cooked_texture(cooked, cooked_texture_path(sourcePath));
+		if (FAILED(hr))
+		{
+			error = "Failed to write " + cooked_texture_path(sourcePath);
+			return hr;
+		}
+		return S_OK;
+	}
+}
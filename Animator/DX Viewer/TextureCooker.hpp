@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include "DirectXTex.h"
+
+// Texture cooking. A source image (anything WIC can read) gets a full mip chain, is block compressed on
+// the CPU into the format that suits how it's used, and is saved next to the source as a DDS. Loading
+// the cooked file is a header parse plus one copy per mip: nothing is decoded or filtered at runtime, and
+// the GPU keeps the compressed blocks, a quarter of the memory of RGBA8 or less.
+// The viewer cooks a texture the first time it loads it; "DX Viewer.exe -cook a.png b.png" does it ahead of time.
+namespace MRenderer
+{
+	using namespace DirectX;
+
+	enum TextureUsage
+	{
+		TEXTURE_USAGE_COLOR = 0, // diffuse, BC7
+		TEXTURE_USAGE_MASK,      // specular, emissive: BC1, or BC3 when the alpha is used
+		TEXTURE_USAGE_NORMAL,    // tangent space normals: BC5, the shader rebuilds z
+		TEXTURE_USAGE_COUNT
+	};
+
+	DXGI_FORMAT cooked_format(TextureUsage usage, bool hasAlpha);
+
+	// Guesses the usage from the usual suffixes (_N, _normal, _spec, _S, _emissive, _E); anything else is colour.
+	TextureUsage texture_usage_from_name(const std::string& path);
+
+	// Where the cooked version of a source texture lives: the source path with ".dds" appended.
+	std::string cooked_texture_path(const std::string& sourcePath);
+
+	// True if the cooked file exists and isn't older than the source.
+	bool cooked_texture_current(const std::string& sourcePath);
+
+	// Mips and block compression. An image whose size isn't a multiple of 4 keeps its mips but stays
+	// uncompressed, D3D12 can't create a block compressed texture with that top level.
+	HRESULT cook_image(const ScratchImage& source, TextureUsage usage, ScratchImage& cooked);
+
+	HRESULT save_cooked_texture(const ScratchImage& cooked, const std::string& path);
+
+	// Reads sourcePath, cooks it and writes cooked_texture_path(sourcePath). Needs COM for WIC.
+	HRESULT cook_texture(const std::string& sourcePath, TextureUsage usage, std::string& error);
+}
@@ -0,0 +1,90 @@
+#include "UploadRing.hpp"
+
+#include <cassert>
+
+namespace MRenderer
+{
+	void UploadRing::Initialize(void* cpuBase, uint64_t gpuBase, uint64_t capacity)
+	{
+		m_cpuBase = static_cast<uint8_t*>(cpuBase);
+		m_gpuBase = gpuBase;
+		m_capacity = capacity;
+		Reset();
+	}
+
+	void UploadRing::Reset()
+	{
+		m_head = 0;
+		m_allocated = 0;
+		m_retired = 0;
+		m_peakUsed = 0;
+		m_failed = 0;
+		m_frames.clear();
+	}
+
+	UploadRing::Allocation UploadRing::Allocate(uint64_t size, uint64_t alignment)
+	{
+		assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+		Allocation allocation;
+		if (size == 0 || size > m_capacity)
+		{
+			m_failed++;
+			return allocation;
+		}
+
+		// Nothing live, start from the beginning rather than waste the tail on padding.
+		if (Used() == 0)
+		{
+			m_head = 0;
+		}
+
+		uint64_t offset = (m_head + alignment - 1) & ~(alignment - 1);
+		uint64_t padding = offset - m_head;
+
+		// Never split an allocation across the end, skip the tail and start over at zero.
+		if (offset + size > m_capacity)
+		{
+			padding = m_capacity - m_head;
+			offset = 0;
+		}
+
+		// The live frames occupy Used() bytes starting at the oldest one; what is left is free.
+		if (Used() + padding + size > m_capacity)
+		{
+			m_failed++;
+			return allocation;
+		}
+
+		m_head = offset + size;
+		if (m_head == m_capacity)
+		{
+			m_head = 0;
+		}
+		m_allocated += padding + size;
+		if (Used() > m_peakUsed)
+		{
+			m_peakUsed = Used();
+		}
+
+		allocation.cpu = m_cpuBase + offset;
+		allocation.gpu = m_gpuBase + offset;
+		allocation.offset = offset;
+		allocation.size = size;
+		return allocation;
+	}
+
+	void UploadRing::EndFrame(uint64_t fenceValue)
+	{
+		m_frames.push_back({ fenceValue, m_allocated });
+	}
+
+	void UploadRing::Retire(uint64_t completedValue)
+	{
+		while (!m_frames.empty() && m_frames.front().fenceValue <= completedValue)
+		{
+			m_retired = m_frames.front().end;
+			m_frames.pop_front();
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+
+namespace MRenderer
+{
+	// Linear sub-allocator over one persistently mapped upload buffer.
+	// Transient per-frame data (debug lines, constants) is carved out of it front to back; when the end is
+	// reached allocation wraps to the start. Memory is given back a whole frame at a time once the fence
+	// value that frame was tagged with in EndFrame() has been passed to Retire().
+	// Knows nothing about D3D12, the caller supplies the CPU pointer and GPU address of the mapped buffer.
+	class UploadRing
+	{
+	public:
+		struct Allocation
+		{
+			void* cpu = nullptr;
+			uint64_t gpu = 0;
+			uint64_t offset = 0;
+			uint64_t size = 0;
+
+			bool Valid() const { return cpu != nullptr; }
+		};
+
+		void Initialize(void* cpuBase, uint64_t gpuBase, uint64_t capacity);
+		void Reset();
+
+		// Returns an invalid Allocation if the live frames leave no room; nothing is ever overwritten.
+		// alignment must be a power of two.
+		Allocation Allocate(uint64_t size, uint64_t alignment);
+
+		// Closes the current frame. Everything allocated since the previous EndFrame() is freed once
+		// Retire() sees a completed value >= fenceValue.
+		void EndFrame(uint64_t fenceValue);
+
+		// Frees every closed frame whose fence value is <= completedValue.
+		void Retire(uint64_t completedValue);
+
+		uint64_t Capacity() const { return m_capacity; }
+
+		// Bytes handed out and not yet retired, including alignment and wrap padding.
+		uint64_t Used() const { return m_allocated - m_retired; }
+
+		uint64_t PeakUsed() const { return m_peakUsed; }
+
+		uint64_t FailedAllocations() const { return m_failed; }
+
+	private:
+		struct FrameMark
+		{
+			uint64_t fenceValue;
+			uint64_t end; // value of m_allocated when the frame was closed
+		};
+
+		uint8_t* m_cpuBase = nullptr;
+		uint64_t m_gpuBase = 0;
+		uint64_t m_capacity = 0;
+
+		uint64_t m_head = 0;        // next free byte, in [0, capacity)
+		uint64_t m_allocated = 0;   // total bytes ever handed out
+		uint64_t m_retired = 0;     // total bytes ever given back
+		uint64_t m_peakUsed = 0;
+		uint64_t m_failed = 0;
+
+		std::deque<FrameMark> m_frames;
+	};
+}
@@ -0,0 +1,76 @@
+#include "UploadScheduler.hpp"
+
+namespace MRenderer
+{
+	void UploadScheduler::SetBatchesInFlight(uint32_t count)
+	{
+		count = count < 1 ? 1 : count > MaxBatches ? MaxBatches : count;
+		m_slotFences.assign(count, 0);
+	}
+
+	uint32_t UploadScheduler::BeginBatch(bool wait)
+	{
+		assert(m_queue != nullptr);
+
+		// The oldest batch is the first to finish.
+		uint32_t oldest = 0;
+		for (uint32_t slot = 1; slot < m_slotFences.size(); slot++)
+		{
+			if (m_slotFences[slot] < m_slotFences[oldest])
+			{
+				oldest = slot;
+			}
+		}
+
+		if (!Complete(m_slotFences[oldest]))
+		{
+			if (!wait)
+			{
+				m_deferred++;
+				return InvalidSlot;
+			}
+			m_stalls++;
+			WaitFor(m_slotFences[oldest]);
+		}
+		return oldest;
+	}
+
+	uint64_t UploadScheduler::EndBatch(uint32_t slot)
+	{
+		assert(m_queue != nullptr && slot < m_slotFences.size());
+
+		m_lastSubmitted = m_queue->Signal();
+		m_slotFences[slot] = m_lastSubmitted;
+		return m_lastSubmitted;
+	}
+
+	bool UploadScheduler::Complete(uint64_t fenceValue)
+	{
+		if (fenceValue <= m_completed)
+		{
+			return true;
+		}
+
+		m_completed = m_queue->CompletedValue();
+		return fenceValue <= m_completed;
+	}
+
+	void UploadScheduler::WaitFor(uint64_t fenceValue)
+	{
+		if (!Complete(fenceValue))
+		{
+			m_queue->WaitForValue(fenceValue);
+			m_completed = m_queue->CompletedValue();
+		}
+	}
+
+	uint32_t UploadScheduler::Busy()
+	{
+		uint32_t busy = 0;
+		for (uint64_t fenceValue : m_slotFences)
+		{
+			busy += Complete(fenceValue) ? 0 : 1;
+		}
+		return busy;
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "FrameRing.hpp"
+
+namespace MRenderer
+{
+	// Paces upload batches on a queue of their own, next to the frame ring on the graphics queue.
+	// Each batch is recorded into one of a few slots (a command allocator each), and a slot is free again
+	// once the queue has passed the fence its batch signalled. BeginBatch() doesn't wait unless asked to: a
+	// frame that finds every slot busy leaves its uploads for a later one instead of stalling. The graphics
+	// queue picks up finished uploads by fence value, polling Complete() for anything that can keep showing
+	// a placeholder, or a GPU side wait on the batch's fence for anything that can't.
+	// Driven through IFrameQueue, so a CPU fake can stand in for the copy queue. No D3D12 or Windows dependency.
+	class UploadScheduler
+	{
+	public:
+		static const uint32_t InvalidSlot = UINT32_MAX;
+		static const uint32_t MaxBatches = 8;
+
+		explicit UploadScheduler(uint32_t batchesInFlight = 3)
+		{
+			SetBatchesInFlight(batchesInFlight);
+		}
+
+		// Only valid while the queue is idle.
+		void SetBatchesInFlight(uint32_t count);
+
+		void SetQueue(IFrameQueue* queue) { m_queue = queue; }
+
+		uint32_t BatchesInFlight() const { return static_cast<uint32_t>(m_slotFences.size()); }
+
+		// A slot whose last batch has finished, to record the next one into. Without wait it returns InvalidSlot
+		// when every slot is still in flight; with wait it blocks on the oldest.
+		uint32_t BeginBatch(bool wait);
+
+		// Call once the batch recorded in slot has been submitted. Returns the fence value it finishes at.
+		uint64_t EndBatch(uint32_t slot);
+
+		// Whether the batch that returned fenceValue has finished. 0, nothing to wait for, always has.
+		bool Complete(uint64_t fenceValue);
+
+		void WaitFor(uint64_t fenceValue);
+		void WaitForIdle() { WaitFor(m_lastSubmitted); }
+
+		// Fence value of the newest batch submitted, 0 before the first.
+		uint64_t LastSubmitted() const { return m_lastSubmitted; }
+
+		// How many slots hold a batch the queue hasn't finished.
+		uint32_t Busy();
+
+		// BeginBatch(false) calls that found every slot busy, and BeginBatch(true) calls that had to wait.
+		uint64_t DeferredCount() const { return m_deferred; }
+		uint64_t StallCount() const { return m_stalls; }
+
+	private:
+		IFrameQueue* m_queue = nullptr;
+		std::vector<uint64_t> m_slotFences; // fence value of each slot's last batch, 0 if never used
+		uint64_t m_completed = 0;           // last value read from the queue
+		uint64_t m_lastSubmitted = 0;
+		uint64_t m_deferred = 0;
+		uint64_t m_stalls = 0;
+	};
+}
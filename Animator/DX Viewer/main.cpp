@@ -1,4 +1,5 @@
 #include "GraphicsApplication.hpp"
+#include "CrowdBenchmark.hpp"
 
 
 
@@ -8,6 +9,7 @@
 //--------------------------------------------------------------------------------------
 HRESULT InitWindow(HINSTANCE hInstance, int nCmdShow, MRenderer::GraphicsApplication& g_gApp);
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
+int CookTextures(int count, LPWSTR* paths);
 //void Render();
 
 
@@ -19,7 +21,27 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 {
     MRenderer::GraphicsApplication g_gApp(800, 600);
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
+
+    // "-cook a.png b.png ..." cooks the textures ahead of time and exits without opening a window.
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(lpCmdLine, &argc);
+    if (argv && argc > 0 && wcscmp(argv[0], L"-cook") == 0)
+    {
+        int result = CookTextures(argc - 1, argv + 1);
+        LocalFree(argv);
+        return result;
+    }
+    // "-bench-culling [instances]" times culling and building a synthetic crowd and exits, "-bench-grid
+    // [instances]" culling and level selection through the spatial grid, see CrowdBenchmark.hpp.
+    if (argv && argc > 0 && (wcscmp(argv[0], L"-bench-culling") == 0 || wcscmp(argv[0], L"-bench-grid") == 0))
+    {
+        const size_t instances = argc > 1 ? static_cast<size_t>(_wtoi64(argv[1])) : 100000;
+        int result = wcscmp(argv[0], L"-bench-grid") == 0 ? MRenderer::run_grid_benchmark(instances, std::cout)
+            : MRenderer::run_culling_benchmark(instances, std::cout);
+        LocalFree(argv);
+        return result;
+    }
+    LocalFree(argv);
 
     g_gApp.m_aspectRatio = static_cast<float>(g_gApp.m_windowWidth) / static_cast<float>(g_gApp.m_windowHeight);
     if (FAILED(InitWindow(hInstance, nCmdShow, g_gApp)))
@@ -47,6 +69,38 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 }
 
 
+//--------------------------------------------------------------------------------------
+// Cook each texture next to its source, see TextureCooker.hpp. Returns the number that failed.
+//--------------------------------------------------------------------------------------
+int CookTextures(int count, LPWSTR* paths)
+{
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        std::wstring wide(paths[i]);
+        std::string path(wide.begin(), wide.end());
+
+        XTime timer;
+        timer.Restart();
+
+        std::string error;
+        if (FAILED(MRenderer::cook_texture(path, MRenderer::texture_usage_from_name(path), error)))
+        {
+            std::cout << error << "\n";
+            failed++;
+            continue;
+        }
+
+        std::cout << "Cooked " << MRenderer::cooked_texture_path(path) << " in " << timer.TotalTimeExact() << " s\n";
+    }
+
+    CoUninitialize();
+    return failed;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Register class and create window
 //--------------------------------------------------------------------------------------
@@ -1,18 +1,40 @@
 #include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib") // GetProcessMemoryInfo(), for ReportMemory()
 #include <d3d11_1.h>
 #include <d3dcompiler.h>
 #include <directxmath.h>
 
 #include <fbxsdk.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <iterator>
+#include <map>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+#include "InfluenceSelection.hpp"
+#include "VertexWeld.hpp"
 
 namespace MFBXExporter
 {
 	constexpr int maxPathLength = 260;
-	constexpr int MAX_INFLUENCES = 4;
+	constexpr int MIN_CONTROL_POINTS_PER_WORKER = 4096;
+	constexpr uint64_t STREAM_KEYFRAME_BYTES = 512ull << 20; // a baked clip bigger than this is spooled to disk even without -stream
+	constexpr size_t SPOOL_COPY_BYTES = 4 << 20;
+	constexpr double CLIP_BLOCK_SECONDS = 1.0; // keyframes are grouped into blocks this long for the viewer to page in, see BuildClipBlocks()
+	constexpr int LOD_COUNT = 4; // levels of detail including the full mesh, fewer if simplifying stops paying off
+	constexpr int INFLUENCE_BUCKETS = 3;
+	constexpr int BUCKET_INFLUENCES[INFLUENCE_BUCKETS] = { 1, 2, 4 }; // influences each bucket's skinning path blends
 	using namespace DirectX;
 
 	using ulong = unsigned long long;
@@ -46,10 +68,28 @@ namespace MFBXExporter
 		MoralesPose poseData;
 	};
 
+	// Axis aligned box, model space.
+	struct MoralesBounds
+	{
+		float min[3];
+		float max[3];
+	};
+
+	// A run of consecutive keyframes whose keytimes fall in the same CLIP_BLOCK_SECONDS of the clip.
+	struct MoralesClipBlock
+	{
+		uint32_t firstKey;
+		uint32_t keyCount;
+	};
+
 	struct MoralesAnimation
 	{
 		double duration;
-		std::vector<MoralesKeyframe> keyframes;
+		std::vector<MoralesKeyframe> keyframes; // empty if they're spooled, see keyframeSpool
+		std::vector<MoralesBounds> keyBounds; // the skinned mesh's at each keyframe, see ComputeKeyframeBounds()
+		double blockSeconds = 0.0;
+		std::vector<MoralesClipBlock> blocks; // every keyframe in one, in order, see BuildClipBlocks()
+		std::vector<double> keytimes;         // every keyframe's, so the viewer can find keys without reading them
 	};
 
 	struct MoralesMaterial
@@ -71,48 +111,132 @@ namespace MFBXExporter
 		Component components[COUNT];
 	};
 
+	// A run of triangles in indicesList drawn with one material, -1 for none.
+	struct MoralesSubmesh
+	{
+		uint32_t indexStart;
+		uint32_t indexCount;
+		int32_t material;
+	};
+
+	// One level of detail: a run of submeshes drawing a run of vertices of their own.
+	struct MoralesLod
+	{
+		uint32_t submeshStart;
+		uint32_t submeshCount;
+		uint32_t vertexStart;
+		uint32_t vertexCount;
+		float error;      // furthest the surface moved from the full mesh, in model units
+		float switchSize; // drawn while the mesh's bounding sphere covers at most this fraction of the screen height
+	};
+
+	// A cluster of one submesh's triangles, small enough to cull on its own. Its bounds hold in every pose the
+	// clip reaches, see ComputeMeshletBounds().
+	struct MoralesMeshlet
+	{
+		uint32_t vertexStart;   // into meshletVertices
+		uint32_t vertexCount;
+		uint32_t triangleStart; // into meshletTriangles, three bytes per triangle
+		uint32_t triangleCount;
+		uint32_t submesh;
+		float center[3];        // bounding sphere, model space
+		float radius;
+		float coneAxis[3];      // every face normal lies within the cone around it
+		float coneCutoff;       // cos of the cone's half angle, 0 or less if it faces every way
+	};
+
+	// How many of a run of vertices, or of indices, fall in each influence bucket, in bucket order.
+	struct MoralesInfluenceBuckets
+	{
+		uint32_t counts[INFLUENCE_BUCKETS];
+	};
+
 	struct MoralesMesh
 	{
 		std::vector<MoralesVertex> vertexList;
 		std::vector<int> indicesList;
+		std::vector<MoralesSubmesh> submeshes; // by material, each level's after the one before, see lods
+		std::vector<MoralesLod> lods;          // full detail first
+		std::vector<MoralesMeshlet> meshlets;  // each submesh's after the one before
+		std::vector<uint32_t> meshletVertices; // vertexList indices
+		std::vector<uint8_t> meshletTriangles; // corners as indices into their meshlet's vertices
+		std::vector<uint32_t> packedWeights;   // per vertex, four UNORM8 weights x in the low byte, see QuantizeWeights()
+		std::vector<MoralesInfluenceBuckets> lodBuckets;     // each level's vertices, see SortByInfluenceCount()
+		std::vector<MoralesInfluenceBuckets> submeshBuckets; // each submesh's indices
 		std::vector<MoralesMaterial> materialList;
 		std::vector<std::string> materialPaths;
 		MoralesPose bindPose;
 		MoralesAnimation animation; //TODO: maybe add support for multiple animation loading?
 	};
 
-	struct MoralesInfluence
-	{
-		int joint; 
-		float weight;
-	};
-
-	struct MoralesInfluenceSet
+	// One cluster's weight on one control point, as ProcessFbxAnimation() gathers them.
+	struct MoralesInfluenceContribution
 	{
-		MoralesInfluence infs[4];
+		int controlPoint;
+		MoralesInfluence influence;
 	};
 
-
-	std::vector<MoralesInfluenceSet> controlPointInfluences;
-
-	//using MoralesInfluenceSet = std::array<MoralesInfluence, 4>;
-
+	// Skin weights by control point, for every skinned mesh in the bind pose.
+	std::map<FbxMesh*, std::vector<MoralesInfluenceSet>> meshInfluences;
 
 
 	void ProcessFbxMesh(FbxNode* Node);
+	void ProcessFbxMeshNode(FbxNode* node, FbxMesh* mesh);
+	void BuildSubmeshes(MoralesMesh& mesh, const std::vector<int>& materials);
+	void TriangulatePolygon(const std::vector<XMFLOAT4>& corners, std::vector<int>& triangles);
 	void ProcessFbxMaterials(FbxScene* Scene);
+	int MaterialIndex(const FbxSurfaceMaterial* material);
 	void ProcessFbxAnimation(FbxScene* Scene);
+	void BakeFbxAnimation(FbxScene* Scene, const std::string& spoolPath, bool stream);
+	void StoreMaterialTextures(const std::string& sourceFileName, MoralesMesh& mesh);
+	uint64_t ContentHash(const char* data, size_t size);
+	std::string ContentHashName(uint64_t hash);
+	void OptimizeMesh(MoralesMesh& mesh);
+	void ReorderForVertexCache(std::vector<int>& indices, size_t vertexCount);
+	void ReorderForOverdraw(std::vector<int>& indices, const std::vector<MoralesVertex>& vertices, float threshold);
+	void ReorderForVertexFetch(std::vector<int>& indices, std::vector<MoralesVertex>& vertices);
+	int CountCacheMisses(const std::vector<int>& indices, size_t vertexCount);
+	void BuildLods(MoralesMesh& mesh, int maxLevels);
+	float SimplifyMesh(std::vector<int>& indices, std::vector<MoralesVertex>& vertices, size_t targetIndexCount, float maxError);
+	void MergeInfluences(MoralesVertex& into, const MoralesVertex& from, double intoShare, double fromShare);
+	void QuantizeWeights(MoralesMesh& mesh);
+	uint32_t InfluenceBucket(uint32_t packedWeights);
+	void SortByInfluenceCount(MoralesMesh& mesh);
+	void BuildMeshlets(MoralesMesh& mesh);
+	void ComputeMeshletBounds(MoralesMesh& mesh);
+	size_t KeyframeCount(const MoralesMesh& mesh);
+	const MoralesKeyframe& LoadKeyframe(const MoralesMesh& mesh, size_t index, MoralesKeyframe& scratch);
+	void BuildInverseBind(const MoralesMesh& mesh, std::vector<XMMATRIX>& inverseBind);
+	bool BuildSkinningPalette(const std::vector<XMMATRIX>& inverseBind, const MoralesKeyframe& keyframe, std::vector<XMFLOAT4X4>& palette);
+	XMVECTOR SkinPosition(const MoralesVertex& vertex, const XMFLOAT4X4* palette, size_t jointCount);
+	float KeyTurn(const MoralesJoint& a, const MoralesJoint& b);
+	void ComputeKeyframeBounds(MoralesMesh& mesh);
+	void BuildClipBlocks(MoralesMesh& mesh, double blockSeconds);
 	void SaveMesh(const char* meshFileName, MoralesMesh& mesh);
+	void ReportMemory(const char* stage);
 	std::string ReplaceFBXExtension(std::string fileName);
-	bool AreEqual(float a, float b);
 	void ConvertFbxAMatrixToFloat16(float* m, const FbxAMatrix& mat);
 	std::string OpenFileName(const wchar_t* filter, HWND owner);
-	void AddAndKeepArraySorted(MoralesInfluenceSet& mis, MoralesInfluence& mi);
-	void SortMIS(MoralesInfluenceSet& mis);
+	void SelectInfluences(const std::vector<MoralesInfluenceContribution>& contributions, int controlPointCount,
+		std::vector<MoralesInfluenceSet>& influences);
 
 	MoralesMesh moralesMesh;
+	std::vector<FbxSurfaceMaterial*> materialSources; // the FBX material behind each of moralesMesh.materialList
+	std::vector<int> triangleMaterials; // moralesMesh.materialList index of each triangle, as ProcessFbxMesh() adds them
 	int numIndices = 0;
 	int numControlPoints = 0;
+	std::vector<MoralesFbxJoint> skeletonJoints; // the bind pose's joints, found by ProcessFbxAnimation() for BakeFbxAnimation()
+
+	// Where a streaming export bakes the clip to, every keyframe a record exactly as SaveMesh() writes it, in
+	// place of moralesMesh.animation.keyframes. Only one keyframe is ever in memory, see LoadKeyframe().
+	struct MoralesKeyframeSpool
+	{
+		std::string path;
+		std::fstream file;
+		size_t count = 0;
+		uint32_t jointCount = 0;
+	};
+	MoralesKeyframeSpool keyframeSpool;
 
 	int main(int argc, char** argv)
 	{
@@ -121,6 +245,14 @@ namespace MFBXExporter
 		freopen("CONOUT$", "w", stdout);
 		freopen("CONOUT$", "w", stderr);
 
+		// -stream spools the baked clip to disk instead of holding it, for scenes too big to export otherwise.
+		// Clips over STREAM_KEYFRAME_BYTES are spooled either way.
+		bool stream = false;
+		for (int i = 1; i < argc; i++)
+		{
+			stream = stream || std::strcmp(argv[i], "-stream") == 0;
+		}
+
 		//if (argc != 2)
 		//{
 		//	std::cout << "Invalid arguments.\n";
@@ -165,22 +297,59 @@ namespace MFBXExporter
 
 		// The file is imported, so get rid of the importer.
 		lImporter->Destroy();
+		ReportMemory("FBX scene imported");
+
+		std::string newFileLocation = ReplaceFBXExtension(SourceFileLocation);
 
-		// Process the mesh and the materials
+		// Process the mesh and the materials, the materials first so the mesh can refer to them
 		ProcessFbxAnimation(lScene);
 
+		ProcessFbxMaterials(lScene);
+
 		ProcessFbxMesh(lScene->GetRootNode());
+		ReportMemory("Meshes read");
 
-		ProcessFbxMaterials(lScene);
+		BakeFbxAnimation(lScene, newFileLocation + ".keys", stream);
+		ReportMemory("Animation baked");
 
+		// Everything the export needs is out of the scene now. Destroy the SDK manager and all the other objects
+		// it was handling before the mesh is worked on, and whatever pointed into them.
+		lSdkManager->Destroy();
+		lSdkManager = nullptr;
+		lScene = nullptr;
+		std::vector<FbxSurfaceMaterial*>().swap(materialSources);
+		meshInfluences.clear();
+		std::vector<MoralesFbxJoint>().swap(skeletonJoints);
+		ReportMemory("FBX scene released");
 
+		BuildSubmeshes(moralesMesh, triangleMaterials);
+		std::vector<int>().swap(triangleMaterials);
 
-		std::string newFileLocation = ReplaceFBXExtension(SourceFileLocation);
+		StoreMaterialTextures(SourceFileLocation, moralesMesh);
+
+		OptimizeMesh(moralesMesh);
+
+		BuildLods(moralesMesh, LOD_COUNT);
+
+		QuantizeWeights(moralesMesh);
+
+		SortByInfluenceCount(moralesMesh);
+
+		BuildMeshlets(moralesMesh);
+
+		ComputeKeyframeBounds(moralesMesh);
+
+		BuildClipBlocks(moralesMesh, CLIP_BLOCK_SECONDS);
+		ReportMemory("Mesh built");
 
 		SaveMesh(newFileLocation.c_str(), moralesMesh);
 
-		// Destroy the SDK manager and all the other objects it was handling.
-		lSdkManager->Destroy();
+		if (keyframeSpool.file.is_open())
+		{
+			keyframeSpool.file.close();
+			std::remove(keyframeSpool.path.c_str());
+		}
+		ReportMemory("Mesh saved");
 
 		std::cout << "\n\nFile exported successfully . . .\n";
 		std::cout << "File saved as: " << newFileLocation << '\n';
@@ -192,308 +361,399 @@ namespace MFBXExporter
 
 	void ProcessFbxMesh(FbxNode* Node)
 	{
+		// Depth first over the whole scene, every mesh node appended to moralesMesh, not only the root's children.
+		std::cout << "\nName:" << Node->GetName();
 
+		FbxMesh* mesh = Node->GetMesh();
+		if (mesh != NULL)
+		{
+			ProcessFbxMeshNode(Node, mesh);
+		}
 
-		//FBX Mesh stuff
 		int childrenCount = Node->GetChildCount();
-
-		std::cout << "\nName:" << Node->GetName();
-
 		for (int i = 0; i < childrenCount; i++)
 		{
-			FbxNode* childNode = Node->GetChild(i);
-			FbxMesh* mesh = childNode->GetMesh();
-
-			if (mesh != NULL)
-			{
-				std::cout << "\nMesh:" << childNode->GetName();
+			ProcessFbxMesh(Node->GetChild(i));
+		}
+	}
 
+	void ProcessFbxMeshNode(FbxNode* node, FbxMesh* mesh)
+	{
+		std::cout << "\nMesh:" << node->GetName();
 
-				// Get index count from mesh
-				int numVertices = mesh->GetControlPointsCount();
-				numControlPoints = numVertices;
-				std::cout << "\nVertex Count:" << numVertices;
+		// Every mesh shares one vertex buffer, so each is baked into scene space: the node's global transform
+		// and its geometric offset (a pivot its children don't inherit). Skinned meshes are bound in that space too.
+		FbxAMatrix geometricOffset(node->GetGeometricTranslation(FbxNode::eSourcePivot),
+			node->GetGeometricRotation(FbxNode::eSourcePivot), node->GetGeometricScaling(FbxNode::eSourcePivot));
+		FbxAMatrix meshToScene = node->EvaluateGlobalTransform() * geometricOffset;
 
-				// Resize the vertex vector to size of this mesh
-				moralesMesh.vertexList.resize(numVertices);
+		// Get index count from mesh
+		int numVertices = mesh->GetControlPointsCount();
+		numControlPoints = numVertices;
+		std::cout << "\nVertex Count:" << numVertices;
 
-				//================= Process Vertices ===============
-				for (int j = 0; j < numVertices; j++)
-				{
-					FbxVector4 vert = mesh->GetControlPointAt(j);
-					moralesMesh.vertexList[j].Pos.x = static_cast<float>(vert.mData[0]);
-					moralesMesh.vertexList[j].Pos.y = static_cast<float>(vert.mData[1]);
-					moralesMesh.vertexList[j].Pos.z = static_cast<float>(vert.mData[2]);
-					moralesMesh.vertexList[j].Pos.w = static_cast<float>(vert.mData[3]);
+		// This mesh's control points, before they're expanded to one vertex per polygon corner
+		std::vector<MoralesVertex> controlPoints;
+		controlPoints.resize(numVertices);
 
+		//================= Process Vertices ===============
+		for (int j = 0; j < numVertices; j++)
+		{
+			FbxVector4 point = mesh->GetControlPointAt(j);
+			FbxVector4 vert = point;
+			vert.mData[3] = 1.0;
+			vert = meshToScene.MultT(vert);
+			controlPoints[j].Pos.x = static_cast<float>(vert.mData[0]);
+			controlPoints[j].Pos.y = static_cast<float>(vert.mData[1]);
+			controlPoints[j].Pos.z = static_cast<float>(vert.mData[2]);
+			controlPoints[j].Pos.w = static_cast<float>(point.mData[3]);
+		}
 
+		numIndices = mesh->GetPolygonVertexCount();
+		std::cout << "\nIndice Count:" << numIndices;
 
-					// Generate random normal for first attempt at getting to render
-					//simpleMesh.vertexList[j].Normal = RAND_NORMAL;
-				}
+		// No need to allocate int array, FBX does for us
+		const int* polygonVertices = mesh->GetPolygonVertices();
 
-				numIndices = mesh->GetPolygonVertexCount();
-				std::cout << "\nIndice Count:" << numIndices;
+		// Get the Normals array from the mesh
+		FbxArray<FbxVector4> normalsVec;
+		mesh->GetPolygonVertexNormals(normalsVec);
+		std::cout << "\nNormalVec Count:" << normalsVec.Size() << "\n\n";
 
-				// No need to allocate int array, FBX does for us
-				int* indices = mesh->GetPolygonVertices();
+		// Declare a new array for the second vertex array
+		// Note the size is numIndices not numVertices
+		std::vector<MoralesVertex> vertexListExpanded;
+		vertexListExpanded.resize(numIndices);
 
-				// Fill indiceList
-				moralesMesh.indicesList.resize(numIndices);
-				memcpy(moralesMesh.indicesList.data(), indices, numIndices * sizeof(int));
+		int CurrentUV = 0;
 
-				// Get the Normals array from the mesh
-				FbxArray<FbxVector4> normalsVec;
-				mesh->GetPolygonVertexNormals(normalsVec);
-				std::cout << "\nNormalVec Count:" << normalsVec.Size() << "\n\n";
+		//get all UV set names
+		FbxStringList lUVSetNameList;
+		mesh->GetUVSetNames(lUVSetNameList);
 
-				// Declare a new array for the second vertex array
-				// Note the size is numIndices not numVertices
-				std::vector<MoralesVertex> vertexListExpanded;
-				vertexListExpanded.resize(numIndices);
+		//iterating over all uv sets
+		for (int lUVSetIndex = 0; lUVSetIndex < lUVSetNameList.GetCount(); lUVSetIndex++)
+		{
+			//get lUVSetIndex-th uv set
+			const char* lUVSetName = lUVSetNameList.GetStringAt(lUVSetIndex);
+			const FbxGeometryElementUV* lUVElement = mesh->GetElementUV(lUVSetName);
+			if (!lUVElement)
+				continue;
+
+			// only support mapping mode eByPolygonVertex and eByControlPoint
+			if (lUVElement->GetMappingMode() != FbxGeometryElement::eByPolygonVertex &&
+				lUVElement->GetMappingMode() != FbxGeometryElement::eByControlPoint)
+				return;
 
-				int CurrentUV = 0;
+			//index array, where holds the index referenced to the uv data
+			const bool lUseIndex = lUVElement->GetReferenceMode() != FbxGeometryElement::eDirect;
+			const int lIndexCount = (lUseIndex) ? lUVElement->GetIndexArray().GetCount() : 0;
 
-				//get all UV set names
-				FbxStringList lUVSetNameList;
-				mesh->GetUVSetNames(lUVSetNameList);
+			//iterating through the data by polygon
+			const int lPolyCount = mesh->GetPolygonCount();
 
-				//iterating over all uv sets
-				for (int lUVSetIndex = 0; lUVSetIndex < lUVSetNameList.GetCount(); lUVSetIndex++)
+			if (lUVElement->GetMappingMode() == FbxGeometryElement::eByControlPoint)
+			{
+				for (int lPolyIndex = 0; lPolyIndex < lPolyCount; ++lPolyIndex)
 				{
-					//get lUVSetIndex-th uv set
-					const char* lUVSetName = lUVSetNameList.GetStringAt(lUVSetIndex);
-					const FbxGeometryElementUV* lUVElement = mesh->GetElementUV(lUVSetName);
-					if (!lUVElement)
-						continue;
-
-					// only support mapping mode eByPolygonVertex and eByControlPoint
-					if (lUVElement->GetMappingMode() != FbxGeometryElement::eByPolygonVertex &&
-						lUVElement->GetMappingMode() != FbxGeometryElement::eByControlPoint)
-						return;
-
-					//index array, where holds the index referenced to the uv data
-					const bool lUseIndex = lUVElement->GetReferenceMode() != FbxGeometryElement::eDirect;
-					const int lIndexCount = (lUseIndex) ? lUVElement->GetIndexArray().GetCount() : 0;
-
-					//iterating through the data by polygon
-					const int lPolyCount = mesh->GetPolygonCount();
-
-					if (lUVElement->GetMappingMode() == FbxGeometryElement::eByControlPoint)
+					// build the max index array that we need to pass into MakePoly
+					const int lPolySize = mesh->GetPolygonSize(lPolyIndex);
+					for (int lVertIndex = 0; lVertIndex < lPolySize; ++lVertIndex)
 					{
-						for (int lPolyIndex = 0; lPolyIndex < lPolyCount; ++lPolyIndex)
-						{
-							// build the max index array that we need to pass into MakePoly
-							const int lPolySize = mesh->GetPolygonSize(lPolyIndex);
-							for (int lVertIndex = 0; lVertIndex < lPolySize; ++lVertIndex)
-							{
-								FbxVector2 lUVValue;
+						FbxVector2 lUVValue;
 
-								//get the index of the current vertex in control points array
-								int lPolyVertIndex = mesh->GetPolygonVertex(lPolyIndex, lVertIndex);
+						//get the index of the current vertex in control points array
+						int lPolyVertIndex = mesh->GetPolygonVertex(lPolyIndex, lVertIndex);
 
-								//the UV index depends on the reference mode
-								int lUVIndex = lUseIndex ? lUVElement->GetIndexArray().GetAt(lPolyVertIndex) : lPolyVertIndex;
+						//the UV index depends on the reference mode
+						int lUVIndex = lUseIndex ? lUVElement->GetIndexArray().GetAt(lPolyVertIndex) : lPolyVertIndex;
 
-								lUVValue = lUVElement->GetDirectArray().GetAt(lUVIndex);
+						lUVValue = lUVElement->GetDirectArray().GetAt(lUVIndex);
 
-								vertexListExpanded[CurrentUV].Tex.x = lUVValue.mData[0];
-								vertexListExpanded[CurrentUV].Tex.y = lUVValue.mData[1];
+						vertexListExpanded[CurrentUV].Tex.x = lUVValue.mData[0];
+						vertexListExpanded[CurrentUV].Tex.y = lUVValue.mData[1];
 
-								CurrentUV++;
+						CurrentUV++;
 
-								//User TODO:
-								//Print out the value of UV(lUVValue) or log it to a file
-							}
-						}
+						//User TODO:
+						//Print out the value of UV(lUVValue) or log it to a file
 					}
-					else if (lUVElement->GetMappingMode() == FbxGeometryElement::eByPolygonVertex)
+				}
+			}
+			else if (lUVElement->GetMappingMode() == FbxGeometryElement::eByPolygonVertex)
+			{
+				int lPolyIndexCounter = 0;
+				for (int lPolyIndex = 0; lPolyIndex < lPolyCount; ++lPolyIndex)
+				{
+					// build the max index array that we need to pass into MakePoly
+					const int lPolySize = mesh->GetPolygonSize(lPolyIndex);
+					for (int lVertIndex = 0; lVertIndex < lPolySize; ++lVertIndex)
 					{
-						int lPolyIndexCounter = 0;
-						for (int lPolyIndex = 0; lPolyIndex < lPolyCount; ++lPolyIndex)
+						if (lPolyIndexCounter < lIndexCount)
 						{
-							// build the max index array that we need to pass into MakePoly
-							const int lPolySize = mesh->GetPolygonSize(lPolyIndex);
-							for (int lVertIndex = 0; lVertIndex < lPolySize; ++lVertIndex)
-							{
-								if (lPolyIndexCounter < lIndexCount)
-								{
-									FbxVector2 lUVValue;
+							FbxVector2 lUVValue;
 
-									//the UV index depends on the reference mode
-									int lUVIndex = lUseIndex ? lUVElement->GetIndexArray().GetAt(lPolyIndexCounter) : lPolyIndexCounter;
+							//the UV index depends on the reference mode
+							int lUVIndex = lUseIndex ? lUVElement->GetIndexArray().GetAt(lPolyIndexCounter) : lPolyIndexCounter;
 
-									lUVValue = lUVElement->GetDirectArray().GetAt(lUVIndex);
+							lUVValue = lUVElement->GetDirectArray().GetAt(lUVIndex);
 
-									//User TODO:
-									//Print out the value of UV(lUVValue) or log it to a file
-									//lUVValue.mData[]
-									//std::cout << "\n" << CurrentUV << " UV Info : X = " << lUVValue.mData[0] << " Y = " << lUVValue.mData[1] << "\n";
-									vertexListExpanded[CurrentUV].Tex.x = lUVValue.mData[0];
-									vertexListExpanded[CurrentUV].Tex.y = lUVValue.mData[1];
+							//User TODO:
+							//Print out the value of UV(lUVValue) or log it to a file
+							//lUVValue.mData[]
+							//std::cout << "\n" << CurrentUV << " UV Info : X = " << lUVValue.mData[0] << " Y = " << lUVValue.mData[1] << "\n";
+							vertexListExpanded[CurrentUV].Tex.x = lUVValue.mData[0];
+							vertexListExpanded[CurrentUV].Tex.y = lUVValue.mData[1];
 
-									CurrentUV++;
+							CurrentUV++;
 
-									lPolyIndexCounter++;
-								}
-							}
+							lPolyIndexCounter++;
 						}
 					}
 				}
+			}
+		}
 
-				// set all of the control points
-				for (int i = 0; i < numControlPoints; i++)
-				{
-					moralesMesh.vertexList[i].Joints.x = controlPointInfluences[i].infs[0].joint;
-					moralesMesh.vertexList[i].Joints.y = controlPointInfluences[i].infs[1].joint;
-					moralesMesh.vertexList[i].Joints.z = controlPointInfluences[i].infs[2].joint;
-					moralesMesh.vertexList[i].Joints.w = controlPointInfluences[i].infs[3].joint;
+		// set all of the control points. A mesh the skin doesn't reach (a prop, an unskinned part) follows the
+		// root joint, and so do control points no cluster weights. The vertex stores the strongest MAX_INFLUENCES of
+		// the control point's influences, renormalized.
+		auto skinned = meshInfluences.find(mesh);
+		for (int i = 0; i < numControlPoints; i++)
+		{
+			MoralesInfluenceSet influences = {};
+			if (skinned != meshInfluences.end() && i < static_cast<int>(skinned->second.size()))
+			{
+				influences = skinned->second[i];
+			}
 
-					moralesMesh.vertexList[i].Weights.x = controlPointInfluences[i].infs[0].weight;
-					moralesMesh.vertexList[i].Weights.y = controlPointInfluences[i].infs[1].weight;
-					moralesMesh.vertexList[i].Weights.z = controlPointInfluences[i].infs[2].weight;
-					moralesMesh.vertexList[i].Weights.w = controlPointInfluences[i].infs[3].weight;
+			controlPoints[i].Joints.x = influences.infs[0].joint;
+			controlPoints[i].Joints.y = influences.infs[1].joint;
+			controlPoints[i].Joints.z = influences.infs[2].joint;
+			controlPoints[i].Joints.w = influences.infs[3].joint;
 
-					double sum = moralesMesh.vertexList[i].Weights.x + moralesMesh.vertexList[i].Weights.y +
-						moralesMesh.vertexList[i].Weights.z + moralesMesh.vertexList[i].Weights.w;
+			controlPoints[i].Weights.x = influences.infs[0].weight;
+			controlPoints[i].Weights.y = influences.infs[1].weight;
+			controlPoints[i].Weights.z = influences.infs[2].weight;
+			controlPoints[i].Weights.w = influences.infs[3].weight;
 
-					moralesMesh.vertexList[i].Weights.x /= sum;
-					moralesMesh.vertexList[i].Weights.y /= sum;
-					moralesMesh.vertexList[i].Weights.z /= sum;
-					moralesMesh.vertexList[i].Weights.w /= sum;
-				}
-				std::cout << "Mapped control influences to vertices\n";
-				
-				// align (expand) vertex array and set the normals
-				for (int j = 0; j < numIndices; j++)
-				{
-					vertexListExpanded[j].Pos = moralesMesh.vertexList[moralesMesh.indicesList[j]].Pos;
-					vertexListExpanded[j].Normal.x = normalsVec.GetAt(j)[0];
-					vertexListExpanded[j].Normal.y = normalsVec.GetAt(j)[1];
-					vertexListExpanded[j].Normal.z = normalsVec.GetAt(j)[2];
-					vertexListExpanded[j].Normal.w = normalsVec.GetAt(j)[3];
-					vertexListExpanded[j].Joints = moralesMesh.vertexList[moralesMesh.indicesList[j]].Joints;
-					vertexListExpanded[j].Weights = moralesMesh.vertexList[moralesMesh.indicesList[j]].Weights;
-				}
+			double sum = controlPoints[i].Weights.x + controlPoints[i].Weights.y +
+				controlPoints[i].Weights.z + controlPoints[i].Weights.w;
 
-				// make new indices to match the new vertex(2) array
-				std::vector<int> indicesList;
-				indicesList.resize(numIndices);
-				for (int j = 0; j < numIndices; j++)
-				{
-					indicesList[j] = j;
-					//std::cout << "\n" << indicesList[j];
-				}
+			if (sum <= 0.0)
+			{
+				controlPoints[i].Weights = { 1.0, 0.0, 0.0, 0.0 };
+				continue;
+			}
 
-				if (vertexListExpanded.size() > moralesMesh.vertexList.size())
-				{
-					// compactify
-					int expandedSize = vertexListExpanded.size();
-					std::vector<MoralesVertex> compactedVertexList;
-					std::vector<int> compactedIndexList;
-					compactedIndexList.resize(numIndices);
-					bool thereIsACopy = false;
-					for (int j = 0; j < expandedSize; j++)
-					{
-						thereIsACopy = false;
-						int foundAt = 0;
-						for (int k = 0; k < compactedVertexList.size(); k++)
-						{
-							// if the two verts are pretty close to being equal
-							if ((AreEqual(vertexListExpanded[j].Normal.x, compactedVertexList[k].Normal.x)) &&
-								(AreEqual(vertexListExpanded[j].Normal.y, compactedVertexList[k].Normal.y)) &&
-								(AreEqual(vertexListExpanded[j].Normal.z, compactedVertexList[k].Normal.z)) &&
-								(AreEqual(vertexListExpanded[j].Normal.w, compactedVertexList[k].Normal.w)) &&
-								(AreEqual(vertexListExpanded[j].Pos.x, compactedVertexList[k].Pos.x)) &&
-								(AreEqual(vertexListExpanded[j].Pos.y, compactedVertexList[k].Pos.y)) &&
-								(AreEqual(vertexListExpanded[j].Pos.z, compactedVertexList[k].Pos.z)) &&
-								(AreEqual(vertexListExpanded[j].Pos.w, compactedVertexList[k].Pos.w)))
-							{
-								compactedIndexList[j] = k;
-								thereIsACopy = true;
-								break;
-							}
-						}
-						if (!thereIsACopy)
-						{
-							compactedVertexList.push_back(vertexListExpanded[j]);
-							compactedIndexList[j] = compactedVertexList.size() - 1;
-						}
-					}
+			controlPoints[i].Weights.x /= sum;
+			controlPoints[i].Weights.y /= sum;
+			controlPoints[i].Weights.z /= sum;
+			controlPoints[i].Weights.w /= sum;
+		}
+		std::cout << "Mapped control influences to vertices\n";
+		
+		// align (expand) vertex array and set the normals, turned with the mesh (normals ignore its translation)
+		for (int j = 0; j < numIndices; j++)
+		{
+			FbxVector4 normal = meshToScene.MultR(normalsVec.GetAt(j));
+			vertexListExpanded[j].Pos = controlPoints[polygonVertices[j]].Pos;
+			vertexListExpanded[j].Normal.x = normal[0];
+			vertexListExpanded[j].Normal.y = normal[1];
+			vertexListExpanded[j].Normal.z = normal[2];
+			vertexListExpanded[j].Normal.w = normalsVec.GetAt(j)[3];
+			vertexListExpanded[j].Joints = controlPoints[polygonVertices[j]].Joints;
+			vertexListExpanded[j].Weights = controlPoints[polygonVertices[j]].Weights;
+		}
+
+		// Which material each polygon uses: one for the whole mesh, or one per polygon, either way an index
+		// into the node's materials, which ProcessFbxMaterials() mapped to moralesMesh.materialList.
+		const FbxGeometryElementMaterial* materialElement = mesh->GetElementMaterial();
+		auto PolygonMaterial = [&](int polygon)
+		{
+			int nodeMaterial = 0;
+			if (materialElement != NULL && materialElement->GetIndexArray().GetCount() > 0)
+			{
+				const bool allSame = materialElement->GetMappingMode() == FbxGeometryElement::eAllSame;
+				nodeMaterial = materialElement->GetIndexArray().GetAt(allSame ? 0 : polygon);
+			}
+			if (nodeMaterial < 0 || nodeMaterial >= node->GetMaterialCount())
+			{
+				return -1;
+			}
+			return MaterialIndex(node->GetMaterial(nodeMaterial));
+		};
 
+		// make new indices to match the new vertex(2) array, a triangle list over each polygon's corners.
+		// Every corner keeps its own expanded vertex, so UV and normal seams survive until compaction
+		// welds the corners that really are the same.
+		std::vector<int> indicesList;
+		indicesList.reserve(numIndices);
+		std::vector<XMFLOAT4> corners;
+		std::vector<int> cornerTriangles;
+		int quadCount = 0;
+		int ngonCount = 0;
+		const int polygonCount = mesh->GetPolygonCount();
+		for (int p = 0; p < polygonCount; p++)
+		{
+			const int firstCorner = mesh->GetPolygonVertexIndex(p);
+			const int cornerCount = mesh->GetPolygonSize(p);
+			corners.resize(cornerCount);
+			for (int k = 0; k < cornerCount; k++)
+			{
+				corners[k] = vertexListExpanded[firstCorner + k].Pos;
+			}
 
+			cornerTriangles.clear();
+			TriangulatePolygon(corners, cornerTriangles);
+			for (int corner : cornerTriangles)
+			{
+				indicesList.push_back(firstCorner + corner);
+			}
+			triangleMaterials.insert(triangleMaterials.end(), cornerTriangles.size() / 3, PolygonMaterial(p));
 
-					// copy working data to the global SimpleMesh
-					moralesMesh.indicesList.assign(compactedIndexList.begin(), compactedIndexList.end());
-					moralesMesh.vertexList.assign(compactedVertexList.begin(), compactedVertexList.end());
+			quadCount += cornerCount == 4 ? 1 : 0;
+			ngonCount += cornerCount > 4 ? 1 : 0;
+		}
+		std::cout << "\nTriangulated " << polygonCount << " polygons (" << quadCount << " quads, " << ngonCount << " n-gons) into " << indicesList.size() / 3 << " triangles";
 
-					// print out some stats
-					std::cout << "\nindex count BEFORE/AFTER compaction " << numIndices;
-					std::cout << "\nvertex count ORIGINAL (FBX source): " << numVertices;
-					std::cout << "\nvertex count AFTER expansion: " << numIndices;
-					std::cout << "\nvertex count AFTER compaction: " << moralesMesh.vertexList.size();
-					std::cout << "\nSize reduction: " << ((numVertices - moralesMesh.vertexList.size()) / (float)numVertices) * 100.00f << "%";
-					std::cout << "\nor " << (moralesMesh.vertexList.size() / (float)numVertices) << " of the expanded size\n\n";
-				}
-				else
-				{
-					// copy working data to the global SimpleMesh
-					moralesMesh.indicesList.assign(indicesList.begin(), indicesList.end());
-					moralesMesh.vertexList.assign(vertexListExpanded.begin(), vertexListExpanded.end());
-				}
+		if (vertexListExpanded.size() > controlPoints.size())
+		{
+			// weld the corners that really are the same vertex
+			std::vector<MoralesVertex> compactedVertexList;
+			std::vector<int> compactedIndexList;
+			WeldVertices(vertexListExpanded, compactedVertexList, compactedIndexList);
+
+			// print out some stats
+			std::cout << "\nindex count BEFORE/AFTER compaction " << indicesList.size();
+			std::cout << "\nvertex count ORIGINAL (FBX source): " << numVertices;
+			std::cout << "\nvertex count AFTER expansion: " << numIndices;
+			std::cout << "\nvertex count AFTER compaction: " << compactedVertexList.size();
+			std::cout << "\nSize reduction: " << ((numVertices - compactedVertexList.size()) / (float)numVertices) * 100.00f << "%";
+			std::cout << "\nor " << (compactedVertexList.size() / (float)numVertices) << " of the expanded size\n\n";
+
+			// the triangles now point at the compacted vertices
+			for (int& index : indicesList)
+			{
+				index = compactedIndexList[index];
+			}
+			vertexListExpanded.swap(compactedVertexList);
+		}
 
-				// Print out the mesh's texture file
-				int materialCount = childNode->GetSrcObjectCount<FbxSurfaceMaterial>();
+		// append working data to the global MoralesMesh, after the vertices of the meshes before this one
+		const int baseVertex = static_cast<int>(moralesMesh.vertexList.size());
+		for (int index : indicesList)
+		{
+			moralesMesh.indicesList.push_back(baseVertex + index);
+		}
+		moralesMesh.vertexList.insert(moralesMesh.vertexList.end(), vertexListExpanded.begin(), vertexListExpanded.end());
+	}
 
-				for (int index = 0; index < materialCount; index++)
-				{
-					FbxSurfaceMaterial* material = (FbxSurfaceMaterial*)childNode->GetSrcObject<FbxSurfaceMaterial>(index);
-					
-					if (material != NULL)
-					{
-						//std::cout << "\n OLD********* -- material: " << material->GetName() << std::endl;
-						// This only gets the material of type sDiffuse, you probably need to traverse all Standard Material Property by its name to get all possible textures.
-						FbxProperty prop = material->FindProperty(FbxSurfaceMaterial::sDiffuse);
+	// Splits one polygon into triangles, appending corner numbers (0 to corners.size() - 1) in the polygon's
+	// own winding. Ear clipping in the plane of the polygon's Newell normal, so concave and slightly non-planar
+	// n-gons come out right; whatever is left of a polygon it can't clip (self-intersecting, degenerate) is
+	// fanned. Fewer than three corners make no triangles.
+	void TriangulatePolygon(const std::vector<XMFLOAT4>& corners, std::vector<int>& triangles)
+	{
+		const int count = static_cast<int>(corners.size());
+		if (count < 3)
+		{
+			return;
+		}
+		if (count == 3)
+		{
+			triangles.insert(triangles.end(), { 0, 1, 2 });
+			return;
+		}
 
-						// Check if it's layeredtextures
-						int layeredTextureCount = prop.GetSrcObjectCount<FbxLayeredTexture>();
+		// Newell's method: a normal that's robust for concave polygons, pointing the way the winding faces.
+		float normal[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < count; i++)
+		{
+			const XMFLOAT4& a = corners[i];
+			const XMFLOAT4& b = corners[(i + 1) % count];
+			normal[0] += (a.y - b.y) * (a.z + b.z);
+			normal[1] += (a.z - b.z) * (a.x + b.x);
+			normal[2] += (a.x - b.x) * (a.y + b.y);
+		}
 
-						if (layeredTextureCount > 0)
-						{
-							for (int j = 0; j < layeredTextureCount; j++)
-							{
-								FbxLayeredTexture* layered_texture = FbxCast<FbxLayeredTexture>(prop.GetSrcObject<FbxLayeredTexture>(j));
-								int lcount = layered_texture->GetSrcObjectCount<FbxTexture>();
+		// Drop the normal's largest axis; flipping the other two when it points down keeps the winding counter clockwise.
+		int axis = 0;
+		if (fabsf(normal[1]) > fabsf(normal[axis])) axis = 1;
+		if (fabsf(normal[2]) > fabsf(normal[axis])) axis = 2;
+		const int uAxis = (axis + 1) % 3;
+		const int vAxis = (axis + 2) % 3;
+		const float flip = normal[axis] < 0.0f ? -1.0f : 1.0f;
 
-								for (int k = 0; k < lcount; k++)
-								{
-									FbxFileTexture* texture = FbxCast<FbxFileTexture>(layered_texture->GetSrcObject<FbxTexture>(k));
-									// Then, you can get all the properties of the texture, include its name
-									const char* textureName = texture->GetFileName();
-									//std::cout << " OLD********* -- " << textureName;
-								}
-							}
-						}
-						else
-						{
-							// Directly get textures
-							int textureCount = prop.GetSrcObjectCount<FbxTexture>();
-							for (int j = 0; j < textureCount; j++)
-							{
-								FbxFileTexture* texture = FbxCast<FbxFileTexture>(prop.GetSrcObject<FbxTexture>(j));
-								// Then, you can get all the properties of the texture, include its name
-								const char* textureName = texture->GetFileName();
-								//std::cout << " OLD********* -- " << textureName;
+		std::vector<XMFLOAT2> points(count);
+		for (int i = 0; i < count; i++)
+		{
+			const float position[3] = { corners[i].x, corners[i].y, corners[i].z };
+			points[i] = XMFLOAT2(position[uAxis], position[vAxis] * flip);
+		}
 
-								FbxProperty p = texture->RootProperty.Find("Filename");
-								//std::cout << " OLD********* -- " << p.Get<FbxString>() << std::endl;
+		const auto cross = [&points](int a, int b, int c)
+		{
+			return (points[b].x - points[a].x) * (points[c].y - points[a].y) - (points[b].y - points[a].y) * (points[c].x - points[a].x);
+		};
 
-							}
-						}
+		std::vector<int> remaining(count);
+		for (int i = 0; i < count; i++)
+		{
+			remaining[i] = i;
+		}
+
+		while (remaining.size() > 3)
+		{
+			const int size = static_cast<int>(remaining.size());
+			int ear = -1;
+			for (int i = 0; i < size && ear < 0; i++)
+			{
+				const int previous = remaining[(i + size - 1) % size];
+				const int current = remaining[i];
+				const int next = remaining[(i + 1) % size];
+
+				// Reflex or flat corners aren't ears.
+				if (cross(previous, current, next) <= 0.0f)
+				{
+					continue;
+				}
+
+				// Nor is a corner whose triangle has another corner in it, or on its edges. Corners sitting on one
+				// of its corners, as the two ends of a bridge into a hole do, don't count.
+				bool empty = true;
+				for (int other : remaining)
+				{
+					if (other == previous || other == current || other == next)
+					{
+						continue;
+					}
+					const bool shared = (points[other].x == points[previous].x && points[other].y == points[previous].y) ||
+						(points[other].x == points[current].x && points[other].y == points[current].y) ||
+						(points[other].x == points[next].x && points[other].y == points[next].y);
+					if (!shared && cross(previous, current, other) >= 0.0f && cross(current, next, other) >= 0.0f && cross(next, previous, other) >= 0.0f)
+					{
+						empty = false;
+						break;
 					}
 				}
+				if (empty)
+				{
+					ear = i;
+				}
+			}
 
+			if (ear < 0)
+			{
+				break;
 			}
+
+			triangles.insert(triangles.end(), { remaining[(ear + size - 1) % size], remaining[ear], remaining[(ear + 1) % size] });
+			remaining.erase(remaining.begin() + ear);
+		}
+
+		for (size_t i = 1; i + 1 < remaining.size(); i++)
+		{
+			triangles.insert(triangles.end(), { remaining[0], remaining[i], remaining[i + 1] });
 		}
 	}
 
@@ -586,146 +846,1772 @@ namespace MFBXExporter
 			}
 			
 			moralesMesh.materialList.push_back(material);
+			materialSources.push_back(mat);
 		}
 	}
 
+	// Where ProcessFbxMaterials() put material in moralesMesh.materialList, -1 if it skipped it.
+	int MaterialIndex(const FbxSurfaceMaterial* material)
+	{
+		auto found = std::find(materialSources.begin(), materialSources.end(), material);
+		return found != materialSources.end() ? static_cast<int>(found - materialSources.begin()) : -1;
+	}
+
 
-	void ProcessFbxAnimation(FbxScene* Scene)
+	// Copies every texture the mesh uses into a store next to the exported file, named by a hash of its bytes,
+	// and points materialPaths at the copies. Meshes exported to the same folder that use the same image (the
+	// .fbm folders hold one copy per FBX) then share one file, and the viewer keeps one copy of it in memory.
+	void StoreMaterialTextures(const std::string& sourceFileName, MoralesMesh& mesh)
 	{
-		std::vector<MoralesFbxJoint> joints;
-		FbxPose* bindPose = nullptr;
-		// Find the first FbxPose that is a bind pose, assume that the first pose is the only pose of interest.
-		int poseCount = Scene->GetPoseCount();
-		for (int i = 0; i < poseCount; i++)
+		const size_t separator = sourceFileName.find_last_of("\\/");
+		const std::string folder = separator == std::string::npos ? "" : sourceFileName.substr(0, separator + 1);
+		const std::string store = "Textures";
+
+		// Fails harmlessly if an earlier export already made it.
+		CreateDirectoryA((folder + store).c_str(), NULL);
+
+		for (std::string& path : mesh.materialPaths)
 		{
-			FbxPose* pose = Scene->GetPose(i);
+			// The FBX stores texture paths relative to itself, unless they're on another drive.
+			const std::string sourcePath = path.find(':') != std::string::npos ? path : folder + path;
+			std::ifstream source(sourcePath, std::ios_base::in | std::ios_base::binary);
+			if (!source.is_open())
+			{
+				std::cout << "Could not read " << sourcePath << ", keeping its path as is\n";
+				continue;
+			}
+			const std::vector<char> bytes((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
 
-			if (pose->IsBindPose())
+			const size_t dot = path.find_last_of('.');
+			const size_t name = path.find_last_of("\\/");
+			const std::string extension = dot != std::string::npos && (name == std::string::npos || dot > name) ? path.substr(dot) : "";
+			const std::string storedPath = store + "\\" + ContentHashName(ContentHash(bytes.data(), bytes.size())) + extension;
+
+			// Same name, same bytes: anything already there is this texture.
+			std::ifstream existing(folder + storedPath, std::ios_base::in | std::ios_base::binary);
+			if (existing.is_open())
 			{
-				bindPose = pose;
-				// from the bind pose, find the root of the skeleton
-				int nodeCount = pose->GetCount();
-				for (int j = 0; j < nodeCount; j++)
+				std::cout << "Texture " << path << " already stored as " << storedPath << '\n';
+			}
+			else
+			{
+				std::ofstream stored(folder + storedPath, std::ios_base::out | std::ios_base::binary);
+				stored.write(bytes.data(), bytes.size());
+				if (!stored)
 				{
-					FbxNode* node = pose->GetNode(j);
-					FbxSkeleton* skeleton = node->GetSkeleton();
-					if (skeleton != NULL && skeleton->IsSkeletonRoot())
-					{
-						// Starting with the skeleton root, build a dynamic array of FbxNode* paired with parent indices
-						joints.push_back({ node, -1 });
-						break;
-					}
+					std::cout << "Could not write " << folder + storedPath << ", keeping " << path << '\n';
+					continue;
 				}
+				std::cout << "Texture " << path << " stored as " << storedPath << '\n';
 			}
+
+			path = storedPath;
 		}
+	}
 
-		// build the dynarray
-		for (int i = 0; i < joints.size(); ++i)
+	// 64 bit FNV-1a, the same hash the viewer reads back from store file names.
+	uint64_t ContentHash(const char* data, size_t size)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++)
 		{
-			FbxNode* currentNode = joints[i].node;
-			int childCount = currentNode->GetChildCount();
+			hash ^= static_cast<uint8_t>(data[i]);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
 
-			for (int j = 0; j < childCount; j++)
+	std::string ContentHashName(uint64_t hash)
+	{
+		std::ostringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << hash;
+		return name.str();
+	}
+
+	// Post-transform vertex cache the stats are measured against: a FIFO, like most hardware's.
+	constexpr int VERTEX_CACHE_SIZE = 16;
+	// Cache the triangle reordering scores against, an LRU as in Forsyth's paper.
+	constexpr int FORSYTH_CACHE_SIZE = 32;
+	// How much worse than its cluster's ACMR a split for overdraw ordering may make things.
+	constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+	// Vertex cache simulation. A vertex is in the cache if fewer than VERTEX_CACHE_SIZE misses happened
+	// since it was loaded, so both an access and a reset are constant time.
+	struct VertexCache
+	{
+		std::vector<unsigned> loadedAt;
+		unsigned time = VERTEX_CACHE_SIZE + 1;
+
+		explicit VertexCache(size_t vertexCount) : loadedAt(vertexCount, 0) {}
+
+		// 1 for a miss.
+		int Access(int vertex)
+		{
+			if (time - loadedAt[vertex] > VERTEX_CACHE_SIZE)
 			{
-				FbxNode* childNode = currentNode->GetChild(j);
-				if (childNode->GetNodeAttribute() && childNode->GetNodeAttribute()->GetAttributeType() && childNode->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eSkeleton)
-				{
-					joints.push_back({ childNode, i});
-				}
+				loadedAt[vertex] = time++;
+				return 1;
 			}
+			return 0;
 		}
 
+		void Reset() { time += VERTEX_CACHE_SIZE + 1; }
+	};
 
+	// Groups the triangles by material, keeping their order within each, and records a submesh per material so
+	// the viewer draws the whole scene with one vertex and index buffer and one draw per material.
+	void BuildSubmeshes(MoralesMesh& mesh, const std::vector<int>& materials)
+	{
+		const size_t triangleCount = mesh.indicesList.size() / 3;
+		auto MaterialOf = [&](size_t triangle) { return triangle < materials.size() ? materials[triangle] : -1; };
 
-		// Now we have an array of FbxNode* with their parents. Evaluate the global transforms
-		for (size_t i = 0; i < joints.size(); i++)
+		std::vector<size_t> order(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
 		{
-			MoralesJoint mjoint;
-			mjoint.parentIndex = joints[i].parentIndex;
-			FbxAMatrix mat = joints[i].node->EvaluateGlobalTransform();
-			mjoint.globalTransform[0] = mat.mData[0][0];
-			mjoint.globalTransform[1] = mat.mData[0][1];
-			mjoint.globalTransform[2] = mat.mData[0][2];
-			mjoint.globalTransform[3] = mat.mData[0][3];
+			order[t] = t;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return MaterialOf(a) < MaterialOf(b); });
 
-			mjoint.globalTransform[4] = mat.mData[1][0];
-			mjoint.globalTransform[5] = mat.mData[1][1];
-			mjoint.globalTransform[6] = mat.mData[1][2];
-			mjoint.globalTransform[7] = mat.mData[1][3];
-		
-			mjoint.globalTransform[8]  = mat.mData[2][0];
-			mjoint.globalTransform[9]  = mat.mData[2][1];
-			mjoint.globalTransform[10] = mat.mData[2][2];
-			mjoint.globalTransform[11] = mat.mData[2][3];
+		std::vector<int> sorted;
+		sorted.reserve(mesh.indicesList.size());
+		mesh.submeshes.clear();
+		for (size_t t : order)
+		{
+			const int material = MaterialOf(t);
+			if (mesh.submeshes.empty() || mesh.submeshes.back().material != material)
+			{
+				mesh.submeshes.push_back({ static_cast<uint32_t>(sorted.size()), 0, material });
+			}
+			sorted.insert(sorted.end(), mesh.indicesList.begin() + t * 3, mesh.indicesList.begin() + t * 3 + 3);
+			mesh.submeshes.back().indexCount += 3;
+		}
+		// A trailing partial triangle, if any, stays where it was and in no submesh
+		sorted.insert(sorted.end(), mesh.indicesList.begin() + triangleCount * 3, mesh.indicesList.end());
+		mesh.indicesList.swap(sorted);
+
+		std::cout << "\n" << mesh.submeshes.size() << " submeshes:";
+		for (const MoralesSubmesh& submesh : mesh.submeshes)
+		{
+			std::cout << "\n\tmaterial " << submesh.material << ": " << submesh.indexCount / 3 << " triangles";
+		}
+		std::cout << "\n";
+	}
+
+	// Reorders the welded triangle list for the vertex shader, which the 4 matrix skinning makes the
+	// expensive part of drawing a crowd: triangles for the post-transform cache, clusters of them so the
+	// outside of the mesh tends to draw first, then vertices in the order the triangles first use them.
+	// Prints the average cache miss ratio (misses per triangle, 0.5 is the best a regular mesh gets) and
+	// the average transform to vertex ratio (misses per vertex, 1.0 is ideal) before and after. Triangles
+	// only move within their submesh, so each material's range stays where it was.
+	void OptimizeMesh(MoralesMesh& mesh)
+	{
+		std::vector<int>& indices = mesh.indicesList;
+		if (indices.empty() || indices.size() % 3 != 0)
+		{
+			std::cout << "Skipping mesh optimization, the index list isn't a list of triangles\n";
+			return;
+		}
+
+		const float triangleCount = indices.size() / 3.0f;
+		const int missesBefore = CountCacheMisses(indices, mesh.vertexList.size());
+		const size_t verticesBefore = mesh.vertexList.size();
+
+		std::vector<int> range;
+		for (const MoralesSubmesh& submesh : mesh.submeshes)
+		{
+			range.assign(indices.begin() + submesh.indexStart, indices.begin() + submesh.indexStart + submesh.indexCount);
+			ReorderForVertexCache(range, mesh.vertexList.size());
+			ReorderForOverdraw(range, mesh.vertexList, OVERDRAW_THRESHOLD);
+			std::copy(range.begin(), range.end(), indices.begin() + submesh.indexStart);
+		}
+		ReorderForVertexFetch(indices, mesh.vertexList);
+
+		const int missesAfter = CountCacheMisses(indices, mesh.vertexList.size());
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "\nVertex cache (" << VERTEX_CACHE_SIZE << " entry FIFO)";
+		std::cout << "\nACMR BEFORE/AFTER optimization: " << missesBefore / triangleCount << " / " << missesAfter / triangleCount;
+		std::cout << "\nATVR BEFORE/AFTER optimization: " << missesBefore / float(verticesBefore) << " / " << missesAfter / float(mesh.vertexList.size());
+		if (mesh.vertexList.size() != verticesBefore)
+		{
+			std::cout << "\nDropped " << verticesBefore - mesh.vertexList.size() << " vertices no triangle uses";
+		}
+		std::cout << "\n\n";
+		std::cout.unsetf(std::ios_base::floatfield);
+		std::cout << std::setprecision(6);
+	}
+
+	int CountCacheMisses(const std::vector<int>& indices, size_t vertexCount)
+	{
+		VertexCache cache(vertexCount);
+		int misses = 0;
+		for (int index : indices)
+		{
+			misses += cache.Access(index);
+		}
+		return misses;
+	}
+
+	float ForsythVertexScore(int cachePosition, int remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// The last triangle's vertices score the same, whichever order it used them in.
+			score = cachePosition < 3 ? 0.75f : powf(1.0f - (cachePosition - 3) / float(FORSYTH_CACHE_SIZE - 3), 1.5f);
+		}
+
+		// Vertices with few triangles left are worth finishing off, rather than leaving lone triangles behind.
+		return score + 2.0f * powf(float(remainingTriangles), -0.5f);
+	}
+
+	// Tom Forsyth's linear-speed vertex cache optimisation: greedily emits the triangle whose vertices score
+	// highest, by how recently they entered a simulated LRU cache and how few triangles they have left.
+	void ReorderForVertexCache(std::vector<int>& indices, size_t vertexCount)
+	{
+		const size_t triangleCount = indices.size() / 3;
+
+		// Each vertex's triangles, packed by vertex; the first remaining[v] of its range haven't been emitted.
+		std::vector<int> remaining(vertexCount, 0);
+		for (int index : indices)
+		{
+			remaining[index]++;
+		}
+		std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+		}
+		std::vector<int> adjacency(indices.size());
+		std::vector<size_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[filled[indices[i]]++] = static_cast<int>(i / 3);
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+		}
+		std::vector<float> triangleScore(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+		}
+		std::vector<bool> emitted(triangleCount, false);
+
+		std::vector<int> cache;
+		std::vector<int> nextCache;
+		std::vector<int> result;
+		result.reserve(indices.size());
+		size_t cursor = 0;
+		int best = -1;
+		while (result.size() < indices.size())
+		{
+			if (best < 0)
+			{
+				// Nothing in the cache has a triangle left: carry on with the next one in the original order.
+				while (emitted[cursor])
+				{
+					cursor++;
+				}
+				best = static_cast<int>(cursor);
+			}
+
+			emitted[best] = true;
+			const int* triangle = &indices[3 * best];
+			result.insert(result.end(), triangle, triangle + 3);
+
+			for (int k = 0; k < 3; k++)
+			{
+				int* begin = &adjacency[firstTriangle[triangle[k]]];
+				int* end = begin + remaining[triangle[k]];
+				std::swap(*std::find(begin, end, best), *(end - 1));
+				remaining[triangle[k]]--;
+			}
+
+			// The triangle's vertices go to the front of the cache, the rest shift back and the last few drop out.
+			nextCache.clear();
+			for (int k = 0; k < 3; k++)
+			{
+				if (std::find(nextCache.begin(), nextCache.end(), triangle[k]) == nextCache.end())
+				{
+					nextCache.push_back(triangle[k]);
+				}
+			}
+			for (int v : cache)
+			{
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				{
+					nextCache.push_back(v);
+				}
+			}
+
+			for (size_t i = 0; i < nextCache.size(); i++)
+			{
+				const int v = nextCache[i];
+				cachePosition[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+
+				const float score = ForsythVertexScore(cachePosition[v], remaining[v]);
+				const float change = score - vertexScore[v];
+				vertexScore[v] = score;
+				for (int j = 0; j < remaining[v]; j++)
+				{
+					triangleScore[adjacency[firstTriangle[v] + j]] += change;
+				}
+			}
+			if (nextCache.size() > FORSYTH_CACHE_SIZE)
+			{
+				nextCache.resize(FORSYTH_CACHE_SIZE);
+			}
+			cache.swap(nextCache);
+
+			// Only triangles touching the cache changed score, the best one is among them.
+			best = -1;
+			float bestScore = -1.0f;
+			for (int v : cache)
+			{
+				for (int j = 0; j < remaining[v]; j++)
+				{
+					const int t = adjacency[firstTriangle[v] + j];
+					if (triangleScore[t] > bestScore)
+					{
+						best = t;
+						bestScore = triangleScore[t];
+					}
+				}
+			}
+		}
+
+		indices.swap(result);
+	}
+
+	// Overdraw ordering after Sander, Nehab and Barczak's "Fast Triangle Reordering for Vertex Locality and
+	// Reduced Overdraw": cuts the cache ordered list into clusters where the cache starts over anyway, or where
+	// a cut costs less than threshold times the cluster's ACMR, then draws the clusters that face away from the
+	// middle of the mesh first. Those are on its outside, and occlude more than they get occluded.
+	void ReorderForOverdraw(std::vector<int>& indices, const std::vector<MoralesVertex>& vertices, float threshold)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		VertexCache cache(vertices.size());
+
+		// Hard boundaries: the triangles that miss on all three vertices, where the order already starts over.
+		std::vector<size_t> hard;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const int misses = cache.Access(indices[3 * t]) + cache.Access(indices[3 * t + 1]) + cache.Access(indices[3 * t + 2]);
+			if (t == 0 || misses == 3)
+			{
+				hard.push_back(t);
+			}
+		}
+		hard.push_back(triangleCount);
+
+		// Soft boundaries: inside each of those, cut as soon as the misses so far are within the threshold of
+		// the whole cluster's ratio; starting the cache over there costs little.
+		std::vector<size_t> clusters;
+		for (size_t h = 0; h + 1 < hard.size(); h++)
+		{
+			const size_t start = hard[h];
+			const size_t end = hard[h + 1];
+
+			cache.Reset();
+			int clusterMisses = 0;
+			for (size_t i = 3 * start; i < 3 * end; i++)
+			{
+				clusterMisses += cache.Access(indices[i]);
+			}
+			const float limit = threshold * clusterMisses / float(end - start);
+
+			cache.Reset();
+			clusters.push_back(start);
+			size_t runStart = start;
+			int runMisses = 0;
+			for (size_t t = start; t + 1 < end; t++)
+			{
+				runMisses += cache.Access(indices[3 * t]) + cache.Access(indices[3 * t + 1]) + cache.Access(indices[3 * t + 2]);
+				if (runMisses / float(t + 1 - runStart) <= limit)
+				{
+					clusters.push_back(t + 1);
+					cache.Reset();
+					runStart = t + 1;
+					runMisses = 0;
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+
+		// Sort key per cluster: how far its area weighted centroid lies out from the mesh's, along its normal.
+		float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+		for (const MoralesVertex& vertex : vertices)
+		{
+			meshCentroid[0] += vertex.Pos.x / vertices.size();
+			meshCentroid[1] += vertex.Pos.y / vertices.size();
+			meshCentroid[2] += vertex.Pos.z / vertices.size();
+		}
+
+		std::vector<std::pair<float, size_t>> order;
+		for (size_t c = 0; c + 1 < clusters.size(); c++)
+		{
+			float centroid[3] = { 0.0f, 0.0f, 0.0f };
+			float normal[3] = { 0.0f, 0.0f, 0.0f };
+			float area = 0.0f;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+			{
+				const XMFLOAT4& a = vertices[indices[3 * t]].Pos;
+				const XMFLOAT4& b = vertices[indices[3 * t + 1]].Pos;
+				const XMFLOAT4& d = vertices[indices[3 * t + 2]].Pos;
+
+				const float e1[3] = { b.x - a.x, b.y - a.y, b.z - a.z };
+				const float e2[3] = { d.x - a.x, d.y - a.y, d.z - a.z };
+				const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				const float twiceArea = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+				centroid[0] += (a.x + b.x + d.x) / 3.0f * twiceArea;
+				centroid[1] += (a.y + b.y + d.y) / 3.0f * twiceArea;
+				centroid[2] += (a.z + b.z + d.z) / 3.0f * twiceArea;
+				normal[0] += n[0];
+				normal[1] += n[1];
+				normal[2] += n[2];
+				area += twiceArea;
+			}
+
+			const float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			float key = 0.0f;
+			if (area > 0.0f && normalLength > 0.0f)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					key += (centroid[k] / area - meshCentroid[k]) * normal[k] / normalLength;
+				}
+			}
+			order.push_back({ -key, c });
+		}
+		std::stable_sort(order.begin(), order.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first < b.first; });
+
+		std::vector<int> result;
+		result.reserve(indices.size());
+		for (const std::pair<float, size_t>& cluster : order)
+		{
+			result.insert(result.end(), indices.begin() + 3 * clusters[cluster.second], indices.begin() + 3 * clusters[cluster.second + 1]);
+		}
+		indices.swap(result);
+
+		std::cout << "Overdraw ordering: " << order.size() << " clusters, " << hard.size() - 1 << " of them where the cache starts over\n";
+	}
+
+	// Renumbers vertices in the order the triangles first use them, so vertex fetch walks memory forwards.
+	// Vertices no triangle uses are dropped.
+	void ReorderForVertexFetch(std::vector<int>& indices, std::vector<MoralesVertex>& vertices)
+	{
+		std::vector<int> remap(vertices.size(), -1);
+		std::vector<MoralesVertex> ordered;
+		ordered.reserve(vertices.size());
+		for (int& index : indices)
+		{
+			if (remap[index] < 0)
+			{
+				remap[index] = static_cast<int>(ordered.size());
+				ordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(ordered);
+	}
+
+	// Each level aims for this fraction of the triangles of the one before it.
+	constexpr float LOD_TRIANGLE_RATIO = 0.5f;
+	// A level that can't get below this fraction of the one before isn't worth its memory, the chain stops.
+	constexpr float LOD_MIN_REDUCTION = 0.85f;
+	// Largest surface deviation a single level may add, relative to the mesh's bounding radius.
+	constexpr float LOD_MAX_ERROR = 0.05f;
+	// A level is switched to once its error projects to less than this many pixels of a screen this tall.
+	constexpr float LOD_PIXEL_ERROR = 1.0f;
+	constexpr float LOD_REFERENCE_HEIGHT = 1080.0f;
+
+	// Error quadric of a set of planes, weighted by the area of the triangles they came from: the weighted sum
+	// of squared distances from a point to every plane. Symmetric, so ten terms.
+	struct Quadric
+	{
+		double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+		double weight = 0;
+
+		void AddPlane(double a, double b, double c, double d, double w)
+		{
+			a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+			b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+			c2 += w * c * c; cd += w * c * d;
+			d2 += w * d * d;
+			weight += w;
+		}
+
+		Quadric& operator+=(const Quadric& q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			weight += q.weight;
+			return *this;
+		}
+
+		// Mean squared distance of p from the planes.
+		double Error(const XMFLOAT4& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			const double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				+ c2 * z * z + 2 * cd * z + d2;
+			return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+		}
+	};
+
+	// Blends the skin influences of a collapsed vertex into the one it collapsed onto, each side weighted by
+	// the surface area it stood for, and keeps the MAX_INFLUENCES strongest joints.
+	void MergeInfluences(MoralesVertex& into, const MoralesVertex& from, double intoShare, double fromShare)
+	{
+		const int intoJoints[MAX_INFLUENCES] = { into.Joints.x, into.Joints.y, into.Joints.z, into.Joints.w };
+		const double intoWeights[MAX_INFLUENCES] = { into.Weights.x, into.Weights.y, into.Weights.z, into.Weights.w };
+		const int fromJoints[MAX_INFLUENCES] = { from.Joints.x, from.Joints.y, from.Joints.z, from.Joints.w };
+		const double fromWeights[MAX_INFLUENCES] = { from.Weights.x, from.Weights.y, from.Weights.z, from.Weights.w };
+
+		const double total = intoShare + fromShare;
+		if (total <= 0.0)
+		{
+			return;
+		}
+
+		std::pair<double, int> merged[MAX_INFLUENCES * 2];
+		int count = 0;
+		auto Add = [&](int joint, double weight)
+		{
+			if (weight <= 0.0)
+			{
+				return;
+			}
+			for (int i = 0; i < count; i++)
+			{
+				if (merged[i].second == joint)
+				{
+					merged[i].first += weight;
+					return;
+				}
+			}
+			merged[count++] = { weight, joint };
+		};
+		for (int i = 0; i < MAX_INFLUENCES; i++)
+		{
+			Add(intoJoints[i], intoWeights[i] * intoShare / total);
+			Add(fromJoints[i], fromWeights[i] * fromShare / total);
+		}
+		std::sort(merged, merged + count, [](const std::pair<double, int>& a, const std::pair<double, int>& b) { return a.first > b.first; });
+
+		count = std::min(count, MAX_INFLUENCES);
+		double sum = 0.0;
+		for (int i = 0; i < count; i++)
+		{
+			sum += merged[i].first;
+		}
+		if (sum <= 0.0)
+		{
+			return;
+		}
+
+		int joints[MAX_INFLUENCES] = { 0, 0, 0, 0 };
+		double weights[MAX_INFLUENCES] = { 0.0, 0.0, 0.0, 0.0 };
+		for (int i = 0; i < count; i++)
+		{
+			joints[i] = merged[i].second;
+			weights[i] = merged[i].first / sum;
+		}
+		into.Joints = { joints[0], joints[1], joints[2], joints[3] };
+		into.Weights = { weights[0], weights[1], weights[2], weights[3] };
+	}
+
+	// Quadric error edge collapse (Garland and Heckbert) on one submesh's triangles, down to about
+	// targetIndexCount indices or until the next collapse would move the surface further than maxError.
+	// A vertex only ever collapses onto one of its neighbours, so no new vertices are made. Vertices on an
+	// open edge, and every vertex sharing its position with another (a UV or normal seam, or where two
+	// submeshes meet), stay put, which keeps seams and material boundaries exactly where they were. Skin
+	// weights of a collapsed vertex are merged into the survivor and every vertex at its position, so the
+	// seam the survivor may sit on doesn't open up when the mesh is skinned. Returns the largest error of
+	// any collapse made, as a distance.
+	float SimplifyMesh(std::vector<int>& indices, std::vector<MoralesVertex>& vertices, size_t targetIndexCount, float maxError)
+	{
+		const size_t vertexCount = vertices.size();
+
+		// Vertices at the same position, each pointing at the first of them.
+		std::vector<int> byPosition(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			byPosition[v] = static_cast<int>(v);
+		}
+		auto PositionLess = [&](int a, int b)
+		{
+			const XMFLOAT4& p = vertices[a].Pos;
+			const XMFLOAT4& q = vertices[b].Pos;
+			return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+		};
+		std::sort(byPosition.begin(), byPosition.end(), PositionLess);
+		std::vector<int> position(vertexCount);
+		std::vector<int> siblings(vertexCount, 0);
+		std::vector<size_t> firstSibling(vertexCount, 0); // where the position's vertices start in byPosition
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			const int v = byPosition[i];
+			const bool same = i > 0 && !PositionLess(byPosition[i - 1], v) && !PositionLess(v, byPosition[i - 1]);
+			position[v] = same ? position[byPosition[i - 1]] : v;
+			firstSibling[position[v]] = same ? firstSibling[position[v]] : i;
+			siblings[position[v]]++;
+		}
+
+		// Triangles around each vertex, and how many triangles use each edge between positions.
+		const size_t triangleCount = indices.size() / 3;
+		std::vector<std::vector<int>> around(vertexCount);
+		std::map<uint64_t, int> edgeUse;
+		auto EdgeKey = [&](int a, int b)
+		{
+			const uint64_t pa = static_cast<uint32_t>(position[a]);
+			const uint64_t pb = static_cast<uint32_t>(position[b]);
+			return pa < pb ? (pa << 32) | pb : (pb << 32) | pa;
+		};
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				around[indices[t * 3 + k]].push_back(static_cast<int>(t));
+				edgeUse[EdgeKey(indices[t * 3 + k], indices[t * 3 + (k + 1) % 3])]++;
+			}
+		}
+
+		std::vector<char> locked(vertexCount, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			locked[v] = siblings[position[v]] > 1 ? 1 : 0;
+		}
+		for (const auto& edge : edgeUse)
+		{
+			if (edge.second != 2)
+			{
+				locked[edge.first >> 32] = 1;
+				locked[edge.first & 0xffffffffu] = 1;
+			}
+		}
+
+		auto Normal = [&](const XMFLOAT4& p0, const XMFLOAT4& p1, const XMFLOAT4& p2, double n[3])
+		{
+			const double e1[3] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+			const double e2[3] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+			n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+			n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+			n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		};
+
+		// One quadric per position, so the planes on both sides of a seam count.
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const XMFLOAT4& p0 = vertices[indices[t * 3 + 0]].Pos;
+			double n[3];
+			Normal(p0, vertices[indices[t * 3 + 1]].Pos, vertices[indices[t * 3 + 2]].Pos, n);
+			const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length <= 0.0)
+			{
+				continue;
+			}
+			const double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+			const double d = -(a * p0.x + b * p0.y + c * p0.z);
+			for (int k = 0; k < 3; k++)
+			{
+				quadrics[position[indices[t * 3 + k]]].AddPlane(a, b, c, d, length * 0.5);
+			}
+		}
+
+		auto Cost = [&](int from, int to)
+		{
+			Quadric q = quadrics[position[from]];
+			q += quadrics[position[to]];
+			return q.Error(vertices[to].Pos);
+		};
+
+		struct Collapse
+		{
+			double cost;
+			int from;
+			int to;
+			bool operator<(const Collapse& other) const { return cost > other.cost; }
+		};
+		std::priority_queue<Collapse> queue;
+		auto Consider = [&](int from, int to)
+		{
+			if (!locked[from])
+			{
+				queue.push({ Cost(from, to), from, to });
+			}
+		};
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				Consider(indices[t * 3 + k], indices[t * 3 + (k + 1) % 3]);
+				Consider(indices[t * 3 + (k + 1) % 3], indices[t * 3 + k]);
+			}
+		}
+
+		std::vector<char> removed(triangleCount, 0);
+		std::vector<char> collapsed(vertexCount, 0);
+		size_t liveIndices = indices.size();
+		const double maxCost = double(maxError) * maxError;
+		double worst = 0.0;
+		std::vector<int> neighbours;
+
+		while (liveIndices > targetIndexCount && !queue.empty())
+		{
+			Collapse collapse = queue.top();
+			queue.pop();
+			const int from = collapse.from;
+			const int to = collapse.to;
+			if (collapsed[from] || collapsed[to])
+			{
+				continue;
+			}
+
+			// Queued costs go stale as quadrics merge, a collapse that got dearer goes back in line.
+			const double cost = Cost(from, to);
+			if (cost > collapse.cost * 1.0001 + 1e-12)
+			{
+				queue.push({ cost, from, to });
+				continue;
+			}
+			if (cost > maxCost)
+			{
+				break;
+			}
+
+			// The edge has to still exist, no triangle may flip or touch to's position through another vertex,
+			// and the two ends may share no neighbours but the two across the edge, or the surface pinches.
+			bool connected = false;
+			bool valid = true;
+			neighbours.clear();
+			for (int t : around[from])
+			{
+				if (removed[t])
+				{
+					continue;
+				}
+				const int* tri = &indices[t * 3];
+				const bool hasTo = tri[0] == to || tri[1] == to || tri[2] == to;
+				connected = connected || hasTo;
+				for (int k = 0; k < 3; k++)
+				{
+					if (tri[k] != from && tri[k] != to)
+					{
+						valid = valid && position[tri[k]] != position[to];
+						neighbours.push_back(position[tri[k]]);
+					}
+				}
+				if (hasTo)
+				{
+					continue;
+				}
+
+				double before[3];
+				double after[3];
+				XMFLOAT4 p[3] = { vertices[tri[0]].Pos, vertices[tri[1]].Pos, vertices[tri[2]].Pos };
+				Normal(p[0], p[1], p[2], before);
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = tri[k] == from ? vertices[to].Pos : p[k];
+				}
+				Normal(p[0], p[1], p[2], after);
+				valid = valid && before[0] * after[0] + before[1] * after[1] + before[2] * after[2] > 0.0;
+			}
+			if (!connected || !valid)
+			{
+				continue;
+			}
+
+			std::sort(neighbours.begin(), neighbours.end());
+			neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+			int shared = 0;
+			for (int t : around[to])
+			{
+				if (removed[t])
+				{
+					continue;
+				}
+				for (int k = 0; k < 3; k++)
+				{
+					const int corner = indices[t * 3 + k];
+					if (corner != to && std::binary_search(neighbours.begin(), neighbours.end(), position[corner]))
+					{
+						shared++;
+						neighbours.erase(std::lower_bound(neighbours.begin(), neighbours.end(), position[corner]));
+					}
+				}
+			}
+			if (shared > 2)
+			{
+				continue;
+			}
+
+			// Collapse: from's triangles move to to, the two across the edge disappear.
+			const double fromShare = quadrics[position[from]].weight;
+			const double toShare = quadrics[position[to]].weight;
+			for (int t : around[from])
+			{
+				if (removed[t])
+				{
+					continue;
+				}
+				int* tri = &indices[t * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					removed[t] = 1;
+					liveIndices -= 3;
+					continue;
+				}
+				for (int k = 0; k < 3; k++)
+				{
+					tri[k] = tri[k] == from ? to : tri[k];
+				}
+				around[to].push_back(t);
+				for (int k = 0; k < 3; k++)
+				{
+					if (tri[k] != to)
+					{
+						Consider(tri[k], to);
+						Consider(to, tri[k]);
+					}
+				}
+			}
+			around[from].clear();
+			collapsed[from] = 1;
+			quadrics[position[to]] += quadrics[position[from]];
+
+			const MoralesVertex source = vertices[from];
+			const size_t first = firstSibling[position[to]];
+			for (size_t i = first; i < first + siblings[position[to]]; i++)
+			{
+				MergeInfluences(vertices[byPosition[i]], source, toShare, fromShare);
+			}
+			worst = std::max(worst, cost);
+		}
+
+		std::vector<int> remaining;
+		remaining.reserve(liveIndices);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			if (!removed[t])
+			{
+				remaining.insert(remaining.end(), indices.begin() + t * 3, indices.begin() + t * 3 + 3);
+			}
+		}
+		indices.swap(remaining);
+		return static_cast<float>(std::sqrt(worst));
+	}
+
+	// Adds a chain of simplified levels after the optimized full mesh. Each level is simplified from the one
+	// before it, submesh by submesh, optimized like the full mesh, and appended with vertices of its own (its
+	// merged skin weights differ from the full mesh's) and submeshes of its own. The viewer draws a level
+	// while the mesh covers no more of the screen than its switch size, the size at which the level's error,
+	// summed down the chain, projects to LOD_PIXEL_ERROR pixels.
+	void BuildLods(MoralesMesh& mesh, int maxLevels)
+	{
+		mesh.lods.clear();
+		mesh.lods.push_back({ 0, static_cast<uint32_t>(mesh.submeshes.size()), 0, static_cast<uint32_t>(mesh.vertexList.size()), 0.0f, FLT_MAX });
+		if (mesh.vertexList.empty() || mesh.indicesList.size() % 3 != 0)
+		{
+			return;
+		}
+
+		// Bounding sphere about the centre of the bounds, errors and switch sizes are relative to it.
+		XMFLOAT4 lo = mesh.vertexList[0].Pos;
+		XMFLOAT4 hi = lo;
+		for (const MoralesVertex& v : mesh.vertexList)
+		{
+			lo = { std::min(lo.x, v.Pos.x), std::min(lo.y, v.Pos.y), std::min(lo.z, v.Pos.z), 0.0f };
+			hi = { std::max(hi.x, v.Pos.x), std::max(hi.y, v.Pos.y), std::max(hi.z, v.Pos.z), 0.0f };
+		}
+		const float centre[3] = { (lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f };
+		float radius = 0.0f;
+		for (const MoralesVertex& v : mesh.vertexList)
+		{
+			const float dx = v.Pos.x - centre[0], dy = v.Pos.y - centre[1], dz = v.Pos.z - centre[2];
+			radius = std::max(radius, std::sqrt(dx * dx + dy * dy + dz * dz));
+		}
+
+		MoralesMesh level;
+		level.vertexList = mesh.vertexList;
+		level.indicesList = mesh.indicesList;
+		level.submeshes = mesh.submeshes;
+		float error = 0.0f;
+
+		for (int lod = 1; lod < maxLevels; lod++)
+		{
+			MoralesMesh next;
+			next.vertexList = level.vertexList;
+			float levelError = 0.0f;
+			std::vector<int> range;
+			for (const MoralesSubmesh& submesh : level.submeshes)
+			{
+				range.assign(level.indicesList.begin() + submesh.indexStart, level.indicesList.begin() + submesh.indexStart + submesh.indexCount);
+				const size_t target = static_cast<size_t>(submesh.indexCount / 3 * LOD_TRIANGLE_RATIO) * 3;
+				levelError = std::max(levelError, SimplifyMesh(range, next.vertexList, target, LOD_MAX_ERROR * radius));
+				if (!range.empty())
+				{
+					next.submeshes.push_back({ static_cast<uint32_t>(next.indicesList.size()), static_cast<uint32_t>(range.size()), submesh.material });
+					next.indicesList.insert(next.indicesList.end(), range.begin(), range.end());
+				}
+			}
+
+			std::cout << "\nLOD " << lod << ": " << next.indicesList.size() / 3 << " triangles, " << level.indicesList.size() / 3 << " before";
+			if (next.indicesList.empty() || next.indicesList.size() > level.indicesList.size() * LOD_MIN_REDUCTION)
+			{
+				std::cout << ", not enough of a reduction, stopping the chain\n";
+				break;
+			}
+
+			std::cout << "\n";
+
+			OptimizeMesh(next);
+			error += levelError;
+
+			// Projected error in pixels is error / distance * projection[1][1] * height / 2, and the screen size
+			// the viewer measures is radius * projection[1][1] / distance.
+			const float switchSize = error > 0.0f ? 2.0f * radius * LOD_PIXEL_ERROR / (error * LOD_REFERENCE_HEIGHT) : FLT_MAX;
+			std::cout << "LOD " << lod << " error " << error << " (" << error / radius * 100.0f << "% of the radius), switch at " << switchSize << " of the screen height\n";
+
+			const uint32_t vertexStart = static_cast<uint32_t>(mesh.vertexList.size());
+			const uint32_t indexStart = static_cast<uint32_t>(mesh.indicesList.size());
+			mesh.lods.push_back({ static_cast<uint32_t>(mesh.submeshes.size()), static_cast<uint32_t>(next.submeshes.size()),
+				vertexStart, static_cast<uint32_t>(next.vertexList.size()), error, switchSize });
+			for (const MoralesSubmesh& submesh : next.submeshes)
+			{
+				mesh.submeshes.push_back({ indexStart + submesh.indexStart, submesh.indexCount, submesh.material });
+			}
+			for (int index : next.indicesList)
+			{
+				mesh.indicesList.push_back(static_cast<int>(vertexStart) + index);
+			}
+			mesh.vertexList.insert(mesh.vertexList.end(), next.vertexList.begin(), next.vertexList.end());
+
+			level = std::move(next);
+		}
+	}
+
+	// Rounds every vertex's weights to UNORM8, the way the viewer stores them. Influences are put heaviest first,
+	// so a vertex with n of them only uses the first n, and each weight is floored then the ones that lost the
+	// most get the leftover steps back (largest remainder), so the four always sum to exactly 255 and none is
+	// off by a whole step. The rounded weights replace the exact ones, so bounds, meshlets and a viewer reading
+	// the doubles all see what's drawn. Prints how far the weights and the skinned positions moved.
+	void QuantizeWeights(MoralesMesh& mesh)
+	{
+		const std::vector<MoralesVertex> exact = mesh.vertexList;
+		mesh.packedWeights.resize(mesh.vertexList.size());
+
+		double maxWeightError = 0.0;
+		double sumWeightError = 0.0;
+		for (size_t v = 0; v < mesh.vertexList.size(); v++)
+		{
+			MoralesVertex& vertex = mesh.vertexList[v];
+			std::pair<double, int> influences[MAX_INFLUENCES] = { { vertex.Weights.x, vertex.Joints.x }, { vertex.Weights.y, vertex.Joints.y },
+				{ vertex.Weights.z, vertex.Joints.z }, { vertex.Weights.w, vertex.Joints.w } };
+			std::stable_sort(influences, influences + MAX_INFLUENCES,
+				[](const std::pair<double, int>& a, const std::pair<double, int>& b) { return a.first > b.first; });
+
+			double sum = 0.0;
+			for (int i = 0; i < MAX_INFLUENCES; i++)
+			{
+				sum += std::max(influences[i].first, 0.0);
+			}
+
+			int steps[MAX_INFLUENCES] = { 0, 0, 0, 0 };
+			if (sum > 0.0)
+			{
+				double remainders[MAX_INFLUENCES];
+				int left = 255;
+				for (int i = 0; i < MAX_INFLUENCES; i++)
+				{
+					const double scaled = std::max(influences[i].first, 0.0) / sum * 255.0;
+					steps[i] = static_cast<int>(std::floor(scaled));
+					remainders[i] = scaled - steps[i];
+					left -= steps[i];
+				}
+				for (; left > 0; left--)
+				{
+					int most = 0;
+					for (int i = 1; i < MAX_INFLUENCES; i++)
+					{
+						if (remainders[i] > remainders[most])
+						{
+							most = i;
+						}
+					}
+					steps[most]++;
+					remainders[most] = -1.0;
+				}
+			}
+
+			// An influence rounded away keeps its joint but not its weight, the paths that skip it never read it.
+			uint32_t packed = 0;
+			for (int i = 0; i < MAX_INFLUENCES; i++)
+			{
+				const double weight = steps[i] / 255.0;
+				const double error = std::fabs(weight - (sum > 0.0 ? std::max(influences[i].first, 0.0) / sum : 0.0));
+				maxWeightError = std::max(maxWeightError, error);
+				sumWeightError += error;
+				packed |= static_cast<uint32_t>(steps[i]) << (8 * i);
+			}
+			mesh.packedWeights[v] = packed;
+			vertex.Joints = { influences[0].second, influences[1].second, influences[2].second, influences[3].second };
+			vertex.Weights = { steps[0] / 255.0, steps[1] / 255.0, steps[2] / 255.0, steps[3] / 255.0 };
+		}
+
+		// Skinned at every keyframe both ways, what the rounding actually costs on screen.
+		const size_t jointCount = mesh.bindPose.size();
+		std::vector<XMMATRIX> inverseBind;
+		BuildInverseBind(mesh, inverseBind);
+		std::vector<XMFLOAT4X4> palette;
+		MoralesKeyframe scratch;
+		size_t poseCount = 0;
+		float maxPositionError = 0.0f;
+		for (size_t k = 0; k < KeyframeCount(mesh); k++)
+		{
+			if (!BuildSkinningPalette(inverseBind, LoadKeyframe(mesh, k, scratch), palette))
+			{
+				continue;
+			}
+			poseCount++;
+			for (size_t v = 0; v < mesh.vertexList.size(); v++)
+			{
+				const XMVECTOR before = SkinPosition(exact[v], palette.data(), jointCount);
+				const XMVECTOR after = SkinPosition(mesh.vertexList[v], palette.data(), jointCount);
+				maxPositionError = std::max(maxPositionError, XMVectorGetX(XMVector3Length(after - before)));
+			}
+		}
+
+		std::cout << "\nWeights quantized to 8 bits: largest error " << maxWeightError << ", mean "
+			<< (mesh.vertexList.empty() ? 0.0 : sumWeightError / (mesh.vertexList.size() * MAX_INFLUENCES))
+			<< ", skinned positions moved at most " << maxPositionError << " over " << poseCount << " keyframes\n";
+	}
+
+	// The bucket whose skinning path covers every nonzero weight of packedWeights: the first with at least as
+	// many influences as the last nonzero one's slot. No weights at all skins to nothing on any path.
+	uint32_t InfluenceBucket(uint32_t packedWeights)
+	{
+		int used = 0;
+		for (int i = 0; i < MAX_INFLUENCES; i++)
+		{
+			if ((packedWeights >> (8 * i)) & 0xFF)
+			{
+				used = i + 1;
+			}
+		}
+		int bucket = 0;
+		while (bucket + 1 < INFLUENCE_BUCKETS && BUCKET_INFLUENCES[bucket] < used)
+		{
+			bucket++;
+		}
+		return static_cast<uint32_t>(bucket);
+	}
+
+	// Sorts each level's vertices into influence buckets, fewest influences first, and each submesh's triangles
+	// by the bucket of their most influenced corner, so the viewer can skin and draw every bucket as one range
+	// with a path that blends only the influences it has. Both sorts are stable, vertices keep the fetch order
+	// and triangles the cache order they had within a bucket. Call after QuantizeWeights(), before the meshlets.
+	void SortByInfluenceCount(MoralesMesh& mesh)
+	{
+		mesh.lodBuckets.clear();
+		mesh.submeshBuckets.assign(mesh.submeshes.size(), {});
+
+		std::vector<int> remap(mesh.vertexList.size());
+		std::vector<MoralesVertex> vertices;
+		std::vector<uint32_t> weights;
+		std::vector<int> triangles;
+		uint32_t total[INFLUENCE_BUCKETS] = {};
+		for (const MoralesLod& lod : mesh.lods)
+		{
+			MoralesInfluenceBuckets buckets = {};
+			vertices.clear();
+			weights.clear();
+			for (uint32_t bucket = 0; bucket < INFLUENCE_BUCKETS; bucket++)
+			{
+				for (uint32_t v = lod.vertexStart; v < lod.vertexStart + lod.vertexCount; v++)
+				{
+					if (InfluenceBucket(mesh.packedWeights[v]) == bucket)
+					{
+						remap[v] = static_cast<int>(lod.vertexStart + vertices.size());
+						vertices.push_back(mesh.vertexList[v]);
+						weights.push_back(mesh.packedWeights[v]);
+						buckets.counts[bucket]++;
+					}
+				}
+				total[bucket] += buckets.counts[bucket];
+			}
+			std::copy(vertices.begin(), vertices.end(), mesh.vertexList.begin() + lod.vertexStart);
+			std::copy(weights.begin(), weights.end(), mesh.packedWeights.begin() + lod.vertexStart);
+			mesh.lodBuckets.push_back(buckets);
+
+			for (uint32_t s = lod.submeshStart; s < lod.submeshStart + lod.submeshCount; s++)
+			{
+				const MoralesSubmesh& submesh = mesh.submeshes[s];
+				int* indices = mesh.indicesList.data() + submesh.indexStart;
+				for (uint32_t i = 0; i < submesh.indexCount; i++)
+				{
+					indices[i] = remap[indices[i]];
+				}
+
+				triangles.clear();
+				for (uint32_t bucket = 0; bucket < INFLUENCE_BUCKETS; bucket++)
+				{
+					for (uint32_t t = 0; t + 2 < submesh.indexCount; t += 3)
+					{
+						const uint32_t most = std::max(InfluenceBucket(mesh.packedWeights[indices[t]]),
+							std::max(InfluenceBucket(mesh.packedWeights[indices[t + 1]]), InfluenceBucket(mesh.packedWeights[indices[t + 2]])));
+						if (most == bucket)
+						{
+							triangles.insert(triangles.end(), indices + t, indices + t + 3);
+							mesh.submeshBuckets[s].counts[bucket] += 3;
+						}
+					}
+				}
+				std::copy(triangles.begin(), triangles.end(), indices);
+			}
+		}
+
+		std::cout << "\nInfluence buckets:";
+		for (uint32_t bucket = 0; bucket < INFLUENCE_BUCKETS; bucket++)
+		{
+			std::cout << " " << total[bucket] << " vertices skinned with " << BUCKET_INFLUENCES[bucket] << (bucket + 1 < INFLUENCE_BUCKETS ? "," : "\n");
+		}
+	}
+
+	// Meshlets fit the limits mesh shader hardware likes: 64 vertices keep a meshlet's vertex indices in a byte
+	// and 124 triangles leave room for four more in a 128 entry primitive buffer.
+	constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+	constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+	// Splits every submesh of every level into meshlets. Triangles are taken greedily, preferring ones that add
+	// the fewest new vertices to the meshlet being filled, so meshlets stay compact and their bounds small.
+	void BuildMeshlets(MoralesMesh& mesh)
+	{
+		mesh.meshlets.clear();
+		mesh.meshletVertices.clear();
+		mesh.meshletTriangles.clear();
+
+		const uint8_t unused = 0xFF;
+		std::vector<uint8_t> localIndex(mesh.vertexList.size(), unused);
+		std::vector<uint32_t> adjacencyOffsets;
+		std::vector<uint32_t> adjacency;
+		std::vector<bool> emitted;
+
+		for (uint32_t s = 0; s < mesh.submeshes.size(); s++)
+		{
+			const MoralesSubmesh& submesh = mesh.submeshes[s];
+			const int* indices = mesh.indicesList.data() + submesh.indexStart;
+			const uint32_t triangleCount = submesh.indexCount / 3;
+
+			// Triangles around each vertex, as offsets into one array.
+			adjacencyOffsets.assign(mesh.vertexList.size() + 1, 0);
+			for (uint32_t i = 0; i < triangleCount * 3; i++)
+			{
+				adjacencyOffsets[indices[i] + 1]++;
+			}
+			for (size_t v = 1; v < adjacencyOffsets.size(); v++)
+			{
+				adjacencyOffsets[v] += adjacencyOffsets[v - 1];
+			}
+			adjacency.resize(triangleCount * 3);
+			{
+				std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+				for (uint32_t i = 0; i < triangleCount * 3; i++)
+				{
+					adjacency[fill[indices[i]]++] = i / 3;
+				}
+			}
+			emitted.assign(triangleCount, false);
+
+			MoralesMeshlet meshlet = {};
+			meshlet.vertexStart = static_cast<uint32_t>(mesh.meshletVertices.size());
+			meshlet.triangleStart = static_cast<uint32_t>(mesh.meshletTriangles.size() / 3);
+			meshlet.submesh = s;
+			float sum[3] = { 0.0f, 0.0f, 0.0f }; // of the meshlet's vertex positions
+
+			auto newVertices = [&](uint32_t t)
+			{
+				return (localIndex[indices[t * 3]] == unused ? 1u : 0u) + (localIndex[indices[t * 3 + 1]] == unused ? 1u : 0u) +
+					(localIndex[indices[t * 3 + 2]] == unused ? 1u : 0u);
+			};
+			auto flush = [&]()
+			{
+				if (meshlet.triangleCount == 0)
+				{
+					return;
+				}
+				for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+				{
+					localIndex[mesh.meshletVertices[meshlet.vertexStart + i]] = unused;
+				}
+				mesh.meshlets.push_back(meshlet);
+				meshlet.vertexStart = static_cast<uint32_t>(mesh.meshletVertices.size());
+				meshlet.triangleStart = static_cast<uint32_t>(mesh.meshletTriangles.size() / 3);
+				meshlet.vertexCount = 0;
+				meshlet.triangleCount = 0;
+				sum[0] = sum[1] = sum[2] = 0.0f;
+			};
+
+			uint32_t scan = 0; // every triangle before it has been emitted
+			for (uint32_t done = 0; done < triangleCount; done++)
+			{
+				// The unused neighbour adding the fewest vertices, the one nearest the meshlet's centre on a tie so
+				// the meshlet grows as a patch rather than a strip.
+				uint32_t best = UINT32_MAX;
+				uint32_t bestCost = 3;
+				float bestDistance = FLT_MAX;
+				const float count = static_cast<float>(std::max(meshlet.vertexCount, 1u));
+				const float centre[3] = { sum[0] / count, sum[1] / count, sum[2] / count };
+				for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+				{
+					const uint32_t vertex = mesh.meshletVertices[meshlet.vertexStart + i];
+					for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++)
+					{
+						const uint32_t t = adjacency[a];
+						if (emitted[t] || newVertices(t) > bestCost)
+						{
+							continue;
+						}
+						const uint32_t cost = newVertices(t);
+						const XMFLOAT4& p0 = mesh.vertexList[indices[t * 3]].Pos;
+						const XMFLOAT4& p1 = mesh.vertexList[indices[t * 3 + 1]].Pos;
+						const XMFLOAT4& p2 = mesh.vertexList[indices[t * 3 + 2]].Pos;
+						const float dx = (p0.x + p1.x + p2.x) / 3.0f - centre[0];
+						const float dy = (p0.y + p1.y + p2.y) / 3.0f - centre[1];
+						const float dz = (p0.z + p1.z + p2.z) / 3.0f - centre[2];
+						const float distance = dx * dx + dy * dy + dz * dz;
+						if (cost < bestCost || distance < bestDistance)
+						{
+							best = t;
+							bestCost = cost;
+							bestDistance = distance;
+						}
+					}
+				}
+
+				// Nothing next to the meshlet fits, or nothing is next to it: carry on in index order, which the
+				// vertex cache optimization already left fairly local.
+				if (best == UINT32_MAX || meshlet.vertexCount + bestCost > MESHLET_MAX_VERTICES)
+				{
+					while (emitted[scan])
+					{
+						scan++;
+					}
+					best = scan;
+					bestCost = newVertices(best);
+				}
+				if (meshlet.vertexCount + bestCost > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+				{
+					flush();
+				}
+
+				for (int corner = 0; corner < 3; corner++)
+				{
+					const int vertex = indices[best * 3 + corner];
+					if (localIndex[vertex] == unused)
+					{
+						localIndex[vertex] = static_cast<uint8_t>(meshlet.vertexCount++);
+						mesh.meshletVertices.push_back(static_cast<uint32_t>(vertex));
+						sum[0] += mesh.vertexList[vertex].Pos.x;
+						sum[1] += mesh.vertexList[vertex].Pos.y;
+						sum[2] += mesh.vertexList[vertex].Pos.z;
+					}
+					mesh.meshletTriangles.push_back(localIndex[vertex]);
+				}
+				meshlet.triangleCount++;
+				emitted[best] = true;
+			}
+			flush();
+		}
+
+		ComputeMeshletBounds(mesh);
+
+		std::cout << "\nMeshlets: " << mesh.meshlets.size() << " of at most " << MESHLET_MAX_VERTICES << " vertices and "
+			<< MESHLET_MAX_TRIANGLES << " triangles";
+		if (!mesh.meshlets.empty())
+		{
+			std::cout << ", " << std::fixed << std::setprecision(1) << double(mesh.meshletVertices.size()) / mesh.meshlets.size()
+				<< " vertices and " << double(mesh.meshletTriangles.size() / 3) / mesh.meshlets.size() << " triangles each on average"
+				<< std::defaultfloat;
+		}
+		std::cout << "\n";
+	}
+
+	// Bounds that hold for the whole clip, not just the bind pose: every meshlet vertex is skinned at every
+	// keyframe. The sphere takes in every position it reaches and the cone every facing its triangles turn to,
+	// so a runtime test against either stays conservative at whatever time an instance is sampled.
+	//
+	// Keyframes are the outer loop, so only one is needed at a time and a spooled clip is read through in order.
+	// That takes two passes: the first finds each meshlet's box and mean facing, the second how far its
+	// positions and facings stray from their centres.
+	void ComputeMeshletBounds(MoralesMesh& mesh)
+	{
+		// Without a skeleton the bind pose positions are all there is.
+		const size_t jointCount = mesh.bindPose.size();
+		const size_t keyframeCount = KeyframeCount(mesh);
+		std::vector<XMMATRIX> inverseBind;
+		BuildInverseBind(mesh, inverseBind);
+
+		std::vector<XMFLOAT3> lo(mesh.meshlets.size(), XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX));
+		std::vector<XMFLOAT3> hi(mesh.meshlets.size(), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+		std::vector<XMFLOAT3> facing(mesh.meshlets.size(), XMFLOAT3(0.0f, 0.0f, 0.0f));
+		std::vector<bool> faces(mesh.meshlets.size(), false); // whether the meshlet has a mean facing for its cone
+		std::vector<bool> flipped(mesh.meshletTriangles.size() / 3, false);
+
+		std::vector<XMFLOAT4X4> palette;
+		MoralesKeyframe scratch;
+		std::vector<XMFLOAT3> positions;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			// Pose 0 is the bind pose, the viewer shows it when there's no clip to play, then every keyframe.
+			for (size_t pose = 0; pose <= keyframeCount; pose++)
+			{
+				if (pose > 0 && !BuildSkinningPalette(inverseBind, LoadKeyframe(mesh, pose - 1, scratch), palette))
+				{
+					continue;
+				}
+
+				for (size_t m = 0; m < mesh.meshlets.size(); m++)
+				{
+					MoralesMeshlet& meshlet = mesh.meshlets[m];
+					positions.clear();
+					for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+					{
+						const MoralesVertex& vertex = mesh.vertexList[mesh.meshletVertices[meshlet.vertexStart + i]];
+						const XMVECTOR p = pose > 0 ? SkinPosition(vertex, palette.data(), jointCount)
+							: XMVectorSet(vertex.Pos.x, vertex.Pos.y, vertex.Pos.z, 1.0f);
+						XMFLOAT3 stored;
+						XMStoreFloat3(&stored, p);
+						positions.push_back(stored);
+					}
+
+					// Sphere about the centre of the bounds of every position reached.
+					for (const XMFLOAT3& p : positions)
+					{
+						if (pass == 0)
+						{
+							XMStoreFloat3(&lo[m], XMVectorMin(XMLoadFloat3(&lo[m]), XMLoadFloat3(&p)));
+							XMStoreFloat3(&hi[m], XMVectorMax(XMLoadFloat3(&hi[m]), XMLoadFloat3(&p)));
+						}
+						else
+						{
+							const XMVECTOR centre = XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(meshlet.center));
+							meshlet.radius = std::max(meshlet.radius, XMVectorGetX(XMVector3Length(XMLoadFloat3(&p) - centre)));
+						}
+					}
+
+					// Face normals, turned to the side the vertex normals face whichever way the triangles wind.
+					// Skinning doesn't flip a triangle over, so the bind pose decides the side for every pose.
+					for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+					{
+						const uint8_t* corners = &mesh.meshletTriangles[(meshlet.triangleStart + t) * 3];
+						const XMVECTOR a = XMLoadFloat3(&positions[corners[0]]);
+						const XMVECTOR b = XMLoadFloat3(&positions[corners[1]]);
+						const XMVECTOR c = XMLoadFloat3(&positions[corners[2]]);
+						XMVECTOR n = XMVector3Cross(b - a, c - a);
+						if (pose == 0)
+						{
+							XMVECTOR side = XMVectorZero();
+							for (int corner = 0; corner < 3; corner++)
+							{
+								const XMFLOAT4& normal = mesh.vertexList[mesh.meshletVertices[meshlet.vertexStart + corners[corner]]].Normal;
+								side += XMVectorSet(normal.x, normal.y, normal.z, 0.0f);
+							}
+							flipped[meshlet.triangleStart + t] = XMVectorGetX(XMVector3Dot(n, side)) < 0.0f;
+						}
+						if (XMVectorGetX(XMVector3LengthSq(n)) <= 0.0f)
+						{
+							continue;
+						}
+						XMFLOAT3 stored;
+						XMStoreFloat3(&stored, XMVector3Normalize(flipped[meshlet.triangleStart + t] ? -n : n));
+						if (pass == 0)
+						{
+							XMStoreFloat3(&facing[m], XMLoadFloat3(&facing[m]) + XMLoadFloat3(&stored));
+						}
+						else if (faces[m])
+						{
+							const XMVECTOR axis = XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(meshlet.coneAxis));
+							meshlet.coneCutoff = std::min(meshlet.coneCutoff, XMVectorGetX(XMVector3Dot(axis, XMLoadFloat3(&stored))));
+						}
+					}
+				}
+			}
+
+			if (pass > 0)
+			{
+				break;
+			}
+			for (size_t m = 0; m < mesh.meshlets.size(); m++)
+			{
+				MoralesMeshlet& meshlet = mesh.meshlets[m];
+				XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(meshlet.center), (XMLoadFloat3(&lo[m]) + XMLoadFloat3(&hi[m])) * 0.5f);
+				meshlet.radius = 0.0f;
+
+				// Cone around the mean facing, as wide as the normal furthest from it. cos(half angle) <= 0 leaves
+				// the meshlet facing every way, it is never back facing as a whole.
+				XMVECTOR axis = XMLoadFloat3(&facing[m]);
+				meshlet.coneCutoff = -1.0f;
+				if (XMVectorGetX(XMVector3LengthSq(axis)) > 0.0f)
+				{
+					axis = XMVector3Normalize(axis);
+					meshlet.coneCutoff = 1.0f;
+					faces[m] = true;
+				}
+				XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(meshlet.coneAxis), axis);
+			}
+		}
+	}
+
+	// How many keyframes the clip has, held or spooled.
+	size_t KeyframeCount(const MoralesMesh& mesh)
+	{
+		return keyframeSpool.file.is_open() ? keyframeSpool.count : mesh.animation.keyframes.size();
+	}
+
+	// Keyframe index of the clip: the one held in mesh, or read from the spool into scratch. One the spool can't
+	// give back comes out posing no joints.
+	const MoralesKeyframe& LoadKeyframe(const MoralesMesh& mesh, size_t index, MoralesKeyframe& scratch)
+	{
+		if (!keyframeSpool.file.is_open())
+		{
+			return mesh.animation.keyframes[index];
+		}
+
+		const uint64_t recordSize = sizeof(double) + sizeof(MoralesJoint) * keyframeSpool.jointCount;
+		scratch.poseData.resize(keyframeSpool.jointCount);
+		keyframeSpool.file.clear();
+		keyframeSpool.file.seekg(static_cast<std::streamoff>(index * recordSize));
+		keyframeSpool.file.read((char*)&scratch.keytime, sizeof(double));
+		keyframeSpool.file.read((char*)scratch.poseData.data(), sizeof(MoralesJoint) * keyframeSpool.jointCount);
+		if (!keyframeSpool.file)
+		{
+			scratch.poseData.clear();
+		}
+		return scratch;
+	}
 
-			mjoint.globalTransform[12] = mat.mData[3][0];
-			mjoint.globalTransform[13] = mat.mData[3][1];
-			mjoint.globalTransform[14] = mat.mData[3][2];
-			mjoint.globalTransform[15] = mat.mData[3][3];
-			moralesMesh.bindPose.push_back(mjoint);
+	// The bind pose's inverse, per joint, to skin keyframes with. Empty without a skeleton.
+	void BuildInverseBind(const MoralesMesh& mesh, std::vector<XMMATRIX>& inverseBind)
+	{
+		const size_t jointCount = mesh.bindPose.size();
+		inverseBind.resize(jointCount);
+		for (size_t j = 0; j < jointCount; j++)
+		{
+			inverseBind[j] = XMMatrixInverse(nullptr, XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(mesh.bindPose[j].globalTransform)));
 		}
+	}
 
-		std::cout << "Bind pose loaded, " << moralesMesh.bindPose.size() << " joints\n\n";
-		std::cout << "Loading animation data...\n";
+	// Skinning matrices, inverse bind then pose, per joint for one keyframe. False, and no matrices, for a
+	// keyframe that doesn't pose every joint of the bind pose, or without a skeleton.
+	bool BuildSkinningPalette(const std::vector<XMMATRIX>& inverseBind, const MoralesKeyframe& keyframe, std::vector<XMFLOAT4X4>& palette)
+	{
+		const size_t jointCount = inverseBind.size();
+		palette.clear();
+		if (jointCount == 0 || keyframe.poseData.size() != jointCount)
+		{
+			return false;
+		}
 
-		// bind pose completed (hopefully)
-		// Get the animation data
+		palette.resize(jointCount);
+		for (size_t j = 0; j < jointCount; j++)
+		{
+			XMStoreFloat4x4(&palette[j], inverseBind[j] * XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(keyframe.poseData[j].globalTransform)));
+		}
+		return true;
+	}
 
-		// From the scene, get the animation stack
+	// The vertex's position blended by its weights through one keyframe's skinning matrices.
+	XMVECTOR SkinPosition(const MoralesVertex& vertex, const XMFLOAT4X4* palette, size_t jointCount)
+	{
+		const XMVECTOR p = XMVectorSet(vertex.Pos.x, vertex.Pos.y, vertex.Pos.z, 1.0f);
+		const int joints[MAX_INFLUENCES] = { vertex.Joints.x, vertex.Joints.y, vertex.Joints.z, vertex.Joints.w };
+		const double weights[MAX_INFLUENCES] = { vertex.Weights.x, vertex.Weights.y, vertex.Weights.z, vertex.Weights.w };
+		XMVECTOR skinned = XMVectorZero();
+		for (int k = 0; k < MAX_INFLUENCES; k++)
+		{
+			if (weights[k] > 0.0 && joints[k] >= 0 && static_cast<size_t>(joints[k]) < jointCount)
+			{
+				skinned += XMVector3Transform(p, XMLoadFloat4x4(&palette[joints[k]])) * static_cast<float>(weights[k]);
+			}
+		}
+		return skinned;
+	}
 
-		FbxAnimStack* aStack = Scene->GetCurrentAnimationStack();
+	// 1 - cos(angle / 2) for the angle between two joint transforms' rotations: times a vertex's distance from
+	// the joint, how far the viewer's slerp between them carries it off the straight line between the two.
+	float KeyTurn(const MoralesJoint& a, const MoralesJoint& b)
+	{
+		// The trace of a * transpose(b)'s rotation is 1 + 2 cos(angle), and cos(angle / 2) = sqrt(1 + trace) / 2.
+		float trace = 0.0f;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				trace += a.globalTransform[i * 4 + j] * b.globalTransform[i * 4 + j];
+			}
+		}
+		trace = std::min(std::max(trace, -1.0f), 3.0f);
+		return 1.0f - std::sqrt(1.0f + trace) * 0.5f;
+	}
 
-		// Get the duration of the animation
+	// The full detail level's bounds at every keyframe, for the viewer to cull whole characters with before it
+	// samples them. Every other level's vertices sit on its surface. Each box is grown to take in everywhere
+	// interpolating to the keyframe before or after it carries the mesh, as the viewer's compute_key_bounds()
+	// does, so the union of two neighbouring keys' boxes holds every pose between them. Left empty unless every
+	// keyframe poses the whole skeleton, the viewer then works them out itself.
+	void ComputeKeyframeBounds(MoralesMesh& mesh)
+	{
+		MoralesAnimation& animation = mesh.animation;
+		animation.keyBounds.clear();
 
-		FbxTimeSpan timeSpan = aStack->GetLocalTimeSpan();
-		FbxTime time = timeSpan.GetDuration();
+		const size_t jointCount = mesh.bindPose.size();
+		const size_t first = mesh.lods.empty() ? 0 : mesh.lods[0].vertexStart;
+		const size_t count = mesh.lods.empty() ? mesh.vertexList.size() : mesh.lods[0].vertexCount;
+		if (count == 0)
+		{
+			return;
+		}
 
-		ulong animationFrames = time.GetFrameCount(FbxTime::eFrames24);
+		std::vector<XMMATRIX> inverseBind;
+		BuildInverseBind(mesh, inverseBind);
 
-		moralesMesh.animation.duration = time.GetSecondDouble();
+		// Furthest any vertex a joint moves sits from it, which the joint's rotation keeps.
+		std::vector<float> radius(jointCount, 0.0f);
+		for (size_t v = first; v < first + count; v++)
+		{
+			const MoralesVertex& vertex = mesh.vertexList[v];
+			const XMVECTOR p = XMVectorSet(vertex.Pos.x, vertex.Pos.y, vertex.Pos.z, 1.0f);
+			const int joints[MAX_INFLUENCES] = { vertex.Joints.x, vertex.Joints.y, vertex.Joints.z, vertex.Joints.w };
+			const double weights[MAX_INFLUENCES] = { vertex.Weights.x, vertex.Weights.y, vertex.Weights.z, vertex.Weights.w };
+			for (int k = 0; k < MAX_INFLUENCES; k++)
+			{
+				if (weights[k] > 0.0 && joints[k] >= 0 && static_cast<size_t>(joints[k]) < jointCount)
+				{
+					radius[joints[k]] = std::max(radius[joints[k]], XMVectorGetX(XMVector3Length(XMVector3Transform(p, inverseBind[joints[k]]))));
+				}
+			}
+		}
 
-		std::cout << "Animation duration: " << moralesMesh.animation.duration << " seconds\n";
-		std::cout << "Animation frame count: " << animationFrames << " frames\n";
+		std::vector<XMFLOAT4X4> palette;
+		MoralesKeyframe scratch;
+		const size_t keyframeCount = KeyframeCount(mesh);
+		if (keyframeCount == 0)
+		{
+			return;
+		}
+		// Furthest interpolating from one pose to another carries a vertex off the line between the two.
+		auto pose_margin = [&](const MoralesPose& from, const MoralesPose& to)
+		{
+			float margin = 0.0f;
+			for (size_t j = 0; j < jointCount; j++)
+			{
+				margin = std::max(margin, radius[j] * KeyTurn(from[j], to[j]));
+			}
+			return margin;
+		};
+		MoralesPose firstPose;
+		MoralesPose previousPose;
+		std::vector<float> margins(keyframeCount, 0.0f);
+		for (size_t k = 0; k < keyframeCount; k++)
+		{
+			const MoralesKeyframe& keyframe = LoadKeyframe(mesh, k, scratch);
+			if (!BuildSkinningPalette(inverseBind, keyframe, palette))
+			{
+				animation.keyBounds.clear();
+				return;
+			}
 
-		for (ulong i = 0; i < animationFrames; i++)
+			XMVECTOR lo = XMVectorReplicate(FLT_MAX);
+			XMVECTOR hi = XMVectorReplicate(-FLT_MAX);
+			for (size_t v = first; v < first + count; v++)
+			{
+				const XMVECTOR p = SkinPosition(mesh.vertexList[v], palette.data(), jointCount);
+				lo = XMVectorMin(lo, p);
+				hi = XMVectorMax(hi, p);
+			}
+			MoralesBounds bounds;
+			XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(bounds.min), lo);
+			XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(bounds.max), hi);
+			animation.keyBounds.push_back(bounds);
+
+			// The viewer interpolates every key to the next, and the last back to the first.
+			if (k > 0)
+			{
+				const float margin = pose_margin(previousPose, keyframe.poseData);
+				margins[k - 1] = std::max(margins[k - 1], margin);
+				margins[k] = std::max(margins[k], margin);
+			}
+			if (k > 0 && k + 1 == keyframeCount)
+			{
+				const float margin = pose_margin(keyframe.poseData, firstPose);
+				margins[k] = std::max(margins[k], margin);
+				margins[0] = std::max(margins[0], margin);
+			}
+			if (k == 0)
+			{
+				firstPose = keyframe.poseData;
+			}
+			previousPose = keyframe.poseData;
+		}
+
+		for (size_t k = 0; k < keyframeCount; k++)
 		{
-			MoralesKeyframe kf;
+			for (int j = 0; j < 3; j++)
+			{
+				animation.keyBounds[k].min[j] -= margins[k];
+				animation.keyBounds[k].max[j] += margins[k];
+			}
+		}
 
-			time.SetFrame(i, FbxTime::eFrames24);
-			kf.keytime = time.GetSecondDouble();
-			// Still on step 8
+		std::cout << "\nKeyframe bounds: " << animation.keyBounds.size() << " boxes over " << count << " vertices";
+	}
 
-			for (int j = 0; j < joints.size(); j++)
+	// Groups the keyframes into blocks of blockSeconds each, by keytime, and gathers the keytimes. Every keyframe
+	// is a record of the same size in the file, so the viewer reads a block of them with one read at an offset
+	// it can work out, and keeps only the blocks around its playheads instead of the whole clip. Left empty
+	// unless the keytimes ascend, the viewer then reads the clip whole.
+	void BuildClipBlocks(MoralesMesh& mesh, double blockSeconds)
+	{
+		MoralesAnimation& animation = mesh.animation;
+		animation.blockSeconds = blockSeconds;
+		animation.blocks.clear();
+		animation.keytimes.clear();
+
+		MoralesKeyframe scratch;
+		const size_t keyframeCount = KeyframeCount(mesh);
+		animation.keytimes.reserve(keyframeCount);
+		int64_t block = -1;
+		for (size_t k = 0; k < keyframeCount; k++)
+		{
+			const double keytime = LoadKeyframe(mesh, k, scratch).keytime;
+			if (!animation.keytimes.empty() && keytime < animation.keytimes.back())
 			{
-				MoralesJoint mjoint;
-				mjoint.parentIndex = joints[j].parentIndex;
-				FbxAMatrix mat = joints[j].node->EvaluateGlobalTransform(time);
+				animation.blocks.clear();
+				animation.keytimes.clear();
+				std::cout << "\nKeyframes out of order, the clip is written without blocks";
+				return;
+			}
+			animation.keytimes.push_back(keytime);
 
-				ConvertFbxAMatrixToFloat16(mjoint.globalTransform, mat);
+			const int64_t keyBlock = static_cast<int64_t>(std::floor(std::max(keytime, 0.0) / blockSeconds));
+			if (animation.blocks.empty() || keyBlock != block)
+			{
+				animation.blocks.push_back({ static_cast<uint32_t>(k), 0 });
+				block = keyBlock;
+			}
+			animation.blocks.back().keyCount++;
+		}
 
-				kf.poseData.push_back(mjoint);
+		std::cout << "\nClip blocks: " << animation.blocks.size() << " of " << blockSeconds << " s over " << keyframeCount << " keyframes";
+	}
+
+	// The skeleton, its bind pose and every skinned mesh's weights. The clip is baked later, by BakeFbxAnimation().
+	void ProcessFbxAnimation(FbxScene* Scene)
+	{
+		std::vector<MoralesFbxJoint>& joints = skeletonJoints;
+		joints.clear();
+		std::unordered_map<FbxNode*, int> jointIndices; // each joint's node to its index in joints
+		FbxPose* bindPose = nullptr;
+		// Find the first FbxPose that is a bind pose, assume that the first pose is the only pose of interest.
+		int poseCount = Scene->GetPoseCount();
+		for (int i = 0; i < poseCount; i++)
+		{
+			FbxPose* pose = Scene->GetPose(i);
+
+			if (pose->IsBindPose())
+			{
+				bindPose = pose;
+				// from the bind pose, find the root of the skeleton
+				int nodeCount = pose->GetCount();
+				for (int j = 0; j < nodeCount; j++)
+				{
+					FbxNode* node = pose->GetNode(j);
+					FbxSkeleton* skeleton = node->GetSkeleton();
+					if (skeleton != NULL && skeleton->IsSkeletonRoot())
+					{
+						// Starting with the skeleton root, build a dynamic array of FbxNode* paired with parent indices
+						jointIndices.emplace(node, static_cast<int>(joints.size()));
+						joints.push_back({ node, -1 });
+						break;
+					}
+				}
 			}
+		}
+
+		// build the dynarray
+		for (int i = 0; i < joints.size(); ++i)
+		{
+			FbxNode* currentNode = joints[i].node;
+			int childCount = currentNode->GetChildCount();
 
-			moralesMesh.animation.keyframes.push_back(kf);
+			for (int j = 0; j < childCount; j++)
+			{
+				FbxNode* childNode = currentNode->GetChild(j);
+				if (childNode->GetNodeAttribute() && childNode->GetNodeAttribute()->GetAttributeType() && childNode->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eSkeleton)
+				{
+					jointIndices.emplace(childNode, static_cast<int>(joints.size()));
+					joints.push_back({ childNode, i});
+				}
+			}
 		}
 
-		std::cout << "Loading Vertex Skin Data\n";
 
-		
 
-		for (auto& inf : controlPointInfluences)
+		// Now we have an array of FbxNode* with their parents. Evaluate the global transforms
+		for (size_t i = 0; i < joints.size(); i++)
 		{
-			inf.infs[0].joint = -1;
-			inf.infs[0].weight = -1.0;
-			inf.infs[1].joint = -1;
-			inf.infs[1].weight = -1.0;
-			inf.infs[2].joint = -1;
-			inf.infs[2].weight = -1.0;
-			inf.infs[3].joint = -1;
-			inf.infs[3].weight = -1.0;
+			MoralesJoint mjoint;
+			mjoint.parentIndex = joints[i].parentIndex;
+			FbxAMatrix mat = joints[i].node->EvaluateGlobalTransform();
+			mjoint.globalTransform[0] = mat.mData[0][0];
+			mjoint.globalTransform[1] = mat.mData[0][1];
+			mjoint.globalTransform[2] = mat.mData[0][2];
+			mjoint.globalTransform[3] = mat.mData[0][3];
+
+			mjoint.globalTransform[4] = mat.mData[1][0];
+			mjoint.globalTransform[5] = mat.mData[1][1];
+			mjoint.globalTransform[6] = mat.mData[1][2];
+			mjoint.globalTransform[7] = mat.mData[1][3];
+		
+			mjoint.globalTransform[8]  = mat.mData[2][0];
+			mjoint.globalTransform[9]  = mat.mData[2][1];
+			mjoint.globalTransform[10] = mat.mData[2][2];
+			mjoint.globalTransform[11] = mat.mData[2][3];
 
+			mjoint.globalTransform[12] = mat.mData[3][0];
+			mjoint.globalTransform[13] = mat.mData[3][1];
+			mjoint.globalTransform[14] = mat.mData[3][2];
+			mjoint.globalTransform[15] = mat.mData[3][3];
+			moralesMesh.bindPose.push_back(mjoint);
 		}
 
+		std::cout << "Bind pose loaded, " << moralesMesh.bindPose.size() << " joints\n\n";
+
+		std::cout << "Loading Vertex Skin Data\n";
+
+		
+
+		// Every cluster's weights are gathered before any are chosen between, so a control point keeps its
+		// strongest influences whatever order the clusters come in. A cluster linked to a node outside the skeleton
+		// has no joint to follow, so its weights are left out.
+		size_t unlinkedClusters = 0;
 		int nodeCount = bindPose->GetCount();
 		for (int i = 0; i < nodeCount; i++)
 		{
@@ -733,10 +2619,11 @@ namespace MFBXExporter
 			if (node != NULL)
 			{
 				FbxMesh* mesh = node->GetMesh();
-				if (mesh != NULL)
+				// a mesh instanced on several nodes is skinned once
+				if (mesh != NULL && meshInfluences.find(mesh) == meshInfluences.end())
 				{
 					numControlPoints = mesh->GetControlPointsCount();
-					controlPointInfluences.resize(numControlPoints);
+					std::vector<MoralesInfluenceContribution> contributions;
 
 					int deformerCount = mesh->GetDeformerCount();
 					for (int j = 0; j < deformerCount; j++)
@@ -752,97 +2639,194 @@ namespace MFBXExporter
 								FbxCluster* cluster = skin->GetCluster(k);
 
 								FbxNode* linkedNode = cluster->GetLink();
-								for (int l = 0; l < joints.size(); ++l)
+								auto joint = jointIndices.find(linkedNode);
+								if (joint == jointIndices.end())
 								{
-									if (joints[l].node == linkedNode)
+									unlinkedClusters++;
+									continue;
+								}
+
+								int joint_index = joint->second;
+								int controlPointsInCluster = cluster->GetControlPointIndicesCount();
+								double* weights = cluster->GetControlPointWeights();
+								int* point_indices = cluster->GetControlPointIndices();
+								for (int I = 0; I < controlPointsInCluster; I++)
+								{
+									if (point_indices[I] < 0 || point_indices[I] >= numControlPoints || !(weights[I] > 0.0))
 									{
-										int joint_index = l;
-										int controlPointsInCluster = cluster->GetControlPointIndicesCount();
-										double* weights = cluster->GetControlPointWeights();
-										int* point_indices = cluster->GetControlPointIndices();
-										for (int I = 0; I < controlPointsInCluster; I++)
-										{
-											MoralesInfluence mi = { joint_index, weights[I] };
-
-											AddAndKeepArraySorted(controlPointInfluences[point_indices[I]], mi);
-
-										}
-										break;
+										continue;
 									}
+									MoralesInfluence mi = { joint_index, static_cast<float>(weights[I]) };
+									contributions.push_back({ point_indices[I], mi });
 								}
 							}
 						}
 					}
+
+					SelectInfluences(contributions, numControlPoints, meshInfluences[mesh]);
 				}
 			}
 		}
 
+		if (unlinkedClusters > 0)
+		{
+			std::cout << "Warning: " << unlinkedClusters << " skin clusters link to nodes outside the skeleton, their weights were ignored\n";
+		}
 		std::cout << "Loaded control influences\n";
+	}
 
-		std::cout << "Loaded Animation\n\n";
+	// Samples every joint's global transform at every frame of the current animation stack, 24 a second. A
+	// clip too big to hold (or any, with stream set) goes to a spool at spoolPath a keyframe at a time.
+	void BakeFbxAnimation(FbxScene* Scene, const std::string& spoolPath, bool stream)
+	{
+		const std::vector<MoralesFbxJoint>& joints = skeletonJoints;
+		std::cout << "\nLoading animation data...\n";
 
+		// From the scene, get the animation stack
 
-		// TODO: Get animation (skin?) weights
+		FbxAnimStack* aStack = Scene->GetCurrentAnimationStack();
 
-	}
+		// Get the duration of the animation
 
-	void AddAndKeepArraySorted(MoralesInfluenceSet& mis, MoralesInfluence& mi)
-	{
+		FbxTimeSpan timeSpan = aStack->GetLocalTimeSpan();
+		FbxTime time = timeSpan.GetDuration();
 
-		int size = MAX_INFLUENCES;
-		for (int i = 0; i < MAX_INFLUENCES; i++)
+		ulong animationFrames = time.GetFrameCount(FbxTime::eFrames24);
+
+		moralesMesh.animation.duration = time.GetSecondDouble();
+
+		std::cout << "Animation duration: " << moralesMesh.animation.duration << " seconds\n";
+		std::cout << "Animation frame count: " << animationFrames << " frames\n";
+
+		const uint64_t bakedBytes = animationFrames * (sizeof(double) + sizeof(MoralesJoint) * joints.size());
+		if (stream || bakedBytes > STREAM_KEYFRAME_BYTES)
 		{
-			if (mis.infs[i].joint == -1)
+			keyframeSpool.path = spoolPath;
+			keyframeSpool.file.open(spoolPath, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+			if (!keyframeSpool.file.is_open())
 			{
-				size = i;
-				break;
+				std::cout << "Could not create " << spoolPath << " to spool the animation to\n";
+				std::cin.get();
+				exit(-1);
 			}
+			keyframeSpool.count = 0;
+			keyframeSpool.jointCount = static_cast<uint32_t>(joints.size());
+			std::cout << "Spooling " << bakedBytes / (1024 * 1024) << " MB of keyframes to " << spoolPath << '\n';
 		}
 
-		if (size < MAX_INFLUENCES)
+		MoralesKeyframe kf;
+		for (ulong i = 0; i < animationFrames; i++)
 		{
-			mis.infs[size] = mi;
-			return;
-		}
+			time.SetFrame(i, FbxTime::eFrames24);
+			kf.keytime = time.GetSecondDouble();
+			kf.poseData.clear();
 
-		double lowest_weight = mi.weight;
-		for (int i = 0; i < size; i++)
-		{
-			if (mis.infs[i].weight < lowest_weight)
+			for (int j = 0; j < joints.size(); j++)
 			{
-				mis.infs[MAX_INFLUENCES - 1] = mi;
-				SortMIS(mis);
-				return;
+				MoralesJoint mjoint;
+				mjoint.parentIndex = joints[j].parentIndex;
+				FbxAMatrix mat = joints[j].node->EvaluateGlobalTransform(time);
+
+				ConvertFbxAMatrixToFloat16(mjoint.globalTransform, mat);
+
+				kf.poseData.push_back(mjoint);
+			}
+
+			if (keyframeSpool.file.is_open())
+			{
+				keyframeSpool.file.write((const char*)&kf.keytime, sizeof(double));
+				keyframeSpool.file.write((const char*)kf.poseData.data(), sizeof(MoralesJoint) * kf.poseData.size());
+				keyframeSpool.count++;
+			}
+			else
+			{
+				moralesMesh.animation.keyframes.push_back(kf);
 			}
 		}
+
+		if (keyframeSpool.file.is_open() && !keyframeSpool.file.flush())
+		{
+			std::cout << "Could not write the animation to " << spoolPath << '\n';
+			std::cin.get();
+			exit(-1);
+		}
+
+		std::cout << "Loaded Animation\n\n";
 	}
 
-	void SortMIS(MoralesInfluenceSet& mis) // slow bubble sort, could optimize later.
+	// Sorts the contributions by control point with a counting sort, so each one's sit together in one flat
+	// array, then picks every control point's strongest MAX_INFLUENCES with one partial sort. Control points are
+	// independent, so they're split between threads. Warns about the ones that had more influences than fit.
+	void SelectInfluences(const std::vector<MoralesInfluenceContribution>& contributions, int controlPointCount,
+		std::vector<MoralesInfluenceSet>& influences)
 	{
-		int size = MAX_INFLUENCES;
-		for (int i = 0; i < MAX_INFLUENCES; i++)
+		const size_t pointCount = static_cast<size_t>(std::max(controlPointCount, 0));
+		influences.assign(pointCount, MoralesInfluenceSet{});
+
+		std::vector<size_t> offsets(pointCount + 1, 0);
+		for (const MoralesInfluenceContribution& contribution : contributions)
 		{
-			if (mis.infs[i].joint == -1)
-			{
-				size = i;
-				break;
-			}
+			offsets[contribution.controlPoint + 1]++;
+		}
+		for (size_t p = 0; p < pointCount; p++)
+		{
+			offsets[p + 1] += offsets[p];
+		}
+		std::vector<MoralesInfluence> gathered(contributions.size());
+		std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+		for (const MoralesInfluenceContribution& contribution : contributions)
+		{
+			gathered[next[contribution.controlPoint]++] = contribution.influence;
 		}
-		int moves;
-		do 
+
+		// Each worker counts its own overflow, added up once they've all finished.
+		struct Overflow
+		{
+			size_t points = 0;
+			double worstDropped = 0.0;
+		};
+		const size_t workers = std::max<size_t>(1, std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+			pointCount / MIN_CONTROL_POINTS_PER_WORKER));
+		const size_t chunk = (pointCount + workers - 1) / workers;
+		std::vector<Overflow> overflows(workers);
+		auto selectRange = [&](size_t worker)
 		{
-			moves = 0;
-			for (int i = 0; i < size - 1; i++)
+			const size_t end = std::min(pointCount, (worker + 1) * chunk);
+			for (size_t p = worker * chunk; p < end; p++)
 			{
-				if (mis.infs[i].weight < mis.infs[i + 1].weight)
+				const double dropped = SelectControlPointInfluences(gathered.data() + offsets[p], gathered.data() + offsets[p + 1], influences[p]);
+				if (dropped >= 0.0)
 				{
-					MoralesInfluence t = mis.infs[i];
-					mis.infs[i] = mis.infs[i + 1];
-					mis.infs[i + 1] = t;
-					moves++;
+					overflows[worker].points++;
+					overflows[worker].worstDropped = std::max(overflows[worker].worstDropped, dropped);
 				}
 			}
-		} while (moves != 0);
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t w = 1; w < workers; w++)
+		{
+			threads.emplace_back(selectRange, w);
+		}
+		// The calling thread takes the first range rather than sitting idle.
+		selectRange(0);
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		Overflow overflow;
+		for (const Overflow& worker : overflows)
+		{
+			overflow.points += worker.points;
+			overflow.worstDropped = std::max(overflow.worstDropped, worker.worstDropped);
+		}
+		if (overflow.points > 0)
+		{
+			std::cout << "Warning: " << overflow.points << " of " << pointCount << " control points have more than "
+				<< MAX_INFLUENCES << " influences, the lightest were dropped (up to " << std::setprecision(3)
+				<< overflow.worstDropped * 100.0 << std::setprecision(6) << "% of a control point's weight)\n";
+		}
 	}
 
 	void ConvertFbxAMatrixToFloat16(float* m, const FbxAMatrix& mat)
@@ -879,7 +2863,7 @@ namespace MFBXExporter
 		uint32_t mat_count = (uint32_t)mesh.materialList.size();
 		uint32_t matp_count = (uint32_t)mesh.materialPaths.size();
 		uint32_t bindpose_joint_count = (uint32_t)mesh.bindPose.size();
-		uint32_t frame_count = (uint32_t)mesh.animation.keyframes.size();
+		uint32_t frame_count = (uint32_t)KeyframeCount(mesh);
 
 		file.write((const char*)&index_count, sizeof(uint32_t));
 		file.write((const char*)mesh.indicesList.data(), sizeof(uint32_t) * index_count);
@@ -904,19 +2888,96 @@ namespace MFBXExporter
 
 		file.write((const char*)&mesh.animation.duration, sizeof(double));
 
-		uint32_t joint_count = mesh.animation.keyframes[0].poseData.size();
+		uint32_t joint_count = keyframeSpool.file.is_open() ? keyframeSpool.jointCount
+			: mesh.animation.keyframes.empty() ? 0 : (uint32_t)mesh.animation.keyframes[0].poseData.size();
 		file.write((const char*)&joint_count, sizeof(uint32_t));
 		file.write((const char*)&frame_count, sizeof(uint32_t));
-		// loop keyframes
-		for (size_t i = 0; i < frame_count; i++)
+		if (keyframeSpool.file.is_open())
+		{
+			// The spool holds the keyframes just as they're written here, copied over a block at a time.
+			std::vector<char> block(SPOOL_COPY_BYTES);
+			uint64_t left = frame_count * (sizeof(double) + sizeof(MoralesJoint) * (uint64_t)joint_count);
+			keyframeSpool.file.clear();
+			keyframeSpool.file.seekg(0);
+			while (left > 0 && keyframeSpool.file)
+			{
+				const size_t size = (size_t)std::min<uint64_t>(left, block.size());
+				keyframeSpool.file.read(block.data(), size);
+				file.write(block.data(), keyframeSpool.file.gcount());
+				left -= keyframeSpool.file.gcount();
+			}
+			if (left > 0)
+			{
+				std::cout << "Could not read the animation back from " << keyframeSpool.path << '\n';
+			}
+		}
+		else
 		{
-			file.write((const char*)&mesh.animation.keyframes[i].keytime, sizeof(double));
-			file.write((const char*)mesh.animation.keyframes[i].poseData.data(), sizeof(MoralesJoint) * joint_count);
+			// loop keyframes
+			for (size_t i = 0; i < frame_count; i++)
+			{
+				file.write((const char*)&mesh.animation.keyframes[i].keytime, sizeof(double));
+				file.write((const char*)mesh.animation.keyframes[i].poseData.data(), sizeof(MoralesJoint) * joint_count);
+			}
 		}
 
+		// Last, so a viewer that predates submeshes, levels of detail, meshlets, keyframe bounds, influence buckets and clip blocks still reads the rest
+		uint32_t submesh_count = (uint32_t)mesh.submeshes.size();
+		file.write((const char*)&submesh_count, sizeof(uint32_t));
+		file.write((const char*)mesh.submeshes.data(), sizeof(MoralesSubmesh) * submesh_count);
+
+		uint32_t lod_count = (uint32_t)mesh.lods.size();
+		file.write((const char*)&lod_count, sizeof(uint32_t));
+		file.write((const char*)mesh.lods.data(), sizeof(MoralesLod) * lod_count);
+
+		uint32_t meshlet_count = (uint32_t)mesh.meshlets.size();
+		uint32_t meshlet_vertex_count = (uint32_t)mesh.meshletVertices.size();
+		uint32_t meshlet_triangle_count = (uint32_t)(mesh.meshletTriangles.size() / 3);
+		file.write((const char*)&meshlet_count, sizeof(uint32_t));
+		file.write((const char*)mesh.meshlets.data(), sizeof(MoralesMeshlet) * meshlet_count);
+		file.write((const char*)&meshlet_vertex_count, sizeof(uint32_t));
+		file.write((const char*)mesh.meshletVertices.data(), sizeof(uint32_t) * meshlet_vertex_count);
+		file.write((const char*)&meshlet_triangle_count, sizeof(uint32_t));
+		file.write((const char*)mesh.meshletTriangles.data(), 3 * meshlet_triangle_count);
+
+		uint32_t key_bounds_count = (uint32_t)mesh.animation.keyBounds.size();
+		file.write((const char*)&key_bounds_count, sizeof(uint32_t));
+		file.write((const char*)mesh.animation.keyBounds.data(), sizeof(MoralesBounds) * key_bounds_count);
+
+		uint32_t bucket_count = INFLUENCE_BUCKETS;
+		uint32_t lod_bucket_count = (uint32_t)mesh.lodBuckets.size();
+		uint32_t submesh_bucket_count = (uint32_t)mesh.submeshBuckets.size();
+		uint32_t packed_weight_count = (uint32_t)mesh.packedWeights.size();
+		file.write((const char*)&bucket_count, sizeof(uint32_t));
+		file.write((const char*)&lod_bucket_count, sizeof(uint32_t));
+		file.write((const char*)mesh.lodBuckets.data(), sizeof(MoralesInfluenceBuckets) * lod_bucket_count);
+		file.write((const char*)&submesh_bucket_count, sizeof(uint32_t));
+		file.write((const char*)mesh.submeshBuckets.data(), sizeof(MoralesInfluenceBuckets) * submesh_bucket_count);
+		file.write((const char*)&packed_weight_count, sizeof(uint32_t));
+		file.write((const char*)mesh.packedWeights.data(), sizeof(uint32_t) * packed_weight_count);
+
+		uint32_t block_count = (uint32_t)mesh.animation.blocks.size();
+		uint32_t keytime_count = (uint32_t)mesh.animation.keytimes.size();
+		file.write((const char*)&mesh.animation.blockSeconds, sizeof(double));
+		file.write((const char*)&block_count, sizeof(uint32_t));
+		file.write((const char*)mesh.animation.blocks.data(), sizeof(MoralesClipBlock) * block_count);
+		file.write((const char*)&keytime_count, sizeof(uint32_t));
+		file.write((const char*)mesh.animation.keytimes.data(), sizeof(double) * keytime_count);
+
 		file.close();
 	}
 
+	// The memory the process has committed now and at its peak so far, after one stage of the export.
+	void ReportMemory(const char* stage)
+	{
+		PROCESS_MEMORY_COUNTERS counters = {};
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			std::cout << "\n[Memory] " << stage << ": " << counters.PagefileUsage / (1024 * 1024) << " MB committed, peak "
+				<< counters.PeakPagefileUsage / (1024 * 1024) << " MB\n";
+		}
+	}
+
 	std::string ReplaceFBXExtension(std::string fileName)
 	{
 		fileName.replace(fileName.end() - 3, fileName.end(), "mbm");
@@ -924,13 +2985,6 @@ namespace MFBXExporter
 		return fileName;
 	}
 
-	// Pretty basic implmentation of float equality. May be changed later.
-	bool AreEqual(float a, float b)
-	{
-		//return fabs(a - b) <= std::numeric_limits<float>::epsilon();
-		return a == b;
-	}
-
 	std::string OpenFileName(const wchar_t* filter, HWND owner)
 	{
 		OPENFILENAME ofn;
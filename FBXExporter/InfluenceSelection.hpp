@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Picking a control point's skin influences from every cluster's weight on it. Apart from FBXExporter.cpp,
+// which needs the FBX SDK, so it builds and is tested anywhere, like VertexWeld.hpp.
+namespace MFBXExporter
+{
+	constexpr int MAX_INFLUENCES = 4; // influences a vertex stores, and so kept per control point
+
+	struct MoralesInfluence
+	{
+		int joint; 
+		float weight;
+	};
+
+	// A control point's strongest influences, heaviest first, summing to 1. Unused ones are joint 0 with weight 0.
+	struct MoralesInfluenceSet
+	{
+		MoralesInfluence infs[MAX_INFLUENCES];
+	};
+
+	// Merges the contributions in [first, last) that name the same joint, keeps the MAX_INFLUENCES heaviest in
+	// influences, heaviest first (the lower joint first on a tie, so the result doesn't depend on cluster order),
+	// and renormalizes them to sum to 1. Returns the share of the weight that was dropped, or -1 if nothing was.
+	// Reorders [first, last).
+	inline double SelectControlPointInfluences(MoralesInfluence* first, MoralesInfluence* last, MoralesInfluenceSet& influences)
+	{
+		std::sort(first, last, [](const MoralesInfluence& a, const MoralesInfluence& b) { return a.joint < b.joint; });
+		MoralesInfluence* merged = first;
+		for (MoralesInfluence* it = first; it != last; ++it)
+		{
+			if (merged != first && (merged - 1)->joint == it->joint)
+			{
+				(merged - 1)->weight += it->weight;
+			}
+			else
+			{
+				*merged++ = *it;
+			}
+		}
+
+		const ptrdiff_t count = merged - first;
+		const ptrdiff_t kept = std::min<ptrdiff_t>(count, MAX_INFLUENCES);
+		std::partial_sort(first, first + kept, merged, [](const MoralesInfluence& a, const MoralesInfluence& b)
+		{
+			return a.weight > b.weight || (a.weight == b.weight && a.joint < b.joint);
+		});
+
+		double total = 0.0;
+		for (MoralesInfluence* it = first; it != merged; ++it)
+		{
+			total += it->weight;
+		}
+		double keptTotal = 0.0;
+		for (ptrdiff_t i = 0; i < kept; i++)
+		{
+			keptTotal += first[i].weight;
+		}
+		if (keptTotal <= 0.0)
+		{
+			return -1.0;
+		}
+
+		for (ptrdiff_t i = 0; i < kept; i++)
+		{
+			influences.infs[i].joint = first[i].joint;
+			influences.infs[i].weight = static_cast<float>(first[i].weight / keptTotal);
+		}
+		return count > MAX_INFLUENCES ? 1.0 - keptTotal / total : -1.0;
+	}
+}
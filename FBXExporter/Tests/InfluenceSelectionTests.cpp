@@ -0,0 +1,150 @@
+#include "InfluenceSelection.hpp"
+#include "TestCheck.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+// SelectControlPointInfluences() against brute force on random control points: every joint's weight summed,
+// then the heaviest picked one at a time. Weights are multiples of 1/64 so sums come out exact whatever order
+// they're added in, and ties between joints are common.
+namespace
+{
+	using namespace MFBXExporter;
+
+	std::mt19937 g_random(47);
+
+	struct Expected
+	{
+		std::vector<MoralesInfluence> kept; // heaviest first, not yet renormalized
+		double dropped;                     // -1 if nothing was
+	};
+
+	Expected brute_force(const std::vector<MoralesInfluence>& contributions)
+	{
+		std::map<int, float> byJoint;
+		double total = 0.0;
+		for (const MoralesInfluence& contribution : contributions)
+		{
+			byJoint[contribution.joint] += contribution.weight;
+			total += contribution.weight;
+		}
+
+		Expected expected;
+		double keptTotal = 0.0;
+		while (!byJoint.empty() && expected.kept.size() < MAX_INFLUENCES)
+		{
+			// The map is in joint order, so the first of equal weights is the lower joint.
+			auto heaviest = byJoint.begin();
+			for (auto it = byJoint.begin(); it != byJoint.end(); ++it)
+			{
+				if (it->second > heaviest->second)
+				{
+					heaviest = it;
+				}
+			}
+			expected.kept.push_back({ heaviest->first, heaviest->second });
+			keptTotal += heaviest->second;
+			byJoint.erase(heaviest);
+		}
+		expected.dropped = byJoint.empty() ? -1.0 : 1.0 - keptTotal / total;
+		return expected;
+	}
+
+	std::vector<MoralesInfluence> random_contributions()
+	{
+		std::vector<MoralesInfluence> contributions(1 + g_random() % 12);
+		for (MoralesInfluence& contribution : contributions)
+		{
+			contribution.joint = static_cast<int>(g_random() % 8);
+			contribution.weight = static_cast<float>(1 + g_random() % 16) / 64.0f;
+		}
+		return contributions;
+	}
+
+	void test_matches_brute_force()
+	{
+		bool kept = true;
+		bool normalized = true;
+		bool dropped = true;
+		bool orderFree = true;
+		int overflowed = 0;
+		for (int i = 0; i < 20000; i++)
+		{
+			std::vector<MoralesInfluence> contributions = random_contributions();
+			std::vector<MoralesInfluence> reordered = contributions;
+			const Expected expected = brute_force(contributions);
+
+			MoralesInfluenceSet influences = {};
+			const double share = SelectControlPointInfluences(contributions.data(), contributions.data() + contributions.size(), influences);
+
+			double keptTotal = 0.0;
+			for (const MoralesInfluence& influence : expected.kept)
+			{
+				keptTotal += influence.weight;
+			}
+			double sum = 0.0;
+			for (size_t k = 0; k < MAX_INFLUENCES; k++)
+			{
+				const MoralesInfluence& influence = influences.infs[k];
+				if (k < expected.kept.size())
+				{
+					kept &= influence.joint == expected.kept[k].joint &&
+						influence.weight == static_cast<float>(expected.kept[k].weight / keptTotal);
+				}
+				else
+				{
+					kept &= influence.joint == 0 && influence.weight == 0.0f;
+				}
+				sum += influence.weight;
+			}
+			normalized &= std::fabs(sum - 1.0) < 1e-6;
+			dropped &= expected.dropped < 0.0 ? share == -1.0 : std::fabs(share - expected.dropped) < 1e-12;
+			overflowed += expected.dropped < 0.0 ? 0 : 1;
+
+			// The same contributions in another order pick the same influences.
+			std::shuffle(reordered.begin(), reordered.end(), g_random);
+			MoralesInfluenceSet shuffled = {};
+			SelectControlPointInfluences(reordered.data(), reordered.data() + reordered.size(), shuffled);
+			for (size_t k = 0; k < MAX_INFLUENCES; k++)
+			{
+				orderFree &= shuffled.infs[k].joint == influences.infs[k].joint && shuffled.infs[k].weight == influences.infs[k].weight;
+			}
+		}
+		CHECK(kept);
+		CHECK(normalized);
+		CHECK(dropped);
+		CHECK(orderFree);
+		CHECK(overflowed > 1000); // enough control points with more than MAX_INFLUENCES joints to mean something
+	}
+
+	void test_merges_repeated_joints()
+	{
+		// Joint 3 twice outweighs joint 1 twice; five contributions but only two joints, so nothing is dropped.
+		MoralesInfluence contributions[] = { { 1, 0.25f }, { 3, 0.25f }, { 1, 0.125f }, { 3, 0.375f }, { 1, 0.0f } };
+		MoralesInfluenceSet influences = {};
+		CHECK(SelectControlPointInfluences(contributions, contributions + 5, influences) == -1.0);
+		CHECK(influences.infs[0].joint == 3 && influences.infs[0].weight == 0.625f);
+		CHECK(influences.infs[1].joint == 1 && influences.infs[1].weight == 0.375f);
+		CHECK(influences.infs[2].weight == 0.0f && influences.infs[3].weight == 0.0f);
+	}
+
+	void test_nothing_to_keep()
+	{
+		MoralesInfluenceSet influences = {};
+		CHECK(SelectControlPointInfluences(nullptr, nullptr, influences) == -1.0);
+		MoralesInfluence weightless[] = { { 2, 0.0f } };
+		CHECK(SelectControlPointInfluences(weightless, weightless + 1, influences) == -1.0);
+		CHECK(influences.infs[0].joint == 0 && influences.infs[0].weight == 0.0f);
+	}
+}
+
+int main()
+{
+	test_matches_brute_force();
+	test_merges_repeated_joints();
+	test_nothing_to_keep();
+	return MFBXExporter::Tests::finish("InfluenceSelectionTests");
+}
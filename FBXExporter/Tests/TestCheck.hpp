@@ -0,0 +1,36 @@
+#pragma once
+
+#include <iostream>
+
+// The viewer's Animator/DX Viewer/Tests/TestCheck.hpp in the exporter's namespace, which describes it. A copy
+// rather than a shared include because the exporter and the viewer build on their own and neither reaches
+// into the other's tree; keep the two the same.
+namespace MFBXExporter
+{
+	namespace Tests
+	{
+		inline int& failures()
+		{
+			static int count = 0;
+			return count;
+		}
+
+		inline bool check(bool passed, const char* expression, const char* file, int line)
+		{
+			if (!passed)
+			{
+				std::cout << file << "(" << line << "): CHECK(" << expression << ") failed\n";
+				failures()++;
+			}
+			return passed;
+		}
+
+		inline int finish(const char* suite)
+		{
+			std::cout << suite << ": " << (failures() == 0 ? "passed" : "FAILED") << ", " << failures() << " failed checks\n";
+			return failures() == 0 ? 0 : 1;
+		}
+	}
+}
+
+#define CHECK(expression) MFBXExporter::Tests::check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
@@ -0,0 +1,105 @@
+#include "VertexWeld.hpp"
+#include "TestCheck.hpp"
+
+#include <vector>
+
+// The corner weld on a stand-in for MoralesVertex with the same members, DirectXMath isn't needed for it.
+namespace
+{
+	using namespace MFBXExporter;
+
+	struct Vertex
+	{
+		struct { float x, y, z, w; } Pos;
+		struct { float x, y, z, w; } Normal;
+		struct { float x, y; } Tex;
+		struct { int x, y, z, w; } Joints;
+		struct { double x, y, z, w; } Weights;
+	};
+
+	Vertex corner(float x, float y, float u, float v)
+	{
+		Vertex vertex = {};
+		vertex.Pos = { x, y, 0.0f, 1.0f };
+		vertex.Normal = { 0.0f, 0.0f, 1.0f, 0.0f };
+		vertex.Tex = { u, v };
+		vertex.Joints = { 0, 0, 0, 0 };
+		vertex.Weights = { 1.0, 0.0, 0.0, 0.0 };
+		return vertex;
+	}
+
+	// A unit quad exported as two triangles, one polygon each, so every corner is expanded on its own:
+	// (0, 0) (1, 0) (1, 1) and (0, 0) (1, 1) (0, 1). With seam, the second triangle is mapped to another
+	// part of the texture, so the diagonal's two corners have different UVs either side of it.
+	std::vector<Vertex> quad_corners(bool seam)
+	{
+		const float offset = seam ? 0.5f : 0.0f;
+		return {
+			corner(0, 0, 0, 0), corner(1, 0, 1, 0), corner(1, 1, 1, 1),
+			corner(0, 0, offset, offset), corner(1, 1, 1 + offset, 1 + offset), corner(0, 1, offset, 1 + offset) };
+	}
+
+	void test_quad_without_a_seam_welds_to_four()
+	{
+		std::vector<Vertex> welded;
+		std::vector<int> remap;
+		WeldVertices(quad_corners(false), welded, remap);
+		CHECK(welded.size() == 4);
+		CHECK((remap == std::vector<int>{ 0, 1, 2, 0, 2, 3 }));
+	}
+
+	void test_quad_with_a_uv_seam_keeps_the_seam_vertices()
+	{
+		std::vector<Vertex> welded;
+		std::vector<int> remap;
+		WeldVertices(quad_corners(true), welded, remap);
+
+		// Same positions and normals, but each triangle keeps its own diagonal corners and so its UVs.
+		CHECK(welded.size() == 6);
+		CHECK((remap == std::vector<int>{ 0, 1, 2, 3, 4, 5 }));
+		CHECK(welded[remap[3]].Tex.x == 0.5f && welded[remap[0]].Tex.x == 0.0f);
+		CHECK(welded[remap[4]].Pos.x == welded[remap[2]].Pos.x && welded[remap[4]].Tex.x != welded[remap[2]].Tex.x);
+	}
+
+	void test_skinning_keeps_corners_apart()
+	{
+		// A corner shared by two triangles that its skin data would tell apart is kept twice, one per difference.
+		std::vector<Vertex> corners = quad_corners(false);
+		corners[3].Joints.y = 2;
+		corners[4].Weights = { 0.75, 0.25, 0.0, 0.0 };
+
+		std::vector<Vertex> welded;
+		std::vector<int> remap;
+		WeldVertices(corners, welded, remap);
+		CHECK(welded.size() == 6);
+		CHECK(remap[3] != remap[0] && remap[4] != remap[2]);
+
+		// Normals still count, and the w components too.
+		corners = quad_corners(false);
+		corners[3].Normal.z = -1.0f;
+		corners[4].Pos.w = 0.0f;
+		WeldVertices(corners, welded, remap);
+		CHECK(welded.size() == 6);
+	}
+
+	void test_weld_keeps_first_use_order()
+	{
+		std::vector<Vertex> welded(3);
+		std::vector<int> remap;
+		const std::vector<Vertex> corners = { corner(2, 2, 0, 0), corner(1, 1, 0, 0), corner(2, 2, 0, 0), corner(1, 1, 0, 0) };
+		WeldVertices(corners, welded, remap);
+		CHECK(welded.size() == 2 && welded[0].Pos.x == 2.0f);
+		CHECK((remap == std::vector<int>{ 0, 1, 0, 1 }));
+		WeldVertices(std::vector<Vertex>(), welded, remap);
+		CHECK(welded.empty() && remap.empty());
+	}
+}
+
+int main()
+{
+	test_quad_without_a_seam_welds_to_four();
+	test_quad_with_a_uv_seam_keeps_the_seam_vertices();
+	test_skinning_keeps_corners_apart();
+	test_weld_keeps_first_use_order();
+	return MFBXExporter::Tests::finish("VertexWeldTests");
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Welding of the per-corner vertices ProcessFbxMeshNode() expands a mesh into. Apart from FBXExporter.cpp,
+// which needs the FBX SDK, so it builds and is tested anywhere; it works on any vertex type with
+// MoralesVertex's members.
+namespace MFBXExporter
+{
+	// Whether two corners can share a vertex: everything the viewer reads from it is exactly the same, so UV
+	// and normal seams, and corners skinned differently, stay apart.
+	template <typename Vertex>
+	bool SameVertex(const Vertex& a, const Vertex& b)
+	{
+		return a.Pos.x == b.Pos.x && a.Pos.y == b.Pos.y && a.Pos.z == b.Pos.z && a.Pos.w == b.Pos.w &&
+			a.Normal.x == b.Normal.x && a.Normal.y == b.Normal.y && a.Normal.z == b.Normal.z && a.Normal.w == b.Normal.w &&
+			a.Tex.x == b.Tex.x && a.Tex.y == b.Tex.y &&
+			a.Joints.x == b.Joints.x && a.Joints.y == b.Joints.y && a.Joints.z == b.Joints.z && a.Joints.w == b.Joints.w &&
+			a.Weights.x == b.Weights.x && a.Weights.y == b.Weights.y && a.Weights.z == b.Weights.z && a.Weights.w == b.Weights.w;
+	}
+
+	// Fills welded with the distinct vertices, in order of first use, and remap with where each of vertices went.
+	template <typename Vertex>
+	void WeldVertices(const std::vector<Vertex>& vertices, std::vector<Vertex>& welded, std::vector<int>& remap)
+	{
+		welded.clear();
+		remap.resize(vertices.size());
+		for (size_t j = 0; j < vertices.size(); j++)
+		{
+			size_t k = 0;
+			while (k < welded.size() && !SameVertex(vertices[j], welded[k]))
+			{
+				k++;
+			}
+			if (k == welded.size())
+			{
+				welded.push_back(vertices[j]);
+			}
+			remap[j] = static_cast<int>(k);
+		}
+	}
+}